@@ -2,83 +2,408 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <sys/mman.h>
 #include <unistd.h>
 
-// Alignment helpers
-constexpr U64 align_to_page_size(U64 size) noexcept {
-  return (size + ARENA_PAGE_SIZE - 1) & ~(ARENA_PAGE_SIZE - 1);
+#if ARENA_PROFILE
+#include <algorithm>
+#include <cctype>
+#include <mutex>
+#include <vector>
+#endif
+
+static constexpr U64 ARENA_HUGE_PAGE_SIZE = MiB(2);
+
+static U64 align_up(U64 value, U64 alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
 }
 
-// Arena creation/destruction
-Arena arena_alloc(U64 capacity) {
-  U64 aligned_capacity = align_to_page_size(capacity);
+static U64 arena_commit_granularity(const ArenaParams &params) {
+  U64 chunk = align_to_page_size(params.commit_chunk ? params.commit_chunk
+                                                     : ARENA_PAGE_SIZE);
+  if ((params.flags & ARENA_FLAG_HUGE_PAGES) && chunk < ARENA_HUGE_PAGE_SIZE)
+    chunk = ARENA_HUGE_PAGE_SIZE;
+  return chunk;
+}
 
-#ifndef NDEBUG
-  // Debug: add extra guard page
-  U64 total_size = aligned_capacity + ARENA_PAGE_SIZE;
-  void *base = mmap(nullptr, total_size, PROT_READ | PROT_WRITE,
-                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-  assert(base != MAP_FAILED && "mmap failed");
+// Reserves `capacity` bytes plus a trailing guard page, all PROT_NONE.
+// Nothing is committed until arena_commit_to().
+static U8 *arena_reserve(U64 capacity, U32 flags) {
+  U64 total_size = capacity + ARENA_PAGE_SIZE;
+  int map_flags = MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE;
 
-  // Poison the guard page at the end
-  U8 *guard_page = static_cast<U8 *>(base) + aligned_capacity;
-  mprotect(guard_page, ARENA_PAGE_SIZE, PROT_NONE);
+  if (!(flags & ARENA_FLAG_HUGE_PAGES)) {
+    void *base = mmap(nullptr, total_size, PROT_NONE, map_flags, -1, 0);
+    assert(base != MAP_FAILED && "mmap failed");
+    return static_cast<U8 *>(base);
+  }
 
-  return Arena{static_cast<U8 *>(base), 0, aligned_capacity};
-#else
-  // Release: normal allocation
-  void *base = mmap(nullptr, aligned_capacity, PROT_READ | PROT_WRITE,
-                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-  assert(base != MAP_FAILED && "mmap failed");
+  // Transparent huge pages need 2 MiB alignment: over-reserve, then trim.
+  U64 padded = total_size + ARENA_HUGE_PAGE_SIZE;
+  void *raw = mmap(nullptr, padded, PROT_NONE, map_flags, -1, 0);
+  assert(raw != MAP_FAILED && "mmap failed");
+
+  U8 *start = static_cast<U8 *>(raw);
+  U8 *base = reinterpret_cast<U8 *>(
+      align_up(reinterpret_cast<Ptr>(start), ARENA_HUGE_PAGE_SIZE));
+  if (base > start)
+    munmap(start, base - start);
+  U8 *end = base + total_size;
+  if (end < start + padded)
+    munmap(end, start + padded - end);
+
+  madvise(base, capacity, MADV_HUGEPAGE);
+  return base;
+}
+
+static void arena_commit_to(Arena *arena, U64 offset) {
+  U64 target = align_up(offset, arena_commit_granularity(arena->params));
+  if (target > arena->capacity)
+    target = arena->capacity;
+
+  int rc = mprotect(arena->base + arena->committed, target - arena->committed,
+                    PROT_READ | PROT_WRITE);
+  assert(rc == 0 && "Arena commit failed");
+  (void)rc;
+  arena->committed = target;
+}
+
+// Gives committed memory above max(offset, decommit_above) back to the OS.
+static void arena_decommit_above_offset(Arena *arena) {
+  U64 keep = align_up(arena->offset, arena_commit_granularity(arena->params));
+  if (keep < arena->params.decommit_above)
+    keep = align_to_page_size(arena->params.decommit_above);
+  if (keep >= arena->committed)
+    return;
+
+  madvise(arena->base + keep, arena->committed - keep, MADV_DONTNEED);
+  mprotect(arena->base + keep, arena->committed - keep, PROT_NONE);
+  arena->committed = keep;
+}
+
+#if ARENA_PROFILE
+// ---- Profiling ----
+// Stats live outside the arenas (they must not show up in what they
+// measure) and are never freed, so the report at exit still covers arenas
+// and threads that are long gone.
+
+struct ArenaSiteStats {
+  const char *file; // nullptr marks an empty slot
+  const char *function;
+  U32 line;
+  U64 bytes;
+  U64 count;
+  U64 padding;
+};
+
+struct ArenaProfile {
+  const char *label;
+  std::source_location created;
+  U64 bytes;
+  U64 count;
+  U64 padding;
+  U64 high_water;
+  // Open addressing on (file, line); file names are literals, so comparing
+  // pointers is enough within one translation unit.
+  ArenaSiteStats *sites;
+  U32 site_count;
+  U32 site_cap;
+  ArenaProfile *next;
+};
+
+static std::mutex arena_profiles_mutex;
+static ArenaProfile *arena_profiles;
+
+static void arena_profile_begin(Arena *arena, std::source_location site) {
+  ArenaProfile *profile =
+      static_cast<ArenaProfile *>(calloc(1, sizeof(ArenaProfile)));
+  profile->created = site;
+  std::lock_guard lock(arena_profiles_mutex);
+  profile->next = arena_profiles;
+  arena_profiles = profile;
+  arena->profile = profile;
+}
+
+static U32 arena_site_hash(const char *file, U32 line) {
+  U64 h = ((U64)(Ptr)file ^ line) * 0x9E3779B97F4A7C15ull;
+  return (U32)(h >> 32);
+}
+
+static ArenaSiteStats *arena_profile_site(ArenaProfile *profile,
+                                          std::source_location site) {
+  if (2 * (profile->site_count + 1) > profile->site_cap) {
+    U32 cap = profile->site_cap ? profile->site_cap * 2 : 64;
+    ArenaSiteStats *sites =
+        static_cast<ArenaSiteStats *>(calloc(cap, sizeof(ArenaSiteStats)));
+    for (U32 i = 0; i < profile->site_cap; ++i) {
+      ArenaSiteStats &old = profile->sites[i];
+      if (!old.file)
+        continue;
+      U32 j = arena_site_hash(old.file, old.line) & (cap - 1);
+      while (sites[j].file)
+        j = (j + 1) & (cap - 1);
+      sites[j] = old;
+    }
+    free(profile->sites);
+    profile->sites = sites;
+    profile->site_cap = cap;
+  }
+
+  const char *file = site.file_name();
+  U32 line = site.line();
+  U32 mask = profile->site_cap - 1;
+  U32 i = arena_site_hash(file, line) & mask;
+  while (profile->sites[i].file) {
+    if (profile->sites[i].file == file && profile->sites[i].line == line)
+      return &profile->sites[i];
+    i = (i + 1) & mask;
+  }
+  profile->sites[i] = {.file = file,
+                       .function = site.function_name(),
+                       .line = line};
+  profile->site_count++;
+  return &profile->sites[i];
+}
+
+static void arena_profile_push(Arena *arena, U64 size, U64 padding,
+                               std::source_location site) {
+  ArenaProfile *profile = arena->profile;
+  ArenaSiteStats *stats = arena_profile_site(profile, site);
+  stats->bytes += size;
+  stats->count++;
+  stats->padding += padding;
+  profile->bytes += size;
+  profile->count++;
+  profile->padding += padding;
+  U64 pos = arena->base_pos + arena->offset;
+  if (pos > profile->high_water)
+    profile->high_water = pos;
+}
+
+void arena_profile_label(Arena *arena, const char *label) {
+  arena->profile->label = label;
+}
+
+static const char *arena_profile_basename(const char *path) {
+  const char *slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+// "TokenResult next_token(Arena*, Lexer&)" -> "next_token".
+static void arena_profile_function_name(const char *pretty, char *out,
+                                        U64 out_size) {
+  const char *end = strchr(pretty, '(');
+  if (!end)
+    end = pretty + strlen(pretty);
+  const char *start = end;
+  while (start > pretty && (isalnum((U8)start[-1]) || start[-1] == '_' ||
+                            start[-1] == ':'))
+    --start;
+  snprintf(out, out_size, "%.*s", (int)(end - start), start);
+}
+
+// Everything reported under one label, summed over the arenas that had it.
+struct ArenaProfileGroup {
+  char name[128];
+  U64 arenas;
+  U64 bytes;
+  U64 count;
+  U64 padding;
+  U64 high_water; // Largest of any single arena
+  std::vector<ArenaSiteStats> sites;
+};
+
+void arena_profile_report(FILE *out) {
+  std::lock_guard lock(arena_profiles_mutex);
+
+  std::vector<ArenaProfileGroup> groups;
+  for (ArenaProfile *p = arena_profiles; p; p = p->next) {
+    char name[128];
+    if (p->label)
+      snprintf(name, sizeof(name), "%s", p->label);
+    else
+      snprintf(name, sizeof(name), "%s:%u",
+               arena_profile_basename(p->created.file_name()),
+               p->created.line());
+
+    ArenaProfileGroup *group = nullptr;
+    for (ArenaProfileGroup &g : groups)
+      if (strcmp(g.name, name) == 0)
+        group = &g;
+    if (!group) {
+      group = &groups.emplace_back();
+      memcpy(group->name, name, sizeof(name));
+    }
 
-  return Arena{static_cast<U8 *>(base), 0, aligned_capacity};
+    group->arenas++;
+    group->bytes += p->bytes;
+    group->count += p->count;
+    group->padding += p->padding;
+    if (p->high_water > group->high_water)
+      group->high_water = p->high_water;
+
+    for (U32 i = 0; i < p->site_cap; ++i) {
+      const ArenaSiteStats &site = p->sites[i];
+      if (!site.file)
+        continue;
+      ArenaSiteStats *merged = nullptr;
+      for (ArenaSiteStats &m : group->sites)
+        if (m.line == site.line && strcmp(m.file, site.file) == 0)
+          merged = &m;
+      if (!merged) {
+        group->sites.push_back(site);
+        continue;
+      }
+      merged->bytes += site.bytes;
+      merged->count += site.count;
+      merged->padding += site.padding;
+    }
+  }
+
+  std::sort(groups.begin(), groups.end(), [](auto &a, auto &b) {
+    return a.high_water > b.high_water;
+  });
+  for (ArenaProfileGroup &g : groups) {
+    fprintf(out,
+            "arena %s: %lu arena(s), high-water %lu, %lu bytes in %lu "
+            "pushes, %lu padding\n",
+            g.name, g.arenas, g.high_water, g.bytes, g.count, g.padding);
+    std::sort(g.sites.begin(), g.sites.end(),
+              [](auto &a, auto &b) { return a.bytes > b.bytes; });
+    for (const ArenaSiteStats &site : g.sites) {
+      char function[128];
+      arena_profile_function_name(site.function, function, sizeof(function));
+      fprintf(out, "  %12lu bytes %9lu pushes %7lu padding  %s:%u %s\n",
+              site.bytes, site.count, site.padding,
+              arena_profile_basename(site.file), site.line, function);
+    }
+  }
+}
+#endif
+
+// Arena creation/destruction
+Arena arena_alloc_params(ArenaParams params ARENA_SITE_DEF) {
+  Arena arena = {};
+  arena.params = params;
+  arena.capacity = align_to_page_size(params.reserve);
+  arena.base = arena_reserve(arena.capacity, params.flags);
+#if ARENA_PROFILE
+  arena_profile_begin(&arena, site);
 #endif
+  return arena;
+}
+
+Arena arena_alloc(U64 capacity ARENA_SITE_DEF) {
+  return arena_alloc_params({.reserve = capacity,
+                             .commit_chunk = ARENA_DEFAULT_COMMIT_CHUNK,
+                             .decommit_above = ARENA_DEFAULT_DECOMMIT_ABOVE,
+                             .flags = ARENA_FLAG_NONE} ARENA_SITE_ARG);
+}
+
+// Drops the current block and makes the one before it current again.
+static void arena_pop_block(Arena *arena) {
+  ArenaBlock prev = *arena->prev;
+  munmap(arena->base, arena->capacity + ARENA_PAGE_SIZE);
+
+  arena->base = prev.base;
+  arena->offset = prev.offset;
+  arena->capacity = prev.capacity;
+  arena->committed = prev.committed;
+  arena->base_pos = prev.base_pos;
+  arena->prev = prev.prev;
 }
 
 void arena_release(Arena *arena) {
-#ifndef NDEBUG
+  while (arena->prev)
+    arena_pop_block(arena);
   munmap(arena->base, arena->capacity + ARENA_PAGE_SIZE);
-#else
-  munmap(arena->base, arena->capacity);
-#endif
 
   arena->base = nullptr;
   arena->capacity = 0;
+  arena->committed = 0;
   arena->offset = 0;
 }
 
-void *arena_push_size(Arena *arena, U64 size, U64 alignment) {
+// Starts a new block big enough for `size` bytes at `alignment`, remembering
+// the current one in its header.
+static void arena_push_block(Arena *arena, U64 size, U64 alignment) {
+  U64 needed = align_up(sizeof(ArenaBlock), alignment) + size;
+  U64 capacity = align_to_page_size(
+      arena->params.reserve > needed ? arena->params.reserve : needed);
+
+  ArenaBlock saved = {arena->base,      arena->offset,   arena->capacity,
+                      arena->committed, arena->base_pos, arena->prev};
+
+  arena->base_pos += arena->capacity;
+  arena->capacity = capacity;
+  arena->base = arena_reserve(capacity, arena->params.flags);
+  arena->committed = 0;
+  arena->offset = 0;
+  arena_commit_to(arena, sizeof(ArenaBlock));
+
+  ArenaBlock *header = reinterpret_cast<ArenaBlock *>(arena->base);
+  *header = saved;
+  arena->prev = header;
+  arena->offset = sizeof(ArenaBlock);
+}
+
+void *arena_push_size(Arena *arena, U64 size,
+                      U64 alignment ARENA_SITE_DEF) {
   assert(alignment && (alignment & (alignment - 1)) == 0 &&
          "Alignment must be a power of two");
 
-  uintptr_t current_ptr =
-      reinterpret_cast<uintptr_t>(arena->base + arena->offset);
-  uintptr_t aligned_ptr = (current_ptr + alignment - 1) & ~(alignment - 1);
-
-  U64 alignment_offset = aligned_ptr - current_ptr;
-  U64 total_size = alignment_offset + size;
+  U64 aligned_offset = align_up(arena->offset, alignment);
+  if (aligned_offset + size > arena->capacity) {
+    // Fatal in every build, so Release doesn't quietly start chaining.
+    if (!(arena->params.flags & ARENA_FLAG_CHAIN)) {
+      fprintf(stderr,
+              "arena_push_size: %lu bytes don't fit in the %lu byte "
+              "reservation; reserve more or pass ARENA_FLAG_CHAIN\n",
+              size, arena->capacity);
+      abort();
+    }
+    arena_push_block(arena, size, alignment);
+    aligned_offset = align_up(arena->offset, alignment);
+  }
 
-  assert(arena->offset + total_size <= arena->capacity && "Arena OOM!");
+  U64 new_offset = aligned_offset + size;
+  if (new_offset > arena->committed)
+    arena_commit_to(arena, new_offset);
 
-  void *result = reinterpret_cast<void *>(aligned_ptr);
-  arena->offset += total_size;
+  void *result = arena->base + aligned_offset;
+#if ARENA_PROFILE
+  U64 padding = aligned_offset - arena->offset;
+  arena->offset = new_offset;
+  arena_profile_push(arena, size, padding, site);
+#else
+  arena->offset = new_offset;
+#endif
   return result;
 }
 
 // Position and offset functions
-U64 arena_pos(Arena *arena) { return arena->offset; }
+U64 arena_pos(Arena *arena) { return arena->base_pos + arena->offset; }
 
 void arena_pop_to(Arena *arena, U64 pos) {
-  assert(pos <= arena->offset &&
+  assert(pos <= arena_pos(arena) &&
          "Cannot pop to position beyond current offset");
-  arena->offset = pos;
+  while (pos < arena->base_pos)
+    arena_pop_block(arena);
+
+  // A chained block never hands out its header.
+  U64 floor = arena->prev ? sizeof(ArenaBlock) : 0;
+  U64 offset = pos - arena->base_pos;
+  arena->offset = offset > floor ? offset : floor;
+
+  if (arena->committed > arena->params.decommit_above)
+    arena_decommit_above_offset(arena);
 }
 
 void arena_pop(Arena *arena, U64 amount) {
-  U64 new_offset = (amount >= arena->offset) ? 0 : arena->offset - amount;
-  arena_pop_to(arena, new_offset);
+  U64 pos = arena_pos(arena);
+  arena_pop_to(arena, amount >= pos ? 0 : pos - amount);
 }
 
 void arena_reset(Arena *arena) { arena_pop_to(arena, 0); }
@@ -93,39 +418,70 @@ ArenaTemp temp_begin(Arena *arena) {
 void temp_end(ArenaTemp temp) { arena_pop_to(temp.arena, temp.pos); }
 
 // Scratch arenas
-typedef struct {
-  Arena arenas[2];
-} Scratches;
+static ScratchConfig scratch_config = {.count = 2, .capacity = MiB(64)};
 
-thread_local Scratches *tl_scratches = nullptr;
+// Arenas past `count` haven't been mapped yet. The destructor runs when the
+// thread exits, the main thread's included.
+struct ScratchPool {
+  Arena arenas[SCRATCH_MAX_ARENAS];
+  U64 high_water[SCRATCH_MAX_ARENAS];
+  U32 count;
 
-void scratch_init_and_equip() {
-  if (!tl_scratches) {
-    tl_scratches = new Scratches{};
-    for (std::size_t i = 0; i < 2; ++i) {
-      tl_scratches->arenas[i] = arena_alloc(MiB(64));
-    }
+  ~ScratchPool() {
+    for (U32 i = 0; i < count; ++i)
+      arena_release(&arenas[i]);
   }
+};
+
+static thread_local ScratchPool tl_scratch;
+
+void scratch_configure(ScratchConfig config) {
+  assert(config.count >= 1 && config.count <= SCRATCH_MAX_ARENAS &&
+         "Scratch arena count out of range");
+  assert(config.capacity && "Scratch arenas need a capacity");
+  scratch_config = config;
 }
 
-Arena *tl_get_scratch(Arena *conflicts[], std::size_t count) {
-  for (Arena &arena : tl_scratches->arenas) {
-    bool has_conflict = false;
-    for (std::size_t j = 0; j < count; ++j) {
-      if (&arena == conflicts[j]) {
-        has_conflict = true;
-        break;
-      }
-    }
-    if (!has_conflict)
-      return &arena;
+static bool scratch_conflicts(Arena *arena, Arena **conflicts, U64 count) {
+  for (U64 i = 0; i < count; ++i) {
+    if (conflicts[i] == arena)
+      return true;
   }
-  return nullptr; // no available scratch arena
+  return false;
 }
 
 ArenaTemp scratch_begin(Arena **conflicts, U64 count) {
-  Arena *arena = tl_get_scratch(conflicts, count);
-  return temp_begin(arena);
+  ScratchPool &pool = tl_scratch;
+  for (U32 i = 0; i < pool.count; ++i) {
+    if (!scratch_conflicts(&pool.arenas[i], conflicts, count))
+      return temp_begin(&pool.arenas[i]);
+  }
+  if (pool.count < scratch_config.count) {
+    Arena *arena = &pool.arenas[pool.count++];
+    *arena = arena_alloc(scratch_config.capacity);
+    arena_profile_label(arena, "scratch");
+    return temp_begin(arena);
+  }
+  fprintf(stderr,
+          "scratch_begin: all %u scratch arenas conflict; raise the count "
+          "with scratch_configure\n",
+          pool.count);
+  abort();
 }
 
-void scratch_end(ArenaTemp temp) { temp_end(temp); }
+void scratch_end(ArenaTemp temp) {
+  ScratchPool &pool = tl_scratch;
+  U64 i = (U64)(temp.arena - pool.arenas);
+  assert(i < pool.count && "Not one of this thread's scratch arenas");
+  U64 pos = arena_pos(temp.arena);
+  if (pos > pool.high_water[i])
+    pool.high_water[i] = pos;
+  temp_end(temp);
+}
+
+ScratchStats scratch_stats() {
+  ScratchStats stats = {.count = tl_scratch.count, .high_water = {}};
+  memcpy(stats.high_water, tl_scratch.high_water,
+         sizeof(stats.high_water));
+  return stats;
+}
@@ -1,7 +1,29 @@
 #pragma once
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <unistd.h>
 
+// ARENA_PROFILE builds (cmake -DARENA_PROFILE=ON) record, per arena and per
+// call site, how much was pushed. Allocation functions take the caller's
+// std::source_location as a trailing defaulted argument; helpers that
+// allocate on someone else's behalf can take and forward theirs the same way:
+// ARENA_SITE_PARAM in the declaration, ARENA_SITE_DEF in an out-of-line
+// definition and ARENA_SITE_ARG in the call. Without profiling all three
+// expand to nothing.
+#if ARENA_PROFILE
+#include <source_location>
+#define ARENA_SITE_PARAM                                                       \
+  , std::source_location site = std::source_location::current()
+#define ARENA_SITE_DEF , std::source_location site
+#define ARENA_SITE_ARG , site
+struct ArenaProfile;
+#else
+#define ARENA_SITE_PARAM
+#define ARENA_SITE_DEF
+#define ARENA_SITE_ARG
+#endif
+
 using U64 = std::uint64_t;
 using U32 = std::uint32_t;
 using U16 = std::uint16_t;
@@ -18,10 +40,46 @@ using Size = std::size_t;
 using F32 = float;
 using F64 = double;
 
-struct Arena {
+enum ArenaFlags : U32 {
+  ARENA_FLAG_NONE = 0,
+  // madvise(MADV_HUGEPAGE) the reservation and commit in 2 MiB steps.
+  ARENA_FLAG_HUGE_PAGES = 1 << 0,
+  // When the reservation runs out, chain a new block. Without it, running
+  // out is a fatal error.
+  ARENA_FLAG_CHAIN = 1 << 1,
+};
+
+struct ArenaParams {
+  U64 reserve;        // Virtual size of a block, mapped PROT_NONE up front
+  U64 commit_chunk;   // Commit granularity as the offset grows
+  U64 decommit_above; // Pops give back committed memory above this mark
+  U32 flags;          // ArenaFlags
+};
+
+// Saved state of a full block, stored at the start of the block chained
+// after it.
+struct ArenaBlock {
   U8 *base;
   U64 offset;
   U64 capacity;
+  U64 committed;
+  U64 base_pos;
+  ArenaBlock *prev;
+};
+
+// Positions (arena_pos, ArenaTemp::pos) are global across chained blocks:
+// the current block covers [base_pos, base_pos + capacity).
+struct Arena {
+  U8 *base;
+  U64 offset; // Within the current block
+  U64 capacity;
+  U64 committed;
+  U64 base_pos;
+  ArenaBlock *prev;
+  ArenaParams params;
+#if ARENA_PROFILE
+  ArenaProfile *profile;
+#endif
 };
 
 struct ArenaTemp {
@@ -38,16 +96,23 @@ static constexpr auto KiB(U64 bytes) -> Size { return bytes << 10; }
 // Assume page size is 4096
 static constexpr U64 ARENA_PAGE_SIZE = 4096;
 
-constexpr U64 align_to_page_size(U64 size) noexcept;
+constexpr U64 align_to_page_size(U64 size) noexcept {
+  return (size + ARENA_PAGE_SIZE - 1) & ~(ARENA_PAGE_SIZE - 1);
+}
 
 template <typename T> constexpr U64 align_to(U64 size) noexcept;
 
 // Arena creation/destruction
-Arena arena_alloc(U64 capacity);
+static constexpr U64 ARENA_DEFAULT_COMMIT_CHUNK = KiB(64);
+static constexpr U64 ARENA_DEFAULT_DECOMMIT_ABOVE = MiB(64);
+
+Arena arena_alloc(U64 capacity ARENA_SITE_PARAM);
+Arena arena_alloc_params(ArenaParams params ARENA_SITE_PARAM);
 void arena_release(Arena *arena);
 
 // Core arena functions
-void *arena_push_size(Arena *arena, U64 size, U64 alignment = sizeof(void *));
+void *arena_push_size(Arena *arena, U64 size,
+                      U64 alignment = sizeof(void *) ARENA_SITE_PARAM);
 
 // Position and offset functions
 U64 arena_pos(Arena *arena);
@@ -60,23 +125,26 @@ template <typename T> constexpr U64 align_to(U64 size) noexcept {
   return (size + alignof(T) - 1) & ~(alignof(T) - 1);
 }
 
-template <typename T> T *arena_push(Arena *arena) {
-  return static_cast<T *>(arena_push_size(arena, sizeof(T), alignof(T)));
+template <typename T> T *arena_push(Arena *arena ARENA_SITE_PARAM) {
+  return static_cast<T *>(
+      arena_push_size(arena, sizeof(T), alignof(T) ARENA_SITE_ARG));
 }
 
-template <typename T> T *arena_push_array(Arena *arena, U64 count) {
+template <typename T>
+T *arena_push_array(Arena *arena, U64 count ARENA_SITE_PARAM) {
   return static_cast<T *>(
-      arena_push_size(arena, sizeof(T) * count, alignof(T)));
+      arena_push_size(arena, sizeof(T) * count, alignof(T) ARENA_SITE_ARG));
 }
 
-template <typename T> T *arena_push_zero(Arena *arena) {
-  T *result = arena_push<T>(arena);
+template <typename T> T *arena_push_zero(Arena *arena ARENA_SITE_PARAM) {
+  T *result = arena_push<T>(arena ARENA_SITE_ARG);
   memset(result, 0, sizeof(T));
   return result;
 }
 
-template <typename T> T *arena_push_array_zero(Arena *arena, U64 count) {
-  T *result = arena_push_array<T>(arena, count);
+template <typename T>
+T *arena_push_array_zero(Arena *arena, U64 count ARENA_SITE_PARAM) {
+  T *result = arena_push_array<T>(arena, count ARENA_SITE_ARG);
   memset(result, 0, sizeof(T) * count);
   return result;
 }
@@ -86,6 +154,54 @@ ArenaTemp temp_begin(Arena *arena);
 void temp_end(ArenaTemp temp);
 
 // Scratch arenas
-void scratch_init_and_equip();
+// Every thread has a pool of scratch arenas of its own. Each one is mapped
+// the first time it's handed out and released when the thread exits.
+// scratch_begin hands out the first that isn't in `conflicts`: arenas the
+// caller is allocating its results on, which a temp region must not pop.
+// Running out of arenas that don't conflict is a fatal error.
+static constexpr U32 SCRATCH_MAX_ARENAS = 8;
+
+struct ScratchConfig {
+  U32 count;    // Arenas per thread, at most SCRATCH_MAX_ARENAS
+  U64 capacity; // Reservation of each
+};
+
+// Takes effect for threads that haven't used a scratch arena yet, so set it
+// before starting workers. The default is 2 arenas of 64 MiB.
+void scratch_configure(ScratchConfig config);
 ArenaTemp scratch_begin(Arena **conflicts, U64 count);
 void scratch_end(ArenaTemp temp);
+
+// This thread's pool. high_water is the furthest each arena had been
+// pushed when a scratch region on it ended, which is what a worker pool
+// wants to size `capacity` by.
+struct ScratchStats {
+  U32 count; // Arenas mapped so far
+  U64 high_water[SCRATCH_MAX_ARENAS];
+};
+
+ScratchStats scratch_stats();
+
+// A scratch region for the enclosing C++ scope:
+//   ScratchScope scratch(&out, 1);
+//   U8 *buf = arena_push_array<U8>(scratch.arena, size);
+struct ScratchScope {
+  ArenaTemp temp;
+  Arena *arena;
+
+  explicit ScratchScope(Arena **conflicts = nullptr, U64 count = 0)
+      : temp(scratch_begin(conflicts, count)), arena(temp.arena) {}
+  ~ScratchScope() { scratch_end(temp); }
+  ScratchScope(const ScratchScope &) = delete;
+  ScratchScope &operator=(const ScratchScope &) = delete;
+};
+
+// Profiling
+// Names an arena in the report. Arenas without a label are reported under
+// the file:line that created them.
+#if ARENA_PROFILE
+void arena_profile_label(Arena *arena, const char *label);
+void arena_profile_report(FILE *out);
+#else
+inline void arena_profile_label(Arena *, const char *) {}
+#endif
@@ -0,0 +1,79 @@
+#include "file.hpp"
+#include "arena.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FileMap file_map_readonly(const char *path) {
+  FileMap result = {};
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return result;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return result;
+  }
+
+  U64 size = (U64)st.st_size;
+  U64 mapped_size = align_to_page_size(size) + ARENA_PAGE_SIZE;
+
+  // Reserve the whole range as zero pages first, then map the file over the
+  // front of it. The kernel zero-fills the tail of the last file page and the
+  // extra page is anonymous, which gives us the sentinel for free.
+  void *base = mmap(nullptr, mapped_size, PROT_READ,
+                    MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return result;
+  }
+
+  if (size > 0) {
+    void *view = mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if (view == MAP_FAILED) {
+      munmap(base, mapped_size);
+      close(fd);
+      return result;
+    }
+    madvise(view, size, MADV_SEQUENTIAL);
+    madvise(view, size, MADV_WILLNEED);
+  }
+
+  // The mapping keeps its own reference to the file.
+  close(fd);
+
+  result.data = str8(static_cast<U8 *>(base), size);
+  result.mapped_size = mapped_size;
+  return result;
+}
+
+void file_unmap(FileMap *map) {
+  if (map->data.str)
+    munmap(map->data.str, map->mapped_size);
+
+  map->data = {};
+  map->mapped_size = 0;
+}
+
+bool file_write(const char *path, String8 data) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+
+  U64 done = 0;
+  while (done < data.size) {
+    ssize_t n = write(fd, data.str + done, data.size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      close(fd);
+      return false;
+    }
+    done += (U64)n;
+  }
+  return close(fd) == 0;
+}
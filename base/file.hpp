@@ -0,0 +1,20 @@
+#pragma once
+#include "arena.hpp"
+#include "strings.hpp"
+
+// Read-only view of a file mapped into memory. The mapping is always followed
+// by zeroed bytes up to the next page plus one whole zero page, so
+// `data.str[data.size]` is a readable '\0' and short over-reads past the end
+// stay inside the mapping.
+struct FileMap {
+  String8 data;
+  U64 mapped_size;
+};
+
+// Returns a map with `data.str == nullptr` if the file couldn't be mapped.
+FileMap file_map_readonly(const char *path);
+void file_unmap(FileMap *map);
+
+// Creates or truncates `path` and writes `data` to it, in one write() unless
+// the kernel takes less. Returns false on any failure.
+bool file_write(const char *path, String8 data);
@@ -0,0 +1,274 @@
+#pragma once
+#include "arena.hpp"
+#include "strings.hpp"
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Open-addressing hash map whose tables live in an Arena, laid out like a
+// Swiss table: a control byte per slot holds 7 bits of the key's hash, or
+// says the slot is empty or deleted. Slots come in aligned groups of 16.
+// A lookup compares a group's control bytes against the hash at once, and
+// only looks at the keys whose bits matched. It moves on to the next group
+// only while the one it's in is full.
+//
+// Growing pushes new tables on the arena and rehashes into them. The old
+// ones stay behind until the arena is popped, as with the interner's
+// tables, so a map that grows a lot wants an arena of its own, or a size
+// hint up front.
+//
+// Keys are integers or String8. A String8 key is stored as is, not copied,
+// so its bytes have to outlive the map (interned or on the same arena).
+// Values are plain data.
+
+static constexpr U64 HASH_MAP_GROUP = 16;
+static constexpr U8 HASH_MAP_EMPTY = 0x80;
+static constexpr U8 HASH_MAP_DELETED = 0xFE;
+
+template <typename K, typename V> struct HashMapSlot {
+  K key;
+  V value;
+};
+
+template <typename K, typename V> struct HashMap {
+  static_assert(std::is_trivially_copyable_v<K> &&
+                    std::is_trivially_copyable_v<V>,
+                "Tables are moved with memcpy and never destroyed");
+
+  Arena *arena;
+  U8 *ctrl; // A byte per slot, 16-byte aligned
+  HashMapSlot<K, V> *slots; // Key next to value: a hit is one more miss
+  U64 capacity;    // Slots, a power of two of at least HASH_MAP_GROUP
+  U64 count;       // Live entries
+  U64 growth_left; // Empty slots that may still be filled before a rehash
+};
+
+// ---- Hashing ----
+
+static inline U64 hash_map_mix(U64 a, U64 b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (U64)r ^ (U64)(r >> 64);
+}
+
+template <typename K>
+  requires std::is_integral_v<K>
+inline U64 hash_map_hash(K key) {
+  return hash_map_mix((U64)key ^ 0xa0761d6478bd642full,
+                      0xe7037ed1a0b428dbull);
+}
+
+inline U64 hash_map_hash(String8 key) { return str8_hash(key); }
+
+template <typename K>
+  requires std::is_integral_v<K>
+inline bool hash_map_key_equal(K a, K b) {
+  return a == b;
+}
+
+// str8_match, but inline.
+inline bool hash_map_key_equal(String8 a, String8 b) {
+  return a.size == b.size && memcmp(a.str, b.str, a.size) == 0;
+}
+
+// The low 7 bits go in the control byte, the rest pick the first group.
+// (The low 4 bits of h1 are dropped when it's turned into a group.)
+static inline U8 hash_map_h2(U64 hash) { return (U8)(hash & 0x7F); }
+static inline U64 hash_map_h1(U64 hash) { return hash >> 7; }
+
+// ---- Groups ----
+// Bit i of each mask is set when control byte i of the group matches.
+
+#if defined(__SSE2__)
+static inline U32 hash_map_group_match(const U8 *group, U8 h2) {
+  __m128i ctrl = _mm_load_si128((const __m128i *)group);
+  __m128i eq = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2));
+  return (U32)_mm_movemask_epi8(eq);
+}
+
+static inline U32 hash_map_group_empty(const U8 *group) {
+  return hash_map_group_match(group, HASH_MAP_EMPTY);
+}
+
+// Empty or deleted: the only control bytes with the top bit set.
+static inline U32 hash_map_group_free(const U8 *group) {
+  return (U32)_mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+}
+#else
+static inline U32 hash_map_group_match(const U8 *group, U8 h2) {
+  U32 mask = 0;
+  for (U32 i = 0; i < HASH_MAP_GROUP; ++i)
+    mask |= (U32)(group[i] == h2) << i;
+  return mask;
+}
+
+static inline U32 hash_map_group_empty(const U8 *group) {
+  return hash_map_group_match(group, HASH_MAP_EMPTY);
+}
+
+static inline U32 hash_map_group_free(const U8 *group) {
+  U32 mask = 0;
+  for (U32 i = 0; i < HASH_MAP_GROUP; ++i)
+    mask |= (U32)(group[i] >> 7) << i;
+  return mask;
+}
+#endif
+
+// ---- Tables ----
+
+// Up to 7/8 of the slots may be filled.
+static inline U64 hash_map_max_load(U64 capacity) {
+  return capacity - capacity / 8;
+}
+
+template <typename K, typename V>
+static void hash_map_alloc_tables(HashMap<K, V> *map, U64 capacity) {
+  map->capacity = capacity;
+  map->ctrl = (U8 *)arena_push_size(map->arena, capacity, HASH_MAP_GROUP);
+  memset(map->ctrl, HASH_MAP_EMPTY, capacity);
+  map->slots = arena_push_array<HashMapSlot<K, V>>(map->arena, capacity);
+  map->growth_left = hash_map_max_load(capacity) - map->count;
+}
+
+// Room for `count` entries without growing.
+template <typename K, typename V>
+HashMap<K, V> hash_map_create(Arena *arena, U64 count = 0) {
+  U64 capacity = HASH_MAP_GROUP;
+  while (hash_map_max_load(capacity) < count)
+    capacity *= 2;
+  HashMap<K, V> map = {};
+  map.arena = arena;
+  hash_map_alloc_tables(&map, capacity);
+  return map;
+}
+
+// First slot of the group `hash` starts probing at.
+template <typename K, typename V>
+static U64 hash_map_first_group(const HashMap<K, V> *map, U64 hash) {
+  return hash_map_h1(hash) & (map->capacity - 1) & ~(HASH_MAP_GROUP - 1);
+}
+
+// First free slot on the probe sequence of `hash`. One always exists, since
+// growth_left keeps some slots empty.
+template <typename K, typename V>
+static U64 hash_map_find_free(const HashMap<K, V> *map, U64 hash) {
+  U64 pos = hash_map_first_group(map, hash);
+  while (true) {
+    if (U32 free = hash_map_group_free(map->ctrl + pos))
+      return pos + (U64)__builtin_ctz(free);
+    pos = (pos + HASH_MAP_GROUP) & (map->capacity - 1);
+  }
+}
+
+// Rehashes into new tables: twice the size when the map is more than half
+// full, the same size when deleted slots are what ran it out of room.
+template <typename K, typename V>
+static void hash_map_grow(HashMap<K, V> *map) {
+  U8 *ctrl = map->ctrl;
+  HashMapSlot<K, V> *slots = map->slots;
+  U64 old_capacity = map->capacity;
+  U64 capacity = map->count * 2 > hash_map_max_load(old_capacity)
+                     ? old_capacity * 2
+                     : old_capacity;
+  hash_map_alloc_tables(map, capacity);
+  for (U64 i = 0; i < old_capacity; ++i) {
+    if (ctrl[i] & 0x80)
+      continue;
+    U64 hash = hash_map_hash(slots[i].key);
+    U64 slot = hash_map_find_free(map, hash);
+    map->ctrl[slot] = hash_map_h2(hash);
+    map->slots[slot] = slots[i];
+  }
+}
+
+// ---- Lookup ----
+
+// Slot holding `key`, or capacity when there is none.
+template <typename K, typename V>
+static U64 hash_map_find_slot(const HashMap<K, V> *map, K key, U64 hash) {
+  U64 pos = hash_map_first_group(map, hash);
+  U8 h2 = hash_map_h2(hash);
+  while (true) {
+    const U8 *group = map->ctrl + pos;
+    for (U32 m = hash_map_group_match(group, h2); m; m &= m - 1) {
+      U64 slot = pos + (U64)__builtin_ctz(m);
+      if (hash_map_key_equal(map->slots[slot].key, key))
+        return slot;
+    }
+    if (hash_map_group_empty(group))
+      return map->capacity;
+    pos = (pos + HASH_MAP_GROUP) & (map->capacity - 1);
+  }
+}
+
+// The value for `key`, or nullptr. Pointers stay valid until the map grows.
+template <typename K, typename V>
+V *hash_map_find(const HashMap<K, V> *map, K key) {
+  U64 slot = hash_map_find_slot(map, key, hash_map_hash(key));
+  return slot == map->capacity ? nullptr : &map->slots[slot].value;
+}
+
+// The value for `key`, inserted zeroed first if it wasn't there.
+// `inserted`, when given, says which happened.
+template <typename K, typename V>
+V *hash_map_upsert(HashMap<K, V> *map, K key, bool *inserted = nullptr) {
+  U64 hash = hash_map_hash(key);
+  U64 slot = hash_map_find_slot(map, key, hash);
+  if (inserted)
+    *inserted = slot == map->capacity;
+  if (slot != map->capacity)
+    return &map->slots[slot].value;
+
+  slot = hash_map_find_free(map, hash);
+  if (map->ctrl[slot] == HASH_MAP_EMPTY && map->growth_left == 0) {
+    hash_map_grow(map);
+    slot = hash_map_find_free(map, hash);
+  }
+  if (map->ctrl[slot] == HASH_MAP_EMPTY)
+    map->growth_left--;
+  map->count++;
+  map->ctrl[slot] = hash_map_h2(hash);
+  map->slots[slot] = {key, {}};
+  return &map->slots[slot].value;
+}
+
+template <typename K, typename V>
+void hash_map_put(HashMap<K, V> *map, K key, V value) {
+  *hash_map_upsert(map, key) = value;
+}
+
+// False if `key` wasn't there. When the slot's group still has an empty
+// slot no probe has gone past it, so the slot can go back to empty.
+// Otherwise probes may depend on the group staying full, and it's marked
+// deleted.
+template <typename K, typename V>
+bool hash_map_remove(HashMap<K, V> *map, K key) {
+  U64 slot = hash_map_find_slot(map, key, hash_map_hash(key));
+  if (slot == map->capacity)
+    return false;
+  const U8 *group = map->ctrl + (slot & ~(HASH_MAP_GROUP - 1));
+  bool never_full = hash_map_group_empty(group) != 0;
+  map->ctrl[slot] = never_full ? HASH_MAP_EMPTY : HASH_MAP_DELETED;
+  if (never_full)
+    map->growth_left++;
+  map->count--;
+  return true;
+}
+
+// Forgets every entry, keeping the tables.
+template <typename K, typename V> void hash_map_clear(HashMap<K, V> *map) {
+  memset(map->ctrl, HASH_MAP_EMPTY, map->capacity);
+  map->count = 0;
+  map->growth_left = hash_map_max_load(map->capacity);
+}
+
+// Calls f(key, value) for every entry, in table order.
+template <typename K, typename V, typename F>
+void hash_map_for_each(const HashMap<K, V> *map, F &&f) {
+  for (U64 i = 0; i < map->capacity; ++i) {
+    if (!(map->ctrl[i] & 0x80))
+      f(map->slots[i].key, map->slots[i].value);
+  }
+}
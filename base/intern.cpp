@@ -0,0 +1,109 @@
+#include "intern.hpp"
+#include "arena.hpp"
+#include "strings.hpp"
+#include <cassert>
+#include <cstring>
+
+static constexpr U64 INTERNER_INITIAL_SLOTS = 1024;
+
+static void interner_grow_atoms(Interner *interner) {
+  U64 new_cap = interner->atom_cap * 2;
+  String8 *strings = arena_push_array<String8>(&interner->arena, new_cap);
+  U32 *hashes = arena_push_array<U32>(&interner->arena, new_cap);
+  memcpy(strings, interner->strings, interner->atom_count * sizeof(String8));
+  memcpy(hashes, interner->hashes, interner->atom_count * sizeof(U32));
+  interner->strings = strings;
+  interner->hashes = hashes;
+  interner->atom_cap = new_cap;
+}
+
+static void interner_grow_slots(Interner *interner) {
+  U64 new_count = interner->slot_count * 2;
+  U64 mask = new_count - 1;
+  Atom *slots = arena_push_array_zero<Atom>(&interner->arena, new_count);
+  for (Atom atom = 0; atom < interner->atom_count; ++atom) {
+    U64 i = interner->hashes[atom] & mask;
+    while (slots[i])
+      i = (i + 1) & mask;
+    slots[i] = atom + 1;
+  }
+  interner->slots = slots;
+  interner->slot_count = new_count;
+}
+
+static void interner_init_tables(Interner *interner) {
+  interner->atom_count = 0;
+  interner->atom_cap = INTERNER_INITIAL_SLOTS / 2;
+  interner->strings =
+      arena_push_array<String8>(&interner->arena, interner->atom_cap);
+  interner->hashes =
+      arena_push_array<U32>(&interner->arena, interner->atom_cap);
+  interner->slot_count = INTERNER_INITIAL_SLOTS;
+  interner->slots =
+      arena_push_array_zero<Atom>(&interner->arena, interner->slot_count);
+
+  [[maybe_unused]] Atom empty = intern(interner, str8_lit(""));
+  assert(empty == ATOM_NONE);
+  interner->lookups = 0;
+}
+
+Interner interner_alloc_params(ArenaParams params) {
+  Interner interner = {};
+  interner.arena = arena_alloc_params(params);
+  arena_profile_label(&interner.arena, "interner");
+  interner_init_tables(&interner);
+  return interner;
+}
+
+Interner interner_alloc(U64 capacity) {
+  return interner_alloc_params(
+      {.reserve = capacity,
+       .commit_chunk = ARENA_DEFAULT_COMMIT_CHUNK,
+       .decommit_above = ARENA_DEFAULT_DECOMMIT_ABOVE,
+       .flags = ARENA_FLAG_NONE});
+}
+
+void interner_reset(Interner *interner) {
+  arena_reset(&interner->arena);
+  interner_init_tables(interner);
+}
+
+void interner_release(Interner *interner) {
+  arena_release(&interner->arena);
+  *interner = {};
+}
+
+Atom intern(Interner *interner, String8 s) {
+  interner->lookups++;
+
+  U32 hash = (U32)str8_hash(s);
+  U64 mask = interner->slot_count - 1;
+  U64 i = hash & mask;
+  while (Atom slot = interner->slots[i]) {
+    Atom atom = slot - 1;
+    if (interner->hashes[atom] == hash &&
+        str8_match(interner->strings[atom], s))
+      return atom;
+    i = (i + 1) & mask;
+  }
+
+  // Miss: keep the probe table at most half full.
+  if (interner->atom_count == interner->atom_cap)
+    interner_grow_atoms(interner);
+
+  Atom atom = (Atom)interner->atom_count++;
+  interner->strings[atom] = str8_copy(&interner->arena, s);
+  interner->hashes[atom] = hash;
+
+  if (interner->atom_count * 2 > interner->slot_count) {
+    interner_grow_slots(interner);
+  } else {
+    interner->slots[i] = atom + 1;
+  }
+  return atom;
+}
+
+String8 atom_str8(Interner *interner, Atom atom) {
+  assert(atom < interner->atom_count && "Unknown atom");
+  return interner->strings[atom];
+}
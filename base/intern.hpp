@@ -0,0 +1,33 @@
+#pragma once
+#include "arena.hpp"
+#include "strings.hpp"
+
+// Deduplicates strings into dense U32 atoms, so equal strings compare as
+// equal integers. Atom 0 is the empty string and doubles as "no atom".
+//
+// The interner owns its arena: the string bytes, the atom table and the
+// probe table all live there and grow by doubling.
+
+using Atom = U32;
+static constexpr Atom ATOM_NONE = 0;
+
+struct Interner {
+  Arena arena;
+  String8 *strings; // atom -> string
+  U32 *hashes;      // atom -> low bits of the hash, used when regrowing
+  U64 atom_count;
+  U64 atom_cap;
+  Atom *slots;    // open addressing, atom + 1 per slot, 0 is empty
+  U64 slot_count; // power of two
+  U64 lookups;    // every intern() call, hit or miss
+};
+
+Interner interner_alloc(U64 capacity);
+// For an interner whose arena should chain, or otherwise isn't the default.
+Interner interner_alloc_params(ArenaParams params);
+void interner_release(Interner *interner);
+// Forgets every atom but keeps the arena mapping for reuse.
+void interner_reset(Interner *interner);
+
+Atom intern(Interner *interner, String8 s);
+String8 atom_str8(Interner *interner, Atom atom);
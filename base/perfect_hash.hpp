@@ -0,0 +1,119 @@
+#pragma once
+#include "arena.hpp"
+#include "strings.hpp"
+#include <cstring>
+
+// Compile-time perfect hash over a small, fixed set of strings (keyword
+// tables and the like). perfect_hash_build() searches for a multiplier that
+// sends every key to its own slot, so a lookup is one hash, one length check
+// and one compare.
+//
+// The hash mixes the first two bytes, the last byte and the length, so every
+// key has to be at least 2 bytes long and the keys must differ in one of
+// those.
+
+static constexpr U64 PERFECT_HASH_MAX_KEY = 15;
+
+template <typename V> struct PerfectHashKey {
+  const char *str;
+  U64 size;
+  V value;
+};
+
+#define phash_key(s, v)                                                        \
+  PerfectHashKey<decltype(v)> { (s), sizeof(s) - 1, (v) }
+
+template <typename V> struct PerfectHashSlot {
+  // Stored inline so a lookup doesn't chase a pointer.
+  U8 str[PERFECT_HASH_MAX_KEY + 1];
+  U8 size;
+  V value;
+};
+
+// `index` maps a hash to 1 + the key's position in `slots`, 0 is empty.
+// Keeping it to a byte per bucket lets the table be sparse enough for a
+// collision-free multiplier to exist while staying a few cache lines big.
+template <typename V, Size N, U32 Bits> struct PerfectHash {
+  static_assert(N < 256, "Index is a byte");
+  static constexpr U32 bucket_count = 1u << Bits;
+
+  U32 seed;
+  U64 min_size;
+  U64 max_size;
+  V miss;
+  U8 index[bucket_count];
+  PerfectHashSlot<V> slots[N];
+};
+
+template <typename C>
+constexpr U32 perfect_hash_mix(const C *s, U64 size, U32 seed, U32 bits) {
+  U32 key = (U32)(U8)s[0] | (U32)(U8)s[1] << 8 | (U32)(U8)s[size - 1] << 16 |
+            (U32)size << 24;
+  return (key * seed) >> (32 - bits);
+}
+
+// Never defined: reaching one of these while building turns into a compile
+// error that names the problem.
+void perfect_hash_key_too_long_or_short();
+void perfect_hash_no_seed_found();
+
+template <U32 Bits, typename V, Size N>
+constexpr auto perfect_hash_build(const PerfectHashKey<V> (&keys)[N], V miss)
+    -> PerfectHash<V, N, Bits> {
+  PerfectHash<V, N, Bits> table = {};
+  table.miss = miss;
+  table.min_size = PERFECT_HASH_MAX_KEY;
+  table.max_size = 0;
+  for (Size i = 0; i < N; ++i) {
+    const PerfectHashKey<V> &key = keys[i];
+    if (key.size < 2 || key.size > PERFECT_HASH_MAX_KEY)
+      perfect_hash_key_too_long_or_short();
+    table.min_size = key.size < table.min_size ? key.size : table.min_size;
+    table.max_size = key.size > table.max_size ? key.size : table.max_size;
+
+    PerfectHashSlot<V> &slot = table.slots[i];
+    for (U64 j = 0; j < key.size; ++j)
+      slot.str[j] = (U8)key.str[j];
+    slot.size = (U8)key.size;
+    slot.value = key.value;
+  }
+
+  // Odd multipliers starting from the golden ratio, first collision-free
+  // one wins.
+  for (U32 attempt = 0; attempt < (1u << 14); ++attempt) {
+    U32 seed = 0x9E3779B1u + 2 * attempt;
+    U8 index[1u << Bits] = {};
+    bool ok = true;
+    for (Size i = 0; i < N && ok; ++i) {
+      U32 bucket = perfect_hash_mix(keys[i].str, keys[i].size, seed, Bits);
+      ok = index[bucket] == 0;
+      index[bucket] = (U8)(i + 1);
+    }
+    if (!ok)
+      continue;
+
+    table.seed = seed;
+    for (U32 b = 0; b < (1u << Bits); ++b)
+      table.index[b] = index[b];
+    return table;
+  }
+
+  perfect_hash_no_seed_found();
+  return table;
+}
+
+template <typename V, Size N, U32 Bits>
+inline V perfect_hash_lookup(const PerfectHash<V, N, Bits> &table,
+                             String8 s) {
+  if (s.size < table.min_size || s.size > table.max_size)
+    return table.miss;
+
+  U8 i = table.index[perfect_hash_mix(s.str, s.size, table.seed, Bits)];
+  if (i == 0)
+    return table.miss;
+
+  const PerfectHashSlot<V> &slot = table.slots[i - 1];
+  if (slot.size == s.size && memcmp(slot.str, s.str, s.size) == 0)
+    return slot.value;
+  return table.miss;
+}
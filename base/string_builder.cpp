@@ -1,64 +1,233 @@
 #include "strings.hpp"
 #include <arena.hpp>
 #include <cassert>
+#include <cerrno>
 #include <cstdarg>
 #include <cstdio>
 #include <string_builder.hpp>
+#include <sys/uio.h>
 
-StringBuilder sb_create(Arena *arena, U64 length) {
-  U8 *buf = arena_push_array<U8>(arena, length);
-  return {arena, buf, 0, length};
+StringBuilder sb_create(Arena *arena, U64 length ARENA_SITE_DEF) {
+  U8 *buf = arena_push_array<U8>(arena, length ARENA_SITE_ARG);
+  return {.arena = arena,
+          .start = buf,
+          .length = 0,
+          .cap = length,
+          .first = nullptr,
+          .last = nullptr,
+          .retired = 0};
 }
 
-void sb_append(StringBuilder *sb, String8 str) {
-  assert((sb->length + str.size <= sb->cap) && "SB overshot");
-  std::memcpy(sb->start + sb->length, str.str, str.size);
-  sb->length += str.size;
+void sb_grow(StringBuilder *sb, U64 size) {
+  Arena *arena = sb->arena;
+  assert(arena && "StringBuilder was never created");
+  // Room for `size` past what's written, whether the chunk is extended in
+  // place or a new one is started.
+  U64 cap = sb->cap > 128 ? sb->cap * 2 : 256;
+  while (cap - sb->length < size)
+    cap *= 2;
+
+  // Nothing was pushed after the chunk and the block has room: extend it.
+  U64 extra = cap - sb->cap;
+  if (sb->start + sb->cap == arena->base + arena->offset &&
+      arena->offset + extra <= arena->capacity) {
+    arena_push_array<U8>(arena, extra);
+    sb->cap = cap;
+    return;
+  }
+
+  if (sb->length) {
+    StringBuilderChunk *chunk = arena_push<StringBuilderChunk>(arena);
+    *chunk = {.next = nullptr, .data = str8(sb->start, sb->length)};
+    if (sb->last)
+      sb->last->next = chunk;
+    else
+      sb->first = chunk;
+    sb->last = chunk;
+    sb->retired += sb->length;
+  }
+  sb->start = arena_push_array<U8>(arena, cap);
+  sb->length = 0;
+  sb->cap = cap;
 }
 
 void sb_appendf(StringBuilder *sb, const char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
+  va_list retry;
+  va_copy(retry, args);
 
-  va_list args_copy;
-  va_copy(args_copy, args);
-  int needed = vsnprintf(nullptr, 0, fmt, args_copy);
-  va_end(args_copy);
-
+  // Usually fits in what's left of the chunk, and vsnprintf runs once.
+  U64 room = sb->cap - sb->length;
+  int needed = vsnprintf((char *)sb->start + sb->length, room, fmt, args);
+  va_end(args);
   assert(needed >= 0 && "vsnprintf failed");
+  if ((U64)needed >= room) {
+    U8 *out = sb_reserve(sb, (U64)needed + 1); // +1 for the NUL
+    vsnprintf((char *)out, (U64)needed + 1, fmt, retry);
+  }
+  va_end(retry);
+  sb->length += (U64)needed;
+}
 
-  U64 new_len = sb->length + (U64)needed;
-  assert(new_len <= sb->cap && "SB overshot");
+void sb_append_cstr(StringBuilder *sb, U8 *cstr) {
+  sb_append(sb, str8_cstring(cstr));
+}
 
-  int written = vsnprintf((char *)sb->start + sb->length,
-                          sb->cap - sb->length + 1, // +1 for NUL
-                          fmt, args);
-  va_end(args);
+// ---- Integers ----
 
-  assert(written == needed && "vsnprintf wrote unexpected length");
+static const char sb_digit_pairs[] =
+    "000102030405060708091011121314151617181920212223242526272829"
+    "303132333435363738394041424344454647484950515253545556575859"
+    "606162636465666768697071727374757677787980818283848586878889"
+    "90919293949596979899";
 
-  sb->length = new_len;
+// Writes `num` in decimal backwards from `end`, two digits at a time, and
+// returns where it starts.
+static U8 *sb_decimal(U8 *end, U64 num) {
+  while (num >= 100) {
+    end -= 2;
+    memcpy(end, sb_digit_pairs + num % 100 * 2, 2);
+    num /= 100;
+  }
+  if (num >= 10) {
+    end -= 2;
+    memcpy(end, sb_digit_pairs + num * 2, 2);
+  } else {
+    *--end = (U8)('0' + num);
+  }
+  return end;
 }
 
-void sb_append_char(StringBuilder *sb, U8 c) { sb_append(sb, str8(&c, 1)); }
+static U8 *sb_hex(U8 *end, U64 num) {
+  do {
+    *--end = (U8)"0123456789abcdef"[num & 15];
+    num >>= 4;
+  } while (num);
+  return end;
+}
 
-void sb_append_cstr(StringBuilder *sb, U8 *cstr) {
-  sb_append(sb, str8_cstring(cstr));
+// `sign` (0 for none), then zeros up to `min_digits`, then the digits.
+static void sb_append_digits(StringBuilder *sb, U8 sign, const U8 *digits,
+                             U64 count, U32 min_digits) {
+  U64 pad = min_digits > count ? min_digits - count : 0;
+  U8 *out = sb_reserve(sb, 1 + pad + count);
+  U8 *p = out;
+  if (sign)
+    *p++ = sign;
+  memset(p, '0', pad);
+  memcpy(p + pad, digits, count);
+  sb->length += (U64)(p - out) + pad + count;
+}
+
+void sb_append_unsigned(StringBuilder *sb, U64 num, U32 min_digits) {
+  U8 buf[20];
+  U8 *first = sb_decimal(buf + sizeof(buf), num);
+  sb_append_digits(sb, 0, first, (U64)(buf + sizeof(buf) - first),
+                   min_digits);
+}
+
+void sb_append_signed(StringBuilder *sb, S64 num, U32 min_digits) {
+  U8 buf[20];
+  U64 magnitude = num < 0 ? 0 - (U64)num : (U64)num;
+  U8 *first = sb_decimal(buf + sizeof(buf), magnitude);
+  sb_append_digits(sb, num < 0 ? '-' : 0, first,
+                   (U64)(buf + sizeof(buf) - first), min_digits);
+}
+
+void sb_append_hex(StringBuilder *sb, U64 num, U32 min_digits) {
+  U8 buf[16];
+  U8 *first = sb_hex(buf + sizeof(buf), num);
+  sb_append_digits(sb, 0, first, (U64)(buf + sizeof(buf) - first),
+                   min_digits);
+}
+
+// As std::format does it, the width counts the sign.
+void sb_format_integer(StringBuilder *sb, U64 magnitude, bool negative,
+                       SBSpec spec) {
+  U8 buf[20];
+  U8 *end = buf + sizeof(buf);
+  U8 *first = spec.hex ? sb_hex(end, magnitude) : sb_decimal(end, magnitude);
+  U8 sign = negative ? '-' : spec.plus ? '+' : 0;
+  U32 min_digits = spec.width > (sign != 0) ? spec.width - (sign != 0) : 1;
+  sb_append_digits(sb, sign, first, (U64)(end - first), min_digits);
 }
 
-void sb_append_signed(StringBuilder *sb, S64 num) {
-  char tmp[32];
-  int written = snprintf(tmp, sizeof(tmp), "%lld", (long long)num);
-  assert(written >= 0 && "snprintf failed");
-  assert((sb->length + (U64)written) <= sb->cap && "SB overshot");
+// ---- Whole text ----
 
-  std::memcpy(sb->start + sb->length, tmp, (size_t)written);
-  sb->length += (U64)written;
+void sb_clear(StringBuilder *sb) {
+  sb->length = 0;
+  sb->first = nullptr;
+  sb->last = nullptr;
+  sb->retired = 0;
 }
 
-const char *sb_cstr(StringBuilder *sb) {
-  sb->start[sb->length] = '\0'; // Null terminate
+// Copies the chunks into one with `extra` bytes to spare.
+static void sb_flatten(StringBuilder *sb, U64 extra) {
+  U64 size = sb_size(sb);
+  U8 *text = arena_push_array<U8>(sb->arena, size + extra);
+  U8 *p = text;
+  for (StringBuilderChunk *c = sb->first; c; c = c->next) {
+    memcpy(p, c->data.str, c->data.size);
+    p += c->data.size;
+  }
+  memcpy(p, sb->start, sb->length);
+  *sb = {.arena = sb->arena,
+         .start = text,
+         .length = size,
+         .cap = size + extra,
+         .first = nullptr,
+         .last = nullptr,
+         .retired = 0};
+}
+
+String8 sb_to_str8(StringBuilder *sb) {
+  if (sb->first)
+    sb_flatten(sb, 0);
+  return str8(sb->start, sb->length);
+}
+
+const char *sb_to_cstr(StringBuilder *sb) {
+  if (sb->first || sb->length == sb->cap)
+    sb_flatten(sb, 1);
+  sb->start[sb->length] = '\0';
   return (char *)sb->start;
 }
 
-String8 sb_to_str8(StringBuilder *sb) { return str8_cstring(sb->start); }
+bool sb_write_fd(const StringBuilder *sb, int fd) {
+  const StringBuilderChunk *next = sb->first;
+  bool current = true; // sb->start still to be queued
+  iovec iov[64];
+  U32 done = 0, count = 0; // iov[done, count) is still to be written
+  while (true) {
+    if (done == count) {
+      done = count = 0;
+      while (count < 64 && (next || current)) {
+        String8 data = next ? next->data : str8(sb->start, sb->length);
+        if (next)
+          next = next->next;
+        else
+          current = false;
+        if (data.size)
+          iov[count++] = {.iov_base = data.str, .iov_len = data.size};
+      }
+      if (!count)
+        return true;
+    }
+
+    ssize_t n = writev(fd, iov + done, (int)(count - done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    for (U64 left = (U64)n; left;) {
+      if (left >= iov[done].iov_len) {
+        left -= iov[done++].iov_len;
+      } else {
+        iov[done].iov_base = (U8 *)iov[done].iov_base + left;
+        iov[done].iov_len -= left;
+        left = 0;
+      }
+    }
+  }
+}
@@ -3,20 +3,247 @@
 #include "strings.hpp"
 #include <arena.hpp>
 #include <cstring>
+#include <type_traits>
+
+// Text built up in an arena, a fragment at a time. Bytes go into the current
+// chunk, start[0, length). When it fills up it grows in place if nothing was
+// pushed on the arena after it. Otherwise it's retired to a list and a chunk
+// twice the size takes over, so nothing written is copied again until
+// someone asks for the whole text as one String8 (sb_to_str8). sb_write_fd
+// hands the list to writev as is.
+//
+// Growing pushes on the builder's arena, so a temp scope on that arena must
+// not end while a builder from outside it is still being written to.
+
+struct StringBuilderChunk {
+  StringBuilderChunk *next;
+  String8 data;
+};
 
 struct StringBuilder {
   Arena *arena;
-  U8 *start;
-  U64 length;
+  U8 *start;  // Current chunk
+  U64 length; // Bytes written to it
   U64 cap;
+  StringBuilderChunk *first; // Retired chunks, oldest first
+  StringBuilderChunk *last;
+  U64 retired; // Bytes in them
 };
 
-StringBuilder sb_create(Arena *arena, U64 capacity);
+StringBuilder sb_create(Arena *arena, U64 capacity ARENA_SITE_PARAM);
+
+// Slow path of sb_reserve.
+void sb_grow(StringBuilder *sb, U64 size);
+
+// Room for `size` more bytes at the returned pointer, which the caller
+// fills and then adds to sb->length.
+inline U8 *sb_reserve(StringBuilder *sb, U64 size) {
+  if (sb->cap - sb->length < size)
+    sb_grow(sb, size);
+  return sb->start + sb->length;
+}
+
+inline U64 sb_size(const StringBuilder *sb) {
+  return sb->retired + sb->length;
+}
+
+// Emitters call these once per fragment, so they're inline.
+inline void sb_append(StringBuilder *sb, String8 s) {
+  if (s.size == 0)
+    return;
+  std::memcpy(sb_reserve(sb, s.size), s.str, s.size);
+  sb->length += s.size;
+}
+
+inline void sb_append_char(StringBuilder *sb, U8 c) {
+  *sb_reserve(sb, 1) = c;
+  sb->length++;
+}
 
-void sb_append(StringBuilder *sb, String8 s);
-void sb_appendf(StringBuilder *sb, const char *fmt, ...);
-void sb_append_char(StringBuilder *sb, U8 c);
+void sb_appendf(StringBuilder *sb, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
 void sb_append_cstr(StringBuilder *sb, U8 *cstr);
-void sb_append_signed(StringBuilder *sb, S64 num);
-const char *sb_to_cstr(StringBuilder *sb);
+void sb_append_unsigned(StringBuilder *sb, U64 num, U32 min_digits = 1);
+void sb_append_signed(StringBuilder *sb, S64 num, U32 min_digits = 1);
+void sb_append_hex(StringBuilder *sb, U64 num, U32 min_digits = 1);
+
+// Drops everything written, keeping the current chunk for reuse.
+void sb_clear(StringBuilder *sb);
+
+// The text as one String8 (or '\0' terminated, not counted in the size).
+// Copies the chunks together if there's more than one; the builder keeps
+// working on the copy afterwards.
 String8 sb_to_str8(StringBuilder *sb);
+const char *sb_to_cstr(StringBuilder *sb);
+
+// Writes every chunk with writev. False if the fd stops taking bytes.
+bool sb_write_fd(const StringBuilder *sb, int fd);
+
+// ---- sb_format ----
+//
+// std::format-style formatting without varargs or printf parsing:
+//
+//   sb_format(sb, "  mov {}, QWORD PTR [rbp{:+}]\n", reg, disp);
+//
+// `{}` formats the next argument, `{{` and `}}` are literal braces. Integers
+// take a spec of `+` (always print the sign), `0` and a width (pad with
+// zeros) and `x` (lowercase hex), in that order: `{:016x}`. The format is
+// checked against the argument types at compile time.
+//
+// Arguments are formatted by sb_format_arg overloads, found by ADL at the
+// call, so other modules can add their own types (e.g. x64 registers).
+
+struct SBSpec {
+  bool plus;
+  bool hex;
+  U8 width;
+};
+
+namespace sb_detail {
+template <typename T>
+inline constexpr bool is_integer =
+    std::is_integral_v<T> && !std::is_same_v<T, bool> &&
+    !std::is_same_v<T, char>;
+
+// Not constexpr: reaching one of these while checking a format string is a
+// compile error that names the problem.
+void format_has_too_few_arguments();
+void format_has_too_many_arguments();
+void format_has_unmatched_brace();
+void format_spec_is_invalid();
+void format_spec_on_a_non_integer();
+
+// Parses the spec between ':' and '}' starting at `p`, returns one past the
+// '}', or nullptr when the spec is malformed.
+constexpr const char *parse_spec(const char *p, SBSpec *spec) {
+  *spec = {};
+  if (*p == '}')
+    return p + 1;
+  if (*p++ != ':')
+    return nullptr;
+  if (*p == '+') {
+    spec->plus = true;
+    p++;
+  }
+  if (*p == '0') {
+    p++;
+    if (*p < '1' || *p > '9')
+      return nullptr;
+    while (*p >= '0' && *p <= '9') {
+      if (spec->width > 25)
+        return nullptr;
+      spec->width = (U8)(spec->width * 10 + (*p++ - '0'));
+    }
+  }
+  if (*p == 'x') {
+    spec->hex = true;
+    p++;
+  }
+  return *p == '}' ? p + 1 : nullptr;
+}
+} // namespace sb_detail
+
+// The format string, checked when it's converted from a literal.
+template <typename... Args> struct SBFormat {
+  const char *str;
+  U64 size;
+
+  template <U64 N>
+  consteval SBFormat(const char (&s)[N]) : str(s), size(N - 1) {
+    constexpr bool integer[] = {sb_detail::is_integer<Args>..., false};
+    U32 arg = 0;
+    for (const char *p = s; p < s + N - 1;) {
+      if ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}')) {
+        p += 2;
+      } else if (*p == '}') {
+        sb_detail::format_has_unmatched_brace();
+      } else if (*p == '{') {
+        SBSpec spec;
+        p = sb_detail::parse_spec(p + 1, &spec);
+        if (!p)
+          sb_detail::format_spec_is_invalid();
+        if (arg == sizeof...(Args))
+          sb_detail::format_has_too_few_arguments();
+        if ((spec.plus || spec.hex || spec.width) && !integer[arg])
+          sb_detail::format_spec_on_a_non_integer();
+        arg++;
+      } else {
+        p++;
+      }
+    }
+    if (arg != sizeof...(Args))
+      sb_detail::format_has_too_many_arguments();
+  }
+};
+
+void sb_format_integer(StringBuilder *sb, U64 magnitude, bool negative,
+                       SBSpec spec);
+
+template <typename T>
+  requires sb_detail::is_integer<T>
+inline void sb_format_arg(StringBuilder *sb, T value, SBSpec spec) {
+  bool plain = !spec.plus && !spec.width && !spec.hex;
+  if constexpr (std::is_signed_v<T>) {
+    if (plain)
+      return sb_append_signed(sb, value);
+    bool negative = value < 0;
+    sb_format_integer(sb, negative ? 0 - (U64)value : (U64)value, negative,
+                      spec);
+  } else {
+    if (plain)
+      return sb_append_unsigned(sb, value);
+    sb_format_integer(sb, value, false, spec);
+  }
+}
+
+inline void sb_format_arg(StringBuilder *sb, char c, SBSpec) {
+  sb_append_char(sb, (U8)c);
+}
+
+inline void sb_format_arg(StringBuilder *sb, String8 s, SBSpec) {
+  sb_append(sb, s);
+}
+
+inline void sb_format_arg(StringBuilder *sb, const char *s, SBSpec) {
+  sb_append(sb, str8((U8 *)s, strlen(s)));
+}
+
+namespace sb_detail {
+// Appends the literal text up to the next placeholder, unescaping braces,
+// and returns the placeholder, or `end`.
+inline const char *format_literal(StringBuilder *sb, const char *p,
+                                  const char *end) {
+  while (p < end) {
+    const char *brace = p;
+    while (brace < end && *brace != '{' && *brace != '}')
+      brace++;
+    sb_append(sb, str8((U8 *)p, (U64)(brace - p)));
+    if (brace == end || brace[1] != *brace)
+      return brace;
+    sb_append_char(sb, (U8)*brace);
+    p = brace + 2;
+  }
+  return end;
+}
+
+inline void format_next(StringBuilder *sb, const char *p, const char *end) {
+  format_literal(sb, p, end);
+}
+
+template <typename Arg, typename... Rest>
+inline void format_next(StringBuilder *sb, const char *p, const char *end,
+                        const Arg &arg, const Rest &...rest) {
+  p = format_literal(sb, p, end);
+  SBSpec spec;
+  p = parse_spec(p + 1, &spec);
+  sb_format_arg(sb, arg, spec);
+  format_next(sb, p, end, rest...);
+}
+} // namespace sb_detail
+
+template <typename... Args>
+inline void sb_format(StringBuilder *sb,
+                      SBFormat<std::type_identity_t<Args>...> fmt,
+                      const Args &...args) {
+  sb_detail::format_next(sb, fmt.str, fmt.str + fmt.size, args...);
+}
@@ -2,6 +2,16 @@
 #include "arena.hpp"
 #include <cstring>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The vector paths need nothing past SSE2, which every x86-64 CPU has, so
+// unlike the lexer's scanners they aren't picked at run time. They work on
+// 16-byte blocks and finish with one more block ending at the last byte,
+// overlapping what was already done, so they never read outside the string.
+// Strings shorter than a block go to the scalar versions.
+
 // Character classification & conversions
 bool char_is_whitespace(U8 c) {
   return c == ' ' || c == '\t' || c == '\n' || c == '\r';
@@ -24,27 +34,76 @@ bool char_is_digit(U8 c, U32 base) {
 
 U8 char_to_lower(U8 c) { return char_is_upper(c) ? c + 32 : c; }
 
-U8 char_to_upper(U8 c) { return char_is_upper(c) ? c - 32 : c; }
+U8 char_to_upper(U8 c) { return char_is_lower(c) ? c - 32 : c; }
 
 // String constructors
 String8 str8(U8 *str, U64 size) { return {str, size}; }
 String8 str8_cstring(U8 *cstr) { return {cstr, (U64)strlen((char *)cstr)}; }
 
 // String stylization
-String8 upper_from_str8(Arena *arena, String8 string) {
+String8 upper_from_str8_scalar(Arena *arena, String8 string) {
   U8 *buf = arena_push_array<U8>(arena, string.size);
   for (U64 i = 0; i < string.size; ++i)
     buf[i] = char_to_upper(string.str[i]);
   return {buf, string.size};
 }
 
-String8 lower_from_str8(Arena *arena, String8 string) {
+String8 lower_from_str8_scalar(Arena *arena, String8 string) {
   U8 *buf = arena_push_array<U8>(arena, string.size);
   for (U64 i = 0; i < string.size; ++i)
     buf[i] = char_to_lower(string.str[i]);
   return {buf, string.size};
 }
 
+#if defined(__SSE2__)
+static inline __m128i str8_load(const U8 *p) {
+  return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline U32 str8_mask(__m128i m) { return (U32)_mm_movemask_epi8(m); }
+
+// 0xff in the lanes holding a letter in [lo, lo + 25]. Signed compares keep
+// bytes >= 0x80 out.
+static inline __m128i str8_letters(__m128i v, char lo) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(lo - 1))),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8((char)(lo + 26))));
+}
+
+// Flips the case of every letter in [lo, lo + 25].
+static inline __m128i str8_flip_case(__m128i v, char lo) {
+  return _mm_xor_si128(
+      v, _mm_and_si128(str8_letters(v, lo), _mm_set1_epi8(0x20)));
+}
+
+static String8 str8_flip_case_from(Arena *arena, String8 string, char lo) {
+  U8 *buf = arena_push_array<U8>(arena, string.size);
+  U64 i = 0;
+  for (; i + 16 <= string.size; i += 16)
+    _mm_storeu_si128((__m128i *)(buf + i),
+                     str8_flip_case(str8_load(string.str + i), lo));
+  i = string.size - 16;
+  _mm_storeu_si128((__m128i *)(buf + i),
+                   str8_flip_case(str8_load(string.str + i), lo));
+  return {buf, string.size};
+}
+#endif
+
+String8 upper_from_str8(Arena *arena, String8 string) {
+#if defined(__SSE2__)
+  if (string.size >= 16)
+    return str8_flip_case_from(arena, string, 'a');
+#endif
+  return upper_from_str8_scalar(arena, string);
+}
+
+String8 lower_from_str8(Arena *arena, String8 string) {
+#if defined(__SSE2__)
+  if (string.size >= 16)
+    return str8_flip_case_from(arena, string, 'A');
+#endif
+  return lower_from_str8_scalar(arena, string);
+}
+
 // String slicing
 String8 str8_substr(String8 str, U64 start, U64 end) {
   if (start > str.size)
@@ -56,7 +115,7 @@ String8 str8_substr(String8 str, U64 start, U64 end) {
   return {str.str + start, end - start};
 }
 
-String8 str8_trim_whitespace(String8 s) {
+String8 str8_trim_whitespace_scalar(String8 s) {
   U64 start = 0;
   while (start < s.size && char_is_whitespace(s.str[start]))
     start++;
@@ -66,7 +125,50 @@ String8 str8_trim_whitespace(String8 s) {
   return {s.str + start, end - start};
 }
 
+#if defined(__SSE2__)
+// Bits set for the bytes of the block that aren't whitespace.
+static inline U32 str8_non_whitespace(const U8 *p) {
+  __m128i v = str8_load(p);
+  __m128i ws = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+  return ~str8_mask(ws) & 0xffff;
+}
+#endif
+
+String8 str8_trim_whitespace(String8 s) {
+#if defined(__SSE2__)
+  U64 start = 0;
+  for (; start + 16 <= s.size; start += 16) {
+    if (U32 m = str8_non_whitespace(s.str + start)) {
+      start += (U64)__builtin_ctz(m);
+      break;
+    }
+  }
+  U64 end = s.size;
+  for (; end >= start + 16; end -= 16) {
+    if (U32 m = str8_non_whitespace(s.str + end - 16)) {
+      end -= (U64)__builtin_clz(m) - 16;
+      break;
+    }
+  }
+  // Whatever whitespace is left at either end is shorter than a block.
+  return str8_trim_whitespace_scalar({s.str + start, end - start});
+#else
+  return str8_trim_whitespace_scalar(s);
+#endif
+}
+
 // String Formatting & Copying
+String8 str8_copy(Arena *arena, String8 s ARENA_SITE_DEF) {
+  U8 *buf = arena_push_array<U8>(arena, s.size + 1 ARENA_SITE_ARG);
+  memcpy(buf, s.str, s.size);
+  buf[s.size] = '\0';
+  return {buf, s.size};
+}
+
 String8 str8_cat(Arena *arena, String8 s1, String8 s2) {
   U8 *buf = arena_push_array<U8>(arena, s1.size + s2.size);
   memcpy(buf, s1.str, s1.size);
@@ -79,7 +181,7 @@ bool str8_match(String8 s1, String8 s2) {
   return (s1.size == s2.size) && (memcmp(s1.str, s2.str, s1.size) == 0);
 }
 
-bool str8_match_insensitive(String8 s1, String8 s2) {
+bool str8_match_insensitive_scalar(String8 s1, String8 s2) {
   if (s1.size != s2.size)
     return false;
   for (U64 i = 0; i < s1.size; ++i) {
@@ -89,6 +191,220 @@ bool str8_match_insensitive(String8 s1, String8 s2) {
   return true;
 }
 
+#if defined(__SSE2__)
+static inline bool str8_block_match_insensitive(const U8 *a, const U8 *b) {
+  __m128i x = str8_load(a), y = str8_load(b);
+  __m128i lx = _mm_or_si128(
+      x, _mm_and_si128(str8_letters(x, 'A'), _mm_set1_epi8(0x20)));
+  __m128i ly = _mm_or_si128(
+      y, _mm_and_si128(str8_letters(y, 'A'), _mm_set1_epi8(0x20)));
+  return str8_mask(_mm_cmpeq_epi8(lx, ly)) == 0xffff;
+}
+#endif
+
+bool str8_match_insensitive(String8 s1, String8 s2) {
+#if defined(__SSE2__)
+  if (s1.size != s2.size)
+    return false;
+  if (s1.size >= 16) {
+    for (U64 i = 0; i + 16 <= s1.size; i += 16) {
+      if (!str8_block_match_insensitive(s1.str + i, s2.str + i))
+        return false;
+    }
+    U64 last = s1.size - 16;
+    return str8_block_match_insensitive(s1.str + last, s2.str + last);
+  }
+#endif
+  return str8_match_insensitive_scalar(s1, s2);
+}
+
+// String searching
+U64 str8_find_char_scalar(String8 s, U8 c) {
+  for (U64 i = 0; i < s.size; ++i) {
+    if (s.str[i] == c)
+      return i;
+  }
+  return s.size;
+}
+
+U64 str8_find_scalar(String8 s, String8 needle) {
+  if (needle.size > s.size)
+    return s.size;
+  for (U64 i = 0; i + needle.size <= s.size; ++i) {
+    if (memcmp(s.str + i, needle.str, needle.size) == 0)
+      return i;
+  }
+  return s.size;
+}
+
+// A bitmap of the bytes in `set`.
+struct Str8ByteSet {
+  U64 bits[4];
+};
+
+static Str8ByteSet str8_byte_set(String8 set) {
+  Str8ByteSet result = {};
+  for (U64 i = 0; i < set.size; ++i)
+    result.bits[set.str[i] >> 6] |= 1ull << (set.str[i] & 63);
+  return result;
+}
+
+static inline bool str8_byte_set_has(const Str8ByteSet *set, U8 c) {
+  return set->bits[c >> 6] >> (c & 63) & 1;
+}
+
+U64 str8_find_any_scalar(String8 s, String8 set) {
+  Str8ByteSet bytes = str8_byte_set(set);
+  for (U64 i = 0; i < s.size; ++i) {
+    if (str8_byte_set_has(&bytes, s.str[i]))
+      return i;
+  }
+  return s.size;
+}
+
+U64 str8_find_char(String8 s, U8 c) {
+#if defined(__SSE2__)
+  if (s.size >= 16) {
+    __m128i splat = _mm_set1_epi8((char)c);
+    for (U64 i = 0; i + 16 <= s.size; i += 16) {
+      if (U32 m = str8_mask(_mm_cmpeq_epi8(str8_load(s.str + i), splat)))
+        return i + (U64)__builtin_ctz(m);
+    }
+    U64 last = s.size - 16;
+    U32 m = str8_mask(_mm_cmpeq_epi8(str8_load(s.str + last), splat));
+    return m ? last + (U64)__builtin_ctz(m) : s.size;
+  }
+#endif
+  return str8_find_char_scalar(s, c);
+}
+
+// Candidates are the positions where both the first and the last byte of
+// the needle line up, 16 at a time; only those get a memcmp.
+U64 str8_find(String8 s, String8 needle) {
+  if (needle.size <= 1)
+    return needle.size ? str8_find_char(s, needle.str[0]) : 0;
+  if (needle.size > s.size)
+    return s.size;
+  U64 starts = s.size - needle.size + 1;
+  U64 i = 0;
+#if defined(__SSE2__)
+  __m128i first = _mm_set1_epi8((char)needle.str[0]);
+  __m128i last = _mm_set1_epi8((char)needle.str[needle.size - 1]);
+  for (; i + 16 <= starts; i += 16) {
+    __m128i a = _mm_cmpeq_epi8(str8_load(s.str + i), first);
+    __m128i b =
+        _mm_cmpeq_epi8(str8_load(s.str + i + needle.size - 1), last);
+    for (U32 m = str8_mask(_mm_and_si128(a, b)); m; m &= m - 1) {
+      U64 at = i + (U64)__builtin_ctz(m);
+      if (memcmp(s.str + at + 1, needle.str + 1, needle.size - 2) == 0)
+        return at;
+    }
+  }
+#endif
+  for (; i < starts; ++i) {
+    if (memcmp(s.str + i, needle.str, needle.size) == 0)
+      return i;
+  }
+  return s.size;
+}
+
+// Sets of up to 8 bytes are compared lane-wise; bigger ones go through the
+// bitmap a byte at a time.
+U64 str8_find_any(String8 s, String8 set) {
+#if defined(__SSE2__)
+  if (s.size >= 16 && set.size && set.size <= 8) {
+    __m128i splats[8];
+    for (U64 k = 0; k < set.size; ++k)
+      splats[k] = _mm_set1_epi8((char)set.str[k]);
+    auto block = [&](const U8 *p) {
+      __m128i v = str8_load(p);
+      __m128i hit = _mm_cmpeq_epi8(v, splats[0]);
+      for (U64 k = 1; k < set.size; ++k)
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, splats[k]));
+      return str8_mask(hit);
+    };
+    for (U64 i = 0; i + 16 <= s.size; i += 16) {
+      if (U32 m = block(s.str + i))
+        return i + (U64)__builtin_ctz(m);
+    }
+    U64 last = s.size - 16;
+    U32 m = block(s.str + last);
+    return m ? last + (U64)__builtin_ctz(m) : s.size;
+  }
+#endif
+  return str8_find_any_scalar(s, set);
+}
+
+// String hashing
+static inline U64 hash_mix(U64 a, U64 b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (U64)r ^ (U64)(r >> 64);
+}
+
+// wyhash-style: fold 8 bytes at a time through a 64x64->128 multiply.
+U64 str8_hash(String8 s) {
+  constexpr U64 k0 = 0xa0761d6478bd642full;
+  constexpr U64 k1 = 0xe7037ed1a0b428dbull;
+  U64 h = s.size ^ k0;
+  const U8 *p = s.str;
+  U64 n = s.size;
+  while (n >= 8) {
+    U64 w;
+    memcpy(&w, p, 8);
+    h = hash_mix(h ^ w, k1);
+    p += 8;
+    n -= 8;
+  }
+  U64 tail = 0;
+  memcpy(&tail, p, n);
+  return hash_mix(h ^ tail, k1 ^ s.size);
+}
+
 // String splitting & joining
-// String8List str8_split(Arena *arena, String8 s, U8 sep);
-// String8 str8_join(Arena *arena, String8List list, String8 sep);
+static U64 str8_count_char(String8 s, U8 c) {
+  U64 n = 0, i = 0;
+#if defined(__SSE2__)
+  __m128i splat = _mm_set1_epi8((char)c);
+  for (; i + 16 <= s.size; i += 16)
+    n += (U64)__builtin_popcount(
+        str8_mask(_mm_cmpeq_epi8(str8_load(s.str + i), splat)));
+#endif
+  for (; i < s.size; ++i)
+    n += s.str[i] == c;
+  return n;
+}
+
+// Counting first sizes the array exactly, so the pieces come out as one
+// allocation rather than a node each.
+String8Array str8_split(Arena *arena, String8 s, U8 sep) {
+  String8Array result;
+  result.count = str8_count_char(s, sep) + 1;
+  result.items = arena_push_array<String8>(arena, result.count);
+  U64 start = 0;
+  for (U64 k = 0; k < result.count; ++k) {
+    String8 rest = {s.str + start, s.size - start};
+    U64 size = str8_find_char(rest, sep);
+    result.items[k] = {rest.str, size};
+    start += size + 1;
+  }
+  return result;
+}
+
+String8 str8_join(Arena *arena, String8Array array, String8 sep) {
+  if (!array.count)
+    return {};
+  U64 size = sep.size * (array.count - 1);
+  for (U64 k = 0; k < array.count; ++k)
+    size += array.items[k].size;
+  U8 *buf = arena_push_array<U8>(arena, size);
+  U8 *p = buf;
+  for (U64 k = 0; k < array.count; ++k) {
+    if (k) {
+      memcpy(p, sep.str, sep.size);
+      p += sep.size;
+    }
+    memcpy(p, array.items[k].str, array.items[k].size);
+    p += array.items[k].size;
+  }
+  return {buf, size};
+}
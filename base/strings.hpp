@@ -6,9 +6,9 @@ struct String8 {
   U64 size;
 };
 
-struct String8List {
-  String8 str;
-  String8List *next;
+// Contiguous slices, e.g. the pieces of a str8_split.
+struct String8Array {
+  String8 *items;
   U64 count;
 };
 
@@ -39,12 +39,35 @@ String8 str8_substr(String8 str, U64 start, U64 end);
 String8 str8_trim_whitespace(String8 s);
 
 // String Formatting & Copying
+String8 str8_copy(Arena *arena, String8 s ARENA_SITE_PARAM);
 String8 str8_cat(Arena *arena, String8 s1, String8 s2);
 
 // String matching
 bool str8_match(String8 s1, String8 s2);
 bool str8_match_insensitive(String8 s1, String8 s2);
 
-// String splitting & joining
-String8List str8_split(Arena *arena, String8 s, U8 sep);
-String8 str8_join(Arena *arena, String8List list, String8 sep);
+// String searching. Each returns the index of the first match, or s.size
+// when there is none. An empty needle matches at 0; an empty set never does.
+U64 str8_find_char(String8 s, U8 c);
+U64 str8_find(String8 s, String8 needle);
+U64 str8_find_any(String8 s, String8 set);
+
+// String hashing (fast, not cryptographic)
+U64 str8_hash(String8 s);
+
+// String splitting & joining. str8_split keeps empty pieces, so there is
+// always one more piece than separators and str8_join with the same
+// separator gives back the original text. The pieces point into `s`.
+String8Array str8_split(Arena *arena, String8 s, U8 sep);
+String8 str8_join(Arena *arena, String8Array array, String8 sep);
+
+// Byte-at-a-time versions of the vectorized functions above. They're what
+// those fall back to without SSE2, and what bench/strings.cpp checks and
+// times them against.
+String8 upper_from_str8_scalar(Arena *arena, String8 string);
+String8 lower_from_str8_scalar(Arena *arena, String8 string);
+String8 str8_trim_whitespace_scalar(String8 s);
+bool str8_match_insensitive_scalar(String8 s1, String8 s2);
+U64 str8_find_char_scalar(String8 s, U8 c);
+U64 str8_find_scalar(String8 s, String8 needle);
+U64 str8_find_any_scalar(String8 s, String8 set);
@@ -0,0 +1,136 @@
+#pragma once
+#include "arena.hpp"
+#include "intern.hpp"
+#include <cassert>
+#include <cstring>
+
+// Names in nested block scopes, keyed on interned atoms.
+//
+// Every atom has a head: its innermost visible binding, which links to the
+// binding it shadows. Atoms are dense, so the heads are a plain array
+// indexed by atom. Finding a name is one load, and nothing is ever hashed
+// or rehashed.
+//
+// A scope is a temp region on the table's own arena. Its bindings, and its
+// frame, are pushed inside that region. Closing the scope puts each name it
+// declared back to the binding it shadowed, which is a single store per
+// name, and then frees all of them with one temp_end. Nothing is deleted
+// one by one.
+//
+// Scopes keep a pointer to the table's arena, so the table must stay put
+// while any scope is open.
+
+template <typename V> struct Symbol {
+  Atom name;
+  U32 depth; // Of the scope it was declared in, 0 for the outermost
+  Symbol *shadowed;      // Same name, further out
+  Symbol *next_in_scope; // Declared before it in the same scope
+  V value;
+};
+
+template <typename V> struct SymbolScope {
+  ArenaTemp temp; // Where the scope starts, frame included
+  SymbolScope *parent;
+  Symbol<V> *last; // Newest declaration
+};
+
+template <typename V> struct SymbolTable {
+  Arena arena; // Scopes and their symbols
+  Arena heads_arena;
+  Symbol<V> **heads; // By atom, nullptr if nothing is bound
+  U64 head_count;
+  SymbolScope<V> *scope; // Innermost
+  U32 depth;             // Open scopes
+  U32 max_depth;
+};
+
+template <typename V>
+SymbolTable<V> symbol_table_alloc(U64 capacity, U64 atom_count = 0) {
+  SymbolTable<V> table = {};
+  table.arena = arena_alloc(capacity);
+  table.heads_arena = arena_alloc(capacity);
+  arena_profile_label(&table.arena, "symbols");
+  arena_profile_label(&table.heads_arena, "symbol heads");
+  table.head_count = atom_count > 64 ? atom_count : 64;
+  table.heads =
+      arena_push_array_zero<Symbol<V> *>(&table.heads_arena, table.head_count);
+  return table;
+}
+
+// Empties the table for reuse, keeping its memory and its heads' size. Any
+// scopes still open are dropped.
+template <typename V> void symbol_table_reset(SymbolTable<V> *table) {
+  arena_reset(&table->arena);
+  arena_reset(&table->heads_arena);
+  table->heads = arena_push_array_zero<Symbol<V> *>(&table->heads_arena,
+                                                     table->head_count);
+  table->scope = nullptr;
+  table->depth = 0;
+  table->max_depth = 0;
+}
+
+template <typename V> void symbol_table_release(SymbolTable<V> *table) {
+  arena_release(&table->arena);
+  arena_release(&table->heads_arena);
+  *table = {};
+}
+
+template <typename V> void symbol_scope_begin(SymbolTable<V> *table) {
+  ArenaTemp temp = temp_begin(&table->arena);
+  SymbolScope<V> *scope = arena_push<SymbolScope<V>>(&table->arena);
+  *scope = {.temp = temp, .parent = table->scope, .last = nullptr};
+  table->scope = scope;
+  table->depth++;
+  if (table->depth > table->max_depth)
+    table->max_depth = table->depth;
+}
+
+template <typename V> void symbol_scope_end(SymbolTable<V> *table) {
+  SymbolScope<V> *scope = table->scope;
+  assert(scope && "No scope to end");
+  for (Symbol<V> *s = scope->last; s; s = s->next_in_scope)
+    table->heads[s->name] = s->shadowed;
+  table->scope = scope->parent;
+  table->depth--;
+  temp_end(scope->temp);
+}
+
+// Binds `name` in the innermost scope, shadowing any outer binding. A name
+// declared twice in the same scope shadows itself; symbol_find_here tells
+// when that's about to happen. The symbol lives until its scope ends.
+template <typename V>
+Symbol<V> *symbol_declare(SymbolTable<V> *table, Atom name, V value) {
+  assert(table->scope && "Declaration outside any scope");
+  if (name >= table->head_count) {
+    U64 count = table->head_count * 2;
+    while (count <= name)
+      count *= 2;
+    Symbol<V> **heads =
+        arena_push_array_zero<Symbol<V> *>(&table->heads_arena, count);
+    memcpy(heads, table->heads, table->head_count * sizeof(*heads));
+    table->heads = heads;
+    table->head_count = count;
+  }
+  Symbol<V> *s = arena_push<Symbol<V>>(&table->arena);
+  *s = {.name = name,
+        .depth = table->depth - 1,
+        .shadowed = table->heads[name],
+        .next_in_scope = table->scope->last,
+        .value = value};
+  table->scope->last = s;
+  table->heads[name] = s;
+  return s;
+}
+
+// The innermost binding of `name`, or nullptr.
+template <typename V>
+Symbol<V> *symbol_find(const SymbolTable<V> *table, Atom name) {
+  return name < table->head_count ? table->heads[name] : nullptr;
+}
+
+// The binding of `name` in the innermost scope only, or nullptr.
+template <typename V>
+Symbol<V> *symbol_find_here(const SymbolTable<V> *table, Atom name) {
+  Symbol<V> *s = symbol_find(table, name);
+  return s && s->depth + 1 == table->depth ? s : nullptr;
+}
@@ -0,0 +1,191 @@
+#include "arena.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <cstring>
+
+// Synthetic C sources for lexer and parser benchmarks. Output is a stream of
+// small functions whose statements are picked according to the mix, using
+// only constructs the lexer and parser understand so error paths don't skew
+// the numbers. The same seed always gives the same file.
+
+enum GenMix {
+  GEN_MIXED,
+  GEN_IDENTIFIERS,
+  GEN_COMMENTS,
+  GEN_NUMBERS,
+  GEN_MIX_COUNT,
+};
+
+constexpr String8 gen_mix_to_str8(GenMix mix) {
+  switch (mix) {
+  case GEN_MIXED:
+    return str8_lit("mixed");
+  case GEN_IDENTIFIERS:
+    return str8_lit("identifiers");
+  case GEN_COMMENTS:
+    return str8_lit("comments");
+  case GEN_NUMBERS:
+    return str8_lit("numbers");
+  case GEN_MIX_COUNT:
+    break;
+  }
+  return str8_lit("unknown");
+}
+
+enum GenStatement {
+  GEN_STMT_CALL,    // Identifier heavy
+  GEN_STMT_COMMENT, // Line comments
+  GEN_STMT_NUMBERS, // Numeric literals
+  GEN_STMT_DECL,    // Keywords
+  GEN_STMT_COUNT,
+};
+
+// Relative statement weights per mix, in GenStatement order.
+static constexpr U32 gen_weights[GEN_MIX_COUNT][GEN_STMT_COUNT] = {
+    {40, 20, 20, 20}, // mixed
+    {80, 5, 5, 10},   // identifiers
+    {15, 70, 5, 10},  // comments
+    {10, 5, 75, 10},  // numbers
+};
+
+struct GenState {
+  U64 rng;
+  StringBuilder sb;
+};
+
+static U64 gen_next(GenState *g) {
+  g->rng ^= g->rng << 13;
+  g->rng ^= g->rng >> 7;
+  g->rng ^= g->rng << 17;
+  return g->rng;
+}
+
+static U64 gen_below(GenState *g, U64 n) { return gen_next(g) % n; }
+
+static void gen_pick(GenState *g, const char *const *words, U64 count) {
+  const char *w = words[gen_below(g, count)];
+  sb_append(&g->sb, str8((U8 *)w, strlen(w)));
+}
+
+static const char *const gen_stems[] = {
+    "node",  "count", "buffer", "table", "index", "length", "result",
+    "entry", "scope", "token",  "value", "parent", "cursor", "offset",
+    "ctx",   "it",    "i",      "n",     "tmp",    "out"};
+static const char *const gen_words[] = {
+    "the",    "lexer", "reads",  "each",  "token", "once",  "and",
+    "keeps",  "going", "until",  "end",   "of",    "input", "TODO:",
+    "handle", "this",  "case",   "later", "see",   "above", "note"};
+static const char *const gen_types[] = {"int",   "long",   "unsigned",
+                                        "short", "char",   "float",
+                                        "double", "_Bool"};
+static const char *const gen_qualifiers[] = {"static", "const", "volatile",
+                                             "register", "extern"};
+static const char *const gen_ops[] = {" + ", " - ", " * ", " / "};
+
+// Names like `node_count3` or `parent_token_offset`.
+static void gen_identifier(GenState *g) {
+  U64 parts = 1 + gen_below(g, 3);
+  for (U64 i = 0; i < parts; ++i) {
+    if (i)
+      sb_append_char(&g->sb, '_');
+    gen_pick(g, gen_stems, sizeof(gen_stems) / sizeof(gen_stems[0]));
+  }
+  if (gen_below(g, 3) == 0)
+    sb_append_signed(&g->sb, (S64)gen_below(g, 100));
+}
+
+// Decimal, no leading zero (that would make it octal).
+static void gen_number(GenState *g) {
+  U64 digits = 1 + gen_below(g, 9);
+  U64 n = gen_next(g);
+  sb_append_char(&g->sb, (U8)('1' + n % 9));
+  for (U64 i = 1; i < digits; ++i) {
+    n /= 10;
+    sb_append_char(&g->sb, (U8)('0' + n % 10));
+  }
+}
+
+static void gen_statement(GenState *g, GenStatement kind) {
+  sb_append(&g->sb, str8_lit("    "));
+  switch (kind) {
+  case GEN_STMT_CALL: {
+    gen_identifier(g);
+    sb_append_char(&g->sb, '(');
+    U64 args = gen_below(g, 4);
+    for (U64 i = 0; i < args; ++i) {
+      if (i)
+        sb_append(&g->sb, str8_lit(", "));
+      gen_identifier(g);
+      if (gen_below(g, 4) == 0) {
+        sb_append_char(&g->sb, '.');
+        gen_identifier(g);
+      }
+    }
+    sb_append(&g->sb, str8_lit(");\n"));
+  } break;
+  case GEN_STMT_COMMENT: {
+    sb_append(&g->sb, str8_lit("//"));
+    U64 words = 3 + gen_below(g, 12);
+    for (U64 i = 0; i < words; ++i) {
+      sb_append_char(&g->sb, ' ');
+      gen_pick(g, gen_words, sizeof(gen_words) / sizeof(gen_words[0]));
+    }
+    sb_append_char(&g->sb, '\n');
+  } break;
+  case GEN_STMT_NUMBERS: {
+    sb_append(&g->sb, str8_lit("sum("));
+    U64 terms = 2 + gen_below(g, 6);
+    for (U64 i = 0; i < terms; ++i) {
+      if (i)
+        gen_pick(g, gen_ops, sizeof(gen_ops) / sizeof(gen_ops[0]));
+      gen_number(g);
+    }
+    sb_append(&g->sb, str8_lit(");\n"));
+  } break;
+  case GEN_STMT_DECL: {
+    if (gen_below(g, 2) == 0) {
+      gen_pick(g, gen_qualifiers,
+               sizeof(gen_qualifiers) / sizeof(gen_qualifiers[0]));
+      sb_append_char(&g->sb, ' ');
+    }
+    gen_pick(g, gen_types, sizeof(gen_types) / sizeof(gen_types[0]));
+    sb_append_char(&g->sb, ' ');
+    gen_identifier(g);
+    sb_append(&g->sb, str8_lit(";\n"));
+  } break;
+  case GEN_STMT_COUNT:
+    break;
+  }
+}
+
+static GenStatement gen_pick_statement(GenState *g, GenMix mix) {
+  const U32 *weights = gen_weights[mix];
+  U32 total = 0;
+  for (U32 i = 0; i < GEN_STMT_COUNT; ++i)
+    total += weights[i];
+  U32 r = (U32)gen_below(g, total);
+  for (U32 i = 0; i < GEN_STMT_COUNT; ++i) {
+    if (r < weights[i])
+      return (GenStatement)i;
+    r -= weights[i];
+  }
+  return GEN_STMT_CALL;
+}
+
+// Returns at least `size` bytes of source, '\0' terminated like a mapped
+// SourceFile so it can be lexed directly.
+String8 gen_c_source(Arena *arena, GenMix mix, U64 size, U64 seed) {
+  // A function never adds more than a few KiB past the target.
+  GenState g = {.rng = seed | 1, .sb = sb_create(arena, size + KiB(16))};
+  for (U64 fn = 0; sb_size(&g.sb) < size; ++fn) {
+    sb_append(&g.sb, str8_lit("static int fn_"));
+    sb_append_signed(&g.sb, (S64)fn);
+    sb_append(&g.sb, str8_lit("(int a, long b) {\n"));
+    U64 statements = 4 + gen_below(&g, 16);
+    for (U64 i = 0; i < statements; ++i)
+      gen_statement(&g, gen_pick_statement(&g, mix));
+    sb_append(&g.sb, str8_lit("    return a + b;\n}\n\n"));
+  }
+  const char *text = sb_to_cstr(&g.sb);
+  return str8((U8 *)text, sb_size(&g.sb));
+}
@@ -0,0 +1,176 @@
+#include "arena.hpp"
+#include "strings.hpp"
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// Benchmark harness: times a callable until it has run for a minimum amount
+// of time and keeps the fastest batch, which is the figure least disturbed
+// by whatever else the machine is doing. Results are printed as they come
+// and written out as JSON at the end.
+
+struct BenchResult {
+  String8 group;
+  String8 name;
+  U64 ops;          // Total calls timed
+  F64 ns_per_op;    // Fastest batch
+  U64 bytes_per_op; // Input consumed per call, 0 if not meaningful
+  U64 items_per_op; // Tokens, pushes, lookups... per call
+  const char *item_unit;
+  // One benchmark-specific figure (e.g. bytes_per_node), see bench_annotate.
+  const char *metric;
+  F64 metric_value;
+};
+
+struct BenchSuite {
+  Arena *arena;
+  const char *filter; // Only run benchmarks whose "group/name" contains it
+  F64 min_seconds;    // Per benchmark
+  BenchResult *results;
+  U64 result_count;
+  U64 result_cap;
+  bool failed; // A self-check failed, the exit code reports it
+};
+
+// Keeps the compiler from dropping work whose result is otherwise unused.
+template <typename T> static inline void bench_keep(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static bool bench_selected(BenchSuite *suite, String8 group, String8 name) {
+  if (!suite->filter || !suite->filter[0])
+    return true;
+  char full[512];
+  snprintf(full, sizeof(full), "%.*s/%.*s", (int)group.size, group.str,
+           (int)name.size, name.str);
+  return strstr(full, suite->filter) != nullptr;
+}
+
+static void bench_check(BenchSuite *suite, bool ok, const char *what) {
+  if (ok)
+    return;
+  fprintf(stderr, "bench: self-check failed: %s\n", what);
+  suite->failed = true;
+}
+
+static void bench_record(BenchSuite *suite, const BenchResult &result) {
+  if (suite->result_count == suite->result_cap) {
+    U64 cap = suite->result_cap ? suite->result_cap * 2 : 64;
+    BenchResult *grown = arena_push_array<BenchResult>(suite->arena, cap);
+    if (suite->result_count)
+      memcpy(grown, suite->results, suite->result_count * sizeof(BenchResult));
+    suite->results = grown;
+    suite->result_cap = cap;
+  }
+  suite->results[suite->result_count++] = result;
+
+  F64 secs = result.ns_per_op / 1e9;
+  fprintf(stderr, "%-12.*s %-40.*s %12.1f ns/op", (int)result.group.size,
+          result.group.str, (int)result.name.size, result.name.str,
+          result.ns_per_op);
+  if (result.bytes_per_op)
+    fprintf(stderr, " %9.1f MB/s", (F64)result.bytes_per_op / secs / 1e6);
+  if (result.items_per_op)
+    fprintf(stderr, " %9.2f M%s/s", (F64)result.items_per_op / secs / 1e6,
+            result.item_unit);
+  fprintf(stderr, "\n");
+}
+
+// Runs `fn` in batches that double until one takes a twentieth of the time
+// budget, then keeps timing batches of that size until the budget is spent.
+// Returns false if the filter skipped it.
+template <typename F>
+static bool bench_run(BenchSuite *suite, String8 group, String8 name,
+                      U64 bytes_per_op, U64 items_per_op,
+                      const char *item_unit, F &&fn) {
+  if (!bench_selected(suite, group, name))
+    return false;
+
+  using Clock = std::chrono::steady_clock;
+  F64 batch_target = suite->min_seconds / 20;
+  U64 batch = 1;
+  F64 best = 0;
+  U64 ops = 0;
+  F64 spent = 0;
+  while (spent < suite->min_seconds) {
+    auto start = Clock::now();
+    for (U64 i = 0; i < batch; ++i)
+      fn();
+    F64 secs = std::chrono::duration<F64>(Clock::now() - start).count();
+
+    spent += secs;
+    ops += batch;
+    F64 per_op = secs / (F64)batch;
+    if (best == 0 || per_op < best)
+      best = per_op;
+    if (secs < batch_target)
+      batch *= 2;
+  }
+
+  bench_record(suite, {.group = group,
+                       .name = str8_copy(suite->arena, name),
+                       .ops = ops,
+                       .ns_per_op = best * 1e9,
+                       .bytes_per_op = bytes_per_op,
+                       .items_per_op = items_per_op,
+                       .item_unit = item_unit});
+  return true;
+}
+
+// Attaches a figure to the benchmark that just ran.
+static void bench_annotate(BenchSuite *suite, const char *metric, F64 value) {
+  assert(suite->result_count && "Nothing to annotate");
+  BenchResult *r = &suite->results[suite->result_count - 1];
+  r->metric = metric;
+  r->metric_value = value;
+  fprintf(stderr, "%-12s %-40s %12.1f %s\n", "", "", value, metric);
+}
+
+// ---- JSON ----
+
+static void bench_json_string(FILE *out, String8 s) {
+  fputc('"', out);
+  for (U64 i = 0; i < s.size; ++i) {
+    U8 c = s.str[i];
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+// One object per benchmark. Rates are derived from ns_per_op and included so
+// consumers don't have to know which fields apply.
+static void bench_write_json(BenchSuite *suite, FILE *out,
+                             String8 scanner_name) {
+  fprintf(out, "{\n  \"version\": 1,\n  \"scanner\": ");
+  bench_json_string(out, scanner_name);
+  fprintf(out, ",\n  \"min_seconds\": %g,\n  \"results\": [",
+          suite->min_seconds);
+  for (U64 i = 0; i < suite->result_count; ++i) {
+    const BenchResult &r = suite->results[i];
+    F64 secs = r.ns_per_op / 1e9;
+    fprintf(out, "%s\n    {\"group\": ", i ? "," : "");
+    bench_json_string(out, r.group);
+    fprintf(out, ", \"name\": ");
+    bench_json_string(out, r.name);
+    fprintf(out, ", \"ops\": %lu, \"ns_per_op\": %.3f", r.ops, r.ns_per_op);
+    if (r.bytes_per_op)
+      fprintf(out, ", \"bytes_per_op\": %lu, \"mb_per_s\": %.3f",
+              r.bytes_per_op, (F64)r.bytes_per_op / secs / 1e6);
+    if (r.items_per_op)
+      fprintf(out,
+              ", \"items_per_op\": %lu, \"items_per_s\": %.1f, \"unit\": "
+              "\"%s\"",
+              r.items_per_op, (F64)r.items_per_op / secs, r.item_unit);
+    if (r.metric)
+      fprintf(out, ", \"%s\": %.3f", r.metric, r.metric_value);
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  ],\n  \"failed\": %s\n}\n",
+          suite->failed ? "true" : "false");
+}
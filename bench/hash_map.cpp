@@ -0,0 +1,227 @@
+#include "arena.hpp"
+#include "hash_map.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <string_view>
+#include <unordered_map>
+
+// HashMap against std::unordered_map, with integer keys and with
+// identifier-like String8 keys: building a map from scratch, and lookups
+// that hit and that miss. Before timing, it's run side by side with
+// std::unordered_map through random inserts, lookups and removes.
+
+static constexpr U64 BENCH_MAP_KEYS = 1 << 16;
+
+static U64 map_rng = 0x9E3779B97F4A7C15ull;
+static U64 map_rng_next() {
+  map_rng ^= map_rng << 13;
+  map_rng ^= map_rng >> 7;
+  map_rng ^= map_rng << 17;
+  return map_rng;
+}
+
+// Keys come from a small range so inserts, hits and removes all happen
+// often, and the map both grows and fills up with deleted slots.
+static bool hash_map_agrees(Arena *arena) {
+  ArenaTemp temp = temp_begin(arena);
+  HashMap<U32, U64> map = hash_map_create<U32, U64>(arena);
+  std::unordered_map<U32, U64> reference;
+  bool ok = true;
+  for (U64 op = 0; op < 1 << 20 && ok; ++op) {
+    U32 key = (U32)(map_rng_next() % (op < 1 << 19 ? 4096 : 64));
+    switch (map_rng_next() % 4) {
+    case 0: {
+      bool inserted;
+      U64 *value = hash_map_upsert(&map, key, &inserted);
+      ok &= inserted == !reference.count(key);
+      *value += op;
+      reference[key] += op;
+      break;
+    }
+    case 1: {
+      U64 *value = hash_map_find(&map, key);
+      auto it = reference.find(key);
+      ok &= it == reference.end() ? !value : value && *value == it->second;
+      break;
+    }
+    default:
+      ok &= hash_map_remove(&map, key) == (reference.erase(key) == 1);
+      break;
+    }
+    ok &= map.count == reference.size();
+  }
+
+  U64 seen = 0;
+  hash_map_for_each(&map, [&](U32 key, U64 value) {
+    auto it = reference.find(key);
+    ok &= it != reference.end() && it->second == value;
+    seen++;
+  });
+  ok &= seen == reference.size();
+
+  hash_map_clear(&map);
+  ok &= map.count == 0 && !hash_map_find(&map, (U32)0);
+  temp_end(temp);
+  return ok;
+}
+
+static void bench_hash_map(BenchSuite *suite) {
+  Arena arena = arena_alloc(GiB(1));
+  String8 group = str8_lit("hash_map");
+
+  bench_check(suite, hash_map_agrees(&arena),
+              "HashMap disagrees with std::unordered_map");
+
+  // Distinct keys, and as many keys that aren't in the maps.
+  U64 *ints = arena_push_array<U64>(&arena, BENCH_MAP_KEYS * 2);
+  for (U64 i = 0; i < BENCH_MAP_KEYS * 2; ++i)
+    ints[i] = map_rng_next();
+  U64 *missing = ints + BENCH_MAP_KEYS;
+
+  static const char *stems[] = {"i",     "len",   "node", "count",
+                                "table", "entry", "ptr",  "parent_token"};
+  String8 *names = arena_push_array<String8>(&arena, BENCH_MAP_KEYS * 2);
+  for (U64 i = 0; i < BENCH_MAP_KEYS * 2; ++i) {
+    StringBuilder sb = sb_create(&arena, 32);
+    sb_format(&sb, "{}_{}", stems[i % 8], i);
+    names[i] = sb_to_str8(&sb);
+  }
+  String8 *missing_names = names + BENCH_MAP_KEYS;
+
+  // Lookups go in a shuffled order, not the order keys were inserted in,
+  // which std::unordered_map's nodes are laid out in.
+  U64 *order = arena_push_array<U64>(&arena, BENCH_MAP_KEYS);
+  for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+    order[i] = i;
+  for (U64 i = BENCH_MAP_KEYS - 1; i > 0; --i)
+    std::swap(order[i], order[map_rng_next() % (i + 1)]);
+  U64 *lookup_ints = arena_push_array<U64>(&arena, BENCH_MAP_KEYS);
+  String8 *lookup_names = arena_push_array<String8>(&arena, BENCH_MAP_KEYS);
+  for (U64 i = 0; i < BENCH_MAP_KEYS; ++i) {
+    lookup_ints[i] = ints[order[i]];
+    lookup_names[i] = names[order[i]];
+  }
+
+  bool same = true;
+  auto check = [&](bool ok) { same &= ok; };
+
+  // ---- Integer keys ----
+  bench_run(suite, group, str8_lit("std/insert/u64"), 0, BENCH_MAP_KEYS,
+            "key", [&] {
+              std::unordered_map<U64, U64> map;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                map[ints[i]] = i;
+              bench_keep(map.size());
+            });
+  bench_run(suite, group, str8_lit("insert/u64"), 0, BENCH_MAP_KEYS, "key",
+            [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              HashMap<U64, U64> map = hash_map_create<U64, U64>(&arena);
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                hash_map_put(&map, ints[i], i);
+              bench_keep(map.count);
+              temp_end(temp);
+            });
+
+  std::unordered_map<U64, U64> std_ints;
+  HashMap<U64, U64> ints_map = hash_map_create<U64, U64>(&arena);
+  for (U64 i = 0; i < BENCH_MAP_KEYS; ++i) {
+    std_ints[ints[i]] = i;
+    hash_map_put(&ints_map, ints[i], i);
+  }
+  bench_run(suite, group, str8_lit("std/find-hit/u64"), 0, BENCH_MAP_KEYS,
+            "key", [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                sum += std_ints.find(lookup_ints[i])->second;
+              bench_keep(sum);
+            });
+  bench_run(suite, group, str8_lit("find-hit/u64"), 0, BENCH_MAP_KEYS, "key",
+            [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                sum += *hash_map_find(&ints_map, lookup_ints[i]);
+              bench_keep(sum);
+            });
+  bench_run(suite, group, str8_lit("std/find-miss/u64"), 0, BENCH_MAP_KEYS,
+            "key", [&] {
+              U64 hits = 0;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                hits += std_ints.count(missing[i]);
+              bench_keep(hits);
+            });
+  bench_run(suite, group, str8_lit("find-miss/u64"), 0, BENCH_MAP_KEYS,
+            "key", [&] {
+              U64 hits = 0;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                hits += hash_map_find(&ints_map, missing[i]) != nullptr;
+              bench_keep(hits);
+            });
+  for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+    check(*hash_map_find(&ints_map, ints[i]) == i &&
+          !hash_map_find(&ints_map, missing[i]));
+
+  // ---- String keys ----
+  bench_run(suite, group, str8_lit("std/insert/str"), 0, BENCH_MAP_KEYS,
+            "key", [&] {
+              std::unordered_map<std::string_view, U64> map;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                map[{(const char *)names[i].str, names[i].size}] = i;
+              bench_keep(map.size());
+            });
+  bench_run(suite, group, str8_lit("insert/str"), 0, BENCH_MAP_KEYS, "key",
+            [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              HashMap<String8, U64> map =
+                  hash_map_create<String8, U64>(&arena);
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                hash_map_put(&map, names[i], i);
+              bench_keep(map.count);
+              temp_end(temp);
+            });
+
+  std::unordered_map<std::string_view, U64> std_names;
+  HashMap<String8, U64> names_map = hash_map_create<String8, U64>(&arena);
+  for (U64 i = 0; i < BENCH_MAP_KEYS; ++i) {
+    std_names[{(const char *)names[i].str, names[i].size}] = i;
+    hash_map_put(&names_map, names[i], i);
+  }
+  bench_run(suite, group, str8_lit("std/find-hit/str"), 0, BENCH_MAP_KEYS,
+            "key", [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                sum += std_names
+                           .find({(const char *)lookup_names[i].str,
+                                  lookup_names[i].size})
+                           ->second;
+              bench_keep(sum);
+            });
+  bench_run(suite, group, str8_lit("find-hit/str"), 0, BENCH_MAP_KEYS, "key",
+            [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                sum += *hash_map_find(&names_map, lookup_names[i]);
+              bench_keep(sum);
+            });
+  bench_run(suite, group, str8_lit("std/find-miss/str"), 0, BENCH_MAP_KEYS,
+            "key", [&] {
+              U64 hits = 0;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                hits += std_names.count({(const char *)missing_names[i].str,
+                                         missing_names[i].size});
+              bench_keep(hits);
+            });
+  bench_run(suite, group, str8_lit("find-miss/str"), 0, BENCH_MAP_KEYS,
+            "key", [&] {
+              U64 hits = 0;
+              for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+                hits += hash_map_find(&names_map, missing_names[i]) != nullptr;
+              bench_keep(hits);
+            });
+  for (U64 i = 0; i < BENCH_MAP_KEYS; ++i)
+    check(*hash_map_find(&names_map, names[i]) == i &&
+          !hash_map_find(&names_map, missing_names[i]));
+  bench_check(suite, same, "HashMap lost a key while benchmarking");
+
+  arena_release(&arena);
+}
@@ -0,0 +1,78 @@
+#include "arena.hpp"
+#include "strings.hpp"
+#include <cstring>
+
+// Keyword classification: perfect hash vs. the linear str8_match scan it
+// replaced, over identifier-heavy input.
+
+static TokenKind identifier_type_linear(String8 text) {
+  for (const auto &kw : keywords) {
+    if (str8_match(text, str8((U8 *)kw.str, kw.size)))
+      return kw.value;
+  }
+  return TK_IDENTIFIER;
+}
+
+static U64 rng_state = 0x2545F4914F6CDD1Dull;
+static U64 rng_next() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// Roughly what generated C looks like: a third keywords, the rest a mix of
+// short locals and longer names, some of which share a keyword's prefix.
+static String8 make_word(Arena *arena) {
+  static const char *stems[] = {"i",    "x",      "len",     "buf",
+                                "node", "count",  "inta",    "returned",
+                                "dox",  "table_", "struct_", "ptr"};
+  constexpr U64 stem_count = sizeof(stems) / sizeof(stems[0]);
+  constexpr U64 kw_count = sizeof(keywords) / sizeof(keywords[0]);
+
+  if (rng_next() % 3 == 0) {
+    const auto &kw = keywords[rng_next() % kw_count];
+    return str8_copy(arena, str8((U8 *)kw.str, kw.size));
+  }
+
+  const char *stem = stems[rng_next() % stem_count];
+  U8 buf[32];
+  U64 n = strlen(stem);
+  memcpy(buf, stem, n);
+  U64 suffix = rng_next() % 4;
+  for (U64 i = 0; i < suffix; ++i)
+    buf[n++] = (U8)('0' + rng_next() % 10);
+  return str8_copy(arena, str8(buf, n));
+}
+
+static void bench_keywords(BenchSuite *suite) {
+  Arena arena = arena_alloc(MiB(256));
+
+  constexpr U64 word_count = 1 << 16;
+  String8 *words = arena_push_array<String8>(&arena, word_count);
+  for (U64 i = 0; i < word_count; ++i)
+    words[i] = make_word(&arena);
+
+  bool agree = true;
+  for (U64 i = 0; i < word_count; ++i)
+    agree &= identifier_type(words[i]) == identifier_type_linear(words[i]);
+  bench_check(suite, agree, "perfect hash and linear scan disagree");
+
+  String8 group = str8_lit("keywords");
+  bench_run(suite, group, str8_lit("linear_scan"), 0, word_count, "lookup",
+            [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < word_count; ++i)
+                sum += (U64)identifier_type_linear(words[i]);
+              bench_keep(sum);
+            });
+  bench_run(suite, group, str8_lit("perfect_hash"), 0, word_count, "lookup",
+            [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < word_count; ++i)
+                sum += (U64)identifier_type(words[i]);
+              bench_keep(sum);
+            });
+
+  arena_release(&arena);
+}
@@ -0,0 +1,190 @@
+#include "arena.hpp"
+#include "intern.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+
+// Lexer throughput over one input: the whole stream via perform_lex and the
+// pull interface via lexer_next. Every call starts from an empty arena and
+// interner, as compile_file does for each file. Then the line tables that
+// diagnostics use: building one per file, and mapping every token to its
+// line:column through it. Before timing, perform_lex_parallel is checked
+// against perform_lex on each input.
+
+struct LexWorkload {
+  String8 name;
+  String8 *files; // Each '\0' terminated
+  U64 file_count;
+  U64 bytes;
+};
+
+// Every newline scanner the CPU supports has to find the same line starts as
+// the scalar one, including over unaligned starts and short tails.
+static bool line_index_scanners_agree(Arena *arena, String8 file) {
+  for (U64 skip = 0; skip < 4 && skip < file.size; ++skip) {
+    const U8 *p = file.str + skip;
+    U64 size = file.size - skip;
+    U32 *want = arena_push_array<U32>(arena, size);
+    U64 count = (U64)(scan_newline_ends_scalar(p, size, want) - want);
+    for (ScanKind k : {SCAN_SSE42, SCAN_AVX2}) {
+      if (!scan_supported(k))
+        continue;
+      Scanner s = scanner_for(k);
+      U32 *got = arena_push_array<U32>(arena, size);
+      if (s.newline_count(p, size) != count ||
+          (U64)(s.newline_ends(p, size, got) - got) != count ||
+          memcmp(got, want, count * sizeof(U32)) != 0)
+        return false;
+    }
+  }
+  return true;
+}
+
+static void bench_line_index(BenchSuite *suite, Arena *arena,
+                             Interner *interner, const LexWorkload &w,
+                             U64 tokens) {
+  bool same = true;
+  for (U64 f = 0; f < w.file_count && same; ++f) {
+    same = line_index_scanners_agree(arena, w.files[f]);
+    arena_reset(arena);
+  }
+  bench_check(suite, same, "newline scanners disagree with the scalar one");
+
+  U64 lines = 0;
+  LexResult *lexed = arena_push_array<LexResult>(arena, w.file_count);
+  for (U64 f = 0; f < w.file_count; ++f) {
+    lexed[f] = perform_lex(arena, interner, w.files[f]);
+    lines += line_index_build(arena, w.files[f]).count;
+  }
+
+  bench_run(suite, str8_lit("lex"),
+            str8_cat(suite->arena, str8_lit("line_index_build/"), w.name),
+            w.bytes, lines, "line", [&] {
+              ArenaTemp temp = temp_begin(arena);
+              for (U64 f = 0; f < w.file_count; ++f)
+                bench_keep(line_index_build(arena, w.files[f]).count);
+              temp_end(temp);
+            });
+
+  LineIndex *index = arena_push_array<LineIndex>(arena, w.file_count);
+  for (U64 f = 0; f < w.file_count; ++f)
+    index[f] = line_index_build(arena, w.files[f]);
+  bench_run(suite, str8_lit("lex"),
+            str8_cat(suite->arena, str8_lit("line_index_lookup/"), w.name),
+            w.bytes, tokens, "tok", [&] {
+              U64 sum = 0;
+              for (U64 f = 0; f < w.file_count; ++f) {
+                for (U32 t = 0; t < lexed[f].token_count; ++t)
+                  sum += line_index_lookup(&index[f], lexed[f].offsets[t])
+                             .column;
+              }
+              bench_keep(sum);
+            });
+
+  arena_reset(arena);
+  interner_reset(interner);
+}
+
+// perform_lex_parallel has to produce perform_lex's stream, atoms included,
+// both split the way the driver splits and in small unaligned chunks that
+// make stitching resynchronize.
+static bool lex_parallel_agrees(Arena *arena, String8 input) {
+  static const ParallelLexOptions options[] = {
+      {.jobs = 4,
+       .min_chunk_size = MiB(1),
+       .max_chunks = 16,
+       .split_at_newlines = true},
+      {.jobs = 4, .min_chunk_size = 61, .max_chunks = 64},
+  };
+  bool same = true;
+  for (const ParallelLexOptions &opts : options) {
+    ArenaTemp temp = temp_begin(arena);
+    Interner serial_atoms = interner_alloc(GiB(1));
+    Interner parallel_atoms = interner_alloc(GiB(1));
+    LexResult serial = perform_lex(arena, &serial_atoms, input);
+    LexResult parallel =
+        perform_lex_parallel(arena, &parallel_atoms, input, opts);
+    same &= lex_first_mismatch(&serial, &parallel) < 0;
+    interner_release(&parallel_atoms);
+    interner_release(&serial_atoms);
+    temp_end(temp);
+  }
+  return same;
+}
+
+// One line of distinct identifiers, as short as they can be: the most
+// atoms per byte a chunk's interner can be handed, and no newline to split
+// at.
+static String8 lex_distinct_identifiers(Arena *arena, U64 count) {
+  static const char first[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+  static const char rest[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+  StringBuilder sb = sb_create(arena, count * 6);
+  for (U64 i = 0; i < count; ++i) {
+    U64 n = i;
+    sb_append_char(&sb, (U8)first[n % (sizeof(first) - 1)]);
+    for (n /= sizeof(first) - 1; n; n /= sizeof(rest) - 1)
+      sb_append_char(&sb, (U8)rest[n % (sizeof(rest) - 1)]);
+    sb_append_char(&sb, ' ');
+  }
+  return str8((U8 *)sb_to_cstr(&sb), sb_size(&sb));
+}
+
+static void bench_lex_parallel(BenchSuite *suite) {
+  Arena arena = arena_alloc(GiB(4));
+  String8 input = lex_distinct_identifiers(&arena, 1200000);
+  bench_check(suite, lex_parallel_agrees(&arena, input),
+              "parallel lexer differs on distinct identifiers");
+  arena_release(&arena);
+}
+
+static void bench_lex_workload(BenchSuite *suite, const LexWorkload &w) {
+  Arena arena = arena_alloc(GiB(4));
+  Interner interner = interner_alloc(GiB(1));
+
+  bool same = true;
+  for (U64 f = 0; f < w.file_count; ++f)
+    same &= lex_parallel_agrees(&arena, w.files[f]);
+  bench_check(suite, same, "parallel lexer differs from perform_lex");
+
+  // Token count for the rates, and a check that both interfaces agree.
+  U64 tokens = 0;
+  for (U64 f = 0; f < w.file_count; ++f) {
+    tokens += perform_lex(&arena, &interner, w.files[f]).token_count;
+    arena_reset(&arena);
+    interner_reset(&interner);
+  }
+
+  bench_run(suite, str8_lit("lex"),
+            str8_cat(suite->arena, str8_lit("perform_lex/"), w.name),
+            w.bytes, tokens, "tok", [&] {
+              for (U64 f = 0; f < w.file_count; ++f) {
+                LexResult result = perform_lex(&arena, &interner, w.files[f]);
+                bench_keep(result.token_count);
+                arena_reset(&arena);
+                interner_reset(&interner);
+              }
+            });
+
+  U64 pulled = 0;
+  bench_run(suite, str8_lit("lex"),
+            str8_cat(suite->arena, str8_lit("next_token/"), w.name), w.bytes,
+            tokens, "tok", [&] {
+              pulled = 0;
+              for (U64 f = 0; f < w.file_count; ++f) {
+                Lexer lexer = lexer_begin(&interner, w.files[f]);
+                while (lexer_next(lexer).token.kind != TK_EOF)
+                  ++pulled;
+                ++pulled;
+                arena_reset(&arena);
+                interner_reset(&interner);
+              }
+            });
+  bench_check(suite, pulled == 0 || pulled == tokens,
+              "next_token and perform_lex disagree on the token count");
+
+  bench_line_index(suite, &arena, &interner, w, tokens);
+
+  interner_release(&interner);
+  arena_release(&arena);
+}
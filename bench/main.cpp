@@ -0,0 +1,202 @@
+#include "arena.hpp"
+#include "file.hpp"
+#include "intern.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "../src/lex.cpp"
+#include "../src/lex_parallel.cpp"
+#include "../src/lex_incremental.cpp"
+#include "../src/token_cache.cpp"
+#include "../src/parse.cpp"
+#include "../src/preprocess.cpp"
+
+#include "harness.cpp"
+
+#include "gen.cpp"
+#include "hash_map.cpp"
+#include "keywords.cpp"
+#include "lexer.cpp"
+#include "memory.cpp"
+#include "numbers.cpp"
+#include "parser.cpp"
+#include "preprocess.cpp"
+#include "relex.cpp"
+#include "strings.cpp"
+#include "symbols.cpp"
+#include "token_cache.cpp"
+
+// Benchmark driver. Human readable lines go to stderr as benchmarks finish,
+// the JSON report to stdout (or --json FILE) at the end.
+//
+//   bench [--filter S] [--json FILE] [--min-time SECS] [--size BYTES]
+//         [--seed N] [--corpus DIR]... [--gen MIX]
+//
+// --gen writes one synthetic source of the given mix to stdout and exits,
+// which is handy for feeding main_exec. Sizes take K/M/G suffixes.
+
+#ifndef BENCH_SOURCE_DIR
+#define BENCH_SOURCE_DIR "."
+#endif
+
+static U64 parse_size(const std::string &arg) {
+  char *end = nullptr;
+  U64 n = strtoull(arg.c_str(), &end, 10);
+  switch (*end) {
+  case 'K':
+  case 'k':
+    return KiB(n);
+  case 'M':
+  case 'm':
+    return MiB(n);
+  case 'G':
+  case 'g':
+    return GiB(n);
+  default:
+    return n;
+  }
+}
+
+static bool parse_mix(const std::string &arg, GenMix *mix) {
+  for (U32 m = 0; m < GEN_MIX_COUNT; ++m) {
+    String8 name = gen_mix_to_str8((GenMix)m);
+    if (str8_match(str8((U8 *)arg.data(), arg.size()), name)) {
+      *mix = (GenMix)m;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Every .c file under `dir`, mapped. Missing directories (e.g. the testcases
+// submodule not being checked out) give an empty workload.
+static LexWorkload load_corpus(Arena *arena, const std::string &dir) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> paths;
+  std::error_code ec;
+  for (auto it = fs::recursive_directory_iterator(dir, ec);
+       !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (it->is_regular_file() && it->path().extension() == ".c")
+      paths.push_back(it->path().string());
+  }
+  std::sort(paths.begin(), paths.end());
+
+  String8 name = str8_copy(
+      arena, str8((U8 *)fs::path(dir).filename().c_str(),
+                  strlen(fs::path(dir).filename().c_str())));
+  LexWorkload w = {.name = str8_cat(arena, str8_lit("corpus-"), name),
+                   .files = arena_push_array<String8>(arena, paths.size())};
+  for (const std::string &path : paths) {
+    FileMap map = file_map_readonly(path.c_str());
+    if (!map.data.str)
+      continue;
+    // Kept mapped for the life of the process.
+    w.files[w.file_count++] = map.data;
+    w.bytes += map.data.size;
+  }
+  return w;
+}
+
+auto main(int argc, char *argv[]) -> int {
+  Arena arena = arena_alloc(GiB(4));
+
+  BenchSuite suite = {.arena = &arena, .filter = nullptr, .min_seconds = 0.5};
+  const char *json_path = nullptr;
+  U64 size = MiB(8);
+  U64 seed = 0x9E3779B97F4A7C15ull;
+  std::vector<std::string> corpora;
+  bool gen_only = false;
+  GenMix gen_mix = GEN_MIXED;
+
+  std::vector<std::string> args(argv + 1, argv + argc);
+  for (Size i = 0; i < args.size(); ++i) {
+    const std::string &arg = args[i];
+    bool has_value = i + 1 < args.size();
+    if (arg == "--filter" && has_value) {
+      suite.filter = args[++i].c_str();
+    } else if (arg == "--json" && has_value) {
+      json_path = args[++i].c_str();
+    } else if (arg == "--min-time" && has_value) {
+      suite.min_seconds = strtod(args[++i].c_str(), nullptr);
+    } else if (arg == "--size" && has_value) {
+      size = parse_size(args[++i]);
+    } else if (arg == "--seed" && has_value) {
+      seed = strtoull(args[++i].c_str(), nullptr, 0);
+    } else if (arg == "--corpus" && has_value) {
+      corpora.push_back(args[++i]);
+    } else if (arg == "--gen" && has_value &&
+               parse_mix(args[i + 1], &gen_mix)) {
+      gen_only = true;
+      ++i;
+    } else {
+      fprintf(stderr, "bench: unknown argument '%s'\n", arg.c_str());
+      return 1;
+    }
+  }
+
+  if (gen_only) {
+    String8 source = gen_c_source(&arena, gen_mix, size, seed);
+    fwrite(source.str, 1, source.size, stdout);
+    return 0;
+  }
+
+  if (corpora.empty()) {
+    corpora.push_back(BENCH_SOURCE_DIR "/c-sources");
+    corpora.push_back(BENCH_SOURCE_DIR "/testcases");
+  }
+
+  // ---- Lexer, parser and preprocessor ----
+  for (U32 m = 0; m < GEN_MIX_COUNT; ++m) {
+    String8 source = gen_c_source(&arena, (GenMix)m, size, seed);
+    LexWorkload w = {
+        .name = str8_cat(&arena, str8_lit("synthetic-"),
+                         gen_mix_to_str8((GenMix)m)),
+        .files = &source,
+        .file_count = 1,
+        .bytes = source.size,
+    };
+    bench_lex_workload(&suite, w);
+    bench_token_cache_workload(&suite, w);
+    bench_relex_workload(&suite, w);
+    bench_parse_workload(&suite, w);
+    bench_preprocess_workload(&suite, w);
+  }
+  for (const std::string &dir : corpora) {
+    LexWorkload w = load_corpus(&arena, dir);
+    if (!w.file_count)
+      continue;
+    bench_lex_workload(&suite, w);
+    bench_token_cache_workload(&suite, w);
+    bench_relex_workload(&suite, w);
+    bench_parse_workload(&suite, w);
+    bench_preprocess_workload(&suite, w);
+  }
+  bench_lex_parallel(&suite);
+  bench_preprocess_includes(&suite);
+
+  // ---- Primitives ----
+  bench_keywords(&suite);
+  bench_hash_map(&suite);
+  bench_memory(&suite);
+  bench_numbers(&suite);
+  bench_strings(&suite);
+  bench_symbols(&suite);
+
+  FILE *out = json_path ? fopen(json_path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "bench: couldn't open '%s'\n", json_path);
+    return 1;
+  }
+  bench_write_json(&suite, out, scan_kind_to_str8(scanner.kind));
+  if (out != stdout)
+    fclose(out);
+
+  arena_release(&arena);
+  return suite.failed ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+#include "arena.hpp"
+#include <thread>
+
+// Allocator costs. Pushes are timed in runs of BENCH_PUSHES and popped after
+// each run, so the arena stays warm and committed.
+
+static constexpr U64 BENCH_PUSHES = 1024;
+
+// On a thread of its own, so the pool starts out empty with the count
+// configured here: nested scopes that each conflict with the ones around
+// them get distinct arenas, a later scope reuses the first, and the high
+// water of each arena is what was pushed on it.
+static bool scratch_pool_works() {
+  bool ok = true;
+  scratch_configure({.count = 3, .capacity = MiB(64)});
+  std::thread([&] {
+    ScratchScope a;
+    arena_push_array<U8>(a.arena, KiB(3));
+    {
+      ScratchScope b(&a.arena, 1);
+      arena_push_array<U8>(b.arena, KiB(2));
+      Arena *outer[] = {a.arena, b.arena};
+      {
+        ScratchScope c(outer, 2);
+        arena_push_array<U8>(c.arena, KiB(1));
+        ok &= c.arena != a.arena && c.arena != b.arena;
+      }
+      ok &= b.arena != a.arena;
+    }
+    ScratchScope d;
+    ok &= d.arena == a.arena;
+    ScratchStats stats = scratch_stats();
+    ok &= stats.count == 3 && stats.high_water[1] == KiB(2) &&
+          stats.high_water[2] == KiB(1) && stats.high_water[0] == 0;
+  }).join();
+  scratch_configure({.count = 2, .capacity = MiB(64)});
+  return ok;
+}
+
+static void bench_memory(BenchSuite *suite) {
+  Arena arena = arena_alloc(GiB(1));
+  String8 group = str8_lit("arena");
+
+  bench_run(suite, group, str8_lit("push_size/16"), 0, BENCH_PUSHES, "push",
+            [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              for (U64 i = 0; i < BENCH_PUSHES; ++i)
+                bench_keep(arena_push_size(&arena, 16, 8));
+              temp_end(temp);
+            });
+
+  bench_run(suite, group, str8_lit("push_size/13-unaligned"), 0, BENCH_PUSHES,
+            "push", [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              for (U64 i = 0; i < BENCH_PUSHES; ++i)
+                bench_keep(arena_push_size(&arena, 13, 16));
+              temp_end(temp);
+            });
+
+  bench_run(suite, group, str8_lit("push_array/4KiB"), 0, BENCH_PUSHES,
+            "push", [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              for (U64 i = 0; i < BENCH_PUSHES; ++i)
+                bench_keep(arena_push_array<U8>(&arena, KiB(4)));
+              temp_end(temp);
+            });
+
+  bench_run(suite, group, str8_lit("temp_begin+end"), 0, 1, "pair", [&] {
+    ArenaTemp temp = temp_begin(&arena);
+    bench_keep(temp.pos);
+    temp_end(temp);
+  });
+
+  bench_check(suite, scratch_pool_works(),
+              "Scratch scopes got a conflicting arena");
+
+  bench_run(suite, group, str8_lit("scratch_begin+end"), 0, 1, "pair", [&] {
+    ArenaTemp temp = scratch_begin(nullptr, 0);
+    bench_keep(temp.pos);
+    scratch_end(temp);
+  });
+
+  // Conflicting with the first scratch arena, as a callee handed a scratch
+  // arena by its caller would.
+  ArenaTemp first = scratch_begin(nullptr, 0);
+  Arena *conflict = first.arena;
+  scratch_end(first);
+  bench_run(suite, group, str8_lit("scratch_begin+end/conflict"), 0, 1,
+            "pair", [&] {
+              ArenaTemp temp = scratch_begin(&conflict, 1);
+              bench_keep(temp.pos);
+              scratch_end(temp);
+            });
+
+  bench_run(suite, group, str8_lit("ScratchScope"), 0, 1, "scope", [&] {
+    ScratchScope scratch;
+    bench_keep(scratch.temp.pos);
+  });
+
+  arena_release(&arena);
+}
@@ -0,0 +1,224 @@
+#include "arena.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Numeric literal parsing: number_parse against strtoull/strtod over tables
+// of the kind of literals generated sources are full of. Before timing, it's
+// checked against them on random values in every radix and suffix, and
+// against a list of literals whose type or validity is the point.
+
+struct NumberCase {
+  const char *text;
+  NumberStatus status;
+  NumberType type;
+};
+
+static const NumberCase number_cases[] = {
+    {"0", NUMBER_OK, NUM_INT},
+    {"2147483647", NUMBER_OK, NUM_INT},
+    {"2147483648", NUMBER_OK, NUM_LONG},
+    {"0x7fffffff", NUMBER_OK, NUM_INT},
+    {"0x80000000", NUMBER_OK, NUM_UINT},
+    {"037777777777", NUMBER_OK, NUM_UINT},
+    {"4294967296u", NUMBER_OK, NUM_ULONG},
+    {"1l", NUMBER_OK, NUM_LONG},
+    {"1Lu", NUMBER_OK, NUM_ULONG},
+    {"1ll", NUMBER_OK, NUM_LLONG},
+    {"1ULL", NUMBER_OK, NUM_ULLONG},
+    {"0x8000000000000000", NUMBER_OK, NUM_ULONG},
+    {"0x8000000000000000ll", NUMBER_OK, NUM_ULLONG},
+    {"9223372036854775807", NUMBER_OK, NUM_LONG},
+    {"18446744073709551615u", NUMBER_OK, NUM_ULONG},
+    {"0b1010", NUMBER_OK, NUM_INT},
+    {"1.5", NUMBER_OK, NUM_DOUBLE},
+    {".5f", NUMBER_OK, NUM_FLOAT},
+    {"1e3L", NUMBER_OK, NUM_LONG_DOUBLE},
+    {"09.5", NUMBER_OK, NUM_DOUBLE},
+    {"0x1.8p3", NUMBER_OK, NUM_DOUBLE},
+    {"0x1p-2f", NUMBER_OK, NUM_FLOAT},
+    {"9223372036854775808", NUMBER_OVERFLOW, NUM_INT},
+    {"18446744073709551616u", NUMBER_OVERFLOW, NUM_INT},
+    {"0x10000000000000000", NUMBER_OVERFLOW, NUM_INT},
+    {"1e999", NUMBER_OVERFLOW, NUM_DOUBLE},
+    {"09", NUMBER_INVALID, NUM_INT},
+    {"0x", NUMBER_INVALID, NUM_INT},
+    {"0b102", NUMBER_INVALID, NUM_INT},
+    {"12abc", NUMBER_INVALID, NUM_INT},
+    {"1lL", NUMBER_INVALID, NUM_INT},
+    {"1uu", NUMBER_INVALID, NUM_INT},
+    {"1f", NUMBER_INVALID, NUM_INT},
+    {"1e", NUMBER_INVALID, NUM_DOUBLE},
+    {"1e+", NUMBER_INVALID, NUM_DOUBLE},
+    {"0x1.8", NUMBER_INVALID, NUM_DOUBLE},
+    {"0x1e+1", NUMBER_INVALID, NUM_INT},
+    {"1..2", NUMBER_INVALID, NUM_DOUBLE},
+};
+
+static U64 number_rng = 0x2545F4914F6CDD1Dull;
+static U64 number_rng_next() {
+  number_rng ^= number_rng << 13;
+  number_rng ^= number_rng >> 7;
+  number_rng ^= number_rng << 17;
+  return number_rng;
+}
+
+// `value` written in `base` with a prefix, '\0' terminated in `buf`.
+static String8 number_format(U8 *buf, U64 value, U32 base,
+                             const char *suffix) {
+  U8 digits[64];
+  U64 n = 0;
+  do {
+    digits[n++] = (U8)"0123456789abcdef"[value % base];
+    value /= base;
+  } while (value);
+  U64 size = 0;
+  if (base == 16 || base == 2) {
+    buf[size++] = '0';
+    buf[size++] = base == 16 ? 'x' : 'b';
+  } else if (base == 8) {
+    buf[size++] = '0';
+  }
+  while (n)
+    buf[size++] = digits[--n];
+  for (const char *s = suffix; *s; ++s)
+    buf[size++] = (U8)*s;
+  buf[size] = '\0';
+  return str8(buf, size);
+}
+
+static bool number_check_integers() {
+  static const char *suffixes[] = {"", "u", "l", "UL", "ll", "ull", "LLu"};
+  static const U32 bases[] = {10, 16, 8, 2};
+  U8 buf[96];
+  for (U32 i = 0; i < 1 << 16; ++i) {
+    U64 value = number_rng_next() >> (number_rng_next() % 64);
+    U32 base = bases[i % 4];
+    const char *suffix = suffixes[number_rng_next() % 7];
+    Number n = number_parse(number_format(buf, value, base, suffix));
+    bool u = strchr(suffix, 'u') || strchr(suffix, 'U');
+    NumberStatus want = base == 10 && !u && value > 0x7fffffffffffffffull
+                            ? NUMBER_OVERFLOW
+                            : NUMBER_OK;
+    if (n.status != want || (want == NUMBER_OK && (U64)n.value != value)) {
+      fprintf(stderr, "numbers: '%s' parsed as %ld (status %d)\n", buf,
+              n.value, (int)n.status);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Random doubles in full precision, and short decimals as in tables, as
+// double and as float literals.
+static bool number_check_floats() {
+  char buf[64];
+  for (U32 i = 0; i < 1 << 16; ++i) {
+    F64 d;
+    if (i % 2) {
+      U64 bits = number_rng_next() & 0x7fffffffffffffffull;
+      memcpy(&d, &bits, sizeof(d));
+      if (!std::isfinite(d))
+        continue;
+      snprintf(buf, sizeof(buf), "%.17e", d);
+    } else {
+      d = (F64)(number_rng_next() % 100000000) / 1000.0;
+      snprintf(buf, sizeof(buf), "%.*f", 1 + (int)(i / 2 % 5), d);
+    }
+    bool single = i % 3 == 0;
+    U64 size = strlen(buf);
+    F64 want = single ? (F64)strtof(buf, nullptr) : strtod(buf, nullptr);
+    if (single) {
+      buf[size++] = 'f';
+      buf[size] = '\0';
+    }
+    Number n = number_parse(str8((U8 *)buf, size));
+    bool overflow = std::isinf(want);
+    if (overflow ? n.status != NUMBER_OVERFLOW
+                 : n.status != NUMBER_OK || number_f64(n.value) != want) {
+      fprintf(stderr, "numbers: '%s' parsed as %.17g (status %d)\n", buf,
+              number_f64(n.value), (int)n.status);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool number_check_cases() {
+  for (const NumberCase &c : number_cases) {
+    Number n = number_parse(str8((U8 *)c.text, strlen(c.text)));
+    if (n.status != c.status || (c.status == NUMBER_OK && n.type != c.type)) {
+      fprintf(stderr, "numbers: '%s' gave status %d, type %d\n", c.text,
+              (int)n.status, (int)n.type);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void bench_numbers(BenchSuite *suite) {
+  Arena arena = arena_alloc(MiB(256));
+
+  bench_check(suite, number_check_cases(), "number_parse misclassifies a case");
+  bench_check(suite, number_check_integers(),
+              "number_parse disagrees with the integer it was given");
+  bench_check(suite, number_check_floats(),
+              "number_parse disagrees with strtod");
+
+  // Integers of 1 to 12 digits, and decimals with up to 4 places.
+  constexpr U64 count = 1 << 16;
+  String8 *ints = arena_push_array<String8>(&arena, count);
+  String8 *floats = arena_push_array<String8>(&arena, count);
+  U64 int_bytes = 0, float_bytes = 0;
+  for (U64 i = 0; i < count; ++i) {
+    StringBuilder sb = sb_create(&arena, 32);
+    U64 digits = 1 + number_rng_next() % 12;
+    U64 limit = 1;
+    for (U64 d = 0; d < digits; ++d)
+      limit *= 10;
+    sb_append_unsigned(&sb, number_rng_next() % limit);
+    ints[i] = str8((U8 *)sb_to_cstr(&sb), sb_size(&sb));
+    int_bytes += ints[i].size;
+
+    sb = sb_create(&arena, 32);
+    sb_format(&sb, "{}.{}", number_rng_next() % 100000,
+              number_rng_next() % 10000);
+    floats[i] = str8((U8 *)sb_to_cstr(&sb), sb_size(&sb));
+    float_bytes += floats[i].size;
+  }
+
+  String8 group = str8_lit("numbers");
+  bench_run(suite, group, str8_lit("strtoull/int"), int_bytes, count, "lit",
+            [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < count; ++i)
+                sum += strtoull((const char *)ints[i].str, nullptr, 10);
+              bench_keep(sum);
+            });
+  bench_run(suite, group, str8_lit("number_parse/int"), int_bytes, count,
+            "lit", [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < count; ++i)
+                sum += (U64)number_parse(ints[i]).value;
+              bench_keep(sum);
+            });
+  bench_run(suite, group, str8_lit("strtod/float"), float_bytes, count, "lit",
+            [&] {
+              F64 sum = 0;
+              for (U64 i = 0; i < count; ++i)
+                sum += strtod((const char *)floats[i].str, nullptr);
+              bench_keep(sum);
+            });
+  bench_run(suite, group, str8_lit("number_parse/float"), float_bytes, count,
+            "lit", [&] {
+              U64 sum = 0;
+              for (U64 i = 0; i < count; ++i)
+                sum += (U64)number_parse(floats[i]).value;
+              bench_keep(sum);
+            });
+
+  arena_release(&arena);
+}
@@ -0,0 +1,40 @@
+#include "arena.hpp"
+#include "intern.hpp"
+#include "strings.hpp"
+
+// Parser throughput over pre-lexed token streams, so only perform_parse is
+// timed. bytes_per_node is what the tree costs: node records plus the extra
+// array, over the node count.
+
+static void bench_parse_workload(BenchSuite *suite, const LexWorkload &w) {
+  Arena arena = arena_alloc(GiB(4));
+  Interner interner = interner_alloc(GiB(1));
+
+  LexResult *streams = arena_push_array<LexResult>(&arena, w.file_count);
+  for (U64 f = 0; f < w.file_count; ++f)
+    streams[f] = perform_lex(&arena, &interner, w.files[f]);
+
+  U64 nodes = 0, tree_bytes = 0;
+  ArenaTemp temp = temp_begin(&arena);
+  for (U64 f = 0; f < w.file_count; ++f) {
+    Ast ast = perform_parse(&arena, &streams[f]);
+    nodes += ast.node_count;
+    tree_bytes += (U64)ast.node_count * sizeof(Node) + ast.extra_count * 4;
+  }
+  temp_end(temp);
+
+  bool ran = bench_run(
+      suite, str8_lit("parse"),
+      str8_cat(suite->arena, str8_lit("perform_parse/"), w.name), w.bytes,
+      nodes, "node", [&] {
+        ArenaTemp temp = temp_begin(&arena);
+        for (U64 f = 0; f < w.file_count; ++f)
+          bench_keep(perform_parse(&arena, &streams[f]).node_count);
+        temp_end(temp);
+      });
+  if (ran && nodes)
+    bench_annotate(suite, "bytes_per_node", (F64)tree_bytes / (F64)nodes);
+
+  interner_release(&interner);
+  arena_release(&arena);
+}
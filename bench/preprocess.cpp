@@ -0,0 +1,195 @@
+#include "arena.hpp"
+#include "file.hpp"
+#include "intern.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Preprocessor throughput. The generated workloads have no directives, so
+// this is the cost of the extra pass over plain code, and lexing the output
+// has to give the same tokens as lexing the input.
+
+static void bench_preprocess_workload(BenchSuite *suite, const LexWorkload &w) {
+  Arena arena = arena_alloc(GiB(4));
+  Interner interner = interner_alloc(GiB(1));
+  IncludeCache cache = {};
+  include_cache_init(&cache);
+
+  U64 tokens = 0;
+  bool same_tokens = true;
+  for (U64 f = 0; f < w.file_count; ++f) {
+    Preprocessed pp = perform_preprocess(&arena, &interner, &cache, {},
+                                         str8_lit("<bench>"), w.files[f]);
+    U32 raw = perform_lex(&arena, &interner, w.files[f]).token_count;
+    same_tokens &= perform_lex(&arena, &interner, pp.text).token_count == raw;
+    tokens += raw;
+    arena_reset(&arena);
+    interner_reset(&interner);
+  }
+  bench_check(suite, same_tokens,
+              "preprocessing code without directives changed its tokens");
+
+  bench_run(suite, str8_lit("preprocess"),
+            str8_cat(suite->arena, str8_lit("perform_preprocess/"), w.name),
+            w.bytes, tokens, "tok", [&] {
+              for (U64 f = 0; f < w.file_count; ++f) {
+                bench_keep(perform_preprocess(&arena, &interner, &cache, {},
+                                              str8_lit("<bench>"), w.files[f])
+                               .text.size);
+                arena_reset(&arena);
+                interner_reset(&interner);
+              }
+            });
+
+  include_cache_release(&cache);
+  interner_release(&interner);
+  arena_release(&arena);
+}
+
+// What the server does with one cache across requests: two projects, each
+// with an a.h of the same size and mtime, preprocessed from their own
+// working directories. Each has to get its own header.
+static bool preprocess_cache_follows_cwd(Arena *arena, Interner *interner) {
+  char root[] = "/tmp/bench-pp-cwd-XXXXXX";
+  char cwd[4096];
+  if (!mkdtemp(root) || !getcwd(cwd, sizeof(cwd)))
+    return true;
+  IncludeCache cache = {};
+  include_cache_init(&cache);
+
+  static const char *projects[] = {"one", "two"};
+  String8 headers[2], dirs[2];
+  for (U32 i = 0; i < 2; ++i) {
+    StringBuilder dir = sb_create(arena, 64);
+    sb_format(&dir, "{}/{}", (const char *)root, projects[i]);
+    dirs[i] = str8((U8 *)sb_to_cstr(&dir), sb_size(&dir));
+    mkdir((const char *)dirs[i].str, 0700);
+    headers[i] = str8_copy(arena, str8_cat(arena, dirs[i], str8_lit("/a.h")));
+    StringBuilder sb = sb_create(arena, 64);
+    sb_format(&sb, "int {}(void);\n", projects[i]);
+    file_write((const char *)headers[i].str, sb_to_str8(&sb));
+  }
+  timespec times[2] = {{.tv_sec = 1000000000, .tv_nsec = 0},
+                       {.tv_sec = 1000000000, .tv_nsec = 0}};
+  bool ok = true;
+  for (U32 i = 0; i < 2; ++i) {
+    utimensat(AT_FDCWD, (const char *)headers[i].str, times, 0);
+    ok &= chdir((const char *)dirs[i].str) == 0;
+    Preprocessed pp =
+        perform_preprocess(arena, interner, &cache, {}, str8_lit("m.c"),
+                           str8_lit("#include \"a.h\"\n"));
+    ok &= pp.error_count == 0 &&
+          str8_find(pp.text, str8_cstring((U8 *)projects[i])) < pp.text.size;
+  }
+  ok &= chdir(cwd) == 0;
+
+  include_cache_release(&cache);
+  for (U32 i = 0; i < 2; ++i) {
+    unlink((const char *)headers[i].str);
+    rmdir((const char *)dirs[i].str);
+  }
+  rmdir(root);
+  return ok;
+}
+
+// A resident server's view of a header that keeps being edited: every
+// version has to be what's preprocessed, and replaced versions have to be
+// unmapped and their entries reused, so the cache doesn't grow. Every edit
+// changes the size (the padding cycles through 0-2 spaces, against at most
+// one more digit), so the mtime's granularity doesn't matter.
+static bool preprocess_cache_recycles(Arena *arena, Interner *interner) {
+  char dir[] = "/tmp/bench-pp-edit-XXXXXX";
+  if (!mkdtemp(dir))
+    return true;
+  IncludeCache cache = {};
+  include_cache_init(&cache);
+  String8 header = str8_copy(arena, str8_cat(arena, str8_cstring((U8 *)dir),
+                                             str8_lit("/edited.h")));
+  StringBuilder source = sb_create(arena, 64);
+  sb_format(&source, "#include \"{}\"\n", (const char *)header.str);
+  String8 input = str8((U8 *)sb_to_cstr(&source), sb_size(&source));
+
+  bool ok = true;
+  U64 pos_after_first = 0;
+  for (U32 edit = 0; edit < 256 && ok; ++edit) {
+    ArenaTemp temp = temp_begin(arena);
+    StringBuilder text = sb_create(arena, 64);
+    sb_format(&text, "int version_{}(void);{}\n", edit,
+              &"  "[2 - edit % 3]);
+    file_write((const char *)header.str, sb_to_str8(&text));
+    Preprocessed pp = perform_preprocess(arena, interner, &cache, {},
+                                         str8_lit("<bench>"), input);
+    sb_clear(&text);
+    sb_format(&text, "version_{}", edit);
+    ok &= str8_find(pp.text, sb_to_str8(&text)) < pp.text.size;
+    temp_end(temp);
+    if (edit == 1)
+      pos_after_first = arena_pos(&cache.arena);
+  }
+  ok &= !cache.stale && arena_pos(&cache.arena) == pos_after_first;
+
+  include_cache_release(&cache);
+  unlink((const char *)header.str);
+  rmdir(dir);
+  return ok;
+}
+
+// One guarded header and one #pragma once header, each included 1000 times.
+// After the first run every include is a cache hit, and all but the first
+// in a run are skipped without being read.
+static void bench_preprocess_includes(BenchSuite *suite) {
+  char dir[] = "/tmp/bench-pp-XXXXXX";
+  if (!mkdtemp(dir))
+    return;
+  Arena arena = arena_alloc(GiB(1));
+  Interner interner = interner_alloc(GiB(1));
+  IncludeCache cache = {};
+  include_cache_init(&cache);
+
+  String8 guarded = str8_copy(&arena, str8_cat(&arena, str8_cstring((U8 *)dir),
+                                               str8_lit("/guarded.h")));
+  String8 once = str8_copy(&arena, str8_cat(&arena, str8_cstring((U8 *)dir),
+                                            str8_lit("/once.h")));
+  file_write((const char *)guarded.str,
+             str8_lit("#ifndef GUARDED_H\n#define GUARDED_H\n"
+                      "int guarded(int x);\n#endif\n"));
+  file_write((const char *)once.str,
+             str8_lit("#pragma once\nint once(int x);\n"));
+
+  const U32 includes = 1000;
+  StringBuilder source = sb_create(&arena, includes * 64);
+  for (U32 i = 0; i < includes; ++i)
+    sb_appendf(&source, "#include \"%s\"\n",
+               i & 1 ? (const char *)once.str : (const char *)guarded.str);
+  String8 input = str8((U8 *)sb_to_cstr(&source), sb_size(&source));
+
+  PPStats stats = {};
+  bench_run(suite, str8_lit("preprocess"), str8_lit("include-skip/1000"),
+            input.size, includes, "include", [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              stats = perform_preprocess(&arena, &interner, &cache, {},
+                                         str8_lit("<bench>"), input)
+                          .stats;
+              temp_end(temp);
+              interner_reset(&interner);
+            });
+  bench_check(suite,
+              stats.includes == 0 ||
+                  (stats.includes == includes &&
+                   stats.include_skips == includes - 2),
+              "repeated includes weren't skipped");
+  bench_check(suite, preprocess_cache_follows_cwd(&arena, &interner),
+              "include cache served another directory's header");
+  bench_check(suite, preprocess_cache_recycles(&arena, &interner),
+              "include cache kept replaced versions of a header");
+
+  // The paths live in the arena, so they go first.
+  unlink((const char *)guarded.str);
+  unlink((const char *)once.str);
+  rmdir(dir);
+  include_cache_release(&cache);
+  interner_release(&interner);
+  arena_release(&arena);
+}
@@ -0,0 +1,128 @@
+#include "arena.hpp"
+#include "intern.hpp"
+#include "strings.hpp"
+#include <algorithm>
+#include <cassert>
+
+// Incremental re-lexing. Before timing anything, random edit scripts are
+// checked against a full perform_lex of the edited text, chaining several
+// rounds so relexed streams get relexed again. Then one small edit in the
+// middle of each input is timed against lexing it from scratch.
+
+static constexpr char relex_alphabet[] = " \n\tabcxyz_019(){};,.+-*//@";
+static constexpr U32 RELEX_MAX_EDITS = 8;
+
+// Applies `count` random edits to `input`, filling `edits`, which callers
+// size RELEX_MAX_EDITS, and returns the new text.
+static String8 relex_random_edits(Arena *arena, U64 *rng, String8 input,
+                                  LexEdit *edits, U32 count) {
+  auto next = [&](U64 n) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return n ? *rng % n : 0;
+  };
+
+  assert(count <= RELEX_MAX_EDITS && "Too many edits for one script");
+  U32 *at = arena_push_array<U32>(arena, count);
+  for (U32 e = 0; e < count; ++e)
+    at[e] = (U32)next(input.size + 1);
+  std::sort(at, at + count);
+  U64 size = input.size;
+  for (U32 e = 0; e < count; ++e) {
+    U32 limit = (e + 1 < count ? at[e + 1] : (U32)input.size) - at[e];
+    U32 removed = (U32)next(limit < 16 ? limit + 1 : 17);
+    edits[e] = {.offset = at[e],
+                .removed = removed,
+                .inserted = (U32)next(17)};
+    size = size - removed + edits[e].inserted;
+  }
+
+  U8 *out = arena_push_array<U8>(arena, size + 1);
+  U64 from = 0, n = 0;
+  for (U32 e = 0; e < count; ++e) {
+    memcpy(out + n, input.str + from, edits[e].offset - from);
+    n += edits[e].offset - from;
+    for (U32 c = 0; c < edits[e].inserted; ++c)
+      out[n++] = relex_alphabet[next(sizeof(relex_alphabet) - 1)];
+    from = edits[e].offset + edits[e].removed;
+  }
+  memcpy(out + n, input.str + from, input.size - from);
+  n += input.size - from;
+  out[n] = '\0';
+  return str8(out, n);
+}
+
+static void bench_relex_workload(BenchSuite *suite, const LexWorkload &w) {
+  Arena arena = arena_alloc(GiB(8));
+  Interner interner = interner_alloc(GiB(1));
+
+  // Randomized differential check. Inputs past a few MB make this slow, so
+  // big files only get a few rounds.
+  U64 rng = 0x2545F4914F6CDD1Dull;
+  bool same = true;
+  for (U64 f = 0; f < w.file_count && same; ++f) {
+    String8 input = w.files[f];
+    U32 rounds = input.size > MiB(1) ? 8 : 64;
+    for (U32 round = 0; round < rounds && same; ++round) {
+      LexResult old = perform_lex(&arena, &interner, input);
+      String8 text = input;
+      for (U32 step = 0; step < 4 && same; ++step) {
+        LexEdit edits[RELEX_MAX_EDITS];
+        U32 count = 1 + (U32)(rng % 4);
+        String8 edited =
+            relex_random_edits(&arena, &rng, text, edits, count);
+        LexResult relexed =
+            perform_relex(&arena, &interner, &old, edited, edits, count);
+        LexResult full = perform_lex(&arena, &interner, edited);
+        S64 mismatch = lex_first_mismatch(&relexed, &full);
+        if (mismatch >= 0) {
+          fprintf(stderr, "relex: %.*s file %lu round %u step %u differs at "
+                          "token %ld\n",
+                  (int)w.name.size, w.name.str, f, round, step, mismatch);
+          same = false;
+        }
+        old = relexed;
+        text = edited;
+      }
+      arena_reset(&arena);
+    }
+  }
+  bench_check(suite, same, "perform_relex differs from a full re-lex");
+
+  // One character typed in the middle of each file.
+  LexResult *old = arena_push_array<LexResult>(&arena, w.file_count);
+  String8 *edited = arena_push_array<String8>(&arena, w.file_count);
+  LexEdit *edits = arena_push_array<LexEdit>(&arena, w.file_count);
+  U64 tokens = 0;
+  for (U64 f = 0; f < w.file_count; ++f) {
+    String8 input = w.files[f];
+    old[f] = perform_lex(&arena, &interner, input);
+    tokens += old[f].token_count;
+    U32 at = (U32)(input.size / 2);
+    edits[f] = {.offset = at, .removed = 0, .inserted = 1};
+    U8 *text = arena_push_array<U8>(&arena, input.size + 2);
+    memcpy(text, input.str, at);
+    text[at] = 'q';
+    memcpy(text + at + 1, input.str + at, input.size - at + 1);
+    edited[f] = str8(text, input.size + 1);
+  }
+
+  RelexStats stats = {};
+  bool ran = bench_run(
+      suite, str8_lit("lex"),
+      str8_cat(suite->arena, str8_lit("perform_relex/one-char/"), w.name),
+      w.bytes, tokens, "tok", [&] {
+        ArenaTemp temp = temp_begin(&arena);
+        for (U64 f = 0; f < w.file_count; ++f)
+          bench_keep(perform_relex(&arena, &interner, &old[f], edited[f],
+                                   &edits[f], 1, &stats)
+                         .token_count);
+        temp_end(temp);
+      });
+  if (ran)
+    bench_annotate(suite, "tokens_relexed", stats.relexed);
+
+  interner_release(&interner);
+  arena_release(&arena);
+}
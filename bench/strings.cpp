@@ -0,0 +1,349 @@
+#include "arena.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <cstring>
+
+// String8 and StringBuilder primitives over identifier-sized and
+// line-sized inputs.
+
+static constexpr U64 BENCH_WORDS = 4096;
+static constexpr U64 BENCH_APPENDS = 1024;
+
+// Random strings over an alphabet of letters, whitespace, punctuation and
+// a non-ASCII byte, at every length around the 16-byte blocks, through
+// both versions of each function.
+static bool str8_vector_agrees_with_scalar(Arena *arena) {
+  static const U8 alphabet[] = {'a', 'Z', 'q', 'M', ' ', '\t', '\n', '\r',
+                                '@', '[', '`', '{', 0xC1, 0xE1, '0', '_'};
+  U64 rng = 0x9E3779B97F4A7C15ull;
+  auto next = [&] {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+  };
+  U8 a[80], b[80];
+  for (U32 round = 0; round < 20000; ++round) {
+    ArenaTemp temp = temp_begin(arena);
+    U64 size = next() % 70;
+    for (U64 i = 0; i < size; ++i) {
+      a[i] = alphabet[next() % 16];
+      // Mostly a case-flipped copy, sometimes one byte off.
+      b[i] = char_is_alpha(a[i]) ? a[i] ^ 0x20 : a[i];
+    }
+    if (size && next() % 2)
+      b[next() % size] = alphabet[next() % 16];
+    String8 s = {a, size}, t = {b, size};
+    // A needle taken from the string, or made up.
+    U64 from = size ? next() % size : 0;
+    String8 needle = next() % 4 ? str8_substr(s, from, from + next() % 6)
+                                : str8_substr(t, 0, next() % 4);
+    String8 set = str8_substr(t, from, from + next() % 12);
+    U8 c = alphabet[next() % 16];
+
+    bool same =
+        str8_match(upper_from_str8(arena, s),
+                   upper_from_str8_scalar(arena, s)) &&
+        str8_match(lower_from_str8(arena, s),
+                   lower_from_str8_scalar(arena, s)) &&
+        str8_match(str8_trim_whitespace(s), str8_trim_whitespace_scalar(s)) &&
+        str8_trim_whitespace(s).str ==
+            str8_trim_whitespace_scalar(s).str &&
+        str8_match_insensitive(s, t) == str8_match_insensitive_scalar(s, t) &&
+        str8_find_char(s, c) == str8_find_char_scalar(s, c) &&
+        str8_find(s, needle) == str8_find_scalar(s, needle) &&
+        str8_find_any(s, set) == str8_find_any_scalar(s, set) &&
+        str8_match(str8_join(arena, str8_split(arena, s, c), str8((U8 *)&c, 1)),
+                   s);
+    temp_end(temp);
+    if (!same)
+      return false;
+  }
+  return true;
+}
+
+static void bench_strings(BenchSuite *suite) {
+  Arena arena = arena_alloc(GiB(1));
+  String8 group = str8_lit("str8");
+
+  // Identifiers from the generator's vocabulary, so hashing and matching
+  // see realistic lengths.
+  String8 source = gen_c_source(&arena, GEN_IDENTIFIERS, KiB(256), 7);
+  String8 *words = arena_push_array<String8>(&arena, BENCH_WORDS);
+  U64 word_count = 0;
+  for (U64 i = 0; i < source.size && word_count < BENCH_WORDS;) {
+    U64 end = i;
+    while (end < source.size &&
+           (char_is_alpha(source.str[end]) || source.str[end] == '_' ||
+            (end > i && char_is_digit(source.str[end], 10))))
+      ++end;
+    if (end > i)
+      words[word_count++] = str8_substr(source, i, end);
+    i = end + 1;
+  }
+  U64 word_bytes = 0;
+  for (U64 i = 0; i < word_count; ++i)
+    word_bytes += words[i].size;
+
+  bench_run(suite, group, str8_lit("hash/identifiers"), word_bytes,
+            word_count, "str", [&] {
+              U64 h = 0;
+              for (U64 i = 0; i < word_count; ++i)
+                h ^= str8_hash(words[i]);
+              bench_keep(h);
+            });
+
+  bench_run(suite, group, str8_lit("match/identifiers"), word_bytes,
+            word_count, "str", [&] {
+              U64 hits = 0;
+              for (U64 i = 0; i < word_count; ++i)
+                hits += str8_match(words[i], words[(i + 1) % word_count]);
+              bench_keep(hits);
+            });
+
+  String8 line = str8_lit("    parent_token_offset(node_count, index);   ");
+  bench_run(suite, group, str8_lit("match/line-equal"), line.size, 1, "str",
+            [&] {
+              String8 copy = line;
+              bench_keep(copy.str);
+              bench_keep(str8_match(line, copy));
+            });
+
+  String8 upper_line = upper_from_str8(&arena, line);
+  bench_run(suite, group, str8_lit("match_insensitive_scalar/line"),
+            line.size, 1, "str", [&] {
+              String8 copy = upper_line;
+              bench_keep(copy.str);
+              bench_keep(str8_match_insensitive_scalar(line, copy));
+            });
+
+  bench_run(suite, group, str8_lit("match_insensitive/line"), line.size, 1,
+            "str", [&] {
+              String8 copy = upper_line;
+              bench_keep(copy.str);
+              bench_keep(str8_match_insensitive(line, copy));
+            });
+
+  bench_run(suite, group, str8_lit("trim_whitespace_scalar/line"), line.size,
+            1, "str", [&] {
+              String8 s = line;
+              bench_keep(s.str);
+              bench_keep(str8_trim_whitespace_scalar(s));
+            });
+
+  bench_run(suite, group, str8_lit("trim_whitespace/line"), line.size, 1,
+            "str", [&] {
+              String8 s = line;
+              bench_keep(s.str);
+              bench_keep(str8_trim_whitespace(s));
+            });
+
+  String8 chunk = str8_substr(source, 0, KiB(4));
+  bench_run(suite, group, str8_lit("copy/identifiers"), word_bytes,
+            word_count, "str", [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              for (U64 i = 0; i < word_count; ++i)
+                bench_keep(str8_copy(&arena, words[i]).str);
+              temp_end(temp);
+            });
+
+  bench_run(suite, group, str8_lit("cat/4KiB"), chunk.size * 2, 1, "str",
+            [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              bench_keep(str8_cat(&arena, chunk, chunk).str);
+              temp_end(temp);
+            });
+
+  bench_run(suite, group, str8_lit("lower_scalar/4KiB"), chunk.size, 1, "str",
+            [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              bench_keep(lower_from_str8_scalar(&arena, chunk).str);
+              temp_end(temp);
+            });
+
+  bench_run(suite, group, str8_lit("lower/4KiB"), chunk.size, 1, "str", [&] {
+    ArenaTemp temp = temp_begin(&arena);
+    bench_keep(lower_from_str8(&arena, chunk).str);
+    temp_end(temp);
+  });
+
+  // ---- Searching ----
+  // Needles that occur once, at the end of a 4 KiB chunk of source, so
+  // every search reads the whole chunk.
+  String8 haystack = str8_cat(&arena, chunk, str8_lit("@#~`"));
+  String8 needle = str8_lit("@#~`");
+  String8 set = str8_lit("@`~");
+
+  bench_run(suite, group, str8_lit("find_char_scalar/4KiB"), haystack.size,
+            1, "str", [&] {
+              bench_keep(haystack.str);
+              bench_keep(str8_find_char_scalar(haystack, '@'));
+            });
+  bench_run(suite, group, str8_lit("find_char/4KiB"), haystack.size, 1,
+            "str", [&] {
+              bench_keep(haystack.str);
+              bench_keep(str8_find_char(haystack, '@'));
+            });
+  bench_run(suite, group, str8_lit("find_scalar/4KiB"), haystack.size, 1,
+            "str", [&] {
+              bench_keep(haystack.str);
+              bench_keep(str8_find_scalar(haystack, needle));
+            });
+  bench_run(suite, group, str8_lit("find/4KiB"), haystack.size, 1, "str",
+            [&] {
+              bench_keep(haystack.str);
+              bench_keep(str8_find(haystack, needle));
+            });
+  bench_run(suite, group, str8_lit("find_any_scalar/4KiB"), haystack.size, 1,
+            "str", [&] {
+              bench_keep(haystack.str);
+              bench_keep(str8_find_any_scalar(haystack, set));
+            });
+  bench_run(suite, group, str8_lit("find_any/4KiB"), haystack.size, 1, "str",
+            [&] {
+              bench_keep(haystack.str);
+              bench_keep(str8_find_any(haystack, set));
+            });
+
+  // ---- Splitting & joining ----
+  // A generated file into lines and back.
+  String8 text = str8_substr(source, 0, KiB(64));
+  U64 lines = str8_split(&arena, text, '\n').count;
+  bench_run(suite, group, str8_lit("split/lines"), text.size, lines, "line",
+            [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              bench_keep(str8_split(&arena, text, '\n').items);
+              temp_end(temp);
+            });
+
+  String8Array pieces = str8_split(&arena, text, '\n');
+  bench_run(suite, group, str8_lit("join/lines"), text.size, lines, "line",
+            [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              bench_keep(str8_join(&arena, pieces, str8_lit("\n")).str);
+              temp_end(temp);
+            });
+  bench_check(suite,
+              str8_match(str8_join(&arena, pieces, str8_lit("\n")), text),
+              "str8_join doesn't undo str8_split");
+  bench_check(suite, str8_vector_agrees_with_scalar(&arena),
+              "str8 vector and scalar versions disagree");
+
+  // ---- StringBuilder ----
+  group = str8_lit("sb");
+  StringBuilder sb = sb_create(&arena, MiB(1));
+
+  bench_run(suite, group, str8_lit("append/identifiers"), word_bytes,
+            word_count, "append", [&] {
+              sb_clear(&sb);
+              for (U64 i = 0; i < word_count; ++i)
+                sb_append(&sb, words[i]);
+              bench_keep(sb_size(&sb));
+            });
+
+  bench_run(suite, group, str8_lit("append_char"), BENCH_APPENDS,
+            BENCH_APPENDS, "append", [&] {
+              sb_clear(&sb);
+              for (U64 i = 0; i < BENCH_APPENDS; ++i)
+                sb_append_char(&sb, (U8)('a' + (i & 15)));
+              bench_keep(sb_size(&sb));
+            });
+
+  bench_run(suite, group, str8_lit("append_signed"), 0, BENCH_APPENDS,
+            "append", [&] {
+              sb_clear(&sb);
+              for (U64 i = 0; i < BENCH_APPENDS; ++i)
+                sb_append_signed(&sb, (S64)(i * 7919) - 4000000);
+              bench_keep(sb_size(&sb));
+            });
+
+  bench_run(suite, group, str8_lit("appendf/token-dump"), 0, BENCH_APPENDS,
+            "append", [&] {
+              sb_clear(&sb);
+              for (U64 i = 0; i < BENCH_APPENDS; ++i)
+                sb_appendf(&sb, "kind: %s, iden: '%.*s'\n", "TK_IDENTIFIER",
+                           (int)words[i % word_count].size,
+                           words[i % word_count].str);
+              bench_keep(sb_size(&sb));
+            });
+
+  bench_run(suite, group, str8_lit("format/token-dump"), 0, BENCH_APPENDS,
+            "append", [&] {
+              sb_clear(&sb);
+              for (U64 i = 0; i < BENCH_APPENDS; ++i)
+                sb_format(&sb, "kind: {}, iden: '{}'\n", "TK_IDENTIFIER",
+                          words[i % word_count]);
+              bench_keep(sb_size(&sb));
+            });
+
+  bench_run(suite, group, str8_lit("format/asm-line"), 0, BENCH_APPENDS,
+            "append", [&] {
+              sb_clear(&sb);
+              for (U64 i = 0; i < BENCH_APPENDS; ++i)
+                sb_format(&sb, "  mov QWORD PTR [rbp{:+}], {}\n",
+                          -(S32)(i * 8), "rax");
+              bench_keep(sb_size(&sb));
+            });
+
+  bench_run(suite, group, str8_lit("append_hex"), 0, BENCH_APPENDS, "append",
+            [&] {
+              sb_clear(&sb);
+              for (U64 i = 0; i < BENCH_APPENDS; ++i)
+                sb_append_hex(&sb, i * 0x9E3779B97F4A7C15ull, 16);
+              bench_keep(sb_size(&sb));
+            });
+
+  // A builder that isn't on top of its arena, so it grows by chunks, then
+  // goes out through writev.
+  bench_run(suite, group, str8_lit("append/chunked"), word_bytes * 64,
+            word_count * 64, "append", [&] {
+              ArenaTemp temp = temp_begin(&arena);
+              StringBuilder chunked = sb_create(&arena, 256);
+              arena_push<U64>(&arena);
+              for (U64 r = 0; r < 64; ++r) {
+                for (U64 i = 0; i < word_count; ++i)
+                  sb_append(&chunked, words[i]);
+              }
+              bench_keep(sb_size(&chunked));
+              temp_end(temp);
+            });
+
+  // sb_format has to agree with printf on everything the code base uses.
+  bool same = true;
+  const S64 values[] = {0, 7, -7, 42, -128, 127, 100, -100, 99999,
+                        -9223372036854775807ll - 1, 9223372036854775807ll};
+  char expect[128];
+  for (S64 v : values) {
+    ArenaTemp temp = temp_begin(&arena);
+    StringBuilder got = sb_create(&arena, 16);
+    sb_format(&got, "{} {:+} {:08} {:x} {:016x} {{{}}}", v, v, v, (U64)v,
+              (U64)v, (U32)v);
+    int n = snprintf(expect, sizeof(expect), "%ld %+ld %08ld %lx %016lx {%u}",
+                     v, v, v, (U64)v, (U64)v, (U32)v);
+    same &= str8_match(sb_to_str8(&got), str8((U8 *)expect, (U64)n));
+    temp_end(temp);
+  }
+  bench_check(suite, same, "sb_format disagrees with snprintf");
+
+  // Growing in place has to leave room for what's already written, not
+  // just for the append: 150 bytes in a 200 byte chunk, then 300 more.
+  // Whatever is pushed next must land past the builder's text.
+  {
+    ArenaTemp temp = temp_begin(&arena);
+    U8 text[450];
+    for (U64 i = 0; i < sizeof(text); ++i)
+      text[i] = (U8)('a' + i % 26);
+    StringBuilder grown = sb_create(&arena, 200);
+    sb_append(&grown, str8(text, 150));
+    sb_append(&grown, str8(text + 150, 300));
+    sb_append(&grown, String8{});
+    memset(arena_push_array<U8>(&arena, 64), 0xAA, 64);
+    bench_check(suite,
+                sb_size(&grown) == sizeof(text) &&
+                    str8_match(sb_to_str8(&grown), str8(text, sizeof(text))),
+                "StringBuilder grew over its own text");
+    temp_end(temp);
+  }
+
+  arena_release(&arena);
+}
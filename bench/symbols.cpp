@@ -0,0 +1,217 @@
+#include "arena.hpp"
+#include "hash_map.hpp"
+#include "symbol_table.hpp"
+#include <cassert>
+
+// Scoped name lookup the way a resolver does it, replayed from a trace of
+// block scopes opening and closing, declarations and uses. Three ways:
+//   linear     - the stack codegen used to keep: truncate on exit, scan
+//                back from the top on lookup
+//   hash_map   - a HashMap from atom to binding, with each of a scope's
+//                names removed or put back one by one on exit
+//   symbols    - SymbolTable
+// All three have to resolve every use to the same declaration.
+
+enum SymbolOp : U8 {
+  SYMBOL_OPEN,
+  SYMBOL_CLOSE,
+  SYMBOL_DECLARE,
+  SYMBOL_USE,
+};
+
+struct SymbolEvent {
+  SymbolOp op;
+  Atom atom;
+};
+
+struct SymbolTrace {
+  SymbolEvent *events;
+  U64 count;
+  U64 uses;
+};
+
+static constexpr U32 BENCH_SYMBOL_NAMES = 512;
+
+static U64 symbol_rng = 0x2545F4914F6CDD1Dull;
+static U64 symbol_rng_next() {
+  symbol_rng ^= symbol_rng << 13;
+  symbol_rng ^= symbol_rng >> 7;
+  symbol_rng ^= symbol_rng << 17;
+  return symbol_rng;
+}
+
+// Functions whose bodies nest blocks up to 24 deep. Each block declares a
+// few names, mostly from a small common set (i, len, ...) so shadowing
+// happens, and uses names declared so far, some of them unknown.
+static SymbolTrace symbol_trace(Arena *arena, U64 functions) {
+  U64 cap = functions * 4096;
+  SymbolTrace trace = {arena_push_array<SymbolEvent>(arena, cap), 0, 0};
+  Atom *visible = arena_push_array<Atom>(arena, 4096);
+  U32 *scope_start = arena_push_array<U32>(arena, 64);
+  auto emit = [&](SymbolOp op, Atom atom) {
+    assert(trace.count < cap && "Trace outgrew its buffer");
+    trace.events[trace.count++] = {op, atom};
+  };
+  for (U64 f = 0; f < functions; ++f) {
+    U32 depth = 0, visible_count = 0;
+    do {
+      bool open = depth == 0 || (depth < 24 && symbol_rng_next() % 2 == 0);
+      if (open) {
+        emit(SYMBOL_OPEN, 0);
+        scope_start[depth++] = visible_count;
+        for (U64 d = symbol_rng_next() % 5; d-- > 0;) {
+          Atom atom = (Atom)(1 + (symbol_rng_next() % 4 == 0
+                                      ? symbol_rng_next() % BENCH_SYMBOL_NAMES
+                                      : symbol_rng_next() % 16));
+          emit(SYMBOL_DECLARE, atom);
+          visible[visible_count++] = atom;
+        }
+      }
+      for (U64 u = symbol_rng_next() % 8; u-- > 0;) {
+        Atom atom = visible_count && symbol_rng_next() % 8
+                        ? visible[symbol_rng_next() % visible_count]
+                        : (Atom)(1 + symbol_rng_next() % BENCH_SYMBOL_NAMES);
+        emit(SYMBOL_USE, atom);
+        trace.uses++;
+      }
+      if (!open || symbol_rng_next() % 3 == 0) {
+        emit(SYMBOL_CLOSE, 0);
+        visible_count = scope_start[--depth];
+      }
+    } while (depth);
+  }
+  return trace;
+}
+
+// Each replay returns the sum of (use index * declaration index) over the
+// uses that resolved, which only agrees if every use found the same one.
+
+static U64 symbol_replay_linear(Arena *arena, const SymbolTrace *trace) {
+  struct Local {
+    Atom atom;
+    U32 decl;
+  };
+  ArenaTemp temp = temp_begin(arena);
+  Local *locals = arena_push_array<Local>(arena, trace->count);
+  U32 *scopes = arena_push_array<U32>(arena, 64);
+  U32 count = 0, depth = 0;
+  U64 sum = 0;
+  for (U64 i = 0; i < trace->count; ++i) {
+    const SymbolEvent &e = trace->events[i];
+    switch (e.op) {
+    case SYMBOL_OPEN:
+      scopes[depth++] = count;
+      break;
+    case SYMBOL_CLOSE:
+      count = scopes[--depth];
+      break;
+    case SYMBOL_DECLARE:
+      locals[count++] = {e.atom, (U32)i};
+      break;
+    case SYMBOL_USE:
+      for (U32 l = count; l-- > 0;) {
+        if (locals[l].atom == e.atom) {
+          sum += i * locals[l].decl;
+          break;
+        }
+      }
+      break;
+    }
+  }
+  temp_end(temp);
+  return sum;
+}
+
+static U64 symbol_replay_hash_map(Arena *arena, const SymbolTrace *trace) {
+  // What each declaration replaced, to undo on exit.
+  struct Undo {
+    Atom atom;
+    U32 previous; // Declaration index + 1, 0 if there was none
+  };
+  ArenaTemp temp = temp_begin(arena);
+  HashMap<Atom, U32> map = hash_map_create<Atom, U32>(arena);
+  Undo *undo = arena_push_array<Undo>(arena, trace->count);
+  U32 *scopes = arena_push_array<U32>(arena, 64);
+  U32 undo_count = 0, depth = 0;
+  U64 sum = 0;
+  for (U64 i = 0; i < trace->count; ++i) {
+    const SymbolEvent &e = trace->events[i];
+    switch (e.op) {
+    case SYMBOL_OPEN:
+      scopes[depth++] = undo_count;
+      break;
+    case SYMBOL_CLOSE:
+      for (U32 start = scopes[--depth]; undo_count > start;) {
+        const Undo &u = undo[--undo_count];
+        if (u.previous)
+          hash_map_put(&map, u.atom, u.previous - 1);
+        else
+          hash_map_remove(&map, u.atom);
+      }
+      break;
+    case SYMBOL_DECLARE: {
+      bool inserted;
+      U32 *decl = hash_map_upsert(&map, e.atom, &inserted);
+      undo[undo_count++] = {e.atom, inserted ? 0 : *decl + 1};
+      *decl = (U32)i;
+    } break;
+    case SYMBOL_USE:
+      if (const U32 *decl = hash_map_find(&map, e.atom))
+        sum += i * *decl;
+      break;
+    }
+  }
+  temp_end(temp);
+  return sum;
+}
+
+static U64 symbol_replay_table(SymbolTable<U32> *table,
+                               const SymbolTrace *trace) {
+  U64 sum = 0;
+  for (U64 i = 0; i < trace->count; ++i) {
+    const SymbolEvent &e = trace->events[i];
+    switch (e.op) {
+    case SYMBOL_OPEN:
+      symbol_scope_begin(table);
+      break;
+    case SYMBOL_CLOSE:
+      symbol_scope_end(table);
+      break;
+    case SYMBOL_DECLARE:
+      symbol_declare(table, e.atom, (U32)i);
+      break;
+    case SYMBOL_USE:
+      if (const Symbol<U32> *s = symbol_find(table, e.atom))
+        sum += i * s->value;
+      break;
+    }
+  }
+  return sum;
+}
+
+static void bench_symbols(BenchSuite *suite) {
+  Arena arena = arena_alloc(GiB(1));
+  String8 group = str8_lit("symbols");
+  SymbolTrace trace = symbol_trace(&arena, 4096);
+  SymbolTable<U32> table = symbol_table_alloc<U32>(MiB(64));
+
+  U64 expect = symbol_replay_linear(&arena, &trace);
+  bench_check(suite,
+              symbol_replay_hash_map(&arena, &trace) == expect &&
+                  symbol_replay_table(&table, &trace) == expect &&
+                  table.depth == 0,
+              "Scoped lookups disagree on a declaration");
+
+  bench_run(suite, group, str8_lit("linear"), 0, trace.uses, "use", [&] {
+    bench_keep(symbol_replay_linear(&arena, &trace));
+  });
+  bench_run(suite, group, str8_lit("hash_map"), 0, trace.uses, "use", [&] {
+    bench_keep(symbol_replay_hash_map(&arena, &trace));
+  });
+  if (bench_run(suite, group, str8_lit("symbol_table"), 0, trace.uses, "use",
+                [&] { bench_keep(symbol_replay_table(&table, &trace)); }))
+    bench_annotate(suite, "max_depth", table.max_depth);
+
+  symbol_table_release(&table);
+  arena_release(&arena);
+}
@@ -0,0 +1,65 @@
+#include "arena.hpp"
+#include "file.hpp"
+#include "intern.hpp"
+#include "strings.hpp"
+#include <unistd.h>
+
+// Token cache hits against lexing from scratch: token_cache_load over the
+// same inputs bench_lex_workload times perform_lex on. Entries go to a
+// temporary directory that's removed afterwards.
+
+static void bench_token_cache_workload(BenchSuite *suite,
+                                       const LexWorkload &w) {
+  char dir[] = "/tmp/bench-tokens-XXXXXX";
+  if (!mkdtemp(dir))
+    return;
+  Arena arena = arena_alloc(GiB(4));
+  Interner interner = interner_alloc(GiB(1));
+  TokenCache cache = {.dir = dir};
+
+  // Both sides start from an empty interner, so atoms have to agree too.
+  U64 tokens = 0;
+  bool same = true;
+  U64 *hashes = arena_push_array<U64>(suite->arena, w.file_count);
+  for (U64 f = 0; f < w.file_count; ++f) {
+    hashes[f] = str8_hash(w.files[f]);
+    LexResult lexed = perform_lex(&arena, &interner, w.files[f]);
+    tokens += lexed.token_count;
+    same &= token_cache_store(&arena, &interner, &cache, &lexed, hashes[f]);
+    interner_reset(&interner);
+
+    LexResult loaded = {};
+    FileMap map = {};
+    same &= token_cache_load(&arena, &interner, &cache, w.files[f], hashes[f],
+                             &loaded, &map);
+    same &= lex_first_mismatch(&lexed, &loaded) < 0;
+    file_unmap(&map);
+    arena_reset(&arena);
+    interner_reset(&interner);
+  }
+  bench_check(suite, same, "token cache round trip changed the tokens");
+
+  bench_run(suite, str8_lit("lex"),
+            str8_cat(suite->arena, str8_lit("token_cache_load/"), w.name),
+            w.bytes, tokens, "tok", [&] {
+              for (U64 f = 0; f < w.file_count; ++f) {
+                LexResult loaded = {};
+                FileMap map = {};
+                token_cache_load(&arena, &interner, &cache, w.files[f],
+                                 hashes[f], &loaded, &map);
+                bench_keep(loaded.token_count);
+                file_unmap(&map);
+                arena_reset(&arena);
+                interner_reset(&interner);
+              }
+            });
+
+  for (U64 f = 0; f < w.file_count; ++f) {
+    ArenaTemp temp = temp_begin(&arena);
+    unlink((const char *)token_cache_path(&arena, &cache, hashes[f]).str);
+    temp_end(temp);
+  }
+  rmdir(dir);
+  interner_release(&interner);
+  arena_release(&arena);
+}
@@ -0,0 +1,370 @@
+#include "arena.hpp"
+#include "strings.hpp"
+#include "symbol_table.hpp"
+#include <cassert>
+
+// Code generator: walks the AST and drives X64Asm. It's a stack machine
+// over rax. Every value is a 64-bit integer, every local and parameter gets
+// its own 8-byte slot below rbp, and intermediate results are pushed on the
+// machine stack. Nothing clever, but it's direct enough that the output can
+// be checked against the tree by eye with --asm.
+
+enum CodegenError {
+  CODEGEN_OK,
+  CODEGEN_ERROR_UNKNOWN_VARIABLE,
+  CODEGEN_ERROR_UNSUPPORTED,        // Member access, indirect calls, floats
+  CODEGEN_ERROR_TOO_MANY_ARGUMENTS, // More than fit in registers
+  CODEGEN_ERROR_OUTSIDE_LOOP,       // break or continue
+  CODEGEN_ERROR_REDEFINITION,
+};
+
+constexpr String8 codegen_error_to_str8(CodegenError error) {
+  switch (error) {
+  case CODEGEN_OK:
+    return str8_lit("ok");
+  case CODEGEN_ERROR_UNKNOWN_VARIABLE:
+    return str8_lit("Unknown variable");
+  case CODEGEN_ERROR_UNSUPPORTED:
+    return str8_lit("Unsupported expression");
+  case CODEGEN_ERROR_TOO_MANY_ARGUMENTS:
+    return str8_lit("Too many arguments, at most 6 are supported");
+  case CODEGEN_ERROR_OUTSIDE_LOOP:
+    return str8_lit("Not inside a loop");
+  case CODEGEN_ERROR_REDEFINITION:
+    return str8_lit("Function defined twice");
+  }
+  return str8_lit("unknown");
+}
+
+struct CodegenDiagnostic {
+  U32 token;
+  CodegenError error;
+};
+
+// System V integer argument registers, in order.
+static constexpr X64Reg codegen_arg_regs[] = {X64_RDI, X64_RSI, X64_RDX,
+                                              X64_RCX, X64_R8,  X64_R9};
+static constexpr U32 CODEGEN_MAX_ARGS = 6;
+
+struct Codegen {
+  Arena *arena;
+  const Ast *ast;
+  X64Asm as;
+
+  // Variables in scope, to their offset from rbp. A block is a scope.
+  SymbolTable<S32> *locals;
+  S32 next_offset;
+
+  U32 pushed;         // 8-byte values on the stack, for call alignment
+  U32 return_label;   // Epilogue of the current function
+  U32 break_label;    // Innermost loop, only valid if in_loop
+  U32 continue_label; //
+  bool in_loop;
+
+  CodegenDiagnostic *errors;
+  U32 error_count;
+  U32 error_cap;
+};
+
+struct CodegenResult {
+  X64Asm as; // Code, or assembly text in text mode
+  CodegenDiagnostic *errors;
+  U32 error_count;
+};
+
+static void codegen_error(Codegen *g, U32 token, CodegenError error) {
+  if (g->error_count == g->error_cap)
+    g->errors = x64_grow(g->arena, g->errors, g->error_count, &g->error_cap);
+  g->errors[g->error_count++] = {.token = token, .error = error};
+}
+
+static Atom codegen_atom(Codegen *g, U32 token) {
+  const TokenValue *value = lex_value(g->ast->tokens, token);
+  return value ? value->atom : ATOM_NONE;
+}
+
+static S32 codegen_add_local(Codegen *g, U32 token) {
+  g->next_offset -= 8;
+  symbol_declare(g->locals, codegen_atom(g, token), g->next_offset);
+  return g->next_offset;
+}
+
+static void codegen_push(Codegen *g, X64Reg r) {
+  x64_push(&g->as, r);
+  g->pushed++;
+}
+
+static void codegen_pop(Codegen *g, X64Reg r) {
+  x64_pop(&g->as, r);
+  g->pushed--;
+}
+
+// ---- Expressions ----
+
+static void codegen_expression(Codegen *g, NodeIndex i);
+
+static void codegen_call(Codegen *g, const Node *node) {
+  const Node *callee = ast_node(g->ast, node->lhs);
+  const U32 *extra = ast_extra(g->ast, node->rhs);
+  U32 count = extra[0];
+  if (callee->kind != NODE_IDENTIFIER) {
+    codegen_error(g, callee->token, CODEGEN_ERROR_UNSUPPORTED);
+    return;
+  }
+  if (count > CODEGEN_MAX_ARGS) {
+    codegen_error(g, callee->token, CODEGEN_ERROR_TOO_MANY_ARGUMENTS);
+    return;
+  }
+
+  for (U32 a = 0; a < count; ++a) {
+    codegen_expression(g, extra[1 + a]);
+    codegen_push(g, X64_RAX);
+  }
+  for (U32 a = count; a-- > 0;)
+    codegen_pop(g, codegen_arg_regs[a]);
+
+  // rsp is 16-byte aligned after the prologue, each push moves it by 8.
+  bool pad = g->pushed % 2 != 0;
+  if (pad)
+    x64_alu_imm(&g->as, X64_SUB, X64_RSP, 8);
+  x64_zero_eax(&g->as);
+  x64_call(&g->as, x64_symbol(&g->as, lex_source(g->ast->tokens,
+                                                  callee->token)));
+  if (pad)
+    x64_alu_imm(&g->as, X64_ADD, X64_RSP, 8);
+}
+
+// Leaves the value in rax.
+static void codegen_expression(Codegen *g, NodeIndex i) {
+  const Node *node = ast_node(g->ast, i);
+  switch (node->kind) {
+  case NODE_NUMBER: {
+    // Everything is a 64-bit integer so far.
+    const TokenValue *value = lex_value(g->ast->tokens, node->token);
+    if (number_type_is_float(value->num_type)) {
+      codegen_error(g, node->token, CODEGEN_ERROR_UNSUPPORTED);
+      return;
+    }
+    x64_mov_imm(&g->as, X64_RAX, value->num_value);
+  } break;
+  case NODE_IDENTIFIER: {
+    const Symbol<S32> *local =
+        symbol_find(g->locals, codegen_atom(g, node->token));
+    if (!local) {
+      codegen_error(g, node->token, CODEGEN_ERROR_UNKNOWN_VARIABLE);
+      return;
+    }
+    x64_load_local(&g->as, X64_RAX, local->value);
+  } break;
+  case NODE_BINARY: {
+    codegen_expression(g, node->rhs);
+    codegen_push(g, X64_RAX);
+    codegen_expression(g, node->lhs);
+    codegen_pop(g, X64_RCX);
+    switch (lex_kind(g->ast->tokens, node->token)) {
+    case TK_PLUS:
+      x64_alu(&g->as, X64_ADD, X64_RAX, X64_RCX);
+      break;
+    case TK_MINUS:
+      x64_alu(&g->as, X64_SUB, X64_RAX, X64_RCX);
+      break;
+    case TK_STAR:
+      x64_imul(&g->as, X64_RAX, X64_RCX);
+      break;
+    case TK_SLASH:
+      x64_cqo_idiv(&g->as, X64_RCX);
+      break;
+    default:
+      assert(false && "Binary operator the parser doesn't produce");
+    }
+  } break;
+  case NODE_NEGATE:
+    codegen_expression(g, node->lhs);
+    x64_neg(&g->as, X64_RAX);
+    break;
+  case NODE_PLUS:
+    codegen_expression(g, node->lhs);
+    break;
+  case NODE_CALL:
+    codegen_call(g, node);
+    break;
+  case NODE_MEMBER:
+    codegen_error(g, node->token, CODEGEN_ERROR_UNSUPPORTED);
+    break;
+  default:
+    assert(false && "Not an expression");
+  }
+}
+
+// ---- Statements ----
+
+static void codegen_statement(Codegen *g, NodeIndex i) {
+  const Node *node = ast_node(g->ast, i);
+  switch (node->kind) {
+  case NODE_BLOCK:
+    symbol_scope_begin(g->locals);
+    for (U32 c = 0; c < node->rhs; ++c)
+      codegen_statement(g, *ast_extra(g->ast, node->lhs + c));
+    symbol_scope_end(g->locals);
+    break;
+  case NODE_DECL: {
+    // There's no assignment yet, so a local is zero for its whole life.
+    S32 offset = codegen_add_local(g, node->token);
+    x64_zero_eax(&g->as);
+    x64_store_local(&g->as, offset, X64_RAX);
+  } break;
+  case NODE_RETURN:
+    if (node->lhs != NODE_NONE)
+      codegen_expression(g, node->lhs);
+    else
+      x64_zero_eax(&g->as);
+    x64_jump(&g->as, X64_JMP, g->return_label);
+    break;
+  case NODE_EXPR_STMT:
+    codegen_expression(g, node->lhs);
+    break;
+  case NODE_IF: {
+    const U32 *extra = ast_extra(g->ast, node->rhs);
+    U32 otherwise = x64_new_label(&g->as);
+    U32 end = x64_new_label(&g->as);
+    codegen_expression(g, node->lhs);
+    x64_alu(&g->as, X64_TEST, X64_RAX, X64_RAX);
+    x64_jump(&g->as, X64_JE, otherwise);
+    codegen_statement(g, extra[0]);
+    x64_jump(&g->as, X64_JMP, end);
+    x64_place_label(&g->as, otherwise);
+    if (extra[1] != NODE_NONE)
+      codegen_statement(g, extra[1]);
+    x64_place_label(&g->as, end);
+  } break;
+  case NODE_WHILE: {
+    U32 outer_break = g->break_label;
+    U32 outer_continue = g->continue_label;
+    bool outer_in_loop = g->in_loop;
+    g->continue_label = x64_new_label(&g->as);
+    g->break_label = x64_new_label(&g->as);
+    g->in_loop = true;
+
+    x64_place_label(&g->as, g->continue_label);
+    codegen_expression(g, node->lhs);
+    x64_alu(&g->as, X64_TEST, X64_RAX, X64_RAX);
+    x64_jump(&g->as, X64_JE, g->break_label);
+    codegen_statement(g, node->rhs);
+    x64_jump(&g->as, X64_JMP, g->continue_label);
+    x64_place_label(&g->as, g->break_label);
+
+    g->break_label = outer_break;
+    g->continue_label = outer_continue;
+    g->in_loop = outer_in_loop;
+  } break;
+  case NODE_BREAK:
+  case NODE_CONTINUE:
+    if (!g->in_loop) {
+      codegen_error(g, node->token, CODEGEN_ERROR_OUTSIDE_LOOP);
+      break;
+    }
+    x64_jump(&g->as, X64_JMP,
+             node->kind == NODE_BREAK ? g->break_label : g->continue_label);
+    break;
+  case NODE_EMPTY:
+  case NODE_NONE:
+    break;
+  default:
+    assert(false && "Not a statement");
+  }
+}
+
+// ---- Functions ----
+
+// Declarations anywhere in `i`, which is how many slots the frame needs
+// on top of the parameters. Slots aren't reused between sibling blocks.
+static U32 codegen_count_decls(Codegen *g, NodeIndex i) {
+  const Node *node = ast_node(g->ast, i);
+  switch (node->kind) {
+  case NODE_BLOCK: {
+    U32 count = 0;
+    for (U32 c = 0; c < node->rhs; ++c)
+      count += codegen_count_decls(g, *ast_extra(g->ast, node->lhs + c));
+    return count;
+  }
+  case NODE_DECL:
+    return 1;
+  case NODE_IF: {
+    const U32 *extra = ast_extra(g->ast, node->rhs);
+    return codegen_count_decls(g, extra[0]) +
+           codegen_count_decls(g, extra[1]);
+  }
+  case NODE_WHILE:
+    return codegen_count_decls(g, node->rhs);
+  default:
+    return 0;
+  }
+}
+
+static void codegen_function(Codegen *g, const Node *node) {
+  const U32 *extra = ast_extra(g->ast, node->lhs);
+  NodeIndex body = extra[1];
+  U32 param_count = extra[2];
+  if (body == NODE_NONE)
+    return; // Prototype, calls become undefined symbols
+  if (param_count > CODEGEN_MAX_ARGS) {
+    codegen_error(g, node->token, CODEGEN_ERROR_TOO_MANY_ARGUMENTS);
+    return;
+  }
+
+  U32 symbol = x64_symbol(&g->as, lex_source(g->ast->tokens, node->token));
+  if (g->as.symbols[symbol].defined) {
+    codegen_error(g, node->token, CODEGEN_ERROR_REDEFINITION);
+    return;
+  }
+
+  g->next_offset = 0;
+  g->pushed = 0;
+  g->in_loop = false;
+  g->return_label = x64_new_label(&g->as);
+
+  U32 slots = param_count + codegen_count_decls(g, body);
+  S32 frame = (S32)((slots * 8 + 15) & ~15u);
+
+  x64_begin_function(&g->as, symbol);
+  x64_push(&g->as, X64_RBP);
+  x64_mov(&g->as, X64_RBP, X64_RSP);
+  if (frame)
+    x64_alu_imm(&g->as, X64_SUB, X64_RSP, frame);
+  // Parameters get a scope of their own around the body's.
+  symbol_scope_begin(g->locals);
+  for (U32 p = 0; p < param_count; ++p) {
+    const Node *param = ast_node(g->ast, extra[3 + p]);
+    S32 offset = codegen_add_local(g, param->token);
+    x64_store_local(&g->as, offset, codegen_arg_regs[p]);
+  }
+
+  codegen_statement(g, body);
+  symbol_scope_end(g->locals);
+
+  // Falling off the end returns 0, which is what main wants anyway.
+  x64_zero_eax(&g->as);
+  x64_place_label(&g->as, g->return_label);
+  x64_mov(&g->as, X64_RSP, X64_RBP);
+  x64_pop(&g->as, X64_RBP);
+  x64_ret(&g->as);
+  x64_end_function(&g->as, symbol);
+}
+
+// Generates code for every function in `ast`, which must be free of parse
+// errors. In text mode the result holds Intel-syntax assembly instead of
+// machine code. `locals` is scratch, reset here, so a worker can keep one
+// for all its files.
+auto perform_codegen(Arena *arena, SymbolTable<S32> *locals, const Ast *ast,
+                     bool text) -> CodegenResult {
+  symbol_table_reset(locals);
+  Codegen g = {.arena = arena,
+               .ast = ast,
+               .as = x64_begin(arena, text),
+               .locals = locals};
+  const Node *root = ast_node(ast, ast->root);
+  for (U32 i = 0; i < root->rhs; ++i)
+    codegen_function(&g, ast_node(ast, *ast_extra(ast, root->lhs + i)));
+  x64_finish(&g.as);
+  return {.as = g.as, .errors = g.errors, .error_count = g.error_count};
+}
@@ -0,0 +1,178 @@
+#include "arena.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <cassert>
+#include <elf.h>
+
+// Relocatable ELF64 writer for what X64Asm produced. The layout is fixed:
+//
+//   ELF header | .text | .rela.text | .symtab | .strtab | .shstrtab |
+//   section headers
+//
+// plus an empty .note.GNU-stack so the linker doesn't ask for an executable
+// stack. The whole object is sized up front and built in one buffer, so
+// it goes to disk with a single write.
+
+enum ElfSection : U16 {
+  ELF_SECTION_NULL,
+  ELF_SECTION_TEXT,
+  ELF_SECTION_RELA_TEXT,
+  ELF_SECTION_SYMTAB,
+  ELF_SECTION_STRTAB,
+  ELF_SECTION_SHSTRTAB,
+  ELF_SECTION_NOTE_GNU_STACK,
+  ELF_SECTION_COUNT,
+};
+
+// Section names, packed back to back as they appear in .shstrtab.
+static constexpr const char elf_shstrtab[] =
+    "\0.text\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+static constexpr U32 elf_section_names[ELF_SECTION_COUNT] = {0,  1,  7,  18,
+                                                             26, 34, 44};
+
+// Null, the file name and the .text section symbol come before the
+// functions. Locals must precede globals in .symtab.
+static constexpr U32 ELF_FIRST_GLOBAL = 3;
+
+static U64 elf_align(U64 offset, U64 align) {
+  return (offset + align - 1) & ~(align - 1);
+}
+
+static void elf_pad_to(StringBuilder *sb, U64 offset) {
+  assert(sb_size(sb) <= offset && "Section overlaps the previous one");
+  while (sb_size(sb) < offset)
+    sb_append_char(sb, 0);
+}
+
+template <typename T> static void elf_append(StringBuilder *sb, const T &v) {
+  sb_append(sb, str8((U8 *)&v, sizeof(T)));
+}
+
+// `file_name` becomes the STT_FILE symbol, which is what tools print as the
+// object's source.
+String8 elf_from_x64(Arena *arena, const X64Asm *as, String8 file_name) {
+  assert(!as->text && "Text mode has no machine code to wrap");
+
+  U64 strtab_size = 1 + file_name.size + 1;
+  for (U32 i = 0; i < as->symbol_count; ++i)
+    strtab_size += as->symbols[i].name.size + 1;
+  U64 symbol_count = ELF_FIRST_GLOBAL + as->symbol_count;
+
+  U64 text_offset = sizeof(Elf64_Ehdr);
+  U64 rela_offset = elf_align(text_offset + as->code.size, 8);
+  U64 rela_size = as->reloc_count * sizeof(Elf64_Rela);
+  U64 symtab_offset = rela_offset + rela_size;
+  U64 symtab_size = symbol_count * sizeof(Elf64_Sym);
+  U64 strtab_offset = symtab_offset + symtab_size;
+  U64 shstrtab_offset = strtab_offset + strtab_size;
+  U64 headers_offset = elf_align(shstrtab_offset + sizeof(elf_shstrtab), 8);
+  U64 total = headers_offset + ELF_SECTION_COUNT * sizeof(Elf64_Shdr);
+
+  StringBuilder sb = sb_create(arena, total);
+
+  Elf64_Ehdr header = {};
+  memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  header.e_type = ET_REL;
+  header.e_machine = EM_X86_64;
+  header.e_version = EV_CURRENT;
+  header.e_shoff = headers_offset;
+  header.e_ehsize = sizeof(Elf64_Ehdr);
+  header.e_shentsize = sizeof(Elf64_Shdr);
+  header.e_shnum = ELF_SECTION_COUNT;
+  header.e_shstrndx = ELF_SECTION_SHSTRTAB;
+  elf_append(&sb, header);
+
+  sb_append(&sb, str8(as->code.data, as->code.size));
+
+  // Calls only: PLT32 so undefined functions can live in a shared library.
+  elf_pad_to(&sb, rela_offset);
+  for (U32 i = 0; i < as->reloc_count; ++i) {
+    X64Reloc r = as->relocs[i];
+    Elf64_Rela rela = {
+        .r_offset = r.at,
+        .r_info = ELF64_R_INFO(ELF_FIRST_GLOBAL + r.symbol, R_X86_64_PLT32),
+        .r_addend = -4, // rel32 is relative to the end of the instruction
+    };
+    elf_append(&sb, rela);
+  }
+
+  // Names are laid out in .strtab in symbol order.
+  U32 name = 1;
+  elf_append(&sb, Elf64_Sym{});
+  elf_append(&sb, Elf64_Sym{.st_name = name,
+                            .st_info = ELF64_ST_INFO(STB_LOCAL, STT_FILE),
+                            .st_shndx = SHN_ABS});
+  name += (U32)file_name.size + 1;
+  elf_append(&sb, Elf64_Sym{.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION),
+                            .st_shndx = ELF_SECTION_TEXT});
+  for (U32 i = 0; i < as->symbol_count; ++i) {
+    const X64Symbol *s = &as->symbols[i];
+    Elf64_Sym sym = {.st_name = name};
+    if (s->defined) {
+      sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+      sym.st_shndx = ELF_SECTION_TEXT;
+      sym.st_value = s->offset;
+      sym.st_size = s->size;
+    } else {
+      sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+      sym.st_shndx = SHN_UNDEF;
+    }
+    elf_append(&sb, sym);
+    name += (U32)s->name.size + 1;
+  }
+
+  sb_append_char(&sb, 0);
+  sb_append(&sb, file_name);
+  sb_append_char(&sb, 0);
+  for (U32 i = 0; i < as->symbol_count; ++i) {
+    sb_append(&sb, as->symbols[i].name);
+    sb_append_char(&sb, 0);
+  }
+
+  sb_append(&sb, str8((U8 *)elf_shstrtab, sizeof(elf_shstrtab)));
+
+  elf_pad_to(&sb, headers_offset);
+  Elf64_Shdr sections[ELF_SECTION_COUNT] = {};
+  sections[ELF_SECTION_TEXT] = {.sh_type = SHT_PROGBITS,
+                                .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+                                .sh_offset = text_offset,
+                                .sh_size = as->code.size,
+                                .sh_addralign = 16};
+  sections[ELF_SECTION_RELA_TEXT] = {.sh_type = SHT_RELA,
+                                     .sh_flags = SHF_INFO_LINK,
+                                     .sh_offset = rela_offset,
+                                     .sh_size = rela_size,
+                                     .sh_link = ELF_SECTION_SYMTAB,
+                                     .sh_info = ELF_SECTION_TEXT,
+                                     .sh_addralign = 8,
+                                     .sh_entsize = sizeof(Elf64_Rela)};
+  sections[ELF_SECTION_SYMTAB] = {.sh_type = SHT_SYMTAB,
+                                  .sh_offset = symtab_offset,
+                                  .sh_size = symtab_size,
+                                  .sh_link = ELF_SECTION_STRTAB,
+                                  .sh_info = ELF_FIRST_GLOBAL,
+                                  .sh_addralign = 8,
+                                  .sh_entsize = sizeof(Elf64_Sym)};
+  sections[ELF_SECTION_STRTAB] = {.sh_type = SHT_STRTAB,
+                                  .sh_offset = strtab_offset,
+                                  .sh_size = strtab_size,
+                                  .sh_addralign = 1};
+  sections[ELF_SECTION_SHSTRTAB] = {.sh_type = SHT_STRTAB,
+                                    .sh_offset = shstrtab_offset,
+                                    .sh_size = sizeof(elf_shstrtab),
+                                    .sh_addralign = 1};
+  sections[ELF_SECTION_NOTE_GNU_STACK] = {.sh_type = SHT_PROGBITS,
+                                          .sh_offset = headers_offset,
+                                          .sh_addralign = 1};
+  for (U32 i = 0; i < ELF_SECTION_COUNT; ++i) {
+    sections[i].sh_name = elf_section_names[i];
+    elf_append(&sb, sections[i]);
+  }
+
+  assert(sb_size(&sb) == total && "ELF size estimate is off");
+  return sb_to_str8(&sb);
+}
@@ -1,14 +1,15 @@
 #include "arena.hpp"
+#include "intern.hpp"
+#include "perfect_hash.hpp"
 #include "string_builder.hpp"
 #include "strings.hpp"
 #include <cassert>
 #include <cstdio>
-#include <filesystem>
-#include <fstream>
-#include <ios>
-#include <ostream>
 #include <print>
 
+#include "scan.cpp"
+#include "number.cpp"
+
 // TODO: Should probably be in order of precedence
 enum TokenKind {
   // Seperators
@@ -39,21 +40,61 @@ enum TokenKind {
   TK_STRING,
   TK_NUMBER,
 
-  // Keywords
+  // Keywords (C23)
+  TK_KW_ALIGNAS,
+  TK_KW_ALIGNOF,
+  TK_KW_AUTO,
+  TK_KW_BOOL,
+  TK_KW_BREAK,
+  TK_KW_CASE,
+  TK_KW_CHAR,
+  TK_KW_CONST,
+  TK_KW_CONSTEXPR,
+  TK_KW_CONTINUE,
+  TK_KW_DEFAULT,
+  TK_KW_DO,
+  TK_KW_DOUBLE,
+  TK_KW_ELSE,
+  TK_KW_ENUM,
+  TK_KW_EXTERN,
+  TK_KW_FALSE,
+  TK_KW_FLOAT,
+  TK_KW_FOR,
+  TK_KW_GOTO,
+  TK_KW_IF,
+  TK_KW_INLINE,
   TK_KW_INT,
-  TK_KW_VOID,
+  TK_KW_LONG,
+  TK_KW_NULLPTR,
+  TK_KW_REGISTER,
+  TK_KW_RESTRICT,
   TK_KW_RETURN,
-  // TK_AND,
-  // TK_CLASS,
-  // TK_ELSE,
-  // TK_FALSE,
-  // TK_FUN,
-  // TK_FOR,
-  // TK_IF,
-  // TK_NIL,
-  // TK_OR,
-  // TK_RETURN,
-  // TK_WHILE,
+  TK_KW_SHORT,
+  TK_KW_SIGNED,
+  TK_KW_SIZEOF,
+  TK_KW_STATIC,
+  TK_KW_STATIC_ASSERT,
+  TK_KW_STRUCT,
+  TK_KW_SWITCH,
+  TK_KW_THREAD_LOCAL,
+  TK_KW_TRUE,
+  TK_KW_TYPEDEF,
+  TK_KW_TYPEOF,
+  TK_KW_TYPEOF_UNQUAL,
+  TK_KW_UNION,
+  TK_KW_UNSIGNED,
+  TK_KW_VOID,
+  TK_KW_VOLATILE,
+  TK_KW_WHILE,
+  TK_KW_ATOMIC,
+  TK_KW_BITINT,
+  TK_KW_COMPLEX,
+  TK_KW_DECIMAL128,
+  TK_KW_DECIMAL32,
+  TK_KW_DECIMAL64,
+  TK_KW_GENERIC,
+  TK_KW_IMAGINARY,
+  TK_KW_NORETURN,
 
   TK_EOF,
   TK_ERROR,
@@ -90,13 +131,117 @@ constexpr String8 token_kind_to_str8(TokenKind tk) {
   case TK_IDENTIFIER:
     return str8_lit("TK_IDENTIFIER");
   case TK_STRING:
+    return str8_lit("TK_STRING");
   case TK_NUMBER:
+    return str8_lit("TK_NUMBER");
+  case TK_KW_ALIGNAS:
+    return str8_lit("TK_KW_ALIGNAS");
+  case TK_KW_ALIGNOF:
+    return str8_lit("TK_KW_ALIGNOF");
+  case TK_KW_AUTO:
+    return str8_lit("TK_KW_AUTO");
+  case TK_KW_BOOL:
+    return str8_lit("TK_KW_BOOL");
+  case TK_KW_BREAK:
+    return str8_lit("TK_KW_BREAK");
+  case TK_KW_CASE:
+    return str8_lit("TK_KW_CASE");
+  case TK_KW_CHAR:
+    return str8_lit("TK_KW_CHAR");
+  case TK_KW_CONST:
+    return str8_lit("TK_KW_CONST");
+  case TK_KW_CONSTEXPR:
+    return str8_lit("TK_KW_CONSTEXPR");
+  case TK_KW_CONTINUE:
+    return str8_lit("TK_KW_CONTINUE");
+  case TK_KW_DEFAULT:
+    return str8_lit("TK_KW_DEFAULT");
+  case TK_KW_DO:
+    return str8_lit("TK_KW_DO");
+  case TK_KW_DOUBLE:
+    return str8_lit("TK_KW_DOUBLE");
+  case TK_KW_ELSE:
+    return str8_lit("TK_KW_ELSE");
+  case TK_KW_ENUM:
+    return str8_lit("TK_KW_ENUM");
+  case TK_KW_EXTERN:
+    return str8_lit("TK_KW_EXTERN");
+  case TK_KW_FALSE:
+    return str8_lit("TK_KW_FALSE");
+  case TK_KW_FLOAT:
+    return str8_lit("TK_KW_FLOAT");
+  case TK_KW_FOR:
+    return str8_lit("TK_KW_FOR");
+  case TK_KW_GOTO:
+    return str8_lit("TK_KW_GOTO");
+  case TK_KW_IF:
+    return str8_lit("TK_KW_IF");
+  case TK_KW_INLINE:
+    return str8_lit("TK_KW_INLINE");
   case TK_KW_INT:
     return str8_lit("TK_KW_INT");
-  case TK_KW_VOID:
-    return str8_lit("TK_KW_VOID");
+  case TK_KW_LONG:
+    return str8_lit("TK_KW_LONG");
+  case TK_KW_NULLPTR:
+    return str8_lit("TK_KW_NULLPTR");
+  case TK_KW_REGISTER:
+    return str8_lit("TK_KW_REGISTER");
+  case TK_KW_RESTRICT:
+    return str8_lit("TK_KW_RESTRICT");
   case TK_KW_RETURN:
     return str8_lit("TK_KW_RETURN");
+  case TK_KW_SHORT:
+    return str8_lit("TK_KW_SHORT");
+  case TK_KW_SIGNED:
+    return str8_lit("TK_KW_SIGNED");
+  case TK_KW_SIZEOF:
+    return str8_lit("TK_KW_SIZEOF");
+  case TK_KW_STATIC:
+    return str8_lit("TK_KW_STATIC");
+  case TK_KW_STATIC_ASSERT:
+    return str8_lit("TK_KW_STATIC_ASSERT");
+  case TK_KW_STRUCT:
+    return str8_lit("TK_KW_STRUCT");
+  case TK_KW_SWITCH:
+    return str8_lit("TK_KW_SWITCH");
+  case TK_KW_THREAD_LOCAL:
+    return str8_lit("TK_KW_THREAD_LOCAL");
+  case TK_KW_TRUE:
+    return str8_lit("TK_KW_TRUE");
+  case TK_KW_TYPEDEF:
+    return str8_lit("TK_KW_TYPEDEF");
+  case TK_KW_TYPEOF:
+    return str8_lit("TK_KW_TYPEOF");
+  case TK_KW_TYPEOF_UNQUAL:
+    return str8_lit("TK_KW_TYPEOF_UNQUAL");
+  case TK_KW_UNION:
+    return str8_lit("TK_KW_UNION");
+  case TK_KW_UNSIGNED:
+    return str8_lit("TK_KW_UNSIGNED");
+  case TK_KW_VOID:
+    return str8_lit("TK_KW_VOID");
+  case TK_KW_VOLATILE:
+    return str8_lit("TK_KW_VOLATILE");
+  case TK_KW_WHILE:
+    return str8_lit("TK_KW_WHILE");
+  case TK_KW_ATOMIC:
+    return str8_lit("TK_KW_ATOMIC");
+  case TK_KW_BITINT:
+    return str8_lit("TK_KW_BITINT");
+  case TK_KW_COMPLEX:
+    return str8_lit("TK_KW_COMPLEX");
+  case TK_KW_DECIMAL128:
+    return str8_lit("TK_KW_DECIMAL128");
+  case TK_KW_DECIMAL32:
+    return str8_lit("TK_KW_DECIMAL32");
+  case TK_KW_DECIMAL64:
+    return str8_lit("TK_KW_DECIMAL64");
+  case TK_KW_GENERIC:
+    return str8_lit("TK_KW_GENERIC");
+  case TK_KW_IMAGINARY:
+    return str8_lit("TK_KW_IMAGINARY");
+  case TK_KW_NORETURN:
+    return str8_lit("TK_KW_NORETURN");
   case TK_EOF:
     return str8_lit("TK_EOF");
   case TK_ERROR:
@@ -112,158 +257,252 @@ enum LexError {
   LEX_ERROR_INVALID_NUMBER,
   LEX_ERROR_INVALID_CHARACTER,
   LEX_ERROR_UNEXPECTED_EOF,
+  LEX_ERROR_NUMBER_OVERFLOW,
 };
 
 struct Token {
   TokenKind kind;
+  Atom atom; // Interned name for TK_IDENTIFIER, ATOM_NONE otherwise
   String8 source;
-  S64 num_value;
-  // Maybe helpful?
-  //  U64 line
+  S64 num_value; // See TokenValue
+  NumberType num_type;
+  // No line: a LineIndex maps source offsets to line:column on demand.
 };
 
 struct TokenResult {
   Token token;
   LexError maybe_error;
-  String8 error_msg;
+  U32 error_payload; // See TokenError
+};
+
+// Identifier atoms and literal values, kept out of the hot arrays since
+// most tokens are punctuation or keywords.
+struct TokenValue {
+  U32 token; // Index into the stream
+  Atom atom;
+  // TK_NUMBER: integers as two's complement, floating types as F64 bits
+  // (number_f64).
+  S64 num_value;
+  NumberType num_type;
+  U32 reserved; // Keeps the padding defined, the token cache stores these
 };
 
+// A diagnostic is only a record: lex_error_render() writes the message, and
+// works out the line, when someone reports it. Error storms cost 16 bytes per
+// error until then.
+struct TokenError {
+  U32 token;
+  U32 offset; // Of the offending byte
+  LexError error;
+  U32 payload; // The byte, for LEX_ERROR_INVALID_CHARACTER
+};
+
+// Packed token stream: walking it touches 9 bytes per token. Side tables are
+// sorted by token index, so a linear walk can follow them with a cursor.
 struct LexResult {
-  TokenResult *tokens;
-  Size token_count;
+  String8 source;
+  U8 *kinds; // TokenKind
+  U32 *offsets;
+  U32 *lengths;
+  U32 token_count;
+
+  TokenValue *values;
+  U32 value_count;
+  TokenError *errors;
+  U32 error_count;
 };
 
+static_assert(TK_ERROR <= 0xff, "TokenKind must fit the U8 kind array");
+
+// Tokens lexer_peek() can see ahead of lexer_next(). Power of two.
+static constexpr U32 LEXER_LOOKAHEAD = 8;
+
 struct Lexer {
   const String8 input;
   U64 current;
-  U64 line;
-};
+  Interner *interner;
 
-struct KeywordPair {
-  String8 str;
-  TokenKind kind;
+  // Lookahead ring, filled on demand by lexer_peek()/lexer_next().
+  TokenResult ring[LEXER_LOOKAHEAD];
+  U32 ring_head;
+  U32 ring_count;
 };
 
-static KeywordPair keywords[] = {
-    {str8_lit("int"), TK_KW_INT},
-    {str8_lit("void"), TK_KW_VOID},
-    {str8_lit("return"), TK_KW_RETURN},
-    // {str8_lit("main"), TK_CLASS},
-    // {str8_lit("else"), TK_ELSE},   {str8_lit("false"), TK_FALSE},
-    // {str8_lit("fun"), TK_FUN},     {str8_lit("for"), TK_FOR},
-    // {str8_lit("if"), TK_IF},       {str8_lit("nil"), TK_NIL},
-    // {str8_lit("or"), TK_OR},       {str8_lit("return"), TK_RETURN},
-    // {str8_lit("while"), TK_WHILE},
+// Alternate spellings map onto the same kind.
+static constexpr PerfectHashKey<TokenKind> keywords[] = {
+    phash_key("alignas", TK_KW_ALIGNAS),
+    phash_key("alignof", TK_KW_ALIGNOF),
+    phash_key("auto", TK_KW_AUTO),
+    phash_key("bool", TK_KW_BOOL),
+    phash_key("break", TK_KW_BREAK),
+    phash_key("case", TK_KW_CASE),
+    phash_key("char", TK_KW_CHAR),
+    phash_key("const", TK_KW_CONST),
+    phash_key("constexpr", TK_KW_CONSTEXPR),
+    phash_key("continue", TK_KW_CONTINUE),
+    phash_key("default", TK_KW_DEFAULT),
+    phash_key("do", TK_KW_DO),
+    phash_key("double", TK_KW_DOUBLE),
+    phash_key("else", TK_KW_ELSE),
+    phash_key("enum", TK_KW_ENUM),
+    phash_key("extern", TK_KW_EXTERN),
+    phash_key("false", TK_KW_FALSE),
+    phash_key("float", TK_KW_FLOAT),
+    phash_key("for", TK_KW_FOR),
+    phash_key("goto", TK_KW_GOTO),
+    phash_key("if", TK_KW_IF),
+    phash_key("inline", TK_KW_INLINE),
+    phash_key("int", TK_KW_INT),
+    phash_key("long", TK_KW_LONG),
+    phash_key("nullptr", TK_KW_NULLPTR),
+    phash_key("register", TK_KW_REGISTER),
+    phash_key("restrict", TK_KW_RESTRICT),
+    phash_key("return", TK_KW_RETURN),
+    phash_key("short", TK_KW_SHORT),
+    phash_key("signed", TK_KW_SIGNED),
+    phash_key("sizeof", TK_KW_SIZEOF),
+    phash_key("static", TK_KW_STATIC),
+    phash_key("static_assert", TK_KW_STATIC_ASSERT),
+    phash_key("struct", TK_KW_STRUCT),
+    phash_key("switch", TK_KW_SWITCH),
+    phash_key("thread_local", TK_KW_THREAD_LOCAL),
+    phash_key("true", TK_KW_TRUE),
+    phash_key("typedef", TK_KW_TYPEDEF),
+    phash_key("typeof", TK_KW_TYPEOF),
+    phash_key("typeof_unqual", TK_KW_TYPEOF_UNQUAL),
+    phash_key("union", TK_KW_UNION),
+    phash_key("unsigned", TK_KW_UNSIGNED),
+    phash_key("void", TK_KW_VOID),
+    phash_key("volatile", TK_KW_VOLATILE),
+    phash_key("while", TK_KW_WHILE),
+    phash_key("_Atomic", TK_KW_ATOMIC),
+    phash_key("_BitInt", TK_KW_BITINT),
+    phash_key("_Complex", TK_KW_COMPLEX),
+    phash_key("_Decimal128", TK_KW_DECIMAL128),
+    phash_key("_Decimal32", TK_KW_DECIMAL32),
+    phash_key("_Decimal64", TK_KW_DECIMAL64),
+    phash_key("_Generic", TK_KW_GENERIC),
+    phash_key("_Imaginary", TK_KW_IMAGINARY),
+    phash_key("_Noreturn", TK_KW_NORETURN),
+    phash_key("_Alignas", TK_KW_ALIGNAS),
+    phash_key("_Alignof", TK_KW_ALIGNOF),
+    phash_key("_Bool", TK_KW_BOOL),
+    phash_key("_Static_assert", TK_KW_STATIC_ASSERT),
+    phash_key("_Thread_local", TK_KW_THREAD_LOCAL),
 };
 
-constexpr Size keywords_table_size = sizeof(keywords) / sizeof(keywords[0]);
+static constexpr auto keyword_table =
+    perfect_hash_build<8>(keywords, TK_IDENTIFIER);
 
 U8 current_char(Lexer &lexer) { return lexer.input.str[lexer.current]; }
 
 void advance(Lexer &lexer) {
-  if (lexer.current < lexer.input.size) {
-    if (lexer.input.str[lexer.current] == '\n') {
-      lexer.line++;
-    }
+  if (lexer.current < lexer.input.size)
     lexer.current++;
-  }
 }
 
 // Check whether it's a keyword - otherwise it's an identifier
 TokenKind identifier_type(String8 text) {
-  for (Size i = 0; i < keywords_table_size; ++i) {
-    if (str8_match(text, keywords[i].str)) {
-      return keywords[i].kind;
-    }
-  }
-  return TK_IDENTIFIER;
+  return perfect_hash_lookup(keyword_table, text);
 }
 
 TokenResult lex_identifier(Lexer &lexer) {
   U64 start = lexer.current;
-  U64 end = start;
-  while (char_is_alpha(current_char(lexer)) ||
-         char_is_digit(current_char(lexer), 10) || current_char(lexer) == '_') {
-    advance(lexer);
-    ++end;
-  }
+  // Identifiers never span lines, so we can jump straight to the end.
+  U64 end = scanner.identifier(&lexer.input.str[start]) - lexer.input.str;
+  lexer.current = end;
 
   Token token = {.kind = TK_IDENTIFIER,
                  .source = str8(&lexer.input.str[start], end - start)};
   token.kind = identifier_type(token.source); // Check if it's a keyword
+  if (token.kind == TK_IDENTIFIER)
+    token.atom = intern(lexer.interner, token.source);
 
   return {.token = token, .maybe_error = LEX_OK};
 }
 
+// Invalid literals become TK_ERROR. Ones too large for any type are still
+// numbers, with an error on the side.
 TokenResult lex_number(Lexer &lexer) {
   U64 start = lexer.current;
-  U64 end = start;
-
-  while (char_is_digit(current_char(lexer), 10)) {
-    advance(lexer);
-    ++end;
-  }
-
-  // TODO decimal part
-
-  Token t = {
-      .kind = TK_KW_INT,
-      .source = str8(&lexer.input.str[start], end - start),
-      .num_value = 0, // TODO actually parse the num
-  };
-  TokenResult result = {.token = t};
-  return result;
+  U64 end = number_end(&lexer.input.str[start]) - lexer.input.str;
+  lexer.current = end;
+
+  String8 source = str8(&lexer.input.str[start], end - start);
+  Number n = number_parse(source);
+  if (n.status == NUMBER_INVALID)
+    return {.token = {.kind = TK_ERROR, .source = source},
+            .maybe_error = LEX_ERROR_INVALID_NUMBER};
+  return {.token = {.kind = TK_NUMBER,
+                    .source = source,
+                    .num_value = n.value,
+                    .num_type = n.type},
+          .maybe_error = n.status == NUMBER_OVERFLOW
+                             ? LEX_ERROR_NUMBER_OVERFLOW
+                             : LEX_OK};
 }
 
-TokenResult next_token(Arena *arena, Lexer &lexer) {
+TokenResult next_token(Lexer &lexer) {
   // Skip whitespaces
-  while (char_is_whitespace(current_char(lexer))) {
-    if (current_char(lexer) == '\n')
-      ++lexer.line;
-    ++lexer.current;
-  }
+  const U8 *ws_end = scanner.whitespace(&lexer.input.str[lexer.current]);
+  lexer.current = ws_end - lexer.input.str;
 
+  U64 start = lexer.current;
   if (current_char(lexer) == '\0')
-    return {.token = {.kind = TK_EOF}};
+    return {.token = {.kind = TK_EOF,
+                      .source = str8(&lexer.input.str[start], 0)}};
 
   U8 c = current_char(lexer);
   advance(lexer);
+  String8 lexeme = str8(&lexer.input.str[start], 1);
 
+  TokenKind kind;
   switch (c) {
   case '(':
-    return {.token = {.kind = TK_LEFT_PAREN}};
+    kind = TK_LEFT_PAREN;
+    break;
   case ')':
-    return {.token = {.kind = TK_RIGHT_PAREN}};
+    kind = TK_RIGHT_PAREN;
+    break;
   case '{':
-    return {.token = {.kind = TK_LEFT_BRACE}};
+    kind = TK_LEFT_BRACE;
+    break;
   case '}':
-    return {.token = {.kind = TK_RIGHT_BRACE}};
+    kind = TK_RIGHT_BRACE;
+    break;
   case ';':
-    return {.token = {.kind = TK_SEMICOLON}};
+    kind = TK_SEMICOLON;
+    break;
   case ',':
-    return {.token = {.kind = TK_COMMA}};
+    kind = TK_COMMA;
+    break;
   case '.':
-    return {.token = {.kind = TK_DOT}};
+    if (char_is_digit(current_char(lexer), 10)) {
+      lexer.current--;
+      return lex_number(lexer);
+    }
+    kind = TK_DOT;
+    break;
   case '-':
-    return {.token = {.kind = TK_MINUS}};
+    kind = TK_MINUS;
+    break;
   case '+':
-    return {.token = {.kind = TK_PLUS}};
+    kind = TK_PLUS;
+    break;
   case '/':
     // Is a comment, skip the line.
     if (current_char(lexer) == '/') {
-      advance(lexer);
-      printf("HERE: %c\n", current_char(lexer));
-
-      while (current_char(lexer) != '\n' && current_char(lexer) != '\0') {
-        advance(lexer);
-      }
-
-      return next_token(arena, lexer);
+      lexer.current =
+          scanner.line_rest(&lexer.input.str[lexer.current + 1]) -
+          lexer.input.str;
+      return next_token(lexer);
     }
 
-    return {.token = {.kind = TK_SLASH}};
+    kind = TK_SLASH;
+    break;
   case '*':
-    return {.token = {.kind = TK_STAR}};
+    kind = TK_STAR;
+    break;
 
   default:
     if (char_is_digit(c, 10)) {
@@ -276,58 +515,237 @@ TokenResult next_token(Arena *arena, Lexer &lexer) {
       return lex_identifier(lexer);
     }
 
-    StringBuilder sb = sb_create(arena, 1024);
-    sb_append(&sb, str8_lit("Unexpected Character! -> "));
-    sb_appendf(&sb, "\'%c\', found at %lu:%lu", c, (S64)lexer.line,
-               (S64)lexer.current);
+    return {.token = {.kind = TK_ERROR, .source = lexeme},
+            .maybe_error = LEX_ERROR_INVALID_CHARACTER,
+            .error_payload = c};
+  };
 
-    String8 err_str = sb_to_str8(&sb);
+  return {.token = {.kind = kind, .source = lexeme}};
+}
 
-    return {.maybe_error = LEX_ERROR_INVALID_CHARACTER, .error_msg = err_str};
-  };
+// Pull-based lexing: tokens are produced on demand, so only the lookahead
+// ring is live at any time. `input` follows the same rules as perform_lex.
+Lexer lexer_begin(Interner *interner, String8 input) {
+  return {.input = input, .current = 0, .interner = interner};
+}
+
+// Returns the token `k` positions ahead of the next one (k = 0 is the next
+// token). Valid until the following lexer_next(). Past the end every token is
+// TK_EOF.
+const TokenResult *lexer_peek(Lexer &lexer, U32 k) {
+  assert(k < LEXER_LOOKAHEAD && "Lookahead exceeds the ring");
+  while (lexer.ring_count <= k) {
+    U32 slot = (lexer.ring_head + lexer.ring_count) & (LEXER_LOOKAHEAD - 1);
+    lexer.ring[slot] = next_token(lexer);
+    lexer.ring_count++;
+  }
+  return &lexer.ring[(lexer.ring_head + k) & (LEXER_LOOKAHEAD - 1)];
+}
+
+TokenResult lexer_next(Lexer &lexer) {
+  if (lexer.ring_count == 0)
+    return next_token(lexer);
+
+  TokenResult result = lexer.ring[lexer.ring_head];
+  lexer.ring_head = (lexer.ring_head + 1) & (LEXER_LOOKAHEAD - 1);
+  lexer.ring_count--;
+  return result;
 }
 
-auto perform_lex(Arena *arena, const char *file_name) -> LexResult {
-  auto s = scratch_begin(&arena, 1);
-  std::ifstream f(file_name);
+// Whether a token carries an entry in LexResult::values.
+static bool token_has_value(const Token &token) {
+  return token.kind == TK_IDENTIFIER || token.kind == TK_NUMBER;
+}
 
-  assert(f.is_open());
+// Grows the packed arrays by copying them into fresh arena space. Old copies
+// are left behind, which costs at most as much again as the final stream.
+struct LexBuilder {
+  LexResult result;
+  U32 token_cap;
+  U32 value_cap;
+  U32 error_cap;
+};
 
-  U64 size = std::filesystem::file_size(file_name);
+template <typename T>
+static T *lex_grow_array(Arena *arena, T *items, U32 count,
+                         U32 new_cap ARENA_SITE_PARAM) {
+  T *grown = arena_push_array<T>(arena, new_cap ARENA_SITE_ARG);
+  if (count)
+    memcpy(grown, items, count * sizeof(T));
+  return grown;
+}
 
-  U8 *b = arena_push_array<U8>(s.arena, size + 1);
-  if (!f.read(reinterpret_cast<char *>(b), size)) {
-    assert(false && "Couldn't read from file");
+static void lex_builder_push(Arena *arena, LexBuilder *b,
+                             const TokenResult &r) {
+  LexResult *out = &b->result;
+  if (out->token_count == b->token_cap) {
+    U32 cap = b->token_cap ? b->token_cap * 2 : 1024;
+    out->kinds = lex_grow_array(arena, out->kinds, out->token_count, cap);
+    out->offsets = lex_grow_array(arena, out->offsets, out->token_count, cap);
+    out->lengths = lex_grow_array(arena, out->lengths, out->token_count, cap);
+    b->token_cap = cap;
   }
 
-  String8 str = str8(b, size);
-  Lexer lexer = {.input = str, .current = 0, .line = 0};
+  U32 index = out->token_count++;
+  out->kinds[index] = (U8)r.token.kind;
+  out->offsets[index] = (U32)(r.token.source.str - out->source.str);
+  out->lengths[index] = (U32)r.token.source.size;
 
-  // Token *tokens_start = arena_push<Token>(arena);
-  // Size token_count = 0;
-
-  LexResult lex_result = {
-      .tokens = nullptr,
-      .token_count = 0,
-  };
+  if (token_has_value(r.token)) {
+    if (out->value_count == b->value_cap) {
+      U32 cap = b->value_cap ? b->value_cap * 2 : 256;
+      out->values = lex_grow_array(arena, out->values, out->value_count, cap);
+      b->value_cap = cap;
+    }
+    out->values[out->value_count++] = {.token = index,
+                                       .atom = r.token.atom,
+                                       .num_value = r.token.num_value,
+                                       .num_type = r.token.num_type};
+  }
 
-  while (true) {
+  if (r.maybe_error != LEX_OK) {
+    if (out->error_count == b->error_cap) {
+      U32 cap = b->error_cap ? b->error_cap * 2 : 16;
+      out->errors = lex_grow_array(arena, out->errors, out->error_count, cap);
+      b->error_cap = cap;
+    }
+    out->errors[out->error_count++] = {.token = index,
+                                       .offset = out->offsets[index],
+                                       .error = r.maybe_error,
+                                       .payload = r.error_payload};
+  }
+}
 
-    TokenResult result = next_token(s.arena, lexer);
+// Lexes `input` in place. `input` must be '\0' terminated (e.g. a
+// SourceFile's contents) and outlive the result, token sources slice into it.
+// Identifiers are interned into `interner`, which can be shared across files.
+// Materializes the whole stream, stages that can consume tokens as they come
+// should pull from a Lexer instead.
+auto perform_lex(Arena *arena, Interner *interner, String8 input)
+    -> LexResult {
+  assert(input.size < 0xffffffffull && "Offsets are 32 bits");
+  Lexer lexer = lexer_begin(interner, input);
 
-    TokenResult *t = arena_push<TokenResult>(arena);
-    if (lex_result.tokens == nullptr)
-      lex_result.tokens = t;
+  LexBuilder builder = {.result = {.source = input}};
 
-    *t = result;
-    lex_result.token_count++;
+  while (true) {
+    TokenResult result = lexer_next(lexer);
+    lex_builder_push(arena, &builder, result);
 
     if (result.token.kind == TK_EOF)
       break;
   }
 
-  scratch_end(s);
-  f.close();
+  return builder.result;
+}
+
+inline TokenKind lex_kind(const LexResult *lex, U32 i) {
+  return (TokenKind)lex->kinds[i];
+}
+
+inline String8 lex_source(const LexResult *lex, U32 i) {
+  return str8(lex->source.str + lex->offsets[i], lex->lengths[i]);
+}
+
+// Index of the first side table entry for `token` or any later token.
+template <typename T>
+static U32 lex_side_lower_bound(const T *items, U32 count, U32 token) {
+  U32 lo = 0, hi = count;
+  while (lo < hi) {
+    U32 mid = lo + (hi - lo) / 2;
+    if (items[mid].token < token)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Random access into the side tables, nullptr if the token has no entry.
+// Linear walks should keep a cursor instead.
+template <typename T>
+static const T *lex_side_lookup(const T *items, U32 count, U32 token) {
+  U32 i = lex_side_lower_bound(items, count, token);
+  return i < count && items[i].token == token ? &items[i] : nullptr;
+}
+
+const TokenValue *lex_value(const LexResult *lex, U32 i) {
+  return lex_side_lookup(lex->values, lex->value_count, i);
+}
+
+const TokenError *lex_error(const LexResult *lex, U32 i) {
+  return lex_side_lookup(lex->errors, lex->error_count, i);
+}
+
+// ---- Diagnostics ----
+
+// Where each line of a source starts, built in one vectorized pass once a
+// report needs line:column. Lexing never tracks lines.
+struct LineIndex {
+  U32 *starts; // starts[0] is 0
+  U32 count;
+};
+
+// Both from 1.
+struct LineColumn {
+  U32 line;
+  U32 column;
+};
+
+static LineIndex line_index_build(Arena *arena, String8 source) {
+  assert(source.size < 0xffffffffull && "Offsets are 32 bits");
+  U64 lines = scanner.newline_count(source.str, source.size) + 1;
+  LineIndex index = {.starts = arena_push_array<U32>(arena, lines),
+                     .count = (U32)lines};
+  index.starts[0] = 0;
+  scanner.newline_ends(source.str, source.size, index.starts + 1);
+  return index;
+}
+
+static LineColumn line_index_lookup(const LineIndex *index, U64 offset) {
+  // The last line starting at or before `offset`.
+  U32 lo = 0, hi = index->count;
+  while (hi - lo > 1) {
+    U32 mid = lo + (hi - lo) / 2;
+    if (index->starts[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return {.line = lo + 1, .column = (U32)(offset - index->starts[lo]) + 1};
+}
+
+static String8 lex_error_to_str8(LexError error) {
+  switch (error) {
+  case LEX_OK:
+    return str8_lit("No error");
+  case LEX_ERROR_IO:
+    return str8_lit("Could not read the file");
+  case LEX_ERROR_UNTERMINATED_STRING:
+    return str8_lit("Unterminated string");
+  case LEX_ERROR_INVALID_NUMBER:
+    return str8_lit("Invalid number");
+  case LEX_ERROR_INVALID_CHARACTER:
+    return str8_lit("Unexpected Character!");
+  case LEX_ERROR_UNEXPECTED_EOF:
+    return str8_lit("Unexpected end of file");
+  case LEX_ERROR_NUMBER_OVERFLOW:
+    return str8_lit("Number too large for its type");
+  }
+  return str8_lit("Unknown error");
+}
+
+// The message for `e` alone, for callers that know better where it is.
+inline void lex_error_render_message(StringBuilder *sb, const TokenError &e) {
+  sb_append(sb, lex_error_to_str8(e.error));
+  if (e.error == LEX_ERROR_INVALID_CHARACTER)
+    sb_format(sb, " -> '{}'", (char)e.payload);
+}
 
-  return lex_result;
+// The message for `e`, with `lines` built over the lexed source.
+inline void lex_error_render(StringBuilder *sb, const LineIndex *lines,
+                             const TokenError &e) {
+  LineColumn at = line_index_lookup(lines, e.offset);
+  lex_error_render_message(sb, e);
+  sb_format(sb, ", found at {}:{}", at.line, at.column);
 }
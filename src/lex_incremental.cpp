@@ -0,0 +1,182 @@
+#include "arena.hpp"
+#include "intern.hpp"
+#include "strings.hpp"
+#include <cassert>
+#include <cstring>
+
+// Incremental re-lexing after edits, for editors and watch mode. Lexer state
+// is just the position, so the old stream stays valid up to the last token
+// whose lookahead ends before an edit. From there we lex the new input until
+// a token starts where an old one did past the edit; everything after that
+// is the old stream again, shifted by the size change. Lexing costs as much
+// as the damage, the rest is copying.
+
+struct LexEdit {
+  U32 offset;   // Into the old input
+  U32 removed;  // Bytes of old input replaced
+  U32 inserted; // Bytes of new input that replaced them
+};
+
+struct RelexStats {
+  U32 relexed; // Tokens lexed from the new input
+  U32 reused;  // Tokens copied from the old stream
+};
+
+static void relex_reserve(Arena *arena, LexBuilder *b, U32 tokens,
+                          U32 values, U32 errors) {
+  LexResult *out = &b->result;
+  if (out->token_count + tokens > b->token_cap) {
+    U32 cap = b->token_cap ? b->token_cap : 1024;
+    while (cap < out->token_count + tokens)
+      cap *= 2;
+    out->kinds = lex_grow_array(arena, out->kinds, out->token_count, cap);
+    out->offsets = lex_grow_array(arena, out->offsets, out->token_count, cap);
+    out->lengths = lex_grow_array(arena, out->lengths, out->token_count, cap);
+    b->token_cap = cap;
+  }
+  if (out->value_count + values > b->value_cap) {
+    U32 cap = b->value_cap ? b->value_cap : 256;
+    while (cap < out->value_count + values)
+      cap *= 2;
+    out->values = lex_grow_array(arena, out->values, out->value_count, cap);
+    b->value_cap = cap;
+  }
+  if (out->error_count + errors > b->error_cap) {
+    U32 cap = b->error_cap ? b->error_cap : 16;
+    while (cap < out->error_count + errors)
+      cap *= 2;
+    out->errors = lex_grow_array(arena, out->errors, out->error_count, cap);
+    b->error_cap = cap;
+  }
+}
+
+// Appends old tokens [first, end) moved by `delta` bytes.
+static void relex_copy(Arena *arena, LexBuilder *b, const LexResult *old,
+                       U32 first, U32 end, S64 delta) {
+  if (first >= end)
+    return;
+  U32 v = lex_side_lower_bound(old->values, old->value_count, first);
+  U32 v_end = lex_side_lower_bound(old->values, old->value_count, end);
+  U32 e = lex_side_lower_bound(old->errors, old->error_count, first);
+  U32 e_end = lex_side_lower_bound(old->errors, old->error_count, end);
+  relex_reserve(arena, b, end - first, v_end - v, e_end - e);
+
+  LexResult *out = &b->result;
+  U32 base = out->token_count;
+  U32 count = end - first;
+  memcpy(out->kinds + base, old->kinds + first, count);
+  memcpy(out->lengths + base, old->lengths + first, count * 4ull);
+  if (delta == 0) {
+    memcpy(out->offsets + base, old->offsets + first, count * 4ull);
+  } else {
+    for (U32 t = 0; t < count; ++t)
+      out->offsets[base + t] = (U32)((S64)old->offsets[first + t] + delta);
+  }
+  out->token_count += count;
+
+  for (; v < v_end; ++v) {
+    TokenValue value = old->values[v];
+    value.token = base + (value.token - first);
+    out->values[out->value_count++] = value;
+  }
+  for (; e < e_end; ++e) {
+    TokenError error = old->errors[e];
+    error.token = base + (error.token - first);
+    error.offset = (U32)((S64)error.offset + delta);
+    out->errors[out->error_count++] = error;
+  }
+}
+
+// First old token at or after `from` whose lookahead reaches `offset`. A
+// token looks one byte past its end to know where it stops.
+static U32 relex_first_touched(const LexResult *old, U32 from, U64 offset) {
+  U32 lo = from, hi = old->token_count;
+  while (lo < hi) {
+    U32 mid = lo + (hi - lo) / 2;
+    if ((U64)old->offsets[mid] + old->lengths[mid] < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Re-lexes `input`, which is `old->source` with `edits` applied. Edits are
+// in old input offsets, sorted and non-overlapping. Identifiers are
+// interned into `interner`, which must be the one `old` was lexed with so
+// atoms carry over. `input` follows the same rules as perform_lex.
+auto perform_relex(Arena *arena, Interner *interner, const LexResult *old,
+                   String8 input, const LexEdit *edits, U32 edit_count,
+                   RelexStats *stats = nullptr) -> LexResult {
+  assert(input.size < 0xffffffffull && "Offsets are 32 bits");
+  S64 total_delta = 0;
+  for (U32 n = 0; n < edit_count; ++n) {
+    assert((n == 0 || edits[n].offset >= edits[n - 1].offset +
+                                              edits[n - 1].removed) &&
+           "Edits must be sorted and not overlap");
+    total_delta += (S64)edits[n].inserted - edits[n].removed;
+  }
+  assert((S64)old->source.size + total_delta == (S64)input.size &&
+         "Edits don't describe the new input");
+
+  LexBuilder b = {.result = {.source = input}};
+  relex_reserve(arena, &b, old->token_count + 64, old->value_count + 16,
+                old->error_count);
+  RelexStats s = {};
+
+  U32 i = 0;     // Next old token to reuse
+  S64 delta = 0; // New minus old position, past the edits handled so far
+  U32 n = 0;     // Next edit
+  bool done = false;
+  while (n < edit_count && !done) {
+    U32 k = relex_first_touched(old, i, edits[n].offset);
+    relex_copy(arena, &b, old, i, k, delta);
+    s.reused += k - i;
+    U64 restart = k > i ? (U64)old->offsets[k - 1] + old->lengths[k - 1]
+                  : i > 0 ? old->offsets[i]
+                          : 0;
+
+    Lexer lexer = lexer_begin(interner, input);
+    lexer.current = (U64)((S64)restart + delta);
+    U32 j = k; // Old tokens that might start where a new one does
+    U64 edited_end = 0; // New position past the last absorbed edit
+    while (true) {
+      TokenResult r = next_token(lexer);
+      U64 start = (U64)(r.token.source.str - input.str);
+      U64 end = start + r.token.source.size;
+
+      // Pull in every edit the token's lookahead reaches.
+      while (n < edit_count && (S64)end - delta >= (S64)edits[n].offset) {
+        edited_end = (U64)((S64)edits[n].offset + delta) + edits[n].inserted;
+        delta += (S64)edits[n].inserted - edits[n].removed;
+        n++;
+      }
+
+      if (start >= edited_end && r.token.kind != TK_EOF) {
+        U64 old_start = (U64)((S64)start - delta);
+        while (j < old->token_count && old->offsets[j] < old_start)
+          j++;
+        if (j < old->token_count && old->offsets[j] == old_start &&
+            old->kinds[j] != TK_EOF) {
+          i = j;
+          break;
+        }
+      }
+
+      lex_builder_push(arena, &b, r);
+      s.relexed++;
+      if (r.token.kind == TK_EOF) {
+        done = true;
+        break;
+      }
+    }
+  }
+
+  if (!done) {
+    relex_copy(arena, &b, old, i, old->token_count, delta);
+    s.reused += old->token_count - i;
+  }
+  if (stats)
+    *stats = s;
+  return b.result;
+}
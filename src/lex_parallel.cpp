@@ -0,0 +1,291 @@
+#include "arena.hpp"
+#include "intern.hpp"
+#include "strings.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Parallel lexing for very large inputs. The input is cut into chunks that
+// are lexed speculatively, each with its own arena and interner. A chunk may
+// start inside a comment or a token, so the chunks are then stitched in order:
+// starting from where the previous chunk really ended, we re-lex until we hit
+// a token start the chunk also produced. Lexer state is just the position, so
+// from there on the chunk's tokens are exactly what the serial lexer would
+// have produced.
+
+struct ParallelLexOptions {
+  U32 jobs;
+  U64 min_chunk_size; // Inputs smaller than two chunks are lexed serially
+  U64 max_chunks;
+  // Start chunks right after a '\n'. With the current grammar that's always a
+  // token boundary, so stitching never has to re-lex. A chunk with no '\n'
+  // before the next split point is cut at the byte instead.
+  bool split_at_newlines;
+};
+
+struct LexChunk {
+  U64 start;
+  U64 end;
+
+  Arena arena;
+  Interner interner;
+  LexBuilder builder;
+
+  // Lexer state right before the first token that starts at or after `end`.
+  U64 tail_pos;
+};
+
+// A run of stitched tokens: a slice of a chunk's stream or of the tokens
+// re-lexed while resynchronizing.
+struct LexSegment {
+  const LexResult *from;
+  U32 first;
+  U32 count;
+};
+
+static void lex_chunk(String8 input, LexChunk *chunk, bool last) {
+  U64 size = chunk->end - chunk->start;
+  // Sized for typical code, chained for junk where every byte is an error.
+  chunk->arena =
+      arena_alloc_params({.reserve = size * 64 + MiB(1),
+                          .commit_chunk = ARENA_DEFAULT_COMMIT_CHUNK,
+                          .decommit_above = ARENA_DEFAULT_DECOMMIT_ABOVE,
+                          .flags = ARENA_FLAG_CHAIN});
+  arena_profile_label(&chunk->arena, "lex-chunk");
+  // Chained too: input that's all distinct identifiers needs several times
+  // its size in atom and probe tables.
+  chunk->interner =
+      interner_alloc_params({.reserve = size * 8 + MiB(1),
+                             .commit_chunk = ARENA_DEFAULT_COMMIT_CHUNK,
+                             .decommit_above = ARENA_DEFAULT_DECOMMIT_ABOVE,
+                             .flags = ARENA_FLAG_CHAIN});
+  chunk->builder = {.result = {.source = input}};
+
+  Lexer lexer = lexer_begin(&chunk->interner, input);
+  lexer.current = chunk->start;
+
+  while (true) {
+    U64 pos = lexer.current;
+    TokenResult r = next_token(lexer);
+    U64 token_start = r.token.source.str - input.str;
+    if (!last && token_start >= chunk->end) {
+      chunk->tail_pos = pos;
+      return;
+    }
+
+    lex_builder_push(&chunk->arena, &chunk->builder, r);
+    if (r.token.kind == TK_EOF) {
+      chunk->tail_pos = lexer.current;
+      return;
+    }
+  }
+}
+
+// Runs `fn` on `threads` threads (including the caller) and waits for them.
+template <typename F> static void run_on_threads(U32 threads, F &&fn) {
+  std::vector<std::thread> pool;
+  for (U32 t = 1; t < threads; ++t)
+    pool.emplace_back(fn);
+  fn();
+  for (auto &t : pool)
+    t.join();
+}
+
+// Moves a chunk's atoms into the shared interner for every identifier from
+// token `first` on. Called in stream order, so atoms come out numbered the
+// same way the serial lexer numbers them.
+static void remap_chunk_atoms(Arena *arena, Interner *interner,
+                              LexChunk *chunk, U32 first) {
+  LexResult *tokens = &chunk->builder.result;
+  Atom *map = arena_push_array_zero<Atom>(arena, chunk->interner.atom_count);
+  U32 v = lex_side_lower_bound(tokens->values, tokens->value_count, first);
+  for (; v < tokens->value_count; ++v) {
+    Atom local = tokens->values[v].atom;
+    if (local == ATOM_NONE)
+      continue;
+    if (map[local] == ATOM_NONE)
+      map[local] = intern(interner, atom_str8(&chunk->interner, local));
+    tokens->values[v].atom = map[local];
+  }
+}
+
+// Same result as perform_lex, atoms included. Falls back to it for small
+// inputs.
+auto perform_lex_parallel(Arena *arena, Interner *interner, String8 input,
+                          ParallelLexOptions opts) -> LexResult {
+  U64 min_chunk = opts.min_chunk_size ? opts.min_chunk_size : 1;
+  U64 chunk_count = input.size / min_chunk;
+  if (chunk_count > opts.max_chunks)
+    chunk_count = opts.max_chunks;
+  if (opts.jobs <= 1 || chunk_count < 2)
+    return perform_lex(arena, interner, input);
+  assert(input.size < 0xffffffffull && "Offsets are 32 bits");
+
+  // ---- Split ----
+  LexChunk *chunks = arena_push_array_zero<LexChunk>(arena, chunk_count);
+  U64 prev_end = 0;
+  for (U64 c = 0; c < chunk_count; ++c) {
+    U64 end = input.size * (c + 1) / chunk_count;
+    if (opts.split_at_newlines && end < input.size) {
+      // Only as far as the next split point, so a file with few newlines
+      // still gets split.
+      U64 limit = input.size * (c + 2) / chunk_count;
+      const U8 *nl = (const U8 *)memchr(input.str + end, '\n', limit - end);
+      if (nl)
+        end = (U64)(nl - input.str) + 1;
+    }
+    if (end < prev_end)
+      end = prev_end;
+    chunks[c].start = prev_end;
+    chunks[c].end = end;
+    prev_end = end;
+  }
+
+  U32 threads = opts.jobs < chunk_count ? opts.jobs : (U32)chunk_count;
+  std::atomic<U64> next_chunk = 0;
+
+  // ---- Speculative lexing ----
+  run_on_threads(threads, [&] {
+    for (U64 c; (c = next_chunk.fetch_add(1)) < chunk_count;)
+      lex_chunk(input, &chunks[c], c + 1 == chunk_count);
+  });
+
+  // ---- Stitch ----
+  // Re-lexed tokens go into `resync`, already interned into `interner`.
+  LexBuilder resync = {.result = {.source = input}};
+  LexSegment *segments = arena_push_array<LexSegment>(arena, chunk_count * 2);
+  U64 segment_count = 0;
+
+  U64 pos = 0;
+  bool done = false;
+  for (U64 c = 0; c < chunk_count && !done; ++c) {
+    LexChunk *chunk = &chunks[c];
+    const LexResult *tokens = &chunk->builder.result;
+    bool last = c + 1 == chunk_count;
+
+    U32 j = 0;
+    U32 resync_first = resync.result.token_count;
+    bool synced = pos == chunk->start;
+    Lexer lexer = lexer_begin(interner, input);
+    lexer.current = pos;
+    while (!synced) {
+      U64 before = lexer.current;
+      TokenResult r = next_token(lexer);
+      U64 token_start = r.token.source.str - input.str;
+      if (!last && token_start >= chunk->end) {
+        // Went through the whole chunk without meeting it, leave the token
+        // for the next one.
+        lexer.current = before;
+        break;
+      }
+
+      while (j < tokens->token_count && tokens->offsets[j] < token_start)
+        ++j;
+      if (j < tokens->token_count && tokens->offsets[j] == token_start) {
+        synced = true;
+        break;
+      }
+
+      lex_builder_push(arena, &resync, r);
+      if (r.token.kind == TK_EOF) {
+        done = true;
+        break;
+      }
+    }
+
+    U32 resynced = resync.result.token_count - resync_first;
+    if (resynced)
+      segments[segment_count++] = {&resync.result, resync_first, resynced};
+
+    if (synced) {
+      U32 count = tokens->token_count - j;
+      remap_chunk_atoms(arena, interner, chunk, j);
+      segments[segment_count++] = {tokens, j, count};
+      pos = chunk->tail_pos;
+      done = count && tokens->kinds[tokens->token_count - 1] == TK_EOF;
+    } else {
+      pos = lexer.current;
+    }
+  }
+
+  // ---- Flatten ----
+  U64 total = 0, value_total = 0, error_total = 0;
+  for (U64 s = 0; s < segment_count; ++s) {
+    total += segments[s].count;
+    value_total += segments[s].from->value_count;
+    error_total += segments[s].from->error_count;
+  }
+
+  LexResult out = {.source = input};
+  out.kinds = arena_push_array<U8>(arena, total);
+  out.offsets = arena_push_array<U32>(arena, total);
+  out.lengths = arena_push_array<U32>(arena, total);
+  out.values = arena_push_array<TokenValue>(arena, value_total);
+  out.errors = arena_push_array<TokenError>(arena, error_total);
+
+  for (U64 s = 0; s < segment_count; ++s) {
+    const LexSegment &seg = segments[s];
+    const LexResult *from = seg.from;
+    U32 base = out.token_count;
+    U32 end = seg.first + seg.count;
+    memcpy(out.kinds + base, from->kinds + seg.first, seg.count);
+    memcpy(out.offsets + base, from->offsets + seg.first, seg.count * 4);
+    memcpy(out.lengths + base, from->lengths + seg.first, seg.count * 4);
+    out.token_count += seg.count;
+
+    U32 v = lex_side_lower_bound(from->values, from->value_count, seg.first);
+    for (; v < from->value_count && from->values[v].token < end; ++v) {
+      TokenValue value = from->values[v];
+      value.token = base + (value.token - seg.first);
+      out.values[out.value_count++] = value;
+    }
+
+    U32 e = lex_side_lower_bound(from->errors, from->error_count, seg.first);
+    for (; e < from->error_count && from->errors[e].token < end; ++e) {
+      TokenError error = from->errors[e];
+      error.token = base + (error.token - seg.first);
+      out.errors[out.error_count++] = error;
+    }
+  }
+
+  for (U64 c = 0; c < chunk_count; ++c) {
+    interner_release(&chunks[c].interner);
+    arena_release(&chunks[c].arena);
+  }
+
+  return out;
+}
+
+// Index of the first token where two streams differ, or -1 if they match.
+// Used to check the parallel lexer against the serial one.
+S64 lex_first_mismatch(const LexResult *a, const LexResult *b) {
+  U32 count = a->token_count < b->token_count ? a->token_count : b->token_count;
+  for (U32 i = 0; i < count; ++i) {
+    if (a->kinds[i] != b->kinds[i] || a->offsets[i] != b->offsets[i] ||
+        a->lengths[i] != b->lengths[i])
+      return i;
+  }
+  if (a->token_count != b->token_count)
+    return count;
+
+  if (a->value_count != b->value_count)
+    return 0;
+  for (U32 i = 0; i < a->value_count; ++i) {
+    const TokenValue &x = a->values[i], &y = b->values[i];
+    if (x.token != y.token || x.atom != y.atom ||
+        x.num_value != y.num_value || x.num_type != y.num_type)
+      return x.token < y.token ? x.token : y.token;
+  }
+
+  if (a->error_count != b->error_count)
+    return 0;
+  for (U32 i = 0; i < a->error_count; ++i) {
+    const TokenError &x = a->errors[i], &y = b->errors[i];
+    if (x.token != y.token || x.offset != y.offset || x.error != y.error ||
+        x.payload != y.payload)
+      return x.token < y.token ? x.token : y.token;
+  }
+  return -1;
+}
@@ -1,102 +1,927 @@
 #include "arena.hpp"
+#include "file.hpp"
 #include "string_builder.hpp"
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
 #include <print>
+#include <sched.h>
+#include <spawn.h>
 #include <string_view>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
 #include <vector>
 
 #include "lex.cpp"
+#include "lex_parallel.cpp"
+#include "lex_incremental.cpp"
+#include "token_cache.cpp"
+#include "parse.cpp"
+#include "source.cpp"
+#include "preprocess.cpp"
+#include "x64.cpp"
+#include "codegen.cpp"
+#include "elf.cpp"
+#include "server.cpp"
 
-enum Stage { LEX, PARSE, CODEGEN, ALL };
+// New stages go last: the number is part of every output header.
+enum Stage { LEX, PARSE, CODEGEN, ALL, PREPROCESS };
 
-auto main(int argc, char *argv[]) -> int {
-  scratch_init_and_equip();
-  auto arena = arena_alloc(GiB(4));
+struct Options {
+  Stage stage;
+  bool show_stats;
+  U32 jobs;
+  U32 lex_jobs;    // Threads used to lex a single file
+  bool verify_lex; // Check the parallel lexer against the serial one
+  bool mem_stats;  // Per-arena allocation report, needs ARENA_PROFILE
+  bool emit_asm;   // Print assembly instead of writing objects
+  U32 error_limit; // Diagnostics shown per file, 0 for all
+  std::vector<const char *> include_dirs; // -I
+  std::vector<const char *> defines;      // -D, NAME or NAME=value
+  const char *token_cache_dir;            // --token-cache, off if null
+  const char *server_socket;              // --server
+};
 
-  if (argc < 2) {
-    std::println("Wrong arguments {}", argc);
-    return 1;
+// Per-thread state for compiling files back to back. Everything is reset
+// between files rather than remapped.
+struct Worker {
+  Arena arena;
+  Interner interner;
+  IncludeCache *includes;  // Shared by the whole batch
+  TokenCache *tokens;      // Ditto
+  FileMap token_map;       // Backs the current file's tokens on a cache hit
+  SymbolTable<S32> locals; // Codegen's, reset for each file
+};
+
+// What one file produced. Kept in the worker's arena until it's this file's
+// turn to be written out, so batch output comes out in input order.
+struct FileOutput {
+  StringBuilder out;
+  StringBuilder err;
+  bool had_errors;
+};
+
+static Worker worker_alloc() {
+  // Chained so one huge file can't exhaust it, and reset between files
+  // hands anything above the decommit mark back to the OS.
+  Arena arena = arena_alloc_params({.reserve = GiB(4),
+                                    .commit_chunk = ARENA_DEFAULT_COMMIT_CHUNK,
+                                    .decommit_above = MiB(64),
+                                    .flags = ARENA_FLAG_CHAIN});
+  arena_profile_label(&arena, "worker");
+  return {.arena = arena,
+          .interner = interner_alloc(GiB(1)),
+          .locals = symbol_table_alloc<S32>(MiB(64))};
+}
+
+static void worker_release(Worker *w) {
+  symbol_table_release(&w->locals);
+  interner_release(&w->interner);
+  arena_release(&w->arena);
+}
+
+// ---- Diagnostics ----
+//
+// Past --error-limit a file's diagnostics are only counted, and a file whose
+// lexer alone went past it isn't parsed: on junk input every byte can be an
+// error, and nobody reads the 10000th one.
+
+static bool over_error_limit(const Options &opts, U64 errors) {
+  return opts.error_limit && errors > opts.error_limit;
+}
+
+static void append_error_cap(StringBuilder *sb, U64 dropped) {
+  sb_format(sb, "ERR: limit - {} more errors not shown\n", dropped);
+}
+
+static void append_lex_error(StringBuilder *sb, const LineIndex *lines,
+                             const TokenError &e) {
+  sb_format(sb, "ERR: {} - ", (int)e.error);
+  lex_error_render(sb, lines, e);
+  sb_append_char(sb, '\n');
+}
+
+// Offsets past the preprocessor are into text the user never sees, so they
+// are reported where the preprocessor found them.
+static void append_source_location(StringBuilder *sb, const Preprocessed *pp,
+                                   U32 offset) {
+  PPLine at = pp_locate(pp, offset);
+  sb_format(sb, "{}:{}:{}", at.path, at.line, at.column);
+}
+
+// Stops at the error past the limit, the tokens after it are noise anyway.
+static void append_lex_dump(StringBuilder *sb, Arena *arena,
+                            const Options &opts, const LexResult *result) {
+  LineIndex lines = {};
+  if (result->error_count)
+    lines = line_index_build(arena, result->source);
+  U32 next_error = 0;
+  for (U32 i = 0; i < result->token_count; ++i) {
+    if (next_error < result->error_count &&
+        result->errors[next_error].token == i) {
+      if (over_error_limit(opts, next_error + 1)) {
+        append_error_cap(sb, result->error_count - next_error);
+        return;
+      }
+      append_lex_error(sb, &lines, result->errors[next_error++]);
+    } else {
+      sb_format(sb, "kind: {}, iden: '{}'\n",
+                token_kind_to_str8(lex_kind(result, i)),
+                lex_source(result, i));
+    }
+  }
+}
+
+// S-expressions, one top-level declaration per line:
+// (function main (type int) (block (return 2)))
+static void append_ast_node(StringBuilder *sb, const Ast *ast, NodeIndex i) {
+  const Node *node = ast_node(ast, i);
+  const LexResult *tokens = ast->tokens;
+  switch (node->kind) {
+  case NODE_NONE:
+    sb_append(sb, str8_lit("<error>"));
+    return;
+  case NODE_IDENTIFIER:
+  case NODE_NUMBER:
+    sb_append(sb, lex_source(tokens, node->token));
+    return;
+  default:
+    break;
+  }
+
+  sb_append_char(sb, '(');
+  switch (node->kind) {
+  case NODE_BINARY:
+  case NODE_NEGATE:
+  case NODE_PLUS:
+    sb_append(sb, lex_source(tokens, node->token));
+    break;
+  case NODE_MEMBER:
+    sb_append_char(sb, '.');
+    break;
+  default:
+    sb_append(sb, node_kind_to_str8(node->kind));
+    break;
+  }
+
+  auto child = [&](NodeIndex c) {
+    sb_append_char(sb, ' ');
+    append_ast_node(sb, ast, c);
+  };
+  auto token = [&](U32 t) {
+    sb_append_char(sb, ' ');
+    sb_append(sb, lex_source(tokens, t));
+  };
+
+  switch (node->kind) {
+  case NODE_FUNCTION: {
+    const U32 *extra = ast_extra(ast, node->lhs);
+    token(node->token);
+    child(extra[0]);
+    for (U32 p = 0; p < extra[2]; ++p)
+      child(extra[3 + p]);
+    if (extra[1] != NODE_NONE)
+      child(extra[1]);
+  } break;
+  case NODE_PARAM:
+    child(node->lhs);
+    if (node->token)
+      token(node->token);
+    break;
+  case NODE_TYPE:
+    for (U32 t = 0; t < node->lhs; ++t)
+      token(node->token + t);
+    break;
+  case NODE_BLOCK:
+    for (U32 c = 0; c < node->rhs; ++c)
+      child(*ast_extra(ast, node->lhs + c));
+    break;
+  case NODE_DECL:
+    child(node->lhs);
+    token(node->token);
+    break;
+  case NODE_RETURN:
+    if (node->lhs != NODE_NONE)
+      child(node->lhs);
+    break;
+  case NODE_EXPR_STMT:
+  case NODE_NEGATE:
+  case NODE_PLUS:
+    child(node->lhs);
+    break;
+  case NODE_IF: {
+    const U32 *extra = ast_extra(ast, node->rhs);
+    child(node->lhs);
+    child(extra[0]);
+    if (extra[1] != NODE_NONE)
+      child(extra[1]);
+  } break;
+  case NODE_WHILE:
+  case NODE_BINARY:
+    child(node->lhs);
+    child(node->rhs);
+    break;
+  case NODE_CALL: {
+    const U32 *extra = ast_extra(ast, node->rhs);
+    child(node->lhs);
+    for (U32 a = 0; a < extra[0]; ++a)
+      child(extra[1 + a]);
+  } break;
+  case NODE_MEMBER:
+    child(node->lhs);
+    token(node->token);
+    break;
+  default:
+    break;
+  }
+  sb_append_char(sb, ')');
+}
+
+// Lex and parse errors in the preprocessed `tokens`, in that order. `ast` is
+// null if the file wasn't parsed.
+static void append_diagnostics(StringBuilder *sb, const Options &opts,
+                               const Preprocessed *pp, const LexResult *tokens,
+                               const Ast *ast) {
+  U64 total = (U64)tokens->error_count + (ast ? ast->error_count : 0);
+  U64 shown = over_error_limit(opts, total) ? opts.error_limit : total;
+  U32 lex_shown = shown < tokens->error_count ? (U32)shown
+                                              : tokens->error_count;
+  for (U32 i = 0; i < lex_shown; ++i) {
+    TokenError e = tokens->errors[i];
+    sb_format(sb, "ERR: {} - ", (int)e.error);
+    lex_error_render_message(sb, e);
+    sb_append(sb, str8_lit(", found at "));
+    append_source_location(sb, pp, e.offset);
+    sb_append_char(sb, '\n');
+  }
+  for (U32 i = 0; i < shown - lex_shown; ++i) {
+    AstError e = ast->errors[i];
+    String8 found = lex_source(tokens, e.token);
+    sb_append(sb, str8_lit("ERR: parse - "));
+    sb_append(sb, parse_error_to_str8(e.error));
+    if (e.error == PARSE_ERROR_EXPECTED_TOKEN) {
+      sb_append_char(sb, ' ');
+      sb_append(sb, token_kind_to_str8(e.expected));
+    }
+    sb_format(sb, ", found '{}' at ", found);
+    append_source_location(sb, pp, tokens->offsets[e.token]);
+    sb_append_char(sb, '\n');
+  }
+  if (shown < total)
+    append_error_cap(sb, total - shown);
+}
+
+static void append_ast_dump(StringBuilder *sb, const Options &opts,
+                            const Preprocessed *pp, const Ast *ast) {
+  append_diagnostics(sb, opts, pp, ast->tokens, ast);
+  const Node *root = ast_node(ast, ast->root);
+  for (U32 i = 0; i < root->rhs; ++i) {
+    append_ast_node(sb, ast, *ast_extra(ast, root->lhs + i));
+    sb_append_char(sb, '\n');
+  }
+}
+
+static void append_preprocess_diagnostics(StringBuilder *sb,
+                                         const Preprocessed *pp) {
+  for (U32 i = 0; i < pp->diagnostic_count; ++i) {
+    PPDiagnostic d = pp->diagnostics[i];
+    sb_append(sb, d.warning ? str8_lit("WARN: preprocess - ")
+                            : str8_lit("ERR: preprocess - "));
+    sb_append(sb, pp_error_to_str8(d.error));
+    if (d.detail.size)
+      sb_format(sb, " '{}'", d.detail);
+    sb_format(sb, " at {}:{}\n", d.path, d.line);
+  }
+}
+
+static void append_codegen_errors(StringBuilder *sb, const Preprocessed *pp,
+                                  const Ast *ast, const CodegenResult *code) {
+  for (U32 i = 0; i < code->error_count; ++i) {
+    CodegenDiagnostic e = code->errors[i];
+    String8 at = lex_source(ast->tokens, e.token);
+    sb_append(sb, str8_lit("ERR: codegen - "));
+    sb_append(sb, codegen_error_to_str8(e.error));
+    sb_format(sb, ", '{}' at ", at);
+    append_source_location(sb, pp, ast->tokens->offsets[e.token]);
+    sb_append_char(sb, '\n');
+  }
+}
+
+static Preprocessed preprocess_file(Worker *w, const Options &opts,
+                                    const char *path, String8 input,
+                                    FileOutput *output) {
+  PPConfig config = {.include_dirs = opts.include_dirs.data(),
+                     .include_dir_count = (U32)opts.include_dirs.size(),
+                     .defines = opts.defines.data(),
+                     .define_count = (U32)opts.defines.size()};
+  auto pp_start = std::chrono::steady_clock::now();
+  Preprocessed result =
+      perform_preprocess(&w->arena, &w->interner, w->includes, config,
+                         str8_cstring((U8 *)path), input);
+  auto pp_end = std::chrono::steady_clock::now();
+
+  if (opts.show_stats) {
+    F64 secs = std::chrono::duration<F64>(pp_end - pp_start).count();
+    sb_appendf(&output->err,
+               "preprocess: %lu -> %lu bytes, %u includes (%u skipped), "
+               "%lu expansions in %.3f ms\n",
+               input.size, result.text.size, result.stats.includes,
+               result.stats.include_skips, result.stats.expansions,
+               secs * 1e3);
+    std::lock_guard lock(w->includes->mutex);
+    sb_appendf(&output->err, "include cache: %lu hits, %lu misses\n",
+               w->includes->hits, w->includes->misses);
+  }
+
+  output->had_errors |= result.error_count > 0;
+  return result;
+}
+
+static LexResult lex_file(Worker *w, const Options &opts, const char *path,
+                          String8 input, FileOutput *output) {
+  Arena *arena = &w->arena;
+  auto lex_start = std::chrono::steady_clock::now();
+  // --verify-lex is there to exercise the lexers, so it skips the cache.
+  bool use_cache = w->tokens->dir && !opts.verify_lex &&
+                   input.size >= TOKEN_CACHE_MIN_SIZE;
+  U64 hash = use_cache ? str8_hash(input) : 0;
+  LexResult result = {};
+  bool cache_hit = use_cache && token_cache_load(arena, &w->interner,
+                                                 w->tokens, input, hash,
+                                                 &result, &w->token_map);
+  if (!cache_hit) {
+    result = opts.lex_jobs > 1
+                 ? perform_lex_parallel(arena, &w->interner, input,
+                                        {.jobs = opts.lex_jobs,
+                                         .min_chunk_size = MiB(1),
+                                         .max_chunks = (U64)opts.lex_jobs * 4,
+                                         .split_at_newlines = true})
+                 : perform_lex(arena, &w->interner, input);
+  }
+  auto lex_end = std::chrono::steady_clock::now();
+  if (use_cache && !cache_hit &&
+      !token_cache_store(arena, &w->interner, w->tokens, &result, hash))
+    sb_appendf(&output->err, "token-cache: couldn't write to '%s'\n",
+               w->tokens->dir);
+
+  if (opts.verify_lex) {
+    // Small, unaligned chunks so stitching has to resynchronize from the
+    // middle of tokens and comments.
+    Interner serial_atoms = interner_alloc(GiB(1));
+    Interner parallel_atoms = interner_alloc(GiB(1));
+    LexResult serial = perform_lex(arena, &serial_atoms, input);
+    LexResult parallel = perform_lex_parallel(
+        arena, &parallel_atoms, input,
+        {.jobs = opts.lex_jobs > 1 ? opts.lex_jobs : 2,
+         .min_chunk_size = 61,
+         .max_chunks = 64,
+         .split_at_newlines = false});
+    S64 mismatch = lex_first_mismatch(&serial, &parallel);
+    if (mismatch >= 0) {
+      sb_appendf(&output->err,
+                 "verify-lex: %s: parallel lexer differs at token %ld\n",
+                 path, mismatch);
+      output->had_errors = true;
+    }
+    interner_release(&parallel_atoms);
+    interner_release(&serial_atoms);
+  }
+
+  if (opts.show_stats) {
+    F64 secs = std::chrono::duration<F64>(lex_end - lex_start).count();
+    String8 scan = cache_hit ? str8_lit("token cache")
+                             : scan_kind_to_str8(scanner.kind);
+    sb_appendf(&output->err,
+               "lex: %lu bytes, %u tokens in %.3f ms (%.1f MB/s, %.*s)\n",
+               input.size, result.token_count, secs * 1e3,
+               (F64)input.size / secs / 1e6, (int)scan.size, scan.str);
+    sb_appendf(&output->err,
+               "intern: %lu unique / %lu total identifiers (%lu slots)\n",
+               w->interner.atom_count - 1, w->interner.lookups,
+               w->interner.slot_count);
+  }
+
+  output->had_errors |= result.error_count > 0;
+  return result;
+}
+
+static Ast parse_file(Worker *w, const Options &opts, const LexResult *tokens,
+                      FileOutput *output) {
+  auto parse_start = std::chrono::steady_clock::now();
+  Ast ast = perform_parse(&w->arena, tokens);
+  auto parse_end = std::chrono::steady_clock::now();
+
+  if (opts.show_stats) {
+    F64 secs = std::chrono::duration<F64>(parse_end - parse_start).count();
+    U64 bytes = (U64)ast.node_count * sizeof(Node) + ast.extra_count * 4;
+    sb_appendf(&output->err,
+               "parse: %u tokens, %u nodes in %.3f ms (%.1f M nodes/s, "
+               "%.1f bytes/node)\n",
+               tokens->token_count, ast.node_count, secs * 1e3,
+               (F64)ast.node_count / secs / 1e6,
+               (F64)bytes / (F64)ast.node_count);
+  }
+
+  output->had_errors |= ast.error_count > 0;
+  return ast;
+}
+
+// `dir/name.c` -> `dir/name`, which the object and executable are named
+// after. Anything else keeps its name and gets `.out` for the executable.
+static String8 output_base(Arena *arena, const char *path, bool *is_c) {
+  String8 p = str8_cstring((U8 *)path);
+  *is_c = p.size > 2 && p.str[p.size - 2] == '.' && p.str[p.size - 1] == 'c';
+  return str8_copy(arena, *is_c ? str8_substr(p, 0, p.size - 2) : p);
+}
+
+// The linker is the one external step left. Spawned directly rather than
+// through a shell.
+static bool link_executable(const char *object, const char *executable) {
+  extern char **environ;
+  const char *argv[] = {"cc", "-o", executable, object, nullptr};
+  pid_t pid;
+  if (posix_spawnp(&pid, "cc", nullptr, nullptr, (char *const *)argv,
+                   environ) != 0)
+    return false;
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR)
+      return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Assembly text with --asm, otherwise `name.o` next to the input, linked
+// into `name` for the ALL stage.
+static void generate_file(Worker *w, const Options &opts, const char *path,
+                          const Preprocessed *pp, const Ast *ast,
+                          FileOutput *output) {
+  Arena *arena = &w->arena;
+  auto codegen_start = std::chrono::steady_clock::now();
+  CodegenResult code = perform_codegen(arena, &w->locals, ast, opts.emit_asm);
+  auto codegen_end = std::chrono::steady_clock::now();
+
+  if (code.error_count) {
+    output->out = sb_create(arena, KiB(4));
+    sb_format(&output->out, "{} {}\n", path, (int)opts.stage);
+    append_codegen_errors(&output->out, pp, ast, &code);
+    output->had_errors = true;
+    return;
+  }
+
+  if (opts.show_stats) {
+    F64 secs = std::chrono::duration<F64>(codegen_end - codegen_start).count();
+    sb_appendf(&output->err,
+               "codegen: %lu bytes, %u symbols, %u relocations in %.3f ms\n",
+               opts.emit_asm ? sb_size(&code.as.listing) : code.as.code.size,
+               code.as.symbol_count, code.as.reloc_count, secs * 1e3);
+  }
+
+  if (opts.emit_asm) {
+    output->out = code.as.listing;
+    return;
+  }
+
+  bool is_c = false;
+  String8 base = output_base(arena, path, &is_c);
+  // Copied to get the '\0' str8_cat leaves off.
+  String8 object = str8_copy(arena, str8_cat(arena, base, str8_lit(".o")));
+  String8 executable =
+      is_c ? base : str8_copy(arena, str8_cat(arena, base, str8_lit(".out")));
+  String8 source_name = str8_cstring((U8 *)path);
+  for (U64 i = source_name.size; i-- > 0;) {
+    if (source_name.str[i] == '/') {
+      source_name = str8_substr(source_name, i + 1, source_name.size);
+      break;
+    }
   }
-  std::vector<std::string> args(argv, argv + argc);
 
-  Stage stage = ALL;
-  const char *name = "";
-  for (auto &arg : args) {
+  String8 elf = elf_from_x64(arena, &code.as, source_name);
+  if (!file_write((const char *)object.str, elf)) {
+    sb_appendf(&output->err, "Couldn't write '%s'\n", object.str);
+    output->had_errors = true;
+    return;
+  }
+  if (opts.stage == ALL &&
+      !link_executable((const char *)object.str,
+                       (const char *)executable.str)) {
+    sb_appendf(&output->err, "Linking '%s' failed\n", executable.str);
+    output->had_errors = true;
+  }
+}
+
+static FileOutput compile_file(Worker *w, const Options &opts,
+                               const char *path) {
+  Arena *arena = &w->arena;
+  FileOutput output = {.err = sb_create(arena, 1024)};
+
+  SourceManager sources = {};
+  SourceFile *file = source_open(arena, &sources, path);
+  if (!file) {
+    output.out = sb_create(arena, 1024);
+    sb_format(&output.out, "{} {}\n", path, (int)opts.stage);
+    sb_format(&output.out, "ERR: {} - Couldn't open '{}'\n", (int)LEX_ERROR_IO,
+              path);
+    output.had_errors = true;
+    return output;
+  }
+
+  String8 input = source_contents(file);
+  switch (opts.stage) {
+  case LEX: {
+    LexResult result = lex_file(w, opts, path, input, &output);
+    output.out = sb_create(arena, KiB(64));
+    sb_format(&output.out, "{} {}\n", path, (int)opts.stage);
+    append_lex_dump(&output.out, arena, opts, &result);
+    break;
+  };
+  case PREPROCESS: {
+    Preprocessed pp = preprocess_file(w, opts, path, input, &output);
+    output.out = sb_create(arena, pp.text.size + KiB(4));
+    sb_format(&output.out, "{} {}\n", path, (int)opts.stage);
+    append_preprocess_diagnostics(&output.out, &pp);
+    sb_append(&output.out, pp.text);
+    break;
+  };
+  case PARSE: {
+    Preprocessed pp = preprocess_file(w, opts, path, input, &output);
+    LexResult tokens = lex_file(w, opts, path, pp.text, &output);
+    output.out = sb_create(arena, KiB(64));
+    sb_format(&output.out, "{} {}\n", path, (int)opts.stage);
+    append_preprocess_diagnostics(&output.out, &pp);
+    if (over_error_limit(opts, tokens.error_count)) {
+      append_diagnostics(&output.out, opts, &pp, &tokens, nullptr);
+      break;
+    }
+    Ast ast = parse_file(w, opts, &tokens, &output);
+    append_ast_dump(&output.out, opts, &pp, &ast);
+    break;
+  };
+  case CODEGEN:
+  case ALL: {
+    Preprocessed pp = preprocess_file(w, opts, path, input, &output);
+    LexResult tokens = lex_file(w, opts, path, pp.text, &output);
+    bool parse = !over_error_limit(opts, tokens.error_count);
+    Ast ast = parse ? parse_file(w, opts, &tokens, &output) : Ast{};
+    if (output.had_errors) {
+      output.out = sb_create(arena, KiB(4));
+      sb_format(&output.out, "{} {}\n", path, (int)opts.stage);
+      append_preprocess_diagnostics(&output.out, &pp);
+      append_diagnostics(&output.out, opts, &pp, &tokens,
+                         parse ? &ast : nullptr);
+      break;
+    }
+    generate_file(w, opts, path, &pp, &ast, &output);
+    break;
+  };
+  }
+
+  file_unmap(&w->token_map);
+  source_manager_release(&sources);
+  return output;
+}
+
+// Files are handed out in order and written in order: a worker that finishes
+// early waits for its turn while holding on to its output.
+struct Batch {
+  std::vector<const char *> paths;
+  Options opts;
+  IncludeCache includes;
+  TokenCache tokens;
+
+  std::atomic<U64> next_file;
+  std::mutex mutex;
+  std::condition_variable turn;
+  U64 next_to_write;
+  bool had_errors;
+};
+
+static void batch_worker(Batch *batch) {
+  Worker w = worker_alloc();
+  w.includes = &batch->includes;
+  w.tokens = &batch->tokens;
+
+  while (true) {
+    U64 i = batch->next_file.fetch_add(1);
+    if (i >= batch->paths.size())
+      break;
+
+    arena_reset(&w.arena);
+    interner_reset(&w.interner);
+    FileOutput output = compile_file(&w, batch->opts, batch->paths[i]);
+
+    std::unique_lock lock(batch->mutex);
+    batch->turn.wait(lock, [&] { return batch->next_to_write == i; });
+    sb_write_fd(&output.out, STDOUT_FILENO);
+    sb_write_fd(&output.err, STDERR_FILENO);
+    batch->had_errors |= output.had_errors;
+    batch->next_to_write++;
+    batch->turn.notify_all();
+  }
+
+  worker_release(&w);
+}
+
+// `@file` arguments name a response file with whitespace separated inputs.
+static bool read_response_file(Arena *arena, const char *path,
+                               std::vector<const char *> *paths) {
+  FileMap map = file_map_readonly(path);
+  if (!map.data.str)
+    return false;
+
+  String8 rest = map.data;
+  while (rest.size) {
+    rest = str8_trim_whitespace(rest);
+    U64 end = 0;
+    while (end < rest.size && !char_is_whitespace(rest.str[end]))
+      ++end;
+    if (end) {
+      String8 path_copy = str8_copy(arena, str8_substr(rest, 0, end));
+      paths->push_back((const char *)path_copy.str);
+    }
+    rest = str8_substr(rest, end, rest.size);
+  }
+
+  file_unmap(&map);
+  return true;
+}
+
+// Command line as main() gets it. Stored strings point into `argv` or
+// `arena`. Problems are reported into `err`.
+static bool parse_options(Arena *arena, int argc, char **argv, Options *opts,
+                          std::vector<const char *> *paths,
+                          StringBuilder *err) {
+  *opts = {.stage = ALL,
+           .show_stats = false,
+           .jobs = 1,
+           .lex_jobs = 1,
+           .verify_lex = false,
+           .mem_stats = false,
+           .emit_asm = false,
+           .error_limit = 100,
+           .token_cache_dir = nullptr,
+           .server_socket = nullptr};
+  std::vector<std::string> args(argv + 1, argv + argc);
+  for (Size i = 0; i < args.size(); ++i) {
+    const std::string &arg = args[i];
     if (arg == "--lex") {
-      assert(stage == ALL);
-      stage = LEX;
+      assert(opts->stage == ALL);
+      opts->stage = LEX;
     } else if (arg == "--parse") {
-      assert(stage == ALL);
-      stage = PARSE;
+      assert(opts->stage == ALL);
+      opts->stage = PARSE;
     } else if (arg == "--codegen") {
-      assert(stage == ALL);
-      stage = CODEGEN;
+      assert(opts->stage == ALL);
+      opts->stage = CODEGEN;
+    } else if (arg == "-E" || arg == "--preprocess") {
+      assert(opts->stage == ALL);
+      opts->stage = PREPROCESS;
+    } else if (arg == "-I" && i + 1 < args.size()) {
+      opts->include_dirs.push_back(argv[++i + 1]);
+    } else if (arg.starts_with("-I") && arg.size() > 2) {
+      opts->include_dirs.push_back(argv[i + 1] + 2);
+    } else if (arg == "-D" && i + 1 < args.size()) {
+      opts->defines.push_back(argv[++i + 1]);
+    } else if (arg.starts_with("-D") && arg.size() > 2) {
+      opts->defines.push_back(argv[i + 1] + 2);
+    } else if (arg == "--asm") {
+      opts->emit_asm = true;
+    } else if (arg == "--stats") {
+      opts->show_stats = true;
+    } else if (arg == "--jobs" && i + 1 < args.size()) {
+      opts->jobs = (U32)strtoul(args[++i].c_str(), nullptr, 10);
+      if (opts->jobs == 0)
+        opts->jobs = std::thread::hardware_concurrency();
+    } else if (arg == "--lex-jobs" && i + 1 < args.size()) {
+      opts->lex_jobs = (U32)strtoul(args[++i].c_str(), nullptr, 10);
+      if (opts->lex_jobs == 0)
+        opts->lex_jobs = std::thread::hardware_concurrency();
+    } else if (arg == "--error-limit" && i + 1 < args.size()) {
+      opts->error_limit = (U32)strtoul(args[++i].c_str(), nullptr, 10);
+    } else if (arg == "--token-cache" && i + 1 < args.size()) {
+      opts->token_cache_dir = argv[++i + 1];
+    } else if (arg == "--server" && i + 1 < args.size()) {
+      opts->server_socket = argv[++i + 1];
+    } else if (arg == "--verify-lex") {
+      opts->verify_lex = true;
+    } else if (arg == "--mem-stats") {
+      opts->mem_stats = true;
+    } else if (arg.starts_with("@")) {
+      if (!read_response_file(arena, arg.c_str() + 1, paths)) {
+        sb_appendf(err, "Couldn't read response file '%s'\n",
+                   arg.c_str() + 1);
+        return false;
+      }
     } else {
-      name = arg.c_str();
+      paths->push_back(argv[i + 1]);
     }
   }
 
-  std::println("{} {}", name, (U8)stage);
+  if (opts->token_cache_dir && mkdir(opts->token_cache_dir, 0755) != 0 &&
+      errno != EEXIST) {
+    sb_appendf(err, "Couldn't create token cache '%s'\n",
+               opts->token_cache_dir);
+    return false;
+  }
+  return true;
+}
 
-  switch (stage) {
-  case LEX: {
-    bool had_errors = false;
-    LexResult result = perform_lex(&arena, name);
-    for (Size i = 0; i < result.token_count; ++i) {
-
-      TokenResult t = result.tokens[i];
-      if (t.maybe_error != LEX_OK) {
-        had_errors = true;
-
-        printf("ERR: %d - %.*s\n", t.maybe_error, (int)t.error_msg.size,
-               t.error_msg.str);
-      } else {
-        String8 s = token_kind_to_str8(t.token.kind);
-        printf("kind: %.*s, iden: '%.*s'\n", (int)s.size, s.str,
-               (int)t.token.source.size, t.token.source.str);
-      }
+// ---- Server ----
+
+// Compiles for `--client` invocations. Every thread owns a Worker for its
+// whole life and takes one connection at a time, so the arenas and the
+// include cache stay warm and each request only pays for its files.
+struct Server {
+  int listen_fd;
+  IncludeCache includes;
+};
+
+static void serve_request(Worker *w, Arena *arena, int fd) {
+  ServerRequest request;
+  if (!server_read_request(arena, fd, &request))
+    return;
+
+  StringBuilder err = sb_create(arena, 4096);
+  Options opts;
+  std::vector<const char *> paths;
+  // Each server thread has its own working directory, see server_thread.
+  if (chdir(request.cwd) != 0) {
+    sb_appendf(&err, "Couldn't change to '%s'\n", request.cwd);
+  } else if (parse_options(arena, request.argc, request.argv, &opts, &paths,
+                           &err) &&
+             opts.server_socket) {
+    sb_appendf(&err, "--server can't be sent to a server\n");
+  }
+  if (sb_size(&err)) {
+    server_send_frame(fd, SERVER_FRAME_STDERR, &err);
+    server_send_exit(fd, 1);
+    return;
+  }
+
+  // Files run one after another here; concurrency comes from serving
+  // several clients at once.
+  TokenCache tokens = {.dir = opts.token_cache_dir};
+  w->tokens = &tokens;
+  auto start = std::chrono::steady_clock::now();
+  bool had_errors = false;
+  bool connected = true;
+  for (const char *path : paths) {
+    arena_reset(&w->arena);
+    interner_reset(&w->interner);
+    FileOutput output = compile_file(w, opts, path);
+    had_errors |= output.had_errors;
+    connected = server_send_frame(fd, SERVER_FRAME_STDOUT, &output.out) &&
+                server_send_frame(fd, SERVER_FRAME_STDERR, &output.err);
+    if (!connected)
+      break;
+  }
+  w->tokens = nullptr;
+  if (!connected)
+    return;
+
+  if (opts.show_stats) {
+    auto end = std::chrono::steady_clock::now();
+    F64 secs = std::chrono::duration<F64>(end - start).count();
+    sb_appendf(&err, "server: %lu files in %.3f ms\n", paths.size(),
+               secs * 1e3);
+    if (opts.token_cache_dir)
+      sb_appendf(&err, "token cache: %lu hits, %lu misses, %lu bytes not "
+                       "lexed\n",
+                 tokens.hits.load(), tokens.misses.load(),
+                 tokens.bytes_saved.load());
+    server_send_frame(fd, SERVER_FRAME_STDERR, &err);
+  }
+  server_send_exit(fd, had_errors ? 1 : 0);
+}
+
+static void server_thread(Server *server) {
+  // A private working directory, so requests from clients in different
+  // directories can run side by side.
+  if (unshare(CLONE_FS) != 0) {
+    fprintf(stderr, "server: unshare(CLONE_FS) failed: %s\n",
+            strerror(errno));
+    return;
+  }
+  Worker w = worker_alloc();
+  w.includes = &server->includes;
+  Arena requests = arena_alloc(MiB(64));
+  arena_profile_label(&requests, "server-request");
+
+  while (true) {
+    int fd = accept4(server->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      fprintf(stderr, "server: accept failed: %s\n", strerror(errno));
+      break;
     }
+    if (!server_peer_allowed(fd)) {
+      fprintf(stderr, "server: refused a client running as another user\n");
+      close(fd);
+      continue;
+    }
+    serve_request(&w, &requests, fd);
+    close(fd);
+    arena_reset(&requests);
+  }
 
-    if (had_errors)
-      exit(1);
+  arena_release(&requests);
+  worker_release(&w);
+}
+
+// Runs until killed. --jobs is how many requests are served at once.
+static int run_server(const Options &opts) {
+  Server server = {.listen_fd = server_listen(opts.server_socket)};
+  if (server.listen_fd < 0) {
+    fprintf(stderr, "Couldn't listen on '%s': %s\n", opts.server_socket,
+            strerror(errno));
+    return 1;
+  }
+  include_cache_init(&server.includes);
+  fprintf(stderr, "server: listening on '%s' with %u threads\n",
+          opts.server_socket, opts.jobs);
+
+  std::vector<std::thread> threads;
+  for (U32 j = 0; j < opts.jobs; ++j)
+    threads.emplace_back(server_thread, &server);
+  for (auto &t : threads)
+    t.join();
+
+  close(server.listen_fd);
+  unlink(opts.server_socket);
+  include_cache_release(&server.includes);
+  return 1;
+}
+
+auto main(int argc, char *argv[]) -> int {
+  // Before any setup: the client only forwards its arguments.
+  if (argc >= 3 && strcmp(argv[1], "--client") == 0)
+    return client_run(argv[2], argc - 3, argv + 3);
+
+  auto arena = arena_alloc(MiB(64));
+  arena_profile_label(&arena, "main");
+
+  if (argc < 2) {
+    std::println("Wrong arguments {}", argc);
+    return 1;
+  }
+
+  Batch batch = {};
+  Options &opts = batch.opts;
+  StringBuilder err = sb_create(&arena, 4096);
+  if (!parse_options(&arena, argc, argv, &opts, &batch.paths, &err)) {
+    sb_write_fd(&err, STDERR_FILENO);
+    return 1;
+  }
+  if (opts.server_socket)
+    return run_server(opts);
+
+  include_cache_init(&batch.includes);
+  batch.tokens.dir = opts.token_cache_dir;
+  U64 file_count = batch.paths.size();
+  U32 jobs = opts.jobs < file_count ? opts.jobs : (U32)file_count;
+  auto batch_start = std::chrono::steady_clock::now();
+
+  if (jobs <= 1) {
+    batch_worker(&batch);
+  } else {
+    std::vector<std::thread> threads;
+    for (U32 j = 0; j < jobs; ++j)
+      threads.emplace_back(batch_worker, &batch);
+    for (auto &t : threads)
+      t.join();
+  }
+
+  if (opts.show_stats && file_count > 1) {
+    auto batch_end = std::chrono::steady_clock::now();
+    F64 secs = std::chrono::duration<F64>(batch_end - batch_start).count();
+    fprintf(stderr, "batch: %lu files on %u jobs in %.3f ms\n", file_count,
+            jobs, secs * 1e3);
+  }
+
+  if (opts.show_stats && opts.token_cache_dir) {
+    fprintf(stderr, "token cache: %lu hits, %lu misses, %lu bytes not lexed\n",
+            batch.tokens.hits.load(), batch.tokens.misses.load(),
+            batch.tokens.bytes_saved.load());
+  }
+
+  if (opts.mem_stats) {
+#if ARENA_PROFILE
+    arena_profile_report(stderr);
+#else
+    fprintf(stderr, "mem-stats: rebuild with -DARENA_PROFILE=ON\n");
+#endif
+  }
+
+  include_cache_release(&batch.includes);
+  if (batch.had_errors)
+    exit(1);
 
-    return 0;
-  };
-  default:
-    assert(false && "TODO");
-  }
-
-  // // call gcc's preprocessor
-  // {
-  //   auto ta = get_scratch();
-  //   StringBuilder sb = sb_create(ta.arena, ta.arena->capacity);
-  //   sb_append(&sb, "gcc -E -P ");
-
-  //   sb_append(&sb, name);
-  //   sb_append(&sb, " -o ");
-  //   sb_append(&sb, name.substr(0, name.size() - 2));
-  //   sb_append(&sb, ".i");
-  //   // std::string_view pps_command = ;
-  //   std::println("{}", sb_cstr(&sb));
-  //   system(sb_cstr(&sb));
-  //   release_scratch(ta);
-  // }
-
-  // // Compile the preprocessed file, stubbed, delete after
-  // // just delete it for now
-  // {
-  //   auto ta = get_scratch();
-  //   StringBuilder sb = sb_create(ta.arena, ta.arena->capacity);
-  //   sb_append(&sb, "gcc ");
-
-  //   sb_append(&sb, name);
-  //   sb_append(&sb, " -o ");
-  //   sb_append(&sb, name.substr(0, name.size() - 2));
-  //   // std::string_view pps_command = ;
-  //   std::println("{}", sb_cstr(&sb));
-  //   system(sb_cstr(&sb));
-  //   release_scratch(ta);
-  // }
   return 0;
 }
@@ -0,0 +1,369 @@
+#include "arena.hpp"
+#include "strings.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// Numeric literals: finding where one ends and working out its type and
+// value, so nothing after the lexer looks at the digits again.
+//
+// A literal first spans a whole pp-number (C23 6.4.8): digits, letters, '_',
+// '.', and a sign right after an exponent letter. Whatever is in that span
+// belongs to the one literal, valid or not, so "0x1e+1" and "12abc" are single
+// invalid numbers as in any C compiler.
+//
+// Decimal digits convert eight at a time (SWAR). Floating literals take an
+// exact fast path when the digits and the power of ten are both exact doubles
+// (Clinger), which covers the short decimals of numeric tables; the rest go
+// through strtod, which rounds correctly. Long double values are kept at
+// double precision.
+
+enum NumberType : U32 {
+  NUM_INT,
+  NUM_UINT,
+  NUM_LONG,
+  NUM_ULONG,
+  NUM_LLONG,
+  NUM_ULLONG,
+  NUM_FLOAT,
+  NUM_DOUBLE,
+  NUM_LONG_DOUBLE,
+};
+
+enum NumberStatus {
+  NUMBER_OK,
+  NUMBER_INVALID,  // Not a literal, e.g. "09", "0x", "1e", "12abc"
+  NUMBER_OVERFLOW, // No type can hold it
+};
+
+struct Number {
+  NumberType type;
+  NumberStatus status;
+  S64 value; // Integers as two's complement, floating types as F64 bits
+};
+
+constexpr bool number_type_is_float(NumberType type) {
+  return type >= NUM_FLOAT;
+}
+
+inline F64 number_f64(S64 bits) {
+  F64 f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+inline S64 number_bits(F64 f) {
+  S64 bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+// End of the pp-number starting at `p`, which is a digit or a '.' followed
+// by one. The input is '\0' terminated.
+static const U8 *number_end(const U8 *p) {
+  p = scanner.digits(p);
+  while (true) {
+    U8 c = *p;
+    if (char_is_ident(c) || c == '.') {
+      ++p;
+    } else if ((c == '+' || c == '-') &&
+               ((p[-1] | 0x20) == 'e' || (p[-1] | 0x20) == 'p')) {
+      ++p;
+    } else {
+      return p;
+    }
+  }
+}
+
+// ---- Integers ----
+
+static U32 number_digit_value(U8 c) {
+  return c <= '9' ? (U32)(c - '0') : (U32)((c | 0x20) - 'a' + 10);
+}
+
+// Eight ASCII digits to their value with three multiplies: neighbouring
+// lanes are combined into 2-, 4- and then 8-digit values. The first digit
+// is the low byte of the little-endian load.
+static U64 number_swar_8_digits(const U8 *p) {
+  U64 v;
+  memcpy(&v, p, sizeof(v));
+  v -= 0x3030303030303030ull;
+  v = (v * 10 + (v >> 8)) & 0x00ff00ff00ff00ffull;
+  v = (v * 100 + (v >> 16)) & 0x0000ffff0000ffffull;
+  return (v * 10000 + (v >> 32)) & 0xffffffffull;
+}
+
+// Decimal digits [p, p + count), false on overflow.
+static bool number_decimal(const U8 *p, U64 count, U64 *value) {
+  while (count && *p == '0') {
+    ++p;
+    --count;
+  }
+  // Up to 19 digits can't overflow, the 20th might.
+  U64 safe = count < 19 ? count : 19;
+  U64 v = 0, i = 0;
+  for (; i + 8 <= safe; i += 8)
+    v = v * 100000000 + number_swar_8_digits(p + i);
+  for (; i < safe; ++i)
+    v = v * 10 + (U64)(p[i] - '0');
+  for (; i < count; ++i) {
+    if (__builtin_mul_overflow(v, 10, &v) ||
+        __builtin_add_overflow(v, (U64)(p[i] - '0'), &v))
+      return false;
+  }
+  *value = v;
+  return true;
+}
+
+// Digits [p, p + count) in base 2, 8 or 16, `bits` per digit.
+static bool number_power_of_two(const U8 *p, U64 count, U32 bits,
+                                U64 *value) {
+  U64 v = 0;
+  for (U64 i = 0; i < count; ++i) {
+    if (v >> (64 - bits))
+      return false;
+    v = v << bits | number_digit_value(p[i]);
+  }
+  *value = v;
+  return true;
+}
+
+// u, l, ll and a u on either side of the l's. "lL" isn't a suffix.
+static bool number_integer_suffix(const U8 *p, const U8 *end, bool *u,
+                                  U32 *longs) {
+  *u = false;
+  *longs = 0;
+  if (p < end && (*p | 0x20) == 'u') {
+    *u = true;
+    ++p;
+  }
+  if (p < end && (*p | 0x20) == 'l') {
+    *longs = p + 1 < end && p[1] == p[0] ? 2 : 1;
+    p += *longs;
+  }
+  if (!*u && p < end && (*p | 0x20) == 'u') {
+    *u = true;
+    ++p;
+  }
+  return p == end;
+}
+
+// C23 6.4.4.1: the first type on the suffix's list that holds the value,
+// for LP64. Unsigned types are only on the lists of unsuffixed decimals if
+// there's a 'u'.
+static bool number_integer_type(U64 v, bool decimal, bool u, U32 longs,
+                                NumberType *type) {
+  bool unsigned_ok = u || !decimal;
+  if (!u && longs == 0 && v <= 0x7fffffffull)
+    *type = NUM_INT;
+  else if (unsigned_ok && longs == 0 && v <= 0xffffffffull)
+    *type = NUM_UINT;
+  else if (!u && longs <= 1 && v <= 0x7fffffffffffffffull)
+    *type = NUM_LONG;
+  else if (unsigned_ok && longs <= 1)
+    *type = NUM_ULONG;
+  else if (!u && v <= 0x7fffffffffffffffull)
+    *type = NUM_LLONG;
+  else if (unsigned_ok)
+    *type = NUM_ULLONG;
+  else
+    return false;
+  return true;
+}
+
+// ---- Floating ----
+
+static const F64 number_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static const F32 number_pow10_f32[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                       1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+// m * 10^e rounded once, when m and 10^e are both exact in the type so one
+// IEEE multiply or divide is correctly rounded. 10^e can also borrow zeros
+// from m while m stays exact. False when the literal needs the slow path.
+static bool number_fast_path(U64 m, S64 e, bool single, F64 *out) {
+  if (single) {
+    if (m > (1ull << 24) || e < -10 || e > 10)
+      return false;
+    F32 f = (F32)m;
+    *out = e < 0 ? f / number_pow10_f32[-e] : f * number_pow10_f32[e];
+    return true;
+  }
+  if (m > (1ull << 53) || e < -22 || e > 22 + 15)
+    return false;
+  if (e > 22) {
+    U64 shift = 1;
+    for (S64 i = 22; i < e; ++i)
+      shift *= 10;
+    if (m > (1ull << 53) / shift)
+      return false;
+    m *= shift;
+    e = 22;
+  }
+  F64 f = (F64)m;
+  *out = e < 0 ? f / number_pow10[-e] : f * number_pow10[e];
+  return true;
+}
+
+// Decimal or hex floating literal text [s, end) without its suffix.
+// strtod stops at anything that isn't part of a float, so it can run
+// straight on the source.
+static bool number_slow_path(const U8 *s, const U8 *end, bool single,
+                             F64 *out) {
+  char *stop;
+  *out = single ? (F64)strtof((const char *)s, &stop)
+                : strtod((const char *)s, &stop);
+  assert((const U8 *)stop == end && "strtod disagrees on the literal");
+  (void)end;
+  // Underflow still gives a usable value, only overflow is an error.
+  return !std::isinf(*out);
+}
+
+// char_is_digit, but inline: it runs once per digit.
+static bool number_is_digit(U8 c, U32 base) {
+  U32 d = (U32)(c - '0');
+  if (d < 10)
+    return d < base;
+  return base == 16 && (U32)((c | 0x20) - 'a') < 6;
+}
+
+// Skips digits of `base` from `p`, up to `end`.
+static const U8 *number_digits(const U8 *p, const U8 *end, U32 base) {
+  while (p < end && number_is_digit(*p, base))
+    ++p;
+  return p;
+}
+
+// `s` has an integer part ending at `p` in base 10 or 16, and a '.' or
+// exponent next.
+static Number number_floating(String8 s, const U8 *digits, const U8 *p,
+                              U32 base) {
+  const U8 *end = s.str + s.size;
+  Number n = {.type = NUM_DOUBLE, .status = NUMBER_INVALID};
+  const U8 *int_end = p;
+  const U8 *frac = p, *frac_end = p;
+  if (p < end && *p == '.') {
+    frac = p + 1;
+    frac_end = number_digits(frac, end, base);
+    p = frac_end;
+  }
+  if (int_end == digits && frac_end == frac)
+    return n;
+
+  // The exponent is decimal; hex floats must have one.
+  S64 exponent = 0;
+  U8 marker = base == 16 ? 'p' : 'e';
+  if (p < end && (*p | 0x20) == marker) {
+    ++p;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '+' || *p == '-'))
+      ++p;
+    const U8 *exp_digits = p;
+    for (; p < end && number_is_digit(*p, 10); ++p) {
+      if (exponent < 100000)
+        exponent = exponent * 10 + (*p - '0');
+    }
+    if (p == exp_digits)
+      return n;
+    if (negative)
+      exponent = -exponent;
+  } else if (base == 16) {
+    return n;
+  }
+
+  const U8 *literal_end = p;
+  if (p < end && (*p | 0x20) == 'f') {
+    n.type = NUM_FLOAT;
+    ++p;
+  } else if (p < end && (*p | 0x20) == 'l') {
+    n.type = NUM_LONG_DOUBLE;
+    ++p;
+  }
+  if (p != end)
+    return n;
+
+  bool single = n.type == NUM_FLOAT;
+  F64 value = 0;
+  bool fast = false;
+  if (base == 10) {
+    // Significant digits of both parts; more than 19 won't fit exactly.
+    const U8 *q = digits;
+    while (q < int_end && *q == '0')
+      ++q;
+    U64 int_count = (U64)(int_end - q);
+    const U8 *f = frac;
+    if (!int_count) {
+      while (f < frac_end && *f == '0')
+        ++f;
+    }
+    U64 frac_count = (U64)(frac_end - f);
+    U64 m = 0;
+    if (int_count + frac_count <= 19 && number_decimal(q, int_count, &m)) {
+      U64 frac_value = 0;
+      number_decimal(f, frac_count, &frac_value);
+      for (U64 i = 0; i < frac_count; ++i)
+        m *= 10;
+      m += frac_value;
+      fast = number_fast_path(m, exponent - (S64)(frac_end - frac), single,
+                              &value);
+    }
+  }
+  if (!fast && !number_slow_path(s.str, literal_end, single, &value)) {
+    n.status = NUMBER_OVERFLOW;
+    return n;
+  }
+  n.value = number_bits(value);
+  n.status = NUMBER_OK;
+  return n;
+}
+
+// ---- Literals ----
+
+// Type and value of the pp-number `s` (see number_end).
+static Number number_parse(String8 s) {
+  const U8 *p = s.str, *end = s.str + s.size;
+  U32 base = 10;
+  if (s.size >= 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+    base = 16;
+    p += 2;
+  } else if (s.size >= 2 && p[0] == '0' && (p[1] | 0x20) == 'b') {
+    base = 2;
+    p += 2;
+  }
+
+  const U8 *digits = p;
+  p = number_digits(p, end, base);
+  if (p < end && base != 2 &&
+      (*p == '.' || (*p | 0x20) == (base == 16 ? 'p' : 'e')))
+    return number_floating(s, digits, p, base);
+
+  Number n = {.type = NUM_INT, .status = NUMBER_INVALID};
+  bool u;
+  U32 longs;
+  U64 count = (U64)(p - digits);
+  if (!count || !number_integer_suffix(p, end, &u, &longs))
+    return n;
+
+  U64 value = 0;
+  bool fits;
+  if (base == 10 && digits[0] == '0') {
+    // Octal; a "0" on its own lands here too.
+    if (number_digits(digits, p, 8) != p)
+      return n;
+    base = 8;
+    fits = number_power_of_two(digits, count, 3, &value);
+  } else if (base == 10) {
+    fits = number_decimal(digits, count, &value);
+  } else {
+    fits = number_power_of_two(digits, count, base == 16 ? 4 : 1, &value);
+  }
+
+  n.status = fits && number_integer_type(value, base == 10, u, longs, &n.type)
+                 ? NUMBER_OK
+                 : NUMBER_OVERFLOW;
+  n.value = (S64)value;
+  return n;
+}
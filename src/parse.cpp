@@ -0,0 +1,573 @@
+#include "arena.hpp"
+#include "strings.hpp"
+#include <cassert>
+
+// Parser for the subset of C the lexer covers: functions, declarations,
+// return/if/while/break/continue, and expressions over + - * / with calls
+// and member access.
+//
+// The tree is index based. Nodes are fixed-size records in one array and
+// point at children and tokens by U32 index, so a whole tree is a couple of
+// flat arrays that later passes can sweep linearly. Anything variable-length
+// (a block's statements, a call's arguments) is a run of node indices in
+// `extra`. Index 0 is a null node that "no child" points at.
+
+enum NodeKind : U8 {
+  NODE_NONE,
+
+  NODE_PROGRAM,  // extra[lhs .. lhs + rhs) are top-level functions
+  NODE_FUNCTION, // token: name, lhs: extra = {type, body, param count,
+                 // params...}, body is NODE_NONE for a prototype
+  NODE_PARAM,    // token: name (0 for an unnamed one), lhs: type
+  NODE_TYPE,     // token: first specifier, lhs: number of specifier tokens
+
+  // Statements
+  NODE_BLOCK,     // extra[lhs .. lhs + rhs) are the items
+  NODE_DECL,      // token: name, lhs: type
+  NODE_RETURN,    // lhs: value, may be NODE_NONE
+  NODE_EXPR_STMT, // lhs: expression
+  NODE_IF,        // lhs: condition, rhs: extra = {then, else}
+  NODE_WHILE,     // lhs: condition, rhs: body
+  NODE_BREAK,
+  NODE_CONTINUE,
+  NODE_EMPTY, // A lone ';'
+
+  // Expressions
+  NODE_BINARY,     // token: operator, lhs and rhs: operands
+  NODE_NEGATE,     // token: '-', lhs: operand
+  NODE_PLUS,       // token: '+', lhs: operand
+  NODE_CALL,       // lhs: callee, rhs: extra = {arg count, args...}
+  NODE_MEMBER,     // token: member name, lhs: object
+  NODE_IDENTIFIER, // token
+  NODE_NUMBER,     // token
+};
+
+constexpr String8 node_kind_to_str8(NodeKind kind) {
+  switch (kind) {
+  case NODE_NONE:
+    return str8_lit("none");
+  case NODE_PROGRAM:
+    return str8_lit("program");
+  case NODE_FUNCTION:
+    return str8_lit("function");
+  case NODE_PARAM:
+    return str8_lit("param");
+  case NODE_TYPE:
+    return str8_lit("type");
+  case NODE_BLOCK:
+    return str8_lit("block");
+  case NODE_DECL:
+    return str8_lit("decl");
+  case NODE_RETURN:
+    return str8_lit("return");
+  case NODE_EXPR_STMT:
+    return str8_lit("expr");
+  case NODE_IF:
+    return str8_lit("if");
+  case NODE_WHILE:
+    return str8_lit("while");
+  case NODE_BREAK:
+    return str8_lit("break");
+  case NODE_CONTINUE:
+    return str8_lit("continue");
+  case NODE_EMPTY:
+    return str8_lit("empty");
+  case NODE_BINARY:
+    return str8_lit("binary");
+  case NODE_NEGATE:
+    return str8_lit("negate");
+  case NODE_PLUS:
+    return str8_lit("plus");
+  case NODE_CALL:
+    return str8_lit("call");
+  case NODE_MEMBER:
+    return str8_lit("member");
+  case NODE_IDENTIFIER:
+    return str8_lit("identifier");
+  case NODE_NUMBER:
+    return str8_lit("number");
+  }
+  return str8_lit("unknown");
+}
+
+using NodeIndex = U32;
+
+// 16 bytes. A pointer tree with the same information (kind, token pointer,
+// two child pointers) is 32.
+struct Node {
+  NodeKind kind;
+  U32 token;
+  U32 lhs;
+  U32 rhs;
+};
+
+enum ParseError {
+  PARSE_OK,
+  PARSE_ERROR_EXPECTED_TOKEN, // `expected` says which
+  PARSE_ERROR_EXPECTED_EXPRESSION,
+  PARSE_ERROR_EXPECTED_DECLARATION,
+};
+
+struct AstError {
+  U32 token;
+  ParseError error;
+  TokenKind expected;
+};
+
+struct Ast {
+  const LexResult *tokens;
+  Node *nodes;
+  U32 node_count;
+  U32 *extra;
+  U32 extra_count;
+  AstError *errors;
+  U32 error_count;
+  NodeIndex root;
+};
+
+struct Parser {
+  Arena *arena;
+  Ast ast;
+  U32 node_cap;
+  U32 extra_cap;
+  U32 error_cap;
+
+  U32 pos; // Current token
+
+  // Child lists under construction. Nested lists stack up here and are
+  // copied into `extra` once complete, so each list ends up contiguous.
+  U32 *stack;
+  U32 stack_count;
+  U32 stack_cap;
+};
+
+// ---- Storage ----
+
+static NodeIndex parse_add_node(Parser *p, NodeKind kind, U32 token, U32 lhs,
+                                U32 rhs) {
+  Ast *ast = &p->ast;
+  if (ast->node_count == p->node_cap) {
+    U32 cap = p->node_cap * 2;
+    ast->nodes = lex_grow_array(p->arena, ast->nodes, ast->node_count, cap);
+    p->node_cap = cap;
+  }
+  NodeIndex index = ast->node_count++;
+  ast->nodes[index] = {.kind = kind, .token = token, .lhs = lhs, .rhs = rhs};
+  return index;
+}
+
+static void parse_push_extra(Parser *p, U32 value) {
+  Ast *ast = &p->ast;
+  if (ast->extra_count == p->extra_cap) {
+    U32 cap = p->extra_cap * 2;
+    ast->extra = lex_grow_array(p->arena, ast->extra, ast->extra_count, cap);
+    p->extra_cap = cap;
+  }
+  ast->extra[ast->extra_count++] = value;
+}
+
+static void parse_push_stack(Parser *p, U32 value) {
+  if (p->stack_count == p->stack_cap) {
+    U32 cap = p->stack_cap * 2;
+    p->stack = lex_grow_array(p->arena, p->stack, p->stack_count, cap);
+    p->stack_cap = cap;
+  }
+  p->stack[p->stack_count++] = value;
+}
+
+// Moves stack[base..] into `extra` and returns where it starts.
+static U32 parse_flush_stack(Parser *p, U32 base) {
+  U32 start = p->ast.extra_count;
+  for (U32 i = base; i < p->stack_count; ++i)
+    parse_push_extra(p, p->stack[i]);
+  p->stack_count = base;
+  return start;
+}
+
+// ---- Tokens ----
+
+static TokenKind parse_peek_kind(Parser *p, U32 ahead = 0) {
+  U32 i = p->pos + ahead;
+  const LexResult *tokens = p->ast.tokens;
+  return i < tokens->token_count ? lex_kind(tokens, i) : TK_EOF;
+}
+
+static bool parse_at(Parser *p, TokenKind kind) {
+  return parse_peek_kind(p) == kind;
+}
+
+static U32 parse_advance(Parser *p) {
+  U32 token = p->pos;
+  if (parse_peek_kind(p) != TK_EOF)
+    p->pos++;
+  return token;
+}
+
+static bool parse_eat(Parser *p, TokenKind kind) {
+  if (!parse_at(p, kind))
+    return false;
+  parse_advance(p);
+  return true;
+}
+
+static void parse_error(Parser *p, ParseError error,
+                        TokenKind expected = TK_EOF) {
+  Ast *ast = &p->ast;
+  // One error per token is plenty, recovery can land on the same one twice.
+  if (ast->error_count && ast->errors[ast->error_count - 1].token == p->pos)
+    return;
+  if (ast->error_count == p->error_cap) {
+    U32 cap = p->error_cap ? p->error_cap * 2 : 16;
+    ast->errors = lex_grow_array(p->arena, ast->errors, ast->error_count, cap);
+    p->error_cap = cap;
+  }
+  ast->errors[ast->error_count++] = {
+      .token = p->pos, .error = error, .expected = expected};
+}
+
+static bool parse_expect(Parser *p, TokenKind kind) {
+  if (parse_eat(p, kind))
+    return true;
+  parse_error(p, PARSE_ERROR_EXPECTED_TOKEN, kind);
+  return false;
+}
+
+// Panic mode: skip to just past the next ';' or to a '}' / EOF, whichever
+// comes first, without leaving the enclosing block.
+static void parse_synchronize(Parser *p) {
+  while (true) {
+    TokenKind kind = parse_peek_kind(p);
+    if (kind == TK_EOF || kind == TK_RIGHT_BRACE)
+      return;
+    parse_advance(p);
+    if (kind == TK_SEMICOLON)
+      return;
+  }
+}
+
+static bool parse_is_type_specifier(TokenKind kind) {
+  switch (kind) {
+  case TK_KW_VOID:
+  case TK_KW_CHAR:
+  case TK_KW_SHORT:
+  case TK_KW_INT:
+  case TK_KW_LONG:
+  case TK_KW_FLOAT:
+  case TK_KW_DOUBLE:
+  case TK_KW_SIGNED:
+  case TK_KW_UNSIGNED:
+  case TK_KW_BOOL:
+  case TK_KW_CONST:
+  case TK_KW_VOLATILE:
+  case TK_KW_RESTRICT:
+  case TK_KW_STATIC:
+  case TK_KW_EXTERN:
+  case TK_KW_REGISTER:
+  case TK_KW_AUTO:
+  case TK_KW_INLINE:
+  case TK_KW_THREAD_LOCAL:
+  case TK_KW_CONSTEXPR:
+  case TK_KW_NORETURN:
+  case TK_KW_ATOMIC:
+  case TK_KW_COMPLEX:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool parse_at_type(Parser *p) {
+  return parse_is_type_specifier(parse_peek_kind(p));
+}
+
+// ---- Expressions ----
+
+static NodeIndex parse_expression(Parser *p);
+
+static NodeIndex parse_primary(Parser *p) {
+  switch (parse_peek_kind(p)) {
+  case TK_NUMBER:
+    return parse_add_node(p, NODE_NUMBER, parse_advance(p), 0, 0);
+  case TK_IDENTIFIER:
+    return parse_add_node(p, NODE_IDENTIFIER, parse_advance(p), 0, 0);
+  case TK_LEFT_PAREN: {
+    parse_advance(p);
+    NodeIndex inner = parse_expression(p);
+    parse_expect(p, TK_RIGHT_PAREN);
+    return inner;
+  }
+  default:
+    parse_error(p, PARSE_ERROR_EXPECTED_EXPRESSION);
+    return NODE_NONE;
+  }
+}
+
+static NodeIndex parse_postfix(Parser *p) {
+  NodeIndex node = parse_primary(p);
+  while (true) {
+    if (parse_eat(p, TK_LEFT_PAREN)) {
+      U32 base = p->stack_count;
+      if (!parse_at(p, TK_RIGHT_PAREN)) {
+        do
+          parse_push_stack(p, parse_expression(p));
+        while (parse_eat(p, TK_COMMA));
+      }
+      parse_expect(p, TK_RIGHT_PAREN);
+
+      U32 count = p->stack_count - base;
+      U32 start = p->ast.extra_count;
+      parse_push_extra(p, count);
+      parse_flush_stack(p, base);
+      node = parse_add_node(p, NODE_CALL, 0, node, start);
+    } else if (parse_eat(p, TK_DOT)) {
+      U32 member = p->pos;
+      if (!parse_expect(p, TK_IDENTIFIER))
+        return node;
+      node = parse_add_node(p, NODE_MEMBER, member, node, 0);
+    } else {
+      return node;
+    }
+  }
+}
+
+static NodeIndex parse_unary(Parser *p) {
+  if (parse_at(p, TK_MINUS) || parse_at(p, TK_PLUS)) {
+    NodeKind kind = parse_at(p, TK_MINUS) ? NODE_NEGATE : NODE_PLUS;
+    U32 op = parse_advance(p);
+    return parse_add_node(p, kind, op, parse_unary(p), 0);
+  }
+  return parse_postfix(p);
+}
+
+static U32 parse_binary_precedence(TokenKind kind) {
+  switch (kind) {
+  case TK_STAR:
+  case TK_SLASH:
+    return 2;
+  case TK_PLUS:
+  case TK_MINUS:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// Precedence climbing, all binary operators are left associative.
+static NodeIndex parse_binary(Parser *p, U32 min_precedence) {
+  NodeIndex lhs = parse_unary(p);
+  while (true) {
+    U32 precedence = parse_binary_precedence(parse_peek_kind(p));
+    if (precedence == 0 || precedence < min_precedence)
+      return lhs;
+    U32 op = parse_advance(p);
+    NodeIndex rhs = parse_binary(p, precedence + 1);
+    lhs = parse_add_node(p, NODE_BINARY, op, lhs, rhs);
+  }
+}
+
+static NodeIndex parse_expression(Parser *p) { return parse_binary(p, 1); }
+
+// ---- Declarations ----
+
+static NodeIndex parse_type(Parser *p) {
+  U32 first = p->pos;
+  while (parse_at_type(p))
+    parse_advance(p);
+  return parse_add_node(p, NODE_TYPE, first, p->pos - first, 0);
+}
+
+// After the type: `name;`
+static NodeIndex parse_declaration(Parser *p, NodeIndex type) {
+  U32 name = p->pos;
+  if (!parse_expect(p, TK_IDENTIFIER)) {
+    parse_synchronize(p);
+    return NODE_NONE;
+  }
+  if (!parse_expect(p, TK_SEMICOLON))
+    parse_synchronize(p);
+  return parse_add_node(p, NODE_DECL, name, type, 0);
+}
+
+// ---- Statements ----
+
+static NodeIndex parse_statement(Parser *p);
+
+static NodeIndex parse_block(Parser *p) {
+  U32 open = p->pos;
+  parse_expect(p, TK_LEFT_BRACE);
+  U32 base = p->stack_count;
+  while (!parse_at(p, TK_RIGHT_BRACE) && !parse_at(p, TK_EOF)) {
+    U32 before = p->pos;
+    NodeIndex item = parse_at_type(p) ? parse_declaration(p, parse_type(p))
+                                      : parse_statement(p);
+    if (item != NODE_NONE)
+      parse_push_stack(p, item);
+    // Always make progress, even on a token nothing can start with.
+    if (p->pos == before)
+      parse_advance(p);
+  }
+  parse_expect(p, TK_RIGHT_BRACE);
+
+  U32 count = p->stack_count - base;
+  U32 start = parse_flush_stack(p, base);
+  return parse_add_node(p, NODE_BLOCK, open, start, count);
+}
+
+static NodeIndex parse_statement(Parser *p) {
+  U32 token = p->pos;
+  switch (parse_peek_kind(p)) {
+  case TK_LEFT_BRACE:
+    return parse_block(p);
+  case TK_SEMICOLON:
+    parse_advance(p);
+    return parse_add_node(p, NODE_EMPTY, token, 0, 0);
+  case TK_KW_RETURN: {
+    parse_advance(p);
+    NodeIndex value =
+        parse_at(p, TK_SEMICOLON) ? NODE_NONE : parse_expression(p);
+    if (!parse_expect(p, TK_SEMICOLON))
+      parse_synchronize(p);
+    return parse_add_node(p, NODE_RETURN, token, value, 0);
+  }
+  case TK_KW_BREAK:
+  case TK_KW_CONTINUE: {
+    NodeKind kind = parse_at(p, TK_KW_BREAK) ? NODE_BREAK : NODE_CONTINUE;
+    parse_advance(p);
+    if (!parse_expect(p, TK_SEMICOLON))
+      parse_synchronize(p);
+    return parse_add_node(p, kind, token, 0, 0);
+  }
+  case TK_KW_IF: {
+    parse_advance(p);
+    parse_expect(p, TK_LEFT_PAREN);
+    NodeIndex cond = parse_expression(p);
+    parse_expect(p, TK_RIGHT_PAREN);
+    NodeIndex then = parse_statement(p);
+    NodeIndex otherwise =
+        parse_eat(p, TK_KW_ELSE) ? parse_statement(p) : NODE_NONE;
+    U32 start = p->ast.extra_count;
+    parse_push_extra(p, then);
+    parse_push_extra(p, otherwise);
+    return parse_add_node(p, NODE_IF, token, cond, start);
+  }
+  case TK_KW_WHILE: {
+    parse_advance(p);
+    parse_expect(p, TK_LEFT_PAREN);
+    NodeIndex cond = parse_expression(p);
+    parse_expect(p, TK_RIGHT_PAREN);
+    NodeIndex body = parse_statement(p);
+    return parse_add_node(p, NODE_WHILE, token, cond, body);
+  }
+  default: {
+    U32 errors = p->ast.error_count;
+    NodeIndex expr = parse_expression(p);
+    if (p->ast.error_count != errors) {
+      parse_synchronize(p);
+      return NODE_NONE;
+    }
+    if (!parse_expect(p, TK_SEMICOLON))
+      parse_synchronize(p);
+    return parse_add_node(p, NODE_EXPR_STMT, token, expr, 0);
+  }
+  }
+}
+
+// ---- Functions ----
+
+// `type name(params) body` or `type name(params);`
+static NodeIndex parse_function(Parser *p) {
+  NodeIndex type = parse_type(p);
+  U32 name = p->pos;
+  if (!parse_expect(p, TK_IDENTIFIER) || !parse_expect(p, TK_LEFT_PAREN))
+    return NODE_NONE;
+
+  U32 base = p->stack_count;
+  bool no_params =
+      parse_at(p, TK_KW_VOID) && parse_peek_kind(p, 1) == TK_RIGHT_PAREN;
+  if (no_params) {
+    parse_advance(p);
+  } else if (!parse_at(p, TK_RIGHT_PAREN)) {
+    do {
+      if (!parse_at_type(p)) {
+        parse_error(p, PARSE_ERROR_EXPECTED_DECLARATION);
+        break;
+      }
+      NodeIndex param_type = parse_type(p);
+      U32 param_name = parse_at(p, TK_IDENTIFIER) ? parse_advance(p) : 0;
+      parse_push_stack(
+          p, parse_add_node(p, NODE_PARAM, param_name, param_type, 0));
+    } while (parse_eat(p, TK_COMMA));
+  }
+  parse_expect(p, TK_RIGHT_PAREN);
+
+  NodeIndex body = NODE_NONE;
+  if (!parse_eat(p, TK_SEMICOLON))
+    body = parse_block(p);
+
+  U32 count = p->stack_count - base;
+  U32 start = p->ast.extra_count;
+  parse_push_extra(p, type);
+  parse_push_extra(p, body);
+  parse_push_extra(p, count);
+  parse_flush_stack(p, base);
+  return parse_add_node(p, NODE_FUNCTION, name, start, 0);
+}
+
+// Parses a whole token stream. The tree refers to `tokens` by index, so it
+// has to outlive the Ast. Never fails: errors are collected in Ast::errors
+// and parsing resumes at the next declaration.
+auto perform_parse(Arena *arena, const LexResult *tokens) -> Ast {
+  Parser p = {.arena = arena};
+  p.ast.tokens = tokens;
+
+  // Roughly one node per token in practice.
+  p.node_cap = tokens->token_count > 64 ? tokens->token_count : 64;
+  p.ast.nodes = arena_push_array<Node>(arena, p.node_cap);
+  p.extra_cap = p.node_cap / 4;
+  p.ast.extra = arena_push_array<U32>(arena, p.extra_cap);
+  p.stack_cap = 256;
+  p.stack = arena_push_array<U32>(arena, p.stack_cap);
+  parse_add_node(&p, NODE_NONE, 0, 0, 0);
+
+  U32 base = p.stack_count;
+  while (!parse_at(&p, TK_EOF)) {
+    U32 before = p.pos;
+    if (!parse_at_type(&p)) {
+      parse_error(&p, PARSE_ERROR_EXPECTED_DECLARATION);
+      parse_advance(&p);
+      continue;
+    }
+    NodeIndex fn = parse_function(&p);
+    if (fn != NODE_NONE)
+      parse_push_stack(&p, fn);
+    else
+      parse_synchronize(&p);
+    if (p.pos == before)
+      parse_advance(&p);
+  }
+
+  U32 count = p.stack_count - base;
+  U32 start = parse_flush_stack(&p, base);
+  p.ast.root = parse_add_node(&p, NODE_PROGRAM, 0, start, count);
+  return p.ast;
+}
+
+inline const Node *ast_node(const Ast *ast, NodeIndex i) {
+  return &ast->nodes[i];
+}
+
+inline const U32 *ast_extra(const Ast *ast, U32 i) { return &ast->extra[i]; }
+
+constexpr String8 parse_error_to_str8(ParseError error) {
+  switch (error) {
+  case PARSE_OK:
+    return str8_lit("ok");
+  case PARSE_ERROR_EXPECTED_TOKEN:
+    return str8_lit("Expected token");
+  case PARSE_ERROR_EXPECTED_EXPRESSION:
+    return str8_lit("Expected expression");
+  case PARSE_ERROR_EXPECTED_DECLARATION:
+    return str8_lit("Expected declaration");
+  }
+  return str8_lit("unknown");
+}
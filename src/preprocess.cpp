@@ -0,0 +1,1766 @@
+#include "arena.hpp"
+#include "file.hpp"
+#include "intern.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <cassert>
+#include <cstdio>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// C preprocessor: #include, object- and function-like #define (with # and
+// ##, __VA_ARGS__ and the GNU `, ## __VA_ARGS__` comma), #undef, the #if
+// family, #pragma once, #error and #warning.
+//
+// The result is one '\0' terminated buffer that goes straight to the lexer,
+// the way `gcc -E -P` output would have. Tokens are rebuilt from spellings
+// with a space wherever the source had one, so offsets in it don't match the
+// original file. Line structure is kept but blank lines are dropped.
+//
+// Included files go through an IncludeCache shared by every thread, so each
+// header is mapped once per process and only remapped if it changes. It's
+// keyed on absolute paths, since server requests each run in their own
+// working directory.
+
+// ---- Include cache ----
+
+static constexpr U64 INCLUDE_CACHE_BUCKETS = 1024;
+
+struct IncludeFile {
+  String8 path; // Absolute, '\0' terminated
+  U64 path_cap;
+  FileMap map;
+  S64 mtime_ns;
+  U64 size;
+  U32 readers; // Preprocessor runs that opened it and haven't finished
+  bool stale;  // Changed or gone on disk, out of the hash chains
+
+  // Macro guarding the whole file, if it's wrapped in `#ifndef X ... #endif`.
+  // Learned the first time the file is preprocessed.
+  bool guard_known;
+  String8 guard;
+  U64 guard_cap;
+
+  IncludeFile *next; // Hash chain, or the stale or free list
+};
+
+// Lives as long as the process. An entry whose file changes is taken out of
+// its chain at once, but other threads may still be reading it, so it's
+// only unmapped when its last reader closes it. Its slot, and the storage
+// for its strings, then go to the next file opened. The arena only grows
+// with the number of files mapped at once.
+struct IncludeCache {
+  std::mutex mutex;
+  Arena arena;
+  IncludeFile *buckets[INCLUDE_CACHE_BUCKETS];
+  IncludeFile *stale; // Waiting for their readers
+  IncludeFile *free;  // Unmapped, for reuse
+  U64 hits;
+  U64 misses;
+};
+
+static void include_cache_init(IncludeCache *cache) {
+  memset(cache->buckets, 0, sizeof(cache->buckets));
+  cache->stale = nullptr;
+  cache->free = nullptr;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->arena =
+      arena_alloc_params({.reserve = MiB(256),
+                          .commit_chunk = ARENA_DEFAULT_COMMIT_CHUNK,
+                          .decommit_above = ARENA_DEFAULT_DECOMMIT_ABOVE,
+                          .flags = ARENA_FLAG_CHAIN});
+  arena_profile_label(&cache->arena, "include-cache");
+}
+
+static void include_cache_release(IncludeCache *cache) {
+  for (IncludeFile *bucket : cache->buckets) {
+    for (IncludeFile *f = bucket; f; f = f->next)
+      file_unmap(&f->map);
+  }
+  for (IncludeFile *f = cache->stale; f; f = f->next)
+    file_unmap(&f->map);
+  arena_release(&cache->arena);
+}
+
+// Copies `s`, '\0' terminated, into `*dst`, reusing its storage if it fits.
+static void include_cache_store(IncludeCache *cache, String8 *dst, U64 *cap,
+                                String8 s) {
+  if (*cap < s.size + 1) {
+    *cap = s.size + 1;
+    dst->str = arena_push_array<U8>(&cache->arena, *cap);
+  }
+  memcpy(dst->str, s.str, s.size);
+  dst->str[s.size] = '\0';
+  dst->size = s.size;
+}
+
+// Unmaps `f` and keeps it for reuse. The cache is locked and nobody reads
+// it anymore.
+static void include_cache_free(IncludeCache *cache, IncludeFile *f) {
+  file_unmap(&f->map);
+  f->next = cache->free;
+  cache->free = f;
+}
+
+// Takes `*link`, an entry that no longer matches its file, out of its chain.
+// The cache is locked.
+static void include_cache_retire(IncludeCache *cache, IncludeFile **link) {
+  IncludeFile *f = *link;
+  *link = f->next;
+  f->stale = true;
+  if (f->readers) {
+    f->next = cache->stale;
+    cache->stale = f;
+  } else {
+    include_cache_free(cache, f);
+  }
+}
+
+// Maps `path` the first time it's asked for, and again only if its mtime or
+// size has changed since. A relative `path` is taken relative to `cwd`.
+// nullptr if it isn't a readable regular file. Every file returned has to
+// be given back to include_cache_close.
+static IncludeFile *include_cache_open(IncludeCache *cache, String8 cwd,
+                                       String8 path) {
+  char absolute[8192];
+  if (!path.size || path.str[0] != '/') {
+    int n = snprintf(absolute, sizeof(absolute), "%.*s/%.*s", (int)cwd.size,
+                     cwd.str, (int)path.size, path.str);
+    if (n < 0 || (U64)n >= sizeof(absolute))
+      return nullptr;
+    path = str8((U8 *)absolute, (U64)n);
+  }
+
+  struct stat st;
+  bool found = stat((const char *)path.str, &st) == 0 && S_ISREG(st.st_mode);
+  S64 mtime = found ? (S64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec
+                    : 0;
+  U64 bucket = str8_hash(path) & (INCLUDE_CACHE_BUCKETS - 1);
+
+  std::lock_guard lock(cache->mutex);
+  for (IncludeFile **link = &cache->buckets[bucket]; *link;
+       link = &(*link)->next) {
+    IncludeFile *f = *link;
+    if (!str8_match(f->path, path))
+      continue;
+    if (found && f->mtime_ns == mtime && f->size == (U64)st.st_size) {
+      cache->hits++;
+      f->readers++;
+      return f;
+    }
+    include_cache_retire(cache, link);
+    break;
+  }
+  if (!found)
+    return nullptr;
+
+  FileMap map = file_map_readonly((const char *)path.str);
+  if (!map.data.str)
+    return nullptr;
+  cache->misses++;
+
+  IncludeFile *f = cache->free;
+  if (f)
+    cache->free = f->next;
+  else
+    f = arena_push_zero<IncludeFile>(&cache->arena);
+  include_cache_store(cache, &f->path, &f->path_cap, path);
+  f->map = map;
+  f->mtime_ns = mtime;
+  f->size = (U64)st.st_size;
+  f->readers = 1;
+  f->stale = false;
+  f->guard_known = false;
+  f->guard.size = 0;
+  f->next = cache->buckets[bucket];
+  cache->buckets[bucket] = f;
+  return f;
+}
+
+// Gives back files from include_cache_open, once nothing points into them.
+static void include_cache_close(IncludeCache *cache, IncludeFile **files,
+                                U32 count) {
+  std::lock_guard lock(cache->mutex);
+  for (U32 i = 0; i < count; ++i) {
+    IncludeFile *f = files[i];
+    assert(f->readers && "Include file closed more often than opened");
+    if (--f->readers || !f->stale)
+      continue;
+    IncludeFile **link = &cache->stale;
+    while (*link != f)
+      link = &(*link)->next;
+    *link = f->next;
+    include_cache_free(cache, f);
+  }
+}
+
+// Empty if the file has no guard or hasn't been seen through yet.
+static String8 include_cache_guard(IncludeCache *cache, IncludeFile *f) {
+  std::lock_guard lock(cache->mutex);
+  return f->guard_known ? f->guard : String8{};
+}
+
+static void include_cache_set_guard(IncludeCache *cache, IncludeFile *f,
+                                    String8 guard) {
+  std::lock_guard lock(cache->mutex);
+  if (f->guard_known)
+    return;
+  include_cache_store(cache, &f->guard, &f->guard_cap, guard);
+  f->guard_known = true;
+}
+
+// ---- Tokens ----
+
+enum PPKind : U8 {
+  PP_EOF,
+  PP_NEWLINE,
+  PP_IDENTIFIER,
+  PP_NUMBER,
+  PP_STRING,
+  PP_CHAR,
+  PP_PUNCT,
+};
+
+struct PPToken {
+  PPKind kind;
+  bool space_before;
+  bool line_start; // First on a line of a file, only these start directives
+  bool no_expand;  // Named a macro while it was being expanded
+  Atom atom;       // PP_IDENTIFIER
+  String8 text;
+};
+
+static bool pp_char_is_ident(U8 c) {
+  return char_is_alpha(c) || char_is_digit(c, 10) || c == '_';
+}
+
+struct PPTokens {
+  PPToken *items;
+  U32 count;
+  U32 cap;
+};
+
+static void pp_tokens_push(Arena *arena, PPTokens *list, const PPToken &t) {
+  if (list->count == list->cap) {
+    U32 cap = list->cap ? list->cap * 2 : 16;
+    list->items = lex_grow_array(arena, list->items, list->count, cap);
+    list->cap = cap;
+  }
+  list->items[list->count++] = t;
+}
+
+static bool pp_is_punct(const PPToken &t, String8 spelling) {
+  return t.kind == PP_PUNCT && str8_match(t.text, spelling);
+}
+
+// Raw tokenizer over one file. Comments and line splices are whitespace,
+// newlines are tokens since directives end at them.
+struct PPLexer {
+  const U8 *p; // '\0' terminated
+  U32 line;
+  bool at_line_start;
+};
+
+// Longest first within each length.
+static const String8 pp_puncts[] = {
+    str8_lit("..."), str8_lit("<<="), str8_lit(">>="), str8_lit("->"),
+    str8_lit("++"),  str8_lit("--"),  str8_lit("<<"),  str8_lit(">>"),
+    str8_lit("<="),  str8_lit(">="),  str8_lit("=="),  str8_lit("!="),
+    str8_lit("&&"),  str8_lit("||"),  str8_lit("*="),  str8_lit("/="),
+    str8_lit("%="),  str8_lit("+="),  str8_lit("-="),  str8_lit("&="),
+    str8_lit("^="),  str8_lit("|="),  str8_lit("##"),
+};
+
+static void pp_skip_block_comment(PPLexer *lx) {
+  lx->p += 2;
+  while (*lx->p && !(lx->p[0] == '*' && lx->p[1] == '/')) {
+    if (*lx->p == '\n')
+      lx->line++;
+    lx->p++;
+  }
+  if (*lx->p)
+    lx->p += 2;
+}
+
+// Blanks, comments and backslash-newlines, but not newlines. Returns whether
+// anything was skipped.
+static bool pp_skip_blanks(PPLexer *lx) {
+  const U8 *start = lx->p;
+  while (true) {
+    U8 c = *lx->p;
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+      lx->p++;
+    } else if (c == '\\' && lx->p[1] == '\n') {
+      lx->p += 2;
+      lx->line++;
+    } else if (c == '/' && lx->p[1] == '/') {
+      while (*lx->p != '\n' && *lx->p)
+        lx->p++;
+    } else if (c == '/' && lx->p[1] == '*') {
+      pp_skip_block_comment(lx);
+    } else {
+      return lx->p != start;
+    }
+  }
+}
+
+// The rest of a line in a skipped group. Only comments can hide a newline
+// here; quotes are ignored since disabled code often has unbalanced ones.
+static void pp_skip_line(PPLexer *lx) {
+  while (true) {
+    U8 c = *lx->p;
+    if (c == '\0')
+      return;
+    if (c == '\n') {
+      lx->p++;
+      lx->line++;
+      lx->at_line_start = true;
+      return;
+    }
+    if (c == '\\' && lx->p[1] == '\n') {
+      lx->p += 2;
+      lx->line++;
+    } else if (c == '/' && lx->p[1] == '*') {
+      pp_skip_block_comment(lx);
+    } else {
+      lx->p++;
+    }
+  }
+}
+
+static PPToken pp_lex(PPLexer *lx, Interner *interner) {
+  PPToken t = {.space_before = pp_skip_blanks(lx),
+               .line_start = lx->at_line_start};
+  const U8 *start = lx->p;
+  U8 c = *start;
+
+  if (c == '\0') {
+    // A last line without '\n' still ends like one.
+    t.kind = lx->at_line_start ? PP_EOF : PP_NEWLINE;
+    lx->at_line_start = true;
+    return t;
+  }
+  if (c == '\n') {
+    lx->p++;
+    lx->line++;
+    lx->at_line_start = true;
+    t.kind = PP_NEWLINE;
+    return t;
+  }
+  lx->at_line_start = false;
+
+  const U8 *p = start + 1;
+  if (char_is_alpha(c) || c == '_') {
+    p = scanner.identifier(start);
+    t.kind = PP_IDENTIFIER;
+    t.atom = intern(interner, str8((U8 *)start, (U64)(p - start)));
+  } else if (char_is_digit(c, 10) || (c == '.' && char_is_digit(p[0], 10))) {
+    // pp-number: digits, letters, '.', and signs after an exponent.
+    t.kind = PP_NUMBER;
+    while (true) {
+      U8 e = p[0] | 0x20;
+      if ((e == 'e' || e == 'p') && (p[1] == '+' || p[1] == '-'))
+        p += 2;
+      else if (pp_char_is_ident(p[0]) || p[0] == '.')
+        p++;
+      else
+        break;
+    }
+  } else if (c == '"' || c == '\'') {
+    t.kind = c == '"' ? PP_STRING : PP_CHAR;
+    while (*p && *p != c && *p != '\n') {
+      if (*p == '\\' && p[1] && p[1] != '\n')
+        p++;
+      p++;
+    }
+    if (*p == c)
+      p++;
+  } else {
+    t.kind = PP_PUNCT;
+    // Compared byte by byte: the '\0' ends it before reading past the end.
+    for (String8 punct : pp_puncts) {
+      U64 n = 0;
+      while (n < punct.size && start[n] == punct.str[n])
+        n++;
+      if (n == punct.size) {
+        p = start + n;
+        break;
+      }
+    }
+  }
+
+  lx->p = p;
+  t.text = str8((U8 *)start, (U64)(p - start));
+  return t;
+}
+
+// ---- Preprocessor state ----
+
+enum PPError {
+  PP_OK,
+  PP_ERROR_UNKNOWN_DIRECTIVE,
+  PP_ERROR_BAD_INCLUDE,
+  PP_ERROR_INCLUDE_NOT_FOUND,
+  PP_ERROR_INCLUDE_DEPTH,
+  PP_ERROR_BAD_DEFINE,
+  PP_ERROR_EXPECTED_MACRO_NAME,
+  PP_ERROR_BAD_PASTE,
+  PP_ERROR_UNTERMINATED_ARGUMENTS,
+  PP_ERROR_ARGUMENT_COUNT,
+  PP_ERROR_BAD_EXPRESSION,
+  PP_ERROR_UNBALANCED_CONDITIONAL,
+  PP_ERROR_USER,
+  PP_ERROR_USER_WARNING,
+};
+
+constexpr String8 pp_error_to_str8(PPError error) {
+  switch (error) {
+  case PP_OK:
+    return str8_lit("ok");
+  case PP_ERROR_UNKNOWN_DIRECTIVE:
+    return str8_lit("Unknown directive");
+  case PP_ERROR_BAD_INCLUDE:
+    return str8_lit("Expected \"file\" or <file>");
+  case PP_ERROR_INCLUDE_NOT_FOUND:
+    return str8_lit("Include file not found");
+  case PP_ERROR_INCLUDE_DEPTH:
+    return str8_lit("Includes nested too deeply");
+  case PP_ERROR_BAD_DEFINE:
+    return str8_lit("Malformed #define");
+  case PP_ERROR_EXPECTED_MACRO_NAME:
+    return str8_lit("Expected macro name after");
+  case PP_ERROR_BAD_PASTE:
+    return str8_lit("## doesn't form a single token");
+  case PP_ERROR_UNTERMINATED_ARGUMENTS:
+    return str8_lit("Unterminated macro arguments");
+  case PP_ERROR_ARGUMENT_COUNT:
+    return str8_lit("Wrong number of macro arguments");
+  case PP_ERROR_BAD_EXPRESSION:
+    return str8_lit("Invalid #if expression");
+  case PP_ERROR_UNBALANCED_CONDITIONAL:
+    return str8_lit("Unbalanced conditional");
+  case PP_ERROR_USER:
+    return str8_lit("#error");
+  case PP_ERROR_USER_WARNING:
+    return str8_lit("#warning");
+  }
+  return str8_lit("unknown");
+}
+
+struct PPDiagnostic {
+  String8 path;
+  U32 line;
+  PPError error;
+  bool warning;
+  String8 detail; // The offending name or text, may be empty
+};
+
+enum PPBuiltin : U8 {
+  PP_BUILTIN_NONE,
+  PP_BUILTIN_FILE,
+  PP_BUILTIN_LINE,
+};
+
+struct PPMacro {
+  bool function_like;
+  bool variadic; // Last parameter is __VA_ARGS__
+  bool has_paste;
+  bool disabled; // Being expanded, so its name doesn't expand again
+  PPBuiltin builtin;
+  Atom *params;
+  U32 param_count;
+  PPToken *body;
+  U32 body_count;
+};
+
+// Where tokens come from before the file: macro expansions being rescanned
+// and tokens read ahead and put back. A barrier reads as end of input once
+// empty, which is how arguments are expanded on their own.
+struct PPSource {
+  const PPToken *tokens;
+  U32 count;
+  U32 pos;
+  PPMacro *macro; // Re-enabled once the source is used up
+  bool barrier;
+};
+
+struct PPCond {
+  bool parent_active;
+  bool active;
+  bool taken; // Some branch of this #if has been taken
+  bool seen_else;
+};
+
+// Include guard detection runs while a file is preprocessed: the first thing
+// in it has to be #ifndef, and nothing but whitespace may follow its #endif.
+enum PPGuard : U8 {
+  PP_GUARD_START,
+  PP_GUARD_OPEN,
+  PP_GUARD_CLOSED,
+  PP_GUARD_NONE,
+};
+
+struct PPFile {
+  IncludeFile *include; // nullptr for the main file and the predefines
+  String8 path;
+  String8 dir; // For "" includes
+  PPLexer lexer;
+  U32 cond_base; // Conditionals open when the file was entered
+  PPGuard guard;
+  String8 guard_name;
+  U32 guard_depth;
+};
+
+// Search paths and -D definitions.
+struct PPConfig {
+  const char *const *include_dirs; // Searched before the system ones
+  U32 include_dir_count;
+  const char *const *defines; // NAME or NAME=value
+  U32 define_count;
+};
+
+static constexpr const char *pp_system_dirs[] = {
+    "/usr/local/include", "/usr/include/x86_64-linux-gnu", "/usr/include"};
+static constexpr U32 PP_MAX_INCLUDE_DEPTH = 200;
+
+// Where an output line came from: its first token was at `line`:`column`
+// of `path`, and was written at `offset`.
+struct PPLine {
+  U32 offset;
+  U32 line;
+  U32 column;
+  String8 path;
+};
+
+struct PPStats {
+  U32 includes;      // #include directives that named a file
+  U32 include_skips; // ...that were skipped by #pragma once or a guard
+  U64 expansions;
+};
+
+struct Preprocessor {
+  Arena *arena;
+  Interner *interner;
+  IncludeCache *cache;
+  PPConfig config;
+  String8 cwd; // Relative include paths are under it
+
+  PPFile *file;
+  U32 depth;
+
+  PPSource *sources;
+  U32 source_count;
+  U32 source_cap;
+
+  PPMacro **macros; // By atom
+  U32 macro_cap;
+
+  PPCond *conds;
+  U32 cond_count;
+  U32 cond_cap;
+
+  // Files that said #pragma once and have been included already.
+  IncludeFile **once;
+  U32 once_count;
+  U32 once_cap;
+
+  // Every include_cache_open, closed when the run ends.
+  IncludeFile **opened;
+  U32 opened_count;
+  U32 opened_cap;
+
+  U8 *out;
+  U32 out_size;
+  U32 out_cap;
+  bool line_has_output;
+  bool pending_space; // The macro name just expanded had a space before it
+  U8 last;            // Last byte written
+  PPLine mark;        // Where the next output line starts, once it does
+
+  PPLine *lines;
+  U32 line_count;
+  U32 line_cap;
+
+  PPDiagnostic *diagnostics;
+  U32 diagnostic_count;
+  U32 diagnostic_cap;
+  U32 error_count;
+
+  Atom atom_defined;
+  Atom atom_va_args;
+  PPStats stats;
+};
+
+struct Preprocessed {
+  String8 text; // '\0' terminated
+  PPDiagnostic *diagnostics;
+  U32 diagnostic_count;
+  U32 error_count;
+  PPLine *lines; // By offset
+  U32 line_count;
+  PPStats stats;
+};
+
+// Where byte `offset` of the output came from. Exact for the first token on
+// a line; past it, whitespace the preprocessor collapsed or added can shift
+// the column, and a macro's tokens are placed at its invocation.
+inline PPLine pp_locate(const Preprocessed *pp, U32 offset) {
+  // The last line starting at or before `offset`.
+  U32 lo = 0, hi = pp->line_count;
+  while (hi - lo > 1) {
+    U32 mid = lo + (hi - lo) / 2;
+    if (pp->lines[mid].offset <= offset)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  PPLine at = pp->lines[lo];
+  at.column += offset - at.offset;
+  at.offset = offset;
+  return at;
+}
+
+static void pp_diagnose(Preprocessor *pp, U32 line, PPError error,
+                        String8 detail, bool warning = false) {
+  if (pp->diagnostic_count == pp->diagnostic_cap) {
+    U32 cap = pp->diagnostic_cap ? pp->diagnostic_cap * 2 : 16;
+    pp->diagnostics = lex_grow_array(pp->arena, pp->diagnostics,
+                                     pp->diagnostic_count, cap);
+    pp->diagnostic_cap = cap;
+  }
+  // Copied: it may point into a header that's unmapped once the run ends.
+  pp->diagnostics[pp->diagnostic_count++] = {
+      .path = pp->file->path,
+      .line = line,
+      .error = error,
+      .warning = warning,
+      .detail = detail.size ? str8_copy(pp->arena, detail) : String8{}};
+  if (!warning)
+    pp->error_count++;
+}
+
+static void pp_error(Preprocessor *pp, PPError error, String8 detail = {}) {
+  pp_diagnose(pp, pp->file->lexer.line, error, detail);
+}
+
+static Atom pp_intern(Preprocessor *pp, const char *name) {
+  return intern(pp->interner, str8_cstring((U8 *)name));
+}
+
+static PPMacro *pp_find_macro(Preprocessor *pp, Atom atom) {
+  return atom < pp->macro_cap ? pp->macros[atom] : nullptr;
+}
+
+static void pp_set_macro(Preprocessor *pp, Atom atom, PPMacro *macro) {
+  if (atom >= pp->macro_cap) {
+    U32 cap = pp->macro_cap ? pp->macro_cap : 256;
+    while (cap <= atom)
+      cap *= 2;
+    PPMacro **grown = arena_push_array_zero<PPMacro *>(pp->arena, cap);
+    if (pp->macro_cap)
+      memcpy(grown, pp->macros, pp->macro_cap * sizeof(PPMacro *));
+    pp->macros = grown;
+    pp->macro_cap = cap;
+  }
+  pp->macros[atom] = macro;
+}
+
+static bool pp_active(Preprocessor *pp) {
+  return pp->cond_count == 0 || pp->conds[pp->cond_count - 1].active;
+}
+
+// ---- Output ----
+
+static void pp_reserve(Preprocessor *pp, U64 size) {
+  if (pp->out_size + size <= pp->out_cap)
+    return;
+  U64 cap = pp->out_cap ? pp->out_cap : KiB(64);
+  while (cap < pp->out_size + size)
+    cap *= 2;
+  assert(cap < 0xffffffffull && "Offsets are 32 bits");
+  pp->out = lex_grow_array(pp->arena, pp->out, pp->out_size, (U32)cap);
+  pp->out_cap = (U32)cap;
+}
+
+// Whether two spellings written back to back could lex as one token.
+static bool pp_would_merge(U8 last, U8 next) {
+  auto ident = [](U8 c) { return pp_char_is_ident(c) || c == '.'; };
+  auto punct = [](U8 c) {
+    return c && strchr("+-*/%<>=!&|^#.:", c) != nullptr;
+  };
+  return (ident(last) && ident(next)) || (punct(last) && punct(next));
+}
+
+static void pp_mark_line(Preprocessor *pp) {
+  if (pp->line_count == pp->line_cap) {
+    U32 cap = pp->line_cap ? pp->line_cap * 2 : 256;
+    pp->lines = lex_grow_array(pp->arena, pp->lines, pp->line_count, cap);
+    pp->line_cap = cap;
+  }
+  pp->mark.offset = pp->out_size;
+  pp->lines[pp->line_count++] = pp->mark;
+}
+
+static void pp_emit(Preprocessor *pp, const PPToken &t) {
+  pp_reserve(pp, t.text.size + 1);
+  if (!pp->line_has_output)
+    pp_mark_line(pp);
+  if (pp->line_has_output &&
+      (t.space_before || pp->pending_space ||
+       pp_would_merge(pp->last, t.text.str[0])))
+    pp->out[pp->out_size++] = ' ';
+  memcpy(pp->out + pp->out_size, t.text.str, t.text.size);
+  pp->out_size += (U32)t.text.size;
+  pp->last = t.text.str[t.text.size - 1];
+  pp->line_has_output = true;
+  pp->pending_space = false;
+}
+
+static void pp_emit_newline(Preprocessor *pp) {
+  if (pp->line_has_output) {
+    pp_reserve(pp, 1);
+    pp->out[pp->out_size++] = '\n';
+  }
+  pp->line_has_output = false;
+  pp->pending_space = false;
+}
+
+// ---- Token sources ----
+
+static void pp_push_source(Preprocessor *pp, const PPToken *tokens, U32 count,
+                           PPMacro *macro, bool barrier) {
+  if (pp->source_count == pp->source_cap) {
+    U32 cap = pp->source_cap ? pp->source_cap * 2 : 64;
+    pp->sources =
+        lex_grow_array(pp->arena, pp->sources, pp->source_count, cap);
+    pp->source_cap = cap;
+  }
+  pp->sources[pp->source_count++] = {
+      .tokens = tokens, .count = count, .macro = macro, .barrier = barrier};
+}
+
+static void pp_unget(Preprocessor *pp, const PPToken &t) {
+  PPToken *copy = arena_push<PPToken>(pp->arena);
+  *copy = t;
+  pp_push_source(pp, copy, 1, nullptr, false);
+}
+
+static PPToken pp_next(Preprocessor *pp) {
+  while (pp->source_count) {
+    PPSource *s = &pp->sources[pp->source_count - 1];
+    if (s->pos < s->count)
+      return s->tokens[s->pos++];
+    if (s->barrier)
+      return {.kind = PP_EOF};
+    if (s->macro)
+      s->macro->disabled = false;
+    pp->source_count--;
+  }
+  return pp_lex(&pp->file->lexer, pp->interner);
+}
+
+// Raw tokens up to the end of the current directive line.
+static PPTokens pp_rest_of_line(Preprocessor *pp) {
+  PPTokens list = {};
+  while (true) {
+    PPToken t = pp_lex(&pp->file->lexer, pp->interner);
+    if (t.kind == PP_NEWLINE || t.kind == PP_EOF)
+      return list;
+    t.line_start = false;
+    pp_tokens_push(pp->arena, &list, t);
+  }
+}
+
+// ---- Macro expansion ----
+
+static bool pp_expand(Preprocessor *pp, PPToken *t);
+
+// Expands `tokens` without reading past them, for macro arguments and #if.
+static PPTokens pp_expand_isolated(Preprocessor *pp, const PPToken *tokens,
+                                   U32 count) {
+  PPTokens out = {};
+  U32 base = pp->source_count;
+  pp_push_source(pp, tokens, count, nullptr, true);
+  bool space = false;
+  while (true) {
+    PPToken t = pp_next(pp);
+    if (t.kind == PP_EOF)
+      break;
+    bool had_space = t.space_before;
+    if (pp_expand(pp, &t)) {
+      space |= had_space;
+      continue;
+    }
+    t.space_before |= space;
+    space = false;
+    pp_tokens_push(pp->arena, &out, t);
+  }
+  assert(pp->source_count == base + 1 && "Barrier isn't on top");
+  pp->source_count = base;
+  return out;
+}
+
+static S32 pp_param_index(const PPMacro *m, const PPToken &t) {
+  if (t.kind != PP_IDENTIFIER)
+    return -1;
+  for (U32 i = 0; i < m->param_count; ++i) {
+    if (m->params[i] == t.atom)
+      return (S32)i;
+  }
+  return -1;
+}
+
+static PPToken pp_stringify(Preprocessor *pp, const PPTokens *arg,
+                            bool space_before) {
+  U64 size = 2;
+  for (U32 i = 0; i < arg->count; ++i)
+    size += arg->items[i].text.size * 2 + 1;
+  U8 *buf = arena_push_array<U8>(pp->arena, size);
+  U64 n = 0;
+  buf[n++] = '"';
+  for (U32 i = 0; i < arg->count; ++i) {
+    const PPToken &t = arg->items[i];
+    if (i && t.space_before)
+      buf[n++] = ' ';
+    bool quoted = t.kind == PP_STRING || t.kind == PP_CHAR;
+    for (U64 c = 0; c < t.text.size; ++c) {
+      if (quoted && (t.text.str[c] == '"' || t.text.str[c] == '\\'))
+        buf[n++] = '\\';
+      buf[n++] = t.text.str[c];
+    }
+  }
+  buf[n++] = '"';
+  return {.kind = PP_STRING,
+          .space_before = space_before,
+          .text = str8(buf, n)};
+}
+
+static PPToken pp_paste(Preprocessor *pp, const PPToken &lhs,
+                        const PPToken &rhs) {
+  U64 size = lhs.text.size + rhs.text.size;
+  U8 *buf = arena_push_array<U8>(pp->arena, size + 1);
+  memcpy(buf, lhs.text.str, lhs.text.size);
+  memcpy(buf + lhs.text.size, rhs.text.str, rhs.text.size);
+  buf[size] = '\0';
+
+  PPLexer lx = {.p = buf};
+  PPToken t = pp_lex(&lx, pp->interner);
+  if (lx.p != buf + size) {
+    pp_error(pp, PP_ERROR_BAD_PASTE, str8(buf, size));
+    t.text = str8(buf, size);
+  }
+  t.space_before = lhs.space_before;
+  t.line_start = false;
+  return t;
+}
+
+static void pp_append_arg(Preprocessor *pp, PPTokens *out,
+                          const PPTokens *arg, bool space_before) {
+  for (U32 i = 0; i < arg->count; ++i) {
+    PPToken t = arg->items[i];
+    if (i == 0)
+      t.space_before = space_before;
+    pp_tokens_push(pp->arena, out, t);
+  }
+}
+
+// Replacement list of `m` with arguments substituted and ## applied, ready
+// to be rescanned.
+static PPTokens pp_substitute(Preprocessor *pp, PPMacro *m, PPTokens *args) {
+  PPTokens out = {};
+  PPTokens *expanded = nullptr;
+  bool *is_expanded = nullptr;
+  if (m->param_count) {
+    expanded = arena_push_array<PPTokens>(pp->arena, m->param_count);
+    is_expanded = arena_push_array_zero<bool>(pp->arena, m->param_count);
+  }
+
+  U32 item_start = 0; // Where the last body item's tokens begin in `out`
+  for (U32 i = 0; i < m->body_count; ++i) {
+    const PPToken &b = m->body[i];
+    bool before_paste =
+        i + 1 < m->body_count && pp_is_punct(m->body[i + 1], str8_lit("##"));
+
+    if (m->function_like && pp_is_punct(b, str8_lit("#")) &&
+        i + 1 < m->body_count) {
+      S32 p = pp_param_index(m, m->body[i + 1]);
+      if (p >= 0) {
+        item_start = out.count;
+        pp_tokens_push(pp->arena, &out,
+                       pp_stringify(pp, &args[p], b.space_before));
+        ++i;
+        continue;
+      }
+    }
+
+    if (pp_is_punct(b, str8_lit("##")) && i + 1 < m->body_count) {
+      const PPToken &rhs = m->body[++i];
+      bool lhs_empty = out.count == item_start;
+      S32 p = m->function_like ? pp_param_index(m, rhs) : -1;
+      if (p < 0) {
+        if (lhs_empty)
+          pp_tokens_push(pp->arena, &out, rhs);
+        else
+          out.items[out.count - 1] =
+              pp_paste(pp, out.items[out.count - 1], rhs);
+        continue;
+      }
+
+      const PPTokens *arg = &args[p];
+      bool va = m->variadic && (U32)p == m->param_count - 1;
+      if (va && !lhs_empty &&
+          pp_is_punct(out.items[out.count - 1], str8_lit(","))) {
+        // GNU: the comma goes away when there are no variadic arguments,
+        // and is never pasted onto the first one.
+        if (arg->count == 0)
+          out.count--;
+        else
+          pp_append_arg(pp, &out, arg, rhs.space_before);
+        continue;
+      }
+      if (arg->count == 0)
+        continue;
+      if (lhs_empty) {
+        pp_append_arg(pp, &out, arg, rhs.space_before);
+      } else {
+        out.items[out.count - 1] =
+            pp_paste(pp, out.items[out.count - 1], arg->items[0]);
+        for (U32 a = 1; a < arg->count; ++a)
+          pp_tokens_push(pp->arena, &out, arg->items[a]);
+      }
+      continue;
+    }
+
+    item_start = out.count;
+    S32 p = m->function_like ? pp_param_index(m, b) : -1;
+    if (p < 0) {
+      pp_tokens_push(pp->arena, &out, b);
+    } else if (before_paste) {
+      pp_append_arg(pp, &out, &args[p], b.space_before);
+    } else {
+      if (!is_expanded[p]) {
+        expanded[p] = pp_expand_isolated(pp, args[p].items, args[p].count);
+        is_expanded[p] = true;
+      }
+      pp_append_arg(pp, &out, &expanded[p], b.space_before);
+    }
+  }
+  return out;
+}
+
+// Reads the arguments after a function-like macro's '('. `args` has room
+// for every parameter. Returns false if the list is unterminated.
+static bool pp_collect_args(Preprocessor *pp, PPMacro *m, PPTokens *args,
+                            U32 *count) {
+  U32 n = 0;
+  U32 depth = 0;
+  bool space = false;
+  PPTokens overflow = {};
+  while (true) {
+    PPToken t = pp_next(pp);
+    if (t.kind == PP_EOF) {
+      pp_error(pp, PP_ERROR_UNTERMINATED_ARGUMENTS);
+      return false;
+    }
+    if (t.kind == PP_NEWLINE) {
+      space = true;
+      continue;
+    }
+    t.line_start = false;
+    t.space_before |= space;
+    space = false;
+
+    if (pp_is_punct(t, str8_lit("("))) {
+      depth++;
+    } else if (pp_is_punct(t, str8_lit(")"))) {
+      if (depth == 0)
+        break;
+      depth--;
+    } else if (pp_is_punct(t, str8_lit(",")) && depth == 0 &&
+               !(m->variadic && n + 1 == m->param_count)) {
+      n++;
+      continue;
+    }
+    pp_tokens_push(pp->arena, n < m->param_count ? &args[n] : &overflow, t);
+  }
+  *count = n + 1;
+  return true;
+}
+
+static PPToken pp_builtin_token(Preprocessor *pp, PPBuiltin builtin) {
+  char buf[32];
+  if (builtin == PP_BUILTIN_LINE) {
+    int n = snprintf(buf, sizeof(buf), "%u", pp->file->lexer.line);
+    return {.kind = PP_NUMBER,
+            .text = str8_copy(pp->arena, str8((U8 *)buf, (U64)n))};
+  }
+  String8 path = pp->file->path;
+  U8 *text = arena_push_array<U8>(pp->arena, path.size * 2 + 2);
+  U64 n = 0;
+  text[n++] = '"';
+  for (U64 i = 0; i < path.size; ++i) {
+    if (path.str[i] == '"' || path.str[i] == '\\')
+      text[n++] = '\\';
+    text[n++] = path.str[i];
+  }
+  text[n++] = '"';
+  return {.kind = PP_STRING, .text = str8(text, n)};
+}
+
+// If `t` names a macro, pushes its expansion and returns true. A macro that
+// is already being expanded marks `t` so it never expands later either.
+static bool pp_expand(Preprocessor *pp, PPToken *t) {
+  if (t->kind != PP_IDENTIFIER || t->no_expand)
+    return false;
+  PPMacro *m = pp_find_macro(pp, t->atom);
+  if (!m)
+    return false;
+  if (m->disabled) {
+    t->no_expand = true;
+    return false;
+  }
+
+  if (m->builtin != PP_BUILTIN_NONE) {
+    PPToken *value = arena_push<PPToken>(pp->arena);
+    *value = pp_builtin_token(pp, m->builtin);
+    pp_push_source(pp, value, 1, nullptr, false);
+    pp->stats.expansions++;
+    return true;
+  }
+
+  if (!m->function_like) {
+    pp->stats.expansions++;
+    if (!m->has_paste) {
+      m->disabled = true;
+      pp_push_source(pp, m->body, m->body_count, m, false);
+      return true;
+    }
+    PPTokens body = pp_substitute(pp, m, nullptr);
+    m->disabled = true;
+    pp_push_source(pp, body.items, body.count, m, false);
+    return true;
+  }
+
+  // Only an invocation if '(' comes next, possibly on a later line.
+  PPToken next;
+  bool crossed_line = false;
+  while ((next = pp_next(pp)).kind == PP_NEWLINE)
+    crossed_line = true;
+  if (!pp_is_punct(next, str8_lit("("))) {
+    if (next.kind != PP_EOF)
+      pp_unget(pp, next);
+    if (crossed_line)
+      pp_unget(pp, {.kind = PP_NEWLINE});
+    return false;
+  }
+
+  U32 slots = m->param_count ? m->param_count : 1;
+  PPTokens *args = arena_push_array_zero<PPTokens>(pp->arena, slots);
+  U32 count = 0;
+  if (!pp_collect_args(pp, m, args, &count))
+    return true;
+
+  // `f()` passes one empty argument; a variadic macro may leave out its
+  // variadic arguments entirely.
+  bool ok = count == m->param_count ||
+            (m->param_count == 0 && count == 1 && args[0].count == 0) ||
+            (m->variadic && count + 1 == m->param_count);
+  if (!ok) {
+    pp_error(pp, PP_ERROR_ARGUMENT_COUNT, t->text);
+    return true;
+  }
+
+  pp->stats.expansions++;
+  PPTokens body = pp_substitute(pp, m, args);
+  m->disabled = true;
+  pp_push_source(pp, body.items, body.count, m, false);
+  return true;
+}
+
+// ---- #if expressions ----
+
+struct PPEval {
+  const PPToken *tokens;
+  U32 count;
+  U32 pos;
+  bool failed;
+};
+
+static bool pp_eval_at(PPEval *e, String8 punct) {
+  return e->pos < e->count && pp_is_punct(e->tokens[e->pos], punct);
+}
+
+static bool pp_eval_eat(PPEval *e, String8 punct) {
+  if (!pp_eval_at(e, punct))
+    return false;
+  e->pos++;
+  return true;
+}
+
+// Integer constants, by the lexer's rules.
+static S64 pp_parse_integer(PPEval *e, String8 s) {
+  Number n = number_parse(s);
+  if (n.status != NUMBER_OK || number_type_is_float(n.type))
+    e->failed = true;
+  return n.value;
+}
+
+static S64 pp_parse_char(String8 s) {
+  if (s.size >= 4 && s.str[1] == '\\') {
+    switch (s.str[2]) {
+    case 'n':
+      return '\n';
+    case 't':
+      return '\t';
+    case 'r':
+      return '\r';
+    case '0':
+      return 0;
+    default:
+      return s.str[2];
+    }
+  }
+  return s.size >= 3 ? s.str[1] : 0;
+}
+
+static S64 pp_eval_expression(PPEval *e);
+
+static S64 pp_eval_unary(PPEval *e) {
+  if (e->pos >= e->count) {
+    e->failed = true;
+    return 0;
+  }
+  if (pp_eval_eat(e, str8_lit("!")))
+    return !pp_eval_unary(e);
+  if (pp_eval_eat(e, str8_lit("~")))
+    return ~pp_eval_unary(e);
+  if (pp_eval_eat(e, str8_lit("-")))
+    return -pp_eval_unary(e);
+  if (pp_eval_eat(e, str8_lit("+")))
+    return pp_eval_unary(e);
+  if (pp_eval_eat(e, str8_lit("("))) {
+    S64 value = pp_eval_expression(e);
+    if (!pp_eval_eat(e, str8_lit(")")))
+      e->failed = true;
+    return value;
+  }
+
+  const PPToken &t = e->tokens[e->pos++];
+  switch (t.kind) {
+  case PP_NUMBER:
+    return pp_parse_integer(e, t.text);
+  case PP_CHAR:
+    return pp_parse_char(t.text);
+  case PP_IDENTIFIER:
+    // Whatever survived expansion is 0, except C23's true.
+    return str8_match(t.text, str8_lit("true"));
+  default:
+    e->failed = true;
+    return 0;
+  }
+}
+
+static U32 pp_eval_precedence(PPEval *e) {
+  if (e->pos >= e->count || e->tokens[e->pos].kind != PP_PUNCT)
+    return 0;
+  String8 op = e->tokens[e->pos].text;
+  static const struct {
+    String8 op;
+    U32 precedence;
+  } table[] = {
+      {str8_lit("||"), 1}, {str8_lit("&&"), 2}, {str8_lit("|"), 3},
+      {str8_lit("^"), 4},  {str8_lit("&"), 5},  {str8_lit("=="), 6},
+      {str8_lit("!="), 6}, {str8_lit("<"), 7},  {str8_lit(">"), 7},
+      {str8_lit("<="), 7}, {str8_lit(">="), 7}, {str8_lit("<<"), 8},
+      {str8_lit(">>"), 8}, {str8_lit("+"), 9},  {str8_lit("-"), 9},
+      {str8_lit("*"), 10}, {str8_lit("/"), 10}, {str8_lit("%"), 10},
+  };
+  for (const auto &entry : table) {
+    if (str8_match(op, entry.op))
+      return entry.precedence;
+  }
+  return 0;
+}
+
+static S64 pp_eval_binary(PPEval *e, U32 min_precedence) {
+  S64 lhs = pp_eval_unary(e);
+  while (true) {
+    U32 precedence = pp_eval_precedence(e);
+    if (precedence == 0 || precedence < min_precedence)
+      return lhs;
+    String8 op = e->tokens[e->pos++].text;
+    S64 rhs = pp_eval_binary(e, precedence + 1);
+    U8 a = op.str[0], b = op.size > 1 ? op.str[1] : 0;
+    switch (a) {
+    case '|':
+      lhs = b ? (lhs || rhs) : (lhs | rhs);
+      break;
+    case '&':
+      lhs = b ? (lhs && rhs) : (lhs & rhs);
+      break;
+    case '^':
+      lhs ^= rhs;
+      break;
+    case '=':
+      lhs = lhs == rhs;
+      break;
+    case '!':
+      lhs = lhs != rhs;
+      break;
+    case '<':
+      if (b == '<')
+        lhs = (S64)((U64)lhs << (rhs & 63));
+      else
+        lhs = b ? lhs <= rhs : lhs < rhs;
+      break;
+    case '>':
+      if (b == '>')
+        lhs >>= rhs & 63;
+      else
+        lhs = b ? lhs >= rhs : lhs > rhs;
+      break;
+    case '+':
+      lhs = (S64)((U64)lhs + (U64)rhs);
+      break;
+    case '-':
+      lhs = (S64)((U64)lhs - (U64)rhs);
+      break;
+    case '*':
+      lhs = (S64)((U64)lhs * (U64)rhs);
+      break;
+    case '/':
+    case '%':
+      if (rhs == 0) {
+        e->failed = true;
+        return 0;
+      }
+      lhs = a == '/' ? lhs / rhs : lhs % rhs;
+      break;
+    }
+  }
+}
+
+static S64 pp_eval_expression(PPEval *e) {
+  S64 cond = pp_eval_binary(e, 1);
+  if (!pp_eval_eat(e, str8_lit("?")))
+    return cond;
+  S64 then = pp_eval_expression(e);
+  if (!pp_eval_eat(e, str8_lit(":")))
+    e->failed = true;
+  S64 otherwise = pp_eval_expression(e);
+  return cond ? then : otherwise;
+}
+
+// The rest of an #if or #elif line. `defined` is resolved before anything
+// is expanded, as the standard says.
+static bool pp_eval_condition(Preprocessor *pp, U32 line) {
+  PPTokens raw = pp_rest_of_line(pp);
+  PPTokens resolved = {};
+  for (U32 i = 0; i < raw.count; ++i) {
+    const PPToken &t = raw.items[i];
+    if (t.kind != PP_IDENTIFIER || t.atom != pp->atom_defined) {
+      pp_tokens_push(pp->arena, &resolved, t);
+      continue;
+    }
+    bool paren =
+        i + 1 < raw.count && pp_is_punct(raw.items[i + 1], str8_lit("("));
+    U32 name = i + 1 + paren;
+    if (name >= raw.count || raw.items[name].kind != PP_IDENTIFIER ||
+        (paren && (name + 1 >= raw.count ||
+                   !pp_is_punct(raw.items[name + 1], str8_lit(")"))))) {
+      pp_diagnose(pp, line, PP_ERROR_BAD_EXPRESSION, t.text);
+      return false;
+    }
+    bool defined = pp_find_macro(pp, raw.items[name].atom) != nullptr;
+    pp_tokens_push(pp->arena, &resolved,
+                   {.kind = PP_NUMBER,
+                    .space_before = t.space_before,
+                    .text = defined ? str8_lit("1") : str8_lit("0")});
+    i = name + paren;
+  }
+
+  PPTokens expanded = pp_expand_isolated(pp, resolved.items, resolved.count);
+  PPEval e = {.tokens = expanded.items, .count = expanded.count};
+  S64 value = pp_eval_expression(&e);
+  if (e.failed || e.pos != e.count) {
+    pp_diagnose(pp, line, PP_ERROR_BAD_EXPRESSION, {});
+    return false;
+  }
+  return value != 0;
+}
+
+// ---- Directives ----
+
+static void pp_run_file(Preprocessor *pp, String8 path, String8 data,
+                        IncludeFile *include);
+
+static void pp_define(Preprocessor *pp, U32 line) {
+  PPToken name = pp_lex(&pp->file->lexer, pp->interner);
+  if (name.kind != PP_IDENTIFIER) {
+    pp_diagnose(pp, line, PP_ERROR_BAD_DEFINE, name.text);
+    if (name.kind != PP_NEWLINE)
+      pp_skip_line(&pp->file->lexer);
+    return;
+  }
+
+  PPMacro *m = arena_push_zero<PPMacro>(pp->arena);
+  PPLexer *lx = &pp->file->lexer;
+  // Function-like only if '(' touches the name.
+  if (*lx->p == '(') {
+    m->function_like = true;
+    pp_lex(lx, pp->interner);
+    PPTokens params = {};
+    bool ok = false;
+    PPToken t;
+    while (true) {
+      t = pp_lex(lx, pp->interner);
+      if (params.count == 0 && pp_is_punct(t, str8_lit(")"))) {
+        ok = true;
+        break;
+      }
+      if (pp_is_punct(t, str8_lit("..."))) {
+        m->variadic = true;
+        t = {.kind = PP_IDENTIFIER, .atom = pp->atom_va_args};
+      } else if (t.kind != PP_IDENTIFIER) {
+        break;
+      }
+      pp_tokens_push(pp->arena, &params, t);
+      t = pp_lex(lx, pp->interner);
+      if (pp_is_punct(t, str8_lit(")"))) {
+        ok = true;
+        break;
+      }
+      if (m->variadic || !pp_is_punct(t, str8_lit(",")))
+        break;
+    }
+    if (!ok) {
+      pp_diagnose(pp, line, PP_ERROR_BAD_DEFINE, name.text);
+      if (t.kind != PP_NEWLINE)
+        pp_skip_line(lx);
+      return;
+    }
+    m->param_count = params.count;
+    m->params = arena_push_array<Atom>(pp->arena, params.count);
+    for (U32 i = 0; i < params.count; ++i)
+      m->params[i] = params.items[i].atom;
+  }
+
+  PPTokens body = pp_rest_of_line(pp);
+  for (U32 i = 0; i < body.count; ++i)
+    m->has_paste |= pp_is_punct(body.items[i], str8_lit("##"));
+  if (body.count && (pp_is_punct(body.items[0], str8_lit("##")) ||
+                     pp_is_punct(body.items[body.count - 1], str8_lit("##")))) {
+    pp_diagnose(pp, line, PP_ERROR_BAD_DEFINE, name.text);
+    return;
+  }
+  if (body.count)
+    body.items[0].space_before = false;
+  m->body = body.items;
+  m->body_count = body.count;
+  pp_set_macro(pp, name.atom, m);
+}
+
+static bool pp_once_contains(Preprocessor *pp, IncludeFile *f) {
+  for (U32 i = 0; i < pp->once_count; ++i) {
+    if (pp->once[i] == f)
+      return true;
+  }
+  return false;
+}
+
+// Finds `name` on the search path. "" names look next to the includer first.
+// `found_path` gets the path it was found at, as spelled from the search path.
+static IncludeFile *pp_find_include(Preprocessor *pp, String8 name,
+                                    bool angled, String8 *found_path) {
+  char path[4096];
+  auto try_dir = [&](String8 dir) -> IncludeFile * {
+    int n = dir.size ? snprintf(path, sizeof(path), "%.*s/%.*s",
+                                (int)dir.size, dir.str, (int)name.size,
+                                name.str)
+                     : snprintf(path, sizeof(path), "%.*s", (int)name.size,
+                                name.str);
+    if (n < 0 || (U64)n >= sizeof(path))
+      return nullptr;
+    IncludeFile *f =
+        include_cache_open(pp->cache, pp->cwd, str8((U8 *)path, (U64)n));
+    if (!f)
+      return nullptr;
+    if (pp->opened_count == pp->opened_cap) {
+      U32 cap = pp->opened_cap ? pp->opened_cap * 2 : 16;
+      pp->opened =
+          lex_grow_array(pp->arena, pp->opened, pp->opened_count, cap);
+      pp->opened_cap = cap;
+    }
+    pp->opened[pp->opened_count++] = f;
+    *found_path = str8_copy(pp->arena, str8((U8 *)path, (U64)n));
+    return f;
+  };
+
+  if (name.size && name.str[0] == '/')
+    return try_dir({});
+  IncludeFile *found = nullptr;
+  if (!angled)
+    found = try_dir(pp->file->dir);
+  for (U32 i = 0; !found && i < pp->config.include_dir_count; ++i)
+    found = try_dir(str8_cstring((U8 *)pp->config.include_dirs[i]));
+  for (const char *dir : pp_system_dirs) {
+    if (found)
+      break;
+    found = try_dir(str8_cstring((U8 *)dir));
+  }
+  return found;
+}
+
+static void pp_include(Preprocessor *pp, U32 line) {
+  PPLexer *lx = &pp->file->lexer;
+  pp_skip_blanks(lx);
+
+  String8 name = {};
+  bool angled = false;
+  U8 open = *lx->p;
+  if (open == '"' || open == '<') {
+    U8 close = open == '<' ? '>' : '"';
+    const U8 *start = ++lx->p;
+    while (*lx->p && *lx->p != close && *lx->p != '\n')
+      lx->p++;
+    if (*lx->p == close) {
+      name = str8((U8 *)start, (U64)(lx->p - start));
+      angled = open == '<';
+      lx->p++;
+    }
+    pp_skip_line(lx);
+  } else {
+    // #include MACRO
+    PPTokens raw = pp_rest_of_line(pp);
+    PPTokens t = pp_expand_isolated(pp, raw.items, raw.count);
+    if (t.count == 1 && t.items[0].kind == PP_STRING &&
+        t.items[0].text.size >= 2) {
+      name = str8_substr(t.items[0].text, 1, t.items[0].text.size - 1);
+    } else if (t.count >= 3 && pp_is_punct(t.items[0], str8_lit("<")) &&
+               pp_is_punct(t.items[t.count - 1], str8_lit(">"))) {
+      U64 size = 0;
+      for (U32 i = 1; i + 1 < t.count; ++i)
+        size += t.items[i].text.size + 1;
+      U8 *buf = arena_push_array<U8>(pp->arena, size);
+      U64 n = 0;
+      for (U32 i = 1; i + 1 < t.count; ++i) {
+        if (i > 1 && t.items[i].space_before)
+          buf[n++] = ' ';
+        memcpy(buf + n, t.items[i].text.str, t.items[i].text.size);
+        n += t.items[i].text.size;
+      }
+      name = str8(buf, n);
+      angled = true;
+    }
+  }
+  if (!name.size) {
+    pp_diagnose(pp, line, PP_ERROR_BAD_INCLUDE, {});
+    return;
+  }
+
+  String8 path = {};
+  IncludeFile *f = pp_find_include(pp, name, angled, &path);
+  if (!f) {
+    pp_diagnose(pp, line, PP_ERROR_INCLUDE_NOT_FOUND, name);
+    return;
+  }
+  pp->stats.includes++;
+
+  // Skipped without being read at all if #pragma once or a guard says so.
+  String8 guard = include_cache_guard(pp->cache, f);
+  if (pp_once_contains(pp, f) ||
+      (guard.size &&
+       pp_find_macro(pp, intern(pp->interner, guard)) != nullptr)) {
+    pp->stats.include_skips++;
+    return;
+  }
+  if (pp->depth >= PP_MAX_INCLUDE_DEPTH) {
+    pp_diagnose(pp, line, PP_ERROR_INCLUDE_DEPTH, name);
+    return;
+  }
+  pp_run_file(pp, path, f->map.data, f);
+}
+
+static void pp_push_cond(Preprocessor *pp, bool value) {
+  if (pp->cond_count == pp->cond_cap) {
+    U32 cap = pp->cond_cap ? pp->cond_cap * 2 : 32;
+    pp->conds = lex_grow_array(pp->arena, pp->conds, pp->cond_count, cap);
+    pp->cond_cap = cap;
+  }
+  bool parent = pp_active(pp);
+  pp->conds[pp->cond_count++] = {.parent_active = parent,
+                                 .active = parent && value,
+                                 .taken = value};
+}
+
+// After the '#' that starts a line.
+static void pp_directive(Preprocessor *pp) {
+  PPFile *f = pp->file;
+  PPLexer *lx = &f->lexer;
+  U32 line = lx->line;
+  PPToken name = pp_lex(lx, pp->interner);
+  if (name.kind == PP_NEWLINE || name.kind == PP_EOF)
+    return; // Null directive
+
+  String8 d = name.text;
+  bool active = pp_active(pp);
+
+  // Guard detection only cares about the outermost #ifndef and its #endif.
+  if (f->guard == PP_GUARD_START && !str8_match(d, str8_lit("ifndef")))
+    f->guard = PP_GUARD_NONE;
+  else if (f->guard == PP_GUARD_CLOSED)
+    f->guard = PP_GUARD_NONE;
+
+  if (str8_match(d, str8_lit("ifdef")) || str8_match(d, str8_lit("ifndef"))) {
+    bool value = false;
+    bool at_newline = false;
+    if (active) {
+      PPToken macro = pp_lex(lx, pp->interner);
+      at_newline = macro.kind == PP_NEWLINE;
+      if (macro.kind != PP_IDENTIFIER) {
+        pp_diagnose(pp, line, PP_ERROR_EXPECTED_MACRO_NAME,
+                    str8_cat(pp->arena, str8_lit("#"), d));
+      } else {
+        value = pp_find_macro(pp, macro.atom) != nullptr;
+        if (str8_match(d, str8_lit("ifndef")))
+          value = !value;
+      }
+      if (f->guard == PP_GUARD_START) {
+        f->guard = macro.kind == PP_IDENTIFIER ? PP_GUARD_OPEN : PP_GUARD_NONE;
+        f->guard_name = macro.text;
+        f->guard_depth = pp->cond_count + 1;
+      }
+    }
+    if (!at_newline)
+      pp_skip_line(lx);
+    pp_push_cond(pp, value);
+  } else if (str8_match(d, str8_lit("if"))) {
+    bool value = false;
+    if (active)
+      value = pp_eval_condition(pp, line);
+    else
+      pp_skip_line(lx);
+    pp_push_cond(pp, value);
+  } else if (str8_match(d, str8_lit("elif")) ||
+             str8_match(d, str8_lit("else"))) {
+    if (pp->cond_count == f->cond_base) {
+      pp_diagnose(pp, line, PP_ERROR_UNBALANCED_CONDITIONAL, d);
+      pp_skip_line(lx);
+      return;
+    }
+    if (f->guard == PP_GUARD_OPEN && pp->cond_count == f->guard_depth)
+      f->guard = PP_GUARD_NONE;
+    PPCond *cond = &pp->conds[pp->cond_count - 1];
+    if (cond->seen_else)
+      pp_diagnose(pp, line, PP_ERROR_UNBALANCED_CONDITIONAL, d);
+    bool value = false;
+    if (str8_match(d, str8_lit("elif"))) {
+      if (cond->parent_active && !cond->taken)
+        value = pp_eval_condition(pp, line);
+      else
+        pp_skip_line(lx);
+    } else {
+      value = !cond->taken;
+      cond->seen_else = true;
+      pp_skip_line(lx);
+    }
+    cond->active = cond->parent_active && value;
+    cond->taken |= value;
+  } else if (str8_match(d, str8_lit("endif"))) {
+    pp_skip_line(lx);
+    if (pp->cond_count == f->cond_base) {
+      pp_diagnose(pp, line, PP_ERROR_UNBALANCED_CONDITIONAL, d);
+      return;
+    }
+    if (f->guard == PP_GUARD_OPEN && pp->cond_count == f->guard_depth)
+      f->guard = PP_GUARD_CLOSED;
+    pp->cond_count--;
+  } else if (!active) {
+    pp_skip_line(lx);
+  } else if (str8_match(d, str8_lit("define"))) {
+    pp_define(pp, line);
+  } else if (str8_match(d, str8_lit("undef"))) {
+    PPTokens rest = pp_rest_of_line(pp);
+    if (rest.count && rest.items[0].kind == PP_IDENTIFIER)
+      pp_set_macro(pp, rest.items[0].atom, nullptr);
+    else
+      pp_diagnose(pp, line, PP_ERROR_EXPECTED_MACRO_NAME,
+                  str8_cat(pp->arena, str8_lit("#"), d));
+  } else if (str8_match(d, str8_lit("include"))) {
+    pp_include(pp, line);
+  } else if (str8_match(d, str8_lit("pragma"))) {
+    // Other pragmas have nowhere to go yet and are dropped.
+    PPTokens rest = pp_rest_of_line(pp);
+    if (rest.count == 1 && str8_match(rest.items[0].text, str8_lit("once")) &&
+        f->include && !pp_once_contains(pp, f->include)) {
+      if (pp->once_count == pp->once_cap) {
+        U32 cap = pp->once_cap ? pp->once_cap * 2 : 32;
+        pp->once = lex_grow_array(pp->arena, pp->once, pp->once_count, cap);
+        pp->once_cap = cap;
+      }
+      pp->once[pp->once_count++] = f->include;
+    }
+  } else if (str8_match(d, str8_lit("error")) ||
+             str8_match(d, str8_lit("warning"))) {
+    pp_skip_blanks(lx);
+    const U8 *start = lx->p;
+    while (*lx->p && *lx->p != '\n')
+      lx->p++;
+    bool warning = d.str[0] == 'w';
+    pp_diagnose(pp, line, warning ? PP_ERROR_USER_WARNING : PP_ERROR_USER,
+                str8((U8 *)start, (U64)(lx->p - start)), warning);
+    pp_skip_line(lx);
+  } else if (str8_match(d, str8_lit("line"))) {
+    pp_skip_line(lx); // Output has no line markers to adjust
+  } else {
+    pp_diagnose(pp, line, PP_ERROR_UNKNOWN_DIRECTIVE, d);
+    pp_skip_line(lx);
+  }
+}
+
+static String8 pp_dir_of(String8 path) {
+  for (U64 i = path.size; i-- > 0;) {
+    if (path.str[i] == '/')
+      return str8_substr(path, 0, i ? i : 1);
+  }
+  return {};
+}
+
+static void pp_run_file(Preprocessor *pp, String8 path, String8 data,
+                        IncludeFile *include) {
+  PPFile file = {
+      .include = include,
+      .path = path,
+      .dir = pp_dir_of(path),
+      .lexer = {.p = data.str, .line = 1, .at_line_start = true},
+      .cond_base = pp->cond_count,
+  };
+  PPFile *parent = pp->file;
+  pp->file = &file;
+  pp->depth++;
+
+  while (true) {
+    bool from_file = pp->source_count == 0;
+    PPToken t = pp_next(pp);
+    if (t.kind == PP_EOF)
+      break;
+    if (t.kind == PP_NEWLINE) {
+      pp_emit_newline(pp);
+      continue;
+    }
+    if (t.line_start && pp_is_punct(t, str8_lit("#"))) {
+      pp_directive(pp);
+      continue;
+    }
+    if (!pp_active(pp)) {
+      pp_skip_line(&file.lexer);
+      continue;
+    }
+    if (file.guard != PP_GUARD_OPEN)
+      file.guard = PP_GUARD_NONE;
+
+    // A line's position is its first token's in the file, even when that
+    // token is a macro: the expansion's tokens point into the definition.
+    if (!pp->line_has_output && from_file) {
+      const U8 *begin = t.text.str;
+      while (begin > data.str && begin[-1] != '\n')
+        --begin;
+      pp->mark = {.line = file.lexer.line,
+                  .column = (U32)(t.text.str - begin) + 1,
+                  .path = path};
+    }
+
+    bool space = t.space_before;
+    if (pp_expand(pp, &t)) {
+      pp->pending_space |= space;
+      continue;
+    }
+    pp_emit(pp, t);
+  }
+  pp_emit_newline(pp);
+
+  if (pp->cond_count > file.cond_base) {
+    pp_diagnose(pp, file.lexer.line, PP_ERROR_UNBALANCED_CONDITIONAL,
+                str8_lit("#endif"));
+    pp->cond_count = file.cond_base;
+  }
+  if (include && file.guard == PP_GUARD_CLOSED)
+    include_cache_set_guard(pp->cache, include, file.guard_name);
+
+  pp->depth--;
+  pp->file = parent;
+}
+
+static void pp_define_builtin(Preprocessor *pp, const char *name,
+                              PPBuiltin builtin) {
+  PPMacro *m = arena_push_zero<PPMacro>(pp->arena);
+  m->builtin = builtin;
+  pp_set_macro(pp, pp_intern(pp, name), m);
+}
+
+// Preprocesses `input`, the contents of `path`, into one buffer for
+// perform_lex. Never fails outright: diagnostics are collected and the
+// offending directive is skipped.
+auto perform_preprocess(Arena *arena, Interner *interner,
+                        IncludeCache *cache, const PPConfig &config,
+                        String8 path, String8 input) -> Preprocessed {
+  Preprocessor pp = {
+      .arena = arena, .interner = interner, .cache = cache, .config = config};
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)))
+    pp.cwd = str8_copy(arena, str8_cstring((U8 *)cwd));
+  pp.atom_defined = pp_intern(&pp, "defined");
+  pp.atom_va_args = pp_intern(&pp, "__VA_ARGS__");
+  pp_reserve(&pp, input.size + input.size / 4 + 1);
+
+  // Predefined and -D macros are an ordinary file run first.
+  static const String8 predefined =
+      str8_lit("#define __STDC__ 1\n"
+               "#define __STDC_VERSION__ 202311L\n"
+               "#define __STDC_HOSTED__ 1\n"
+               "#define __x86_64__ 1\n"
+               "#define __linux__ 1\n"
+               "#define __LP64__ 1\n"
+               "#define __CHAR_BIT__ 8\n");
+  StringBuilder defines = sb_create(arena, predefined.size + KiB(1));
+  sb_append(&defines, predefined);
+  for (U32 i = 0; i < config.define_count; ++i) {
+    String8 d = str8_cstring((U8 *)config.defines[i]);
+    U64 eq = 0;
+    while (eq < d.size && d.str[eq] != '=')
+      ++eq;
+    sb_append(&defines, str8_lit("#define "));
+    sb_append(&defines, str8_substr(d, 0, eq));
+    sb_append_char(&defines, ' ');
+    sb_append(&defines, eq < d.size ? str8_substr(d, eq + 1, d.size)
+                                    : str8_lit("1"));
+    sb_append_char(&defines, '\n');
+  }
+  // Lexed like a file, so it needs the '\0' too.
+  String8 builtin = str8((U8 *)sb_to_cstr(&defines), sb_size(&defines));
+
+  pp_define_builtin(&pp, "__FILE__", PP_BUILTIN_FILE);
+  pp_define_builtin(&pp, "__LINE__", PP_BUILTIN_LINE);
+  pp_run_file(&pp, str8_lit("<built-in>"), builtin, nullptr);
+  pp.line_has_output = false;
+  pp.out_size = 0;
+  pp.line_count = 0;
+  // For an output with no lines, so pp_locate always has one.
+  pp.mark = {.line = 1, .column = 1, .path = path};
+  pp_mark_line(&pp);
+
+  pp_run_file(&pp, path, input, nullptr);
+
+  pp_reserve(&pp, 1);
+  pp.out[pp.out_size] = '\0';
+  include_cache_close(cache, pp.opened, pp.opened_count);
+  return {.text = str8(pp.out, pp.out_size),
+          .diagnostics = pp.diagnostics,
+          .diagnostic_count = pp.diagnostic_count,
+          .error_count = pp.error_count,
+          .lines = pp.lines,
+          .line_count = pp.line_count,
+          .stats = pp.stats};
+}
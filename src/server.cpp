@@ -0,0 +1,247 @@
+#include "arena.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// Wire format between `--client` and `--server`, over a Unix stream socket.
+//
+// The client sends one request: a U32 byte count, then its working directory
+// and arguments as back to back '\0' terminated strings. The server answers
+// with frames of a ServerFrame byte and a U32 byte count, carrying stdout and
+// stderr in the order they were produced, and ends with an EXIT frame whose
+// payload is the U32 exit status. Integers are in host order; both ends are
+// always on the same machine.
+
+enum ServerFrame : U8 {
+  SERVER_FRAME_STDOUT = 1,
+  SERVER_FRAME_STDERR,
+  SERVER_FRAME_EXIT,
+};
+
+static constexpr U32 SERVER_MAX_REQUEST = MiB(1);
+
+struct ServerRequest {
+  const char *cwd;
+  int argc;    // Including a placeholder argv[0], as main() sees it
+  char **argv;
+};
+
+static bool fd_write_all(int fd, const void *data, U64 size) {
+  const U8 *p = (const U8 *)data;
+  while (size) {
+    // Sockets only: a client that went away shouldn't SIGPIPE the server.
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= (U64)n;
+  }
+  return true;
+}
+
+static bool fd_read_all(int fd, void *data, U64 size) {
+  U8 *p = (U8 *)data;
+  while (size) {
+    ssize_t n = read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= (U64)n;
+  }
+  return true;
+}
+
+static bool server_address(const char *path, sockaddr_un *addr) {
+  *addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr->sun_path))
+    return false;
+  strcpy(addr->sun_path, path);
+  return true;
+}
+
+static int server_connect(const char *path) {
+  sockaddr_un addr;
+  if (!server_address(path, &addr))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Replaces a socket file left behind by a server that's gone, but not one
+// that's still answering. The socket is created 0600: a request makes the
+// server read and write files and run the linker as its own user.
+// Called before any threads start, since it changes the umask.
+static int server_listen(const char *path) {
+  sockaddr_un addr;
+  if (!server_address(path, &addr))
+    return -1;
+  int live = server_connect(path);
+  if (live >= 0) {
+    close(live);
+    errno = EADDRINUSE;
+    return -1;
+  }
+  unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  mode_t umask_before = umask(0177);
+  bool bound = bind(fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(umask_before);
+  if (!bound || chmod(path, 0600) != 0 || listen(fd, 128) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Whether the process at the other end of `fd` runs as the same user as
+// the server. The socket's mode already keeps others out; this also holds
+// if it's been loosened, or bound somewhere others can reach.
+static bool server_peer_allowed(int fd) {
+  ucred peer;
+  socklen_t size = sizeof(peer);
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 &&
+         peer.uid == geteuid();
+}
+
+static bool server_send_frame(int fd, ServerFrame kind, String8 data) {
+  if (kind != SERVER_FRAME_EXIT && data.size == 0)
+    return true;
+  U8 header[5];
+  U32 size = (U32)data.size;
+  header[0] = kind;
+  memcpy(header + 1, &size, 4);
+  return fd_write_all(fd, header, sizeof(header)) &&
+         fd_write_all(fd, data.str, data.size);
+}
+
+// One frame for all of `sb`, written chunk by chunk.
+static bool server_send_frame(int fd, ServerFrame kind,
+                              const StringBuilder *sb) {
+  U64 size = sb_size(sb);
+  if (size == 0)
+    return true;
+  U8 header[5];
+  U32 size32 = (U32)size;
+  header[0] = kind;
+  memcpy(header + 1, &size32, 4);
+  if (!fd_write_all(fd, header, sizeof(header)))
+    return false;
+  for (const StringBuilderChunk *c = sb->first; c; c = c->next) {
+    if (!fd_write_all(fd, c->data.str, c->data.size))
+      return false;
+  }
+  return fd_write_all(fd, sb->start, sb->length);
+}
+
+static bool server_send_exit(int fd, U32 status) {
+  return server_send_frame(fd, SERVER_FRAME_EXIT,
+                           str8((U8 *)&status, sizeof(status)));
+}
+
+// The strings stay in `arena` for as long as the request is being served.
+static bool server_read_request(Arena *arena, int fd, ServerRequest *out) {
+  U32 size = 0;
+  if (!fd_read_all(fd, &size, 4) || size == 0 || size > SERVER_MAX_REQUEST)
+    return false;
+  U8 *data = arena_push_array<U8>(arena, size);
+  if (!fd_read_all(fd, data, size) || data[size - 1] != '\0')
+    return false;
+
+  U32 count = 0;
+  for (U32 i = 0; i < size; ++i)
+    count += data[i] == '\0';
+  // argv[0] stands in for the cwd string, which is the first one.
+  char **argv = arena_push_array<char *>(arena, count + 1);
+  U32 n = 0;
+  for (U32 start = 0; start < size;) {
+    argv[n++] = (char *)data + start;
+    start += (U32)strlen((char *)data + start) + 1;
+  }
+  argv[n] = nullptr;
+
+  out->cwd = argv[0];
+  out->argc = (int)n;
+  out->argv = argv;
+  return true;
+}
+
+// Forwards the arguments to a server and replays what comes back. Nothing
+// here allocates an arena: the client is meant to start in no time.
+static int client_run(const char *socket_path, int argc, char **argv) {
+  int fd = server_connect(socket_path);
+  if (fd < 0) {
+    fprintf(stderr, "Couldn't connect to server at '%s': %s\n", socket_path,
+            strerror(errno));
+    return 1;
+  }
+
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    fprintf(stderr, "Couldn't get the working directory\n");
+    return 1;
+  }
+  std::vector<char> request(4);
+  request.insert(request.end(), cwd, cwd + strlen(cwd) + 1);
+  for (int i = 0; i < argc; ++i)
+    request.insert(request.end(), argv[i], argv[i] + strlen(argv[i]) + 1);
+  U32 size = (U32)(request.size() - 4);
+  memcpy(request.data(), &size, 4);
+  if (size > SERVER_MAX_REQUEST || !fd_write_all(fd, request.data(),
+                                                 request.size())) {
+    fprintf(stderr, "Couldn't send the request to '%s'\n", socket_path);
+    close(fd);
+    return 1;
+  }
+
+  char buffer[64 * 1024];
+  while (true) {
+    U8 header[5];
+    if (!fd_read_all(fd, header, sizeof(header)))
+      break;
+    U32 left;
+    memcpy(&left, header + 1, 4);
+    if (header[0] == SERVER_FRAME_EXIT) {
+      U32 status = 1;
+      if (left != 4 || !fd_read_all(fd, &status, 4))
+        break;
+      close(fd);
+      return (int)status;
+    }
+    FILE *out = header[0] == SERVER_FRAME_STDOUT ? stdout : stderr;
+    while (left) {
+      U32 chunk = left < sizeof(buffer) ? left : (U32)sizeof(buffer);
+      if (!fd_read_all(fd, buffer, chunk)) {
+        left = 1;
+        break;
+      }
+      fwrite(buffer, 1, chunk, out);
+      left -= chunk;
+    }
+    if (left)
+      break;
+  }
+
+  fprintf(stderr, "Server at '%s' hung up\n", socket_path);
+  close(fd);
+  return 1;
+}
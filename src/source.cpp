@@ -0,0 +1,46 @@
+#include "arena.hpp"
+#include "file.hpp"
+#include "strings.hpp"
+
+// Owns every input mapped during a compilation. Token slices point straight
+// into these mappings, so they must stay alive until the last token is gone.
+struct SourceFile {
+  String8 path;
+  FileMap map;
+  SourceFile *next;
+};
+
+struct SourceManager {
+  SourceFile *first;
+  SourceFile *last;
+  U64 count;
+};
+
+// Maps `path` read-only and registers it. Returns nullptr if it can't be
+// opened. The returned contents are '\0' terminated.
+SourceFile *source_open(Arena *arena, SourceManager *sm, const char *path) {
+  FileMap map = file_map_readonly(path);
+  if (!map.data.str)
+    return nullptr;
+
+  SourceFile *file = arena_push_zero<SourceFile>(arena);
+  file->path = str8_copy(arena, str8_cstring((U8 *)path));
+  file->map = map;
+
+  if (sm->last)
+    sm->last->next = file;
+  else
+    sm->first = file;
+  sm->last = file;
+  sm->count++;
+
+  return file;
+}
+
+String8 source_contents(SourceFile *file) { return file->map.data; }
+
+void source_manager_release(SourceManager *sm) {
+  for (SourceFile *f = sm->first; f; f = f->next)
+    file_unmap(&f->map);
+  *sm = {};
+}
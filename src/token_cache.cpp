@@ -0,0 +1,266 @@
+#include "arena.hpp"
+#include "file.hpp"
+#include "intern.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <unistd.h>
+
+// On-disk cache of lexed token streams, keyed by a hash of the bytes that
+// were lexed. An entry is one flat file holding a LexResult's arrays with
+// every pointer replaced by an offset from the start of the file, so a hit
+// maps it and points the token arrays and errors straight into it. Only
+// identifier atoms need work: they're stored as the entry's own dense
+// numbering plus the spelling of each, and re-interned on load.
+//
+//   header | kinds | offsets | lengths | values | errors | atoms | strings
+//
+// Each section starts 8-byte aligned. Entries are written to a temporary
+// name and renamed into place, so a concurrent reader never sees half of
+// one. Anything that doesn't check out is a miss and gets rewritten.
+
+static constexpr U32 TOKEN_CACHE_MAGIC = 0x434b4f54; // "TOKC"
+// Bump whenever the lexer or this layout changes what an entry means.
+static constexpr U32 TOKEN_CACHE_VERSION = 3;
+
+struct TokenCacheHeader {
+  U32 magic;
+  U32 version;
+  U32 kind_count; // TK_ERROR + 1, so a changed TokenKind enum misses too
+  U32 token_count;
+  U32 value_count;
+  U32 error_count;
+  U32 atom_count; // Including ATOM_NONE, as in Interner
+  U32 reserved;
+  U64 source_hash;
+  U64 source_size;
+  U64 file_size;
+  U64 checksum; // str8_hash of everything after the header
+
+  // Section offsets from the start of the file.
+  U64 kinds;
+  U64 offsets;
+  U64 lengths;
+  U64 values;
+  U64 errors;
+  U64 atoms;
+  U64 strings;
+};
+
+// Spans into the strings section.
+struct TokenCacheString {
+  U32 offset;
+  U32 size;
+};
+
+static_assert(sizeof(TokenValue) == 24, "TokenValue is stored as is");
+static_assert(sizeof(TokenError) == 16, "TokenError is stored as is");
+
+// Below this, opening and mapping an entry costs more than lexing does.
+static constexpr U64 TOKEN_CACHE_MIN_SIZE = KiB(64);
+
+struct TokenCache {
+  const char *dir; // nullptr when caching is off
+  std::atomic<U64> hits;
+  std::atomic<U64> misses;
+  std::atomic<U64> bytes_saved; // Source bytes served without lexing
+};
+
+static U64 token_cache_align(U64 offset) { return (offset + 7) & ~7ull; }
+
+// Section offsets for the given counts; `strings` is the last one.
+static TokenCacheHeader token_cache_layout(U32 token_count, U32 value_count,
+                                           U32 error_count, U32 atom_count) {
+  TokenCacheHeader h = {.magic = TOKEN_CACHE_MAGIC,
+                        .version = TOKEN_CACHE_VERSION,
+                        .kind_count = TK_ERROR + 1,
+                        .token_count = token_count,
+                        .value_count = value_count,
+                        .error_count = error_count,
+                        .atom_count = atom_count};
+  h.kinds = sizeof(TokenCacheHeader);
+  h.offsets = token_cache_align(h.kinds + token_count);
+  h.lengths = h.offsets + (U64)token_count * 4;
+  h.values = token_cache_align(h.lengths + (U64)token_count * 4);
+  h.errors = h.values + (U64)value_count * sizeof(TokenValue);
+  h.atoms = h.errors + (U64)error_count * sizeof(TokenError);
+  h.strings = h.atoms + (U64)atom_count * sizeof(TokenCacheString);
+  return h;
+}
+
+// `dir/0123456789abcdef.tok`, '\0' terminated.
+static String8 token_cache_path(Arena *arena, const TokenCache *cache,
+                                U64 hash) {
+  StringBuilder sb = sb_create(arena, strlen(cache->dir) + 32);
+  sb_format(&sb, "{}/{:016x}.tok", cache->dir, hash);
+  return str8((U8 *)sb_to_cstr(&sb), sb_size(&sb));
+}
+
+// Maps the entry for `input` and builds a LexResult over it. The arrays
+// stay in the mapping, which the caller unmaps once it's done with the
+// result. Returns false on any kind of miss.
+static bool token_cache_load(Arena *arena, Interner *interner,
+                             TokenCache *cache, String8 input, U64 hash,
+                             LexResult *out, FileMap *map) {
+  ArenaTemp temp = temp_begin(arena);
+  String8 path = token_cache_path(arena, cache, hash);
+  FileMap m = file_map_readonly((const char *)path.str);
+  temp_end(temp);
+  if (!m.data.str) {
+    cache->misses++;
+    return false;
+  }
+
+  const U8 *base = m.data.str;
+  TokenCacheHeader h = {};
+  bool ok = m.data.size >= sizeof(h);
+  if (ok) {
+    memcpy(&h, base, sizeof(h));
+    TokenCacheHeader expect = token_cache_layout(h.token_count, h.value_count,
+                                                 h.error_count, h.atom_count);
+    ok = h.magic == TOKEN_CACHE_MAGIC && h.version == TOKEN_CACHE_VERSION &&
+         h.kind_count == TK_ERROR + 1 && h.source_hash == hash &&
+         h.source_size == input.size && h.file_size == m.data.size &&
+         h.atom_count >= 1 && h.kinds == expect.kinds &&
+         h.offsets == expect.offsets && h.lengths == expect.lengths &&
+         h.values == expect.values && h.errors == expect.errors &&
+         h.atoms == expect.atoms && h.strings == expect.strings &&
+         h.strings <= h.file_size &&
+         h.checksum == str8_hash(str8((U8 *)base + sizeof(h),
+                                      m.data.size - sizeof(h)));
+  }
+
+  // Past the checksum this only catches entries written by a broken
+  // writer, but it keeps every span inside the file.
+  U64 strings_size = ok ? h.file_size - h.strings : 0;
+  auto in_strings = [&](TokenCacheString s) {
+    return (U64)s.offset + s.size <= strings_size;
+  };
+  const auto *atoms = (const TokenCacheString *)(base + h.atoms);
+  const auto *errors = (const TokenError *)(base + h.errors);
+  const auto *values = (const TokenValue *)(base + h.values);
+  for (U32 i = 0; ok && i < h.atom_count; ++i)
+    ok = in_strings(atoms[i]);
+  for (U32 i = 0; ok && i < h.error_count; ++i)
+    ok = errors[i].token < h.token_count && errors[i].offset < input.size &&
+         errors[i].error > LEX_OK &&
+         errors[i].error <= LEX_ERROR_NUMBER_OVERFLOW;
+  for (U32 i = 0; ok && i < h.value_count; ++i)
+    ok = values[i].atom < h.atom_count && values[i].token < h.token_count;
+  if (!ok) {
+    file_unmap(&m);
+    cache->misses++;
+    return false;
+  }
+
+  const U8 *strings = base + h.strings;
+  Atom *atom_map = arena_push_array<Atom>(arena, h.atom_count);
+  atom_map[ATOM_NONE] = ATOM_NONE;
+  for (U32 i = 1; i < h.atom_count; ++i)
+    atom_map[i] = intern(interner, str8((U8 *)strings + atoms[i].offset,
+                                        atoms[i].size));
+
+  *out = {.source = input,
+          .kinds = (U8 *)base + h.kinds,
+          .offsets = (U32 *)(base + h.offsets),
+          .lengths = (U32 *)(base + h.lengths),
+          .token_count = h.token_count,
+          .values = arena_push_array<TokenValue>(arena, h.value_count),
+          .value_count = h.value_count,
+          .errors = (TokenError *)(base + h.errors),
+          .error_count = h.error_count};
+  for (U32 i = 0; i < h.value_count; ++i) {
+    out->values[i] = values[i];
+    out->values[i].atom = atom_map[values[i].atom];
+  }
+
+  *map = m;
+  cache->hits++;
+  cache->bytes_saved += input.size;
+  return true;
+}
+
+// Writes `tokens`, lexed from input with hash `hash`, as a new entry.
+// Failing to write just means the next run misses again.
+static bool token_cache_store(Arena *arena, Interner *interner,
+                              TokenCache *cache, const LexResult *tokens,
+                              U64 hash) {
+  ArenaTemp temp = temp_begin(arena);
+
+  // Renumber atoms densely in order of first use, which is also how a
+  // fresh interner would number them.
+  Atom *local = arena_push_array_zero<Atom>(arena, interner->atom_count);
+  Atom *global = arena_push_array<Atom>(arena, tokens->value_count + 1);
+  U32 atom_count = 1;
+  U64 strings_size = 0;
+  for (U32 i = 0; i < tokens->value_count; ++i) {
+    Atom a = tokens->values[i].atom;
+    if (a == ATOM_NONE || local[a] != ATOM_NONE)
+      continue;
+    local[a] = atom_count;
+    global[atom_count++] = a;
+    strings_size += atom_str8(interner, a).size;
+  }
+
+  TokenCacheHeader h = token_cache_layout(
+      tokens->token_count, tokens->value_count, tokens->error_count,
+      atom_count);
+  h.source_hash = hash;
+  h.source_size = tokens->source.size;
+  h.file_size = h.strings + strings_size;
+  assert(strings_size < 0xffffffffull && "String offsets are 32 bits");
+
+  StringBuilder sb = sb_create(arena, h.file_size);
+  sb.length = sizeof(h); // Header goes in last, once the checksum is known
+  auto pad_to = [&](U64 offset) {
+    while (sb_size(&sb) < offset)
+      sb_append_char(&sb, 0);
+  };
+  sb_append(&sb, str8(tokens->kinds, tokens->token_count));
+  pad_to(h.offsets);
+  sb_append(&sb, str8((U8 *)tokens->offsets, tokens->token_count * 4ull));
+  sb_append(&sb, str8((U8 *)tokens->lengths, tokens->token_count * 4ull));
+  pad_to(h.values);
+  for (U32 i = 0; i < tokens->value_count; ++i) {
+    TokenValue v = tokens->values[i];
+    v.atom = local[v.atom];
+    sb_append(&sb, str8((U8 *)&v, sizeof(v)));
+  }
+
+  U32 string_offset = 0;
+  auto next_string = [&](String8 s) {
+    TokenCacheString span = {.offset = string_offset, .size = (U32)s.size};
+    string_offset += (U32)s.size;
+    return span;
+  };
+  sb_append(&sb, str8((U8 *)tokens->errors,
+                      tokens->error_count * sizeof(TokenError)));
+  TokenCacheString none = {};
+  sb_append(&sb, str8((U8 *)&none, sizeof(none)));
+  for (U32 i = 1; i < atom_count; ++i) {
+    TokenCacheString span = next_string(atom_str8(interner, global[i]));
+    sb_append(&sb, str8((U8 *)&span, sizeof(span)));
+  }
+
+  for (U32 i = 1; i < atom_count; ++i)
+    sb_append(&sb, atom_str8(interner, global[i]));
+  assert(sb_size(&sb) == h.file_size && "Token cache size estimate is off");
+
+  String8 entry = sb_to_str8(&sb);
+  h.checksum = str8_hash(str8(entry.str + sizeof(h), entry.size - sizeof(h)));
+  memcpy(entry.str, &h, sizeof(h));
+
+  String8 path = token_cache_path(arena, cache, hash);
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.%d.%d.tmp", path.str, (int)getpid(),
+           (int)gettid());
+  bool ok = file_write(tmp, entry) &&
+            rename(tmp, (const char *)path.str) == 0;
+  if (!ok)
+    unlink(tmp);
+
+  temp_end(temp);
+  return ok;
+}
@@ -0,0 +1,398 @@
+#include "arena.hpp"
+#include "string_builder.hpp"
+#include "strings.hpp"
+#include <cassert>
+#include <cstring>
+
+// x86-64 instruction encoder for the code generator. Every instruction
+// function either appends machine code or, in text mode, the same
+// instruction as Intel-syntax assembly that GNU as accepts, which is the
+// debug view of what gets encoded.
+//
+// Forms are fixed: 64-bit registers, rbp-relative stack slots, rel32
+// branches. Where as has a choice (disp8 vs disp32, imm8 vs imm32) we pick
+// what it picks, so text and bytes line up instruction for instruction.
+// Branches are the exception: as shortens those, we don't.
+
+enum X64Reg : U8 {
+  X64_RAX,
+  X64_RCX,
+  X64_RDX,
+  X64_RBX,
+  X64_RSP,
+  X64_RBP,
+  X64_RSI,
+  X64_RDI,
+  X64_R8,
+  X64_R9,
+  X64_R10,
+  X64_R11,
+  X64_R12,
+  X64_R13,
+  X64_R14,
+  X64_R15,
+};
+
+static const String8 x64_reg_names[] = {
+    str8_lit("rax"), str8_lit("rcx"), str8_lit("rdx"), str8_lit("rbx"),
+    str8_lit("rsp"), str8_lit("rbp"), str8_lit("rsi"), str8_lit("rdi"),
+    str8_lit("r8"),  str8_lit("r9"),  str8_lit("r10"), str8_lit("r11"),
+    str8_lit("r12"), str8_lit("r13"), str8_lit("r14"), str8_lit("r15")};
+
+// Registers print by name in sb_format.
+static void sb_format_arg(StringBuilder *sb, X64Reg r, SBSpec) {
+  sb_append(sb, x64_reg_names[r]);
+}
+
+// Growable byte buffer in an arena, for machine code.
+struct X64Buffer {
+  U8 *data;
+  U64 size;
+  U64 cap;
+};
+
+// Unresolved rel32 to a label, patched by x64_finish().
+struct X64Fixup {
+  U32 at; // Offset of the rel32
+  U32 label;
+};
+
+// R_X86_64_PLT32 against a symbol, resolved by the linker.
+struct X64Reloc {
+  U32 at;
+  U32 symbol;
+};
+
+struct X64Symbol {
+  String8 name;
+  U32 offset;
+  U32 size;
+  bool defined;
+};
+
+struct X64Asm {
+  Arena *arena;
+  bool text;
+
+  X64Buffer code;        // Machine code
+  StringBuilder listing; // Assembly, in text mode
+  S64 *labels;    // Offset per label, -1 until placed
+  U32 label_count;
+  U32 label_cap;
+  X64Fixup *fixups;
+  U32 fixup_count;
+  U32 fixup_cap;
+  X64Reloc *relocs;
+  U32 reloc_count;
+  U32 reloc_cap;
+  X64Symbol *symbols;
+  U32 symbol_count;
+  U32 symbol_cap;
+};
+
+template <typename T>
+static T *x64_grow(Arena *arena, T *items, U32 count, U32 *cap) {
+  U32 new_cap = *cap ? *cap * 2 : 64;
+  T *grown = arena_push_array<T>(arena, new_cap);
+  if (count)
+    memcpy(grown, items, count * sizeof(T));
+  *cap = new_cap;
+  return grown;
+}
+
+static void x64_reserve(X64Asm *a, U64 size) {
+  X64Buffer *b = &a->code;
+  if (b->size + size <= b->cap)
+    return;
+  U64 cap = b->cap ? b->cap * 2 : KiB(4);
+  while (cap < b->size + size)
+    cap *= 2;
+  U8 *grown = arena_push_array<U8>(a->arena, cap);
+  if (b->size)
+    memcpy(grown, b->data, b->size);
+  b->data = grown;
+  b->cap = cap;
+}
+
+static void x64_byte(X64Asm *a, U8 byte) {
+  x64_reserve(a, 1);
+  a->code.data[a->code.size++] = byte;
+}
+
+static void x64_u32(X64Asm *a, U32 value) {
+  x64_reserve(a, 4);
+  memcpy(a->code.data + a->code.size, &value, 4);
+  a->code.size += 4;
+}
+
+static void x64_u64(X64Asm *a, U64 value) {
+  x64_reserve(a, 8);
+  memcpy(a->code.data + a->code.size, &value, 8);
+  a->code.size += 8;
+}
+
+// ---- Encoding helpers ----
+
+static void x64_rex_w(X64Asm *a, X64Reg reg, X64Reg rm) {
+  x64_byte(a, (U8)(0x48 | (reg >> 3) << 2 | (rm >> 3)));
+}
+
+static void x64_modrm_reg(X64Asm *a, U8 reg, X64Reg rm) {
+  x64_byte(a, (U8)(0xC0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+// [rbp + disp], disp8 when it fits.
+static void x64_modrm_rbp(X64Asm *a, X64Reg reg, S32 disp) {
+  if (disp >= -128 && disp <= 127) {
+    x64_byte(a, (U8)(0x40 | (reg & 7) << 3 | X64_RBP));
+    x64_byte(a, (U8)(S8)disp);
+  } else {
+    x64_byte(a, (U8)(0x80 | (reg & 7) << 3 | X64_RBP));
+    x64_u32(a, (U32)disp);
+  }
+}
+
+// ---- Labels and symbols ----
+
+static U32 x64_new_label(X64Asm *a) {
+  if (a->label_count == a->label_cap)
+    a->labels = x64_grow(a->arena, a->labels, a->label_count, &a->label_cap);
+  a->labels[a->label_count] = -1;
+  return a->label_count++;
+}
+
+static void x64_place_label(X64Asm *a, U32 label) {
+  if (a->text) {
+    sb_format(&a->listing, ".L{}:\n", label);
+    return;
+  }
+  a->labels[label] = (S64)a->code.size;
+}
+
+// Symbols are deduplicated by name; the first definition wins.
+static U32 x64_symbol(X64Asm *a, String8 name) {
+  for (U32 i = 0; i < a->symbol_count; ++i) {
+    if (str8_match(a->symbols[i].name, name))
+      return i;
+  }
+  if (a->symbol_count == a->symbol_cap)
+    a->symbols =
+        x64_grow(a->arena, a->symbols, a->symbol_count, &a->symbol_cap);
+  a->symbols[a->symbol_count] = {.name = name};
+  return a->symbol_count++;
+}
+
+static void x64_begin_function(X64Asm *a, U32 symbol) {
+  X64Symbol *s = &a->symbols[symbol];
+  if (a->text) {
+    sb_format(&a->listing, "\n  .globl {}\n  .type {}, @function\n{}:\n",
+              s->name, s->name, s->name);
+    return;
+  }
+  s->offset = (U32)a->code.size;
+}
+
+static void x64_end_function(X64Asm *a, U32 symbol) {
+  X64Symbol *s = &a->symbols[symbol];
+  s->defined = true;
+  if (a->text) {
+    sb_format(&a->listing, "  .size {}, .-{}\n", s->name, s->name);
+    return;
+  }
+  s->size = (U32)a->code.size - s->offset;
+}
+
+// ---- Instructions ----
+
+static void x64_push(X64Asm *a, X64Reg r) {
+  if (a->text)
+    return sb_format(&a->listing, "  push {}\n", r);
+  if (r >= X64_R8)
+    x64_byte(a, 0x41);
+  x64_byte(a, (U8)(0x50 + (r & 7)));
+}
+
+static void x64_pop(X64Asm *a, X64Reg r) {
+  if (a->text)
+    return sb_format(&a->listing, "  pop {}\n", r);
+  if (r >= X64_R8)
+    x64_byte(a, 0x41);
+  x64_byte(a, (U8)(0x58 + (r & 7)));
+}
+
+static void x64_mov(X64Asm *a, X64Reg dst, X64Reg src) {
+  if (a->text)
+    return sb_format(&a->listing, "  mov {}, {}\n", dst, src);
+  x64_rex_w(a, src, dst);
+  x64_byte(a, 0x89);
+  x64_modrm_reg(a, src, dst);
+}
+
+static void x64_mov_imm(X64Asm *a, X64Reg dst, S64 imm) {
+  if (a->text)
+    return sb_format(&a->listing, "  mov {}, {}\n", dst, imm);
+  if (imm >= INT32_MIN && imm <= INT32_MAX) {
+    x64_rex_w(a, X64_RAX, dst);
+    x64_byte(a, 0xC7);
+    x64_modrm_reg(a, 0, dst);
+    x64_u32(a, (U32)imm);
+  } else {
+    x64_rex_w(a, X64_RAX, dst);
+    x64_byte(a, (U8)(0xB8 + (dst & 7)));
+    x64_u64(a, (U64)imm);
+  }
+}
+
+static void x64_load_local(X64Asm *a, X64Reg dst, S32 disp) {
+  if (a->text)
+    return sb_format(&a->listing, "  mov {}, QWORD PTR [rbp{:+}]\n", dst,
+                     disp);
+  x64_rex_w(a, dst, X64_RBP);
+  x64_byte(a, 0x8B);
+  x64_modrm_rbp(a, dst, disp);
+}
+
+static void x64_store_local(X64Asm *a, S32 disp, X64Reg src) {
+  if (a->text)
+    return sb_format(&a->listing, "  mov QWORD PTR [rbp{:+}], {}\n", disp,
+                     src);
+  x64_rex_w(a, src, X64_RBP);
+  x64_byte(a, 0x89);
+  x64_modrm_rbp(a, src, disp);
+}
+
+enum X64AluOp : U8 {
+  X64_ADD = 0x01,
+  X64_SUB = 0x29,
+  X64_XOR = 0x31,
+  X64_TEST = 0x85,
+};
+
+static void x64_alu(X64Asm *a, X64AluOp op, X64Reg dst, X64Reg src) {
+  if (a->text) {
+    const char *name = op == X64_ADD   ? "add"
+                       : op == X64_SUB ? "sub"
+                       : op == X64_XOR ? "xor"
+                                       : "test";
+    return sb_format(&a->listing, "  {} {}, {}\n", name, dst, src);
+  }
+  x64_rex_w(a, src, dst);
+  x64_byte(a, op);
+  x64_modrm_reg(a, src, dst);
+}
+
+// add/sub rsp-style adjustments: /0 is add, /5 is sub.
+static void x64_alu_imm(X64Asm *a, X64AluOp op, X64Reg dst, S32 imm) {
+  assert((op == X64_ADD || op == X64_SUB) && "Only add/sub take immediates");
+  if (a->text)
+    return sb_format(&a->listing, "  {} {}, {}\n",
+                     op == X64_ADD ? "add" : "sub", dst, imm);
+  U8 ext = op == X64_ADD ? 0 : 5;
+  x64_rex_w(a, X64_RAX, dst);
+  if (imm >= -128 && imm <= 127) {
+    x64_byte(a, 0x83);
+    x64_modrm_reg(a, ext, dst);
+    x64_byte(a, (U8)(S8)imm);
+  } else {
+    x64_byte(a, 0x81);
+    x64_modrm_reg(a, ext, dst);
+    x64_u32(a, (U32)imm);
+  }
+}
+
+static void x64_imul(X64Asm *a, X64Reg dst, X64Reg src) {
+  if (a->text)
+    return sb_format(&a->listing, "  imul {}, {}\n", dst, src);
+  x64_rex_w(a, dst, src);
+  x64_byte(a, 0x0F);
+  x64_byte(a, 0xAF);
+  x64_modrm_reg(a, dst, src);
+}
+
+// rdx:rax / src, quotient in rax. Sign-extends rax into rdx first.
+static void x64_cqo_idiv(X64Asm *a, X64Reg src) {
+  if (a->text)
+    return sb_format(&a->listing, "  cqo\n  idiv {}\n", src);
+  x64_byte(a, 0x48);
+  x64_byte(a, 0x99);
+  x64_rex_w(a, X64_RAX, src);
+  x64_byte(a, 0xF7);
+  x64_modrm_reg(a, 7, src);
+}
+
+static void x64_neg(X64Asm *a, X64Reg r) {
+  if (a->text)
+    return sb_format(&a->listing, "  neg {}\n", r);
+  x64_rex_w(a, X64_RAX, r);
+  x64_byte(a, 0xF7);
+  x64_modrm_reg(a, 3, r);
+}
+
+// xor eax, eax: zeroes rax, and tells a variadic callee there are no
+// vector arguments.
+static void x64_zero_eax(X64Asm *a) {
+  if (a->text)
+    return sb_append(&a->listing, str8_lit("  xor eax, eax\n"));
+  x64_byte(a, 0x31);
+  x64_byte(a, 0xC0);
+}
+
+static void x64_ret(X64Asm *a) {
+  if (a->text)
+    return sb_append(&a->listing, str8_lit("  ret\n"));
+  x64_byte(a, 0xC3);
+}
+
+static void x64_call(X64Asm *a, U32 symbol) {
+  if (a->text) {
+    String8 name = a->symbols[symbol].name;
+    return sb_format(&a->listing, "  call {}@PLT\n", name);
+  }
+  x64_byte(a, 0xE8);
+  if (a->reloc_count == a->reloc_cap)
+    a->relocs = x64_grow(a->arena, a->relocs, a->reloc_count, &a->reloc_cap);
+  a->relocs[a->reloc_count++] = {.at = (U32)a->code.size, .symbol = symbol};
+  x64_u32(a, 0);
+}
+
+enum X64Jump { X64_JMP, X64_JE };
+
+static void x64_jump(X64Asm *a, X64Jump kind, U32 label) {
+  if (a->text)
+    return sb_format(&a->listing, "  {} .L{}\n",
+                     kind == X64_JMP ? "jmp" : "je", label);
+  if (kind == X64_JMP) {
+    x64_byte(a, 0xE9);
+  } else {
+    x64_byte(a, 0x0F);
+    x64_byte(a, 0x84);
+  }
+  if (a->fixup_count == a->fixup_cap)
+    a->fixups = x64_grow(a->arena, a->fixups, a->fixup_count, &a->fixup_cap);
+  a->fixups[a->fixup_count++] = {.at = (U32)a->code.size, .label = label};
+  x64_u32(a, 0);
+}
+
+// Patches label references. Call once, after the last instruction.
+static void x64_finish(X64Asm *a) {
+  if (a->text) {
+    sb_append(&a->listing,
+              str8_lit("\n  .section .note.GNU-stack,\"\",@progbits\n"));
+    return;
+  }
+  for (U32 i = 0; i < a->fixup_count; ++i) {
+    X64Fixup f = a->fixups[i];
+    assert(a->labels[f.label] >= 0 && "Jump to a label that was never placed");
+    S32 rel = (S32)(a->labels[f.label] - (S64)(f.at + 4));
+    memcpy(a->code.data + f.at, &rel, 4);
+  }
+}
+
+static X64Asm x64_begin(Arena *arena, bool text) {
+  X64Asm a = {.arena = arena, .text = text};
+  if (text) {
+    a.listing = sb_create(arena, KiB(4));
+    sb_append(&a.listing, str8_lit("  .intel_syntax noprefix\n  .text\n"));
+  }
+  return a;
+}